@@ -0,0 +1,179 @@
+/*
+ *  Created on: Oct 17, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_SDIO_FATFS
+ *  Processor: STM32F405
+ *  Program version: 1.0
+ *  Source file: ADC_DMA_driver.c
+ *  Change history:
+ */
+
+#include <ADC_DMA_driver.h>
+
+RING_t ADC_ring;
+volatile uint32_t ADC_overrun_cnt = 0;
+
+static uint16_t ADC_half_cnt;																		//samples in one half of the buffer
+
+//1)Init ADC, timer and DMA
+void ADC_DMA2_init(uint16_t* buf_ptr, uint16_t sample_cnt){
+
+	/*
+	 * ADC1 on PA4, triggered by the TRGO of TIM2 (update event)
+	 * DMA2 Stream0 Ch0 in circular mode, 16 bits on both sides, half transfer and transfer complete IRQs
+	 * Here the ADC is the peripheral, but the DMA is the flow controller: circular mode is not available with peripheral flow control
+	 * sample_cnt must be even, each half is sample_cnt/2 samples
+	 * The buffer becomes the storage of ADC_ring, so sample_cnt * 2 bytes must be a power of 2 and whole sectors
+	 *
+	 */
+
+	//1)Clocking
+	RCC->AHB1ENR |= (1<<0);																			//PORTA clocking
+	RCC->AHB1ENR |= (1<<22);																		//DMA2 clocking
+	RCC->APB1ENR |= (1<<0);																			//TIM2 clocking
+	RCC->APB2ENR |= (1<<8);																			//ADC1 clocking
+
+	//2)GPIO
+	GPIOA->MODER |= (3<<8);																			//analog mode for PA4 - A0 on the Feather
+
+	//3)ADC
+	ADC123_COMMON->CCR &= ~(3<<16);																	//ADC clock is PCLK2/2
+	ADC1->CR2 &= ~(1<<0);																			//ADC off while we set it up
+	ADC1->CR1 &= ~(3<<24);																			//12 bit resolution
+	ADC1->CR2 |= (1<<11);																			//left alignment - samples are scaled to 16 bits
+	ADC1->SQR1 &= ~(0xF<<20);																		//one conversion in the sequence
+	ADC1->SQR3 = 4;																					//channel 4
+	ADC1->SMPR2 |= (4<<12);																			//84 cycles of sampling for channel 4
+	ADC1->SR &= ~(1<<5);																			//a stop leaves an overrun behind - it would block the DMA requests
+	ADC1->CR2 &= ~(1<<8);																			//DMA requests re-armed
+	ADC1->CR2 |= (1<<8);																			//DMA requests
+	ADC1->CR2 |= (1<<9);																			//DMA requests keep on coming after the first DMA transfer (DDS)
+	ADC1->CR2 &= ~(0xF<<24);
+	ADC1->CR2 |= (6<<24);																			//external trigger is TIM2 TRGO
+	ADC1->CR2 &= ~(3<<28);
+	ADC1->CR2 |= (1<<28);																			//on the rising edge
+	ADC1->CR2 |= (1<<0);																			//ADC on
+
+	//4)Timer
+	TIM2->CR1 &= ~(1<<0);																			//timer stopped
+	TIM2->CR2 &= ~(7<<4);
+	TIM2->CR2 |= (2<<4);																			//TRGO on update event
+
+	//5)DMA
+	DMA2_Stream0->CR &= ~(1<<0);																	//we disable the DMA stream
+	DMA2_Stream0->CR = 0;																			//channel 0, peri to mem, single transfers, low priority
+	DMA2_Stream0->CR |= (2<<16);																	//high priority - SDIO streams can wait, the ADC can't
+	DMA2_Stream0->CR |= (1<<13);																	//memory data size is 16 bits
+	DMA2_Stream0->CR |= (1<<11);																	//peri data size is 16 bits
+	DMA2_Stream0->CR |= (1<<10);																	//memory increment active
+	DMA2_Stream0->CR |= (1<<8);																		//circular mode
+	DMA2_Stream0->CR |= (1<<4);																		//transfer complete IRQ activated - second half full
+	DMA2_Stream0->CR |= (1<<3);																		//half transfer IRQ activated - first half full
+	DMA2_Stream0->CR |= (1<<2);																		//error IRQ activated
+	DMA2_Stream0->FCR = 0;																			//direct mode
+	DMA2_Stream0->PAR = (uintptr_t) (&(ADC1->DR));
+	DMA2_Stream0->M0AR = (uintptr_t) buf_ptr;
+	DMA2_Stream0->NDTR = sample_cnt;
+
+	ADC_half_cnt = sample_cnt / 2;
+
+	RING_init(&ADC_ring, (uint8_t*) buf_ptr, (uint32_t) sample_cnt * 2);
+
+	NVIC_SetPriority(DMA2_Stream0_IRQn, 2);															//below the SDcard: the IRQ only hands over the halves
+	NVIC_EnableIRQ(DMA2_Stream0_IRQn);
+
+}
+
+//2)Start sampling
+void ADC_Sampling_start(uint32_t sample_rate){
+
+	/*
+	 * TIM2 sits on APB1, which is not divided: it counts at SYSCLK
+	 * The rate is rounded to the closest the timer can do
+	 *
+	 */
+
+	RING_init(&ADC_ring, ADC_ring.buf, ADC_ring.size);												//empty - the DMA starts at the beginning of the buffer
+	ADC_overrun_cnt = 0;
+
+	DMA2->LIFCR |= (0x3D<<0);																		//stale stream 0 flags removed
+	DMA2_Stream0->CR |= (1<<0);																		//DMA enabled, it waits for the first conversion
+
+	TIM2->PSC = 0;
+	TIM2->ARR = ((SystemCoreClock + (sample_rate / 2)) / sample_rate) - 1;
+	TIM2->CNT = 0;
+	TIM2->CR1 |= (1<<0);																			//timer counter enable bit - conversions start
+
+}
+
+//3)Stop sampling
+uint16_t ADC_Sampling_stop(void){
+
+	/*
+	 * Stops the trigger first, so the last conversion can still be moved, then the DMA
+	 * The samples already in the half being filled are not handed over by any IRQ - they are committed here, so they can be saved too
+	 * With both the timer and the DMA stopped, there is no producer left to race with
+	 *
+	 */
+
+	uint16_t filled;
+	uint32_t pos;
+
+	TIM2->CR1 &= ~(1<<0);																			//no more triggers
+	DMA2_Stream0->CR &= ~(1<<0);																	//DMA disabled
+	while(DMA2_Stream0->CR & (1<<0));																//wait until the stream has really stopped
+
+	filled = (uint16_t) ((2 * ADC_half_cnt) - DMA2_Stream0->NDTR);									//samples written since the last wrap
+	pos = (uint32_t) filled * 2;																	//where the DMA stopped in the buffer
+	if(filled >= ADC_half_cnt) filled -= ADC_half_cnt;
+
+	if(RING_produce_commit(&ADC_ring, (pos - ADC_ring.head) & (ADC_ring.size - 1)) != 0) ADC_overrun_cnt++;
+
+	return filled;
+
+}
+
+//4)Sampling IRQ
+void DMA2_Stream0_IRQHandler (void){
+
+	/*
+	 * Commits the full half to the ring
+	 * The DMA is now filling the other half: if less than a half is free after the commit, part of it has not been saved yet - an overrun
+	 * The length is counted from the head up to the end of the full half, so a half that did not fit is committed with the next one and the head keeps up with the DMA
+	 *
+	 */
+
+	uint8_t full_half = 2;
+
+	if ((DMA2->LISR & (1<<4)) == (1<<4)) {															//half transfer - first half full
+
+		DMA2->LIFCR |= (1<<4);
+		full_half = 0;
+
+	} else if ((DMA2->LISR & (1<<5)) == (1<<5)) {													//transfer complete - second half full
+
+		DMA2->LIFCR |= (1<<5);
+		full_half = 1;
+
+	} else if ((DMA2->LISR & (1<<3)) == (1<<3)) {													//transfer error
+
+		DMA2->LIFCR |= (1<<3);
+		printf("ADC DMA error!");
+
+	} else {
+
+		//do nothing
+
+	}
+
+	if(full_half < 2){
+
+		uint32_t end = (full_half == 0) ? ((uint32_t) ADC_half_cnt * 2) : 0;						//position right after the full half
+		uint32_t len = ((end - ADC_ring.head - 1) & (ADC_ring.size - 1)) + 1;						//one half - or two if the last one did not fit
+
+		if(RING_produce_commit(&ADC_ring, len) != 0) ADC_overrun_cnt++;							//no room at all - committed with the next half
+		else if(RING_free(&ADC_ring) < ((uint32_t) ADC_half_cnt * 2)) ADC_overrun_cnt++;		//the DMA is already writing over unsaved samples
+
+	}
+
+}
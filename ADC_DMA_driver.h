@@ -0,0 +1,47 @@
+/*
+ *  Created on: Oct 17, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_SDIO_FATFS
+ *  Processor: STM32F405
+ *  Program version: 1.0
+ *  Header file: ADC_DMA_driver.h
+ *  Change history:
+ */
+
+/*
+ * Audio sampling for the WAV capture.
+ * ADC1 converts A0 (PA4, channel 4) on every TIM2 update event; DMA2 Stream0 Ch0 moves the results into a circular buffer.
+ * The buffer is the storage of ADC_ring (see RING_buffer.h), with the DMA as the producer: the half transfer IRQ commits the first half, the transfer complete IRQ the second one, while the DMA goes on filling the other.
+ * The consumer takes the samples with RING_consume_span and gives the space back with RING_consume_release - no copy on either side.
+ * If the DMA moves into space the consumer has not released yet, those samples are overwritten before they were saved: this is counted in ADC_overrun_cnt.
+ *
+ * Samples are 12 bits, left aligned: 0x0000 to 0xFFF0 with 0x8000 at mid-scale.
+ *
+ */
+
+#ifndef INC_ADC_DMA_DRIVER_H_
+#define INC_ADC_DMA_DRIVER_H_
+
+#include "stdint.h"
+#include "stdio.h"
+#ifdef SDIO_HOST_EMULATION
+#include <HOST_SDIO_emulator.h>														//register blocks are emulated on the host
+#else
+#include "stm32f405xx.h"
+#endif
+#include <RING_buffer.h>
+
+//LOCAL CONSTANT
+
+//LOCAL VARIABLE
+
+//EXTERNAL VARIABLE
+extern RING_t ADC_ring;																					//the samples waiting to be saved
+extern volatile uint32_t ADC_overrun_cnt;																	//halves overwritten before they were saved
+
+//FUNCTION PROTOTYPES
+void ADC_DMA2_init(uint16_t* buf_ptr, uint16_t sample_cnt);											//set up ADC1, TIM2 and the circular DMA on a buffer of sample_cnt samples (both halves) - sample_cnt * 2 must be a power of 2
+void ADC_Sampling_start(uint32_t sample_rate);														//start the conversions at sample_rate
+uint16_t ADC_Sampling_stop(void);																	//stop the conversions, commit the samples of the half being filled and give back their number
+
+#endif /* INC_ADC_DMA_DRIVER_H_ */
@@ -9,7 +9,11 @@
  */
 
 #include <ClockDriver_STM32F405.h>
+#ifdef SDIO_HOST_EMULATION
+#include <HOST_SDIO_emulator.h>														//register blocks are emulated on the host
+#else
 #include "stm32f405xx.h"														//device specific header file for registers
+#endif
 
 //1)We set up the core clock and the peripheral prescalers/dividers
 void SysClockConfig(void) {
@@ -148,3 +152,94 @@ void Delay_ms(int milli_sec) {
 		Delay_us(1000);															//we call the custom microsecond delay for 1000 to generate a delay of 1 millisecond
 	}
 }
+
+
+//5) TIM7 setup for one-shot wake-ups
+void TIM7Config (void) {
+	/**
+	 * TIM7 is the twin of TIM6, but it is used as a one-shot alarm: it counts once up to ARR, raises its update IRQ and stops.
+	 * The SDcard driver uses it to come back to a busy card later instead of spinning on it.
+	 * Same 1 MHz counting as TIM6.
+	 * The IRQ itself is enabled in DMA2_SDIO_IRQPriorEnable, together with the SDIO ones.
+	 * 1)Enable TIM7 clocking
+	 * 2)Set prescaler, one-pulse mode and the update IRQ
+	 **/
+
+	//1)
+	RCC->APB1ENR |= (1<<5);														//enable TIM7 clocking
+
+	//2)
+	TIM7->PSC = 32 - 1;															// 32 MHz/32 = 1 MHz -- 1 us resolution
+	TIM7->CR1 |= (1<<3);														//one-pulse mode - CEN is cleared at the update event
+	TIM7->CR1 |= (1<<2);														//URS - only overflow generates the update IRQ, not the UG bit
+	TIM7->EGR |= (1<<0);														//UG - load the prescaler
+	TIM7->SR &= ~(1<<0);
+	TIM7->DIER |= (1<<0);														//update IRQ enabled
+}
+
+
+//6) Start a TIM7 one-shot
+void TIM7_Start_us(uint16_t micro_sec) {
+	/**
+	 * The TIM7 IRQ fires once after micro_sec (1...65535) microseconds
+	 * Restarting a running one-shot simply moves its deadline
+	 *
+	 **/
+	TIM7->CR1 &= ~(1<<0);
+	TIM7->SR &= ~(1<<0);
+	TIM7->CNT = 0;
+	TIM7->ARR = (micro_sec > 1) ? (micro_sec - 1) : 1;
+	TIM7->CR1 |= (1<<0);														//timer counter enable bit
+}
+
+
+//7) Change the PLL "Q" divider
+void SysClock_Set_PLLQ(uint8_t pllq) {
+	/**
+	 * PLLQ drives the SDIOCLK (and the USB/RNG 48 MHz domain, not used here). It can only be changed while the PLL is off.
+	 * Since the PLL is also the system clock, the core is moved to HSI16 for the few microseconds the PLL takes to restart.
+	 * Nothing else may run meanwhile: TIM6/TIM7 count at half speed and the SDIO is not clocked.
+	 * pllq must be 2...15, and the SDIOCLK must stay at 48 MHz or below.
+	 * 1)System clock to HSI16
+	 * 2)PLL off, new "Q", PLL on
+	 * 3)System clock back to the PLL
+	 **/
+
+	//1)
+	RCC->CFGR &= ~(3<<0);														//HSI as source
+	while ((RCC->CFGR & RCC_CFGR_SWS) != 0);
+
+	//2)
+	RCC->CR &= ~(1<<24);														//PLL off
+	while (RCC->CR & (1<<25));													//and wait until it is stopped
+
+	RCC->PLLCFGR &= ~(0xF<<24);
+	RCC->PLLCFGR |= ((uint32_t) (pllq & 0xF)<<24);
+
+	RCC->CR |= (1<<24);															//PLL back on
+	while (!(RCC->CR & (1<<25)));
+
+	//3)
+	RCC->CFGR |= (2<<0);														//PLL as source
+	while ((RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_PLL);
+
+	SystemCoreClockUpdate();
+}
+
+
+//8) SDIOCLK frequency
+uint32_t SysClock_SDIOCLK_Hz(void) {
+	/**
+	 * The PLL "Q" output as it is set in PLLCFGR - HSI16 or the 12 MHz HSE divided by "M", multiplied by "N", divided by "Q"
+	 *
+	 **/
+	uint32_t pllcfgr = RCC->PLLCFGR;
+	uint32_t source_hz = (pllcfgr & (1<<22)) ? 12000000 : 16000000;
+	uint32_t pllm = pllcfgr & 0x3F;
+	uint32_t plln = (pllcfgr >> 6) & 0x1FF;
+	uint32_t pllq = (pllcfgr >> 24) & 0xF;
+
+	if((pllm == 0) || (pllq < 2)) return 0;
+
+	return (uint32_t) ((((uint64_t) source_hz / pllm) * plln) / pllq);
+}
@@ -23,5 +23,9 @@ void SysClockConfig(void);
 void TIM6Config (void);
 void Delay_us(int micro_sec);
 void Delay_ms(int milli_sec);
+void TIM7Config (void);														//one-shot wake-up timer
+void TIM7_Start_us(uint16_t micro_sec);
+void SysClock_Set_PLLQ(uint8_t pllq);												//move the SDIOCLK - PLL VCO / pllq
+uint32_t SysClock_SDIOCLK_Hz(void);
 
 #endif /* RCCTIMPWMDELAY_CUSTOM_H_ */
@@ -0,0 +1,1592 @@
+/*
+ *  Created on: Oct 17, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_SDIO_FATFS
+ *  Processor: STM32F405 (emulated on a Linux host)
+ *  Program version: 1.0
+ *  Source file: HOST_SDIO_emulator.c
+ *  Change history:
+ */
+
+/*
+ * Register level emulation of the SDIO, DMA2 and RCC peripherals and of an SDHC card backed by an image file.
+ * ADC1, triggered by TIM2 and read out by DMA2 Stream0, is modelled as a ramp source for the wav recording.
+ *
+ * The "hardware" runs in a periodic signal handler (the peripheral tick) which interrupts the driver code like a real interrupt would.
+ * This means that the driver's polling loops, the flag handshakes and the IRQ handlers behave the same way as on the MCU, even on a single core host.
+ *
+ * Timing is kept on an emulated clock:
+ * 	- when the hardware has nothing scheduled, every tick advances the clock by EMU_IDLE_NS (the CPU reacting to the last event)
+ * 	  or, once the hardware has been idle for a while, by EMU_IDLE_FAST_NS (delays, CPU work, timeouts)
+ * 	- when a command, a data block, a card busy period or a TIM7 one-shot is pending, the clock jumps to its end, so bus and card timing is exact and repeatable
+ * 	- either step stops at the end of an ADC half buffer, so the DMA half/full IRQs come on time
+ * 	  (CPU time spent while the hardware is busy is not accounted - the MCU is assumed to keep up with the bus)
+ * The host's own scheduling thus has little effect on the measurements, but emulated delays run slower than real time.
+ * Command, data and busy durations are calculated from the SDIO_CK (PLLQ output, CLKDIV/BYPASS, bus width) and from the card timing model in HOST_emu_timing.
+ * Data blocks clocked faster than the card is rated for (25 MHz, or 50 MHz after the CMD6 high speed switch) or than HOST_emu_timing.signal_max_hz fail CRC.
+ * Written blocks clocked faster than HOST_emu_timing.tx_max_hz (if set) underrun the Tx FIFO.
+ * HOST_emu_fault makes one sector fail on purpose: CRC, a missing read block (data timeout), a silent card (command timeout), a broken command response (command CRC) or a lost CMD12.
+ *
+ */
+
+#ifdef SDIO_HOST_EMULATION
+
+#define _GNU_SOURCE
+#include <HOST_SDIO_emulator.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/stat.h>
+
+//register blocks
+SDIO_TypeDef HOST_SDIO_regs;
+DMA_TypeDef HOST_DMA2_regs;
+DMA_Stream_TypeDef HOST_DMA2_Stream0_regs;
+DMA_Stream_TypeDef HOST_DMA2_Stream3_regs;
+DMA_Stream_TypeDef HOST_DMA2_Stream6_regs;
+RCC_TypeDef HOST_RCC_regs;
+PWR_TypeDef HOST_PWR_regs;
+FLASH_TypeDef HOST_FLASH_regs;
+GPIO_TypeDef HOST_GPIOA_regs;
+GPIO_TypeDef HOST_GPIOC_regs;
+GPIO_TypeDef HOST_GPIOD_regs;
+TIM_TypeDef HOST_TIM2_regs;
+TIM_TypeDef HOST_TIM6_regs;
+TIM_TypeDef HOST_TIM7_regs;
+ADC_TypeDef HOST_ADC1_regs;
+ADC_Common_TypeDef HOST_ADC123_COMMON_regs;
+DWT_Type HOST_DWT_regs;
+CoreDebug_Type HOST_CoreDebug_regs;
+
+uint32_t SystemCoreClock = 16000000;
+
+HOST_emu_timing_t HOST_emu_timing = {
+		.read_access_us = 100,
+		.write_block_busy_us = 250,
+		.write_prog_us = 800,
+		.acmd41_busy_cnt = 2,
+		.high_speed = 1,
+		.signal_max_hz = 36000000,															//the 42.7 MHz rung fails, 32 MHz is fine
+		.tx_max_hz = 0,																		//see the clock write check
+		.erase_unit_blocks = 64,
+		.erase_unit_us = 0,																	//a fast card by default - see the pre-erase check
+		.pre_erase_unit_us = 0
+};
+
+HOST_emu_stats_t HOST_emu_stats;
+HOST_emu_fault_t HOST_emu_fault;
+
+//card states as they are reported in RESP1[12:9]
+enum {CARD_IDLE = 0, CARD_READY, CARD_IDENT, CARD_STBY, CARD_TRAN, CARD_DATA, CARD_RCV, CARD_PRG, CARD_DIS};
+
+#define EMU_NO_EVENT		UINT64_MAX
+#define EMU_TICK_NS			50000													//peripheral tick period (host time) - leaves most of the CPU to the driver
+#define EMU_IDLE_NS			2000													//emulated time of a tick with no hardware event pending
+#define EMU_IDLE_FAST_CNT	16														//idle ticks after which the clock speeds up
+#define EMU_IDLE_FAST_NS	200000													//emulated time of an idle tick after that
+#define EMU_HSI_HZ			16000000
+#define EMU_HSE_HZ			12000000												//Feather crystal
+
+typedef struct {
+	uint8_t long_resp;
+	uint8_t crc;																	//R3 comes without a valid CRC
+	uint8_t respcmd;
+	uint32_t resp[4];
+} emu_resp_t;
+
+typedef struct {
+	uint8_t state;
+	uint16_t rca;
+	uint8_t app_cmd;
+	uint32_t acmd41_cnt;
+	uint8_t bus_width;																//1 or 4
+	uint8_t high_speed;																//CMD6 group 1 function 1 selected
+	uint32_t preset_cnt;															//CMD23 block count, 0 if not set
+	uint32_t addr;																	//next block of the ongoing transfer
+	uint32_t blocks_left;															//blocks left of the ongoing transfer
+	uint8_t open_ended;																//transfer runs until CMD12
+	uint8_t reg_read;																//the "data" state serves a register instead of the image
+	uint8_t reg_buf[64];
+	uint32_t reg_len;
+	uint8_t busy;																	//DAT0 is held low
+	uint64_t busy_start_ns;
+	uint64_t ready_ns;																//end of busy/read access time
+	uint32_t pre_erase_cnt;															//ACMD23 block count for the next write, 0 if not set
+	uint32_t pre_erase_start;														//blocks pre-erased for the write in progress
+	uint32_t pre_erase_end;
+	uint32_t pre_erase_us;															//erase time of the pre-erased units, not paid yet
+	uint8_t write_first;															//next block is the first one of the write
+} emu_card_t;
+
+typedef struct {
+	uint8_t active;
+	uint8_t index;
+	uint8_t waitresp;
+	uint32_t arg;
+	uint64_t done_ns;
+} emu_cpsm_t;
+
+typedef struct {
+	uint8_t active;
+	uint8_t dir_read;
+	uint8_t in_block;
+	uint8_t half_done;
+	uint32_t dlen;
+	uint32_t done_bytes;
+	uint32_t block_size;
+	uint32_t block_bytes;
+	uint32_t dma_reload;															//NDTR at the DPSM start - DMA flow control only
+	uint64_t block_end_ns;
+	uint64_t timeout_ns;
+} emu_dpsm_t;
+
+typedef struct {
+	uint64_t last_ns;
+	uint64_t frac;
+} emu_tim_t;
+
+typedef struct {
+	uint8_t running;																//DMA2 Stream0 enabled
+	uint32_t reload;																//NDTR at the enable - circular reload value
+	uint32_t sample_n;																//conversions since power up - the ramp
+} emu_adc_t;
+
+static emu_card_t card;
+static emu_cpsm_t cpsm;
+static emu_dpsm_t dpsm;
+static emu_tim_t tim6;
+static emu_tim_t tim7;
+static emu_tim_t tim2;
+static emu_adc_t adc;
+
+static int emu_image_fd = -1;
+static uint32_t emu_sector_cnt;
+static timer_t emu_timer;
+static volatile uint64_t emu_now_ns;												//emulated clock
+static volatile sig_atomic_t emu_in_tick;
+static uint32_t emu_idle_ticks;
+static volatile uint32_t emu_irq_disable_cnt;
+static uint8_t emu_nvic_enabled[128];
+
+//1)Clock tree
+static uint32_t emu_pll_vco_hz(void){
+
+	/*
+	 * PLL VCO output as set by SysClockConfig
+	 * Returns 0 if the PLL is not running
+	 */
+
+	uint32_t cfg = RCC->PLLCFGR;
+	uint32_t m = cfg & 0x3F;
+	uint32_t n = (cfg >> 6) & 0x1FF;
+	uint32_t src = (cfg & (1<<22)) ? EMU_HSE_HZ : EMU_HSI_HZ;
+
+	if(((RCC->CR & (1<<25)) == 0) || (m < 2) || (n < 2)) return 0;
+
+	return (uint32_t) (((uint64_t) src * n) / m);
+
+}
+
+static uint32_t emu_sysclk_hz(void){
+
+	if((RCC->CFGR & RCC_CFGR_SWS) == RCC_CFGR_SWS_PLL){
+
+		uint32_t p = ((((RCC->PLLCFGR >> 16) & 0x3) + 1) * 2);
+		return emu_pll_vco_hz() / p;
+
+	}
+
+	return EMU_HSI_HZ;
+
+}
+
+static uint32_t emu_sdio_ck_hz(void){
+
+	/*
+	 * SDIOCLK is the PLLQ (48 MHz domain) output
+	 * SDIO_CK is SDIOCLK / (CLKDIV + 2) unless bypassed
+	 * Returns 0 if the card is not clocked
+	 */
+
+	uint32_t q = (RCC->PLLCFGR >> 24) & 0xF;
+	uint32_t sdioclk;
+
+	if(q < 2) return 0;
+	sdioclk = emu_pll_vco_hz() / q;
+
+	if((sdioclk == 0) || ((RCC->APB2ENR & (1<<11)) == 0) || ((SDIO->POWER & 0x3) != 0x3) || ((SDIO->CLKCR & (1<<8)) == 0)) return 0;
+
+	if((SDIO->CLKCR & (1<<10)) == (1<<10)) return sdioclk;
+
+	return sdioclk / ((SDIO->CLKCR & 0xFF) + 2);
+
+}
+
+static uint64_t emu_clk_ns(uint32_t clocks, uint32_t ck_hz){
+
+	return ((uint64_t) clocks * 1000000000ull) / ck_hz;
+
+}
+
+static uint32_t emu_bus_max_hz(void){
+
+	/*
+	 * Fastest SDIO_CK a data block survives: the card rating or the board, whichever is lower
+	 */
+
+	uint32_t card_hz = card.high_speed ? 50000000 : 25000000;
+
+	return (HOST_emu_timing.signal_max_hz < card_hz) ? HOST_emu_timing.signal_max_hz : card_hz;
+
+}
+
+static uint8_t emu_host_bus_width(void){
+
+	uint32_t widbus = (SDIO->CLKCR >> 11) & 0x3;
+
+	if(widbus == 1) return 4;
+	if(widbus == 2) return 8;
+	return 1;
+
+}
+
+//2)RCC and timer
+static void emu_tick_rcc(void){
+
+	uint32_t cr = RCC->CR;
+	uint32_t sw = RCC->CFGR & 0x3;
+
+	if((cr & (1<<0)) && !(cr & (1<<1))) RCC->CR |= (1<<1);						//HSIRDY
+	if((cr & (1<<16)) && !(cr & (1<<17))) RCC->CR |= (1<<17);					//HSERDY
+	if((cr & (1<<24)) && !(cr & (1<<25))) RCC->CR |= (1<<25);					//PLLRDY
+	if(!(cr & (1<<24)) && (cr & (1<<25))) RCC->CR &= ~(1<<25);
+
+	if(((RCC->CFGR >> 2) & 0x3) != sw){
+
+		RCC->CFGR = (RCC->CFGR & ~RCC_CFGR_SWS) | (sw << 2);						//SWS follows SW
+
+	}
+
+}
+
+static void emu_tick_tim(TIM_TypeDef* tim, emu_tim_t* state, uint64_t now){
+
+	/*
+	 * Basic timer: counts at the APB1 timer clock (same as SYSCLK, no APB prescaler is used) divided by PSC+1
+	 */
+
+	uint64_t elapsed = now - state->last_ns;
+	uint64_t ticks;
+	uint32_t cnt;
+
+	state->last_ns = now;
+
+	if((tim->CR1 & (1<<0)) == 0){
+
+		state->frac = 0;
+		return;
+
+	}
+
+	state->frac += elapsed * (uint64_t) (emu_sysclk_hz() / (tim->PSC + 1));
+	ticks = state->frac / 1000000000ull;
+	state->frac %= 1000000000ull;
+
+	if(ticks == 0) return;
+
+	cnt = tim->CNT;
+	if((uint64_t) cnt + ticks > tim->ARR){
+
+		tim->SR |= (1<<0);															//UIF
+		ticks = ((uint64_t) cnt + ticks) % ((uint64_t) tim->ARR + 1);
+		tim->CNT = (uint32_t) ticks;
+
+		if(tim->CR1 & (1<<3)){														//OPM: the counter stops at the update event
+
+			tim->CR1 &= ~(1<<0);
+			tim->CNT = 0;
+			state->frac = 0;
+
+		}
+
+	} else {
+
+		tim->CNT = cnt + (uint32_t) ticks;
+
+	}
+
+}
+
+//3)Clear registers
+static void emu_tick_clear(void){
+
+	uint32_t icr = SDIO->ICR;
+	uint32_t lifcr = DMA2->LIFCR;
+	uint32_t hifcr = DMA2->HIFCR;
+
+	if(icr){
+
+		SDIO->ICR = 0;
+		SDIO->STA &= ~(icr & 0x00C007FF);
+
+	}
+
+	if(lifcr){
+
+		DMA2->LIFCR = 0;
+		DMA2->LISR &= ~lifcr;
+
+	}
+
+	if(hifcr){
+
+		DMA2->HIFCR = 0;
+		DMA2->HISR &= ~hifcr;
+
+	}
+
+}
+
+//4)Card model
+static uint8_t emu_card_fault(uint8_t kind, uint32_t sector){
+
+	/*
+	 * Gives back 1 and uses one up if the injected fault of this kind sits at the sector
+	 */
+
+	if((HOST_emu_fault.kind != kind) || (HOST_emu_fault.count == 0) || (HOST_emu_fault.sector != sector)) return 0;
+
+	HOST_emu_fault.count--;
+
+	return 1;
+
+}
+
+static uint8_t emu_card_withholds(void){
+
+	/*
+	 * The card holds back the read block it is about to send (HOST_FAULT_DATA_TIMEOUT) - the count is used up when the host times out
+	 */
+
+	return (!card.reg_read && (HOST_emu_fault.kind == HOST_FAULT_DATA_TIMEOUT) && (HOST_emu_fault.count != 0) && (HOST_emu_fault.sector == card.addr));
+
+}
+
+static uint32_t emu_card_status(void){
+
+	/*
+	 * R1 card status: CURRENT_STATE [12:9], READY_FOR_DATA [8], APP_CMD [5]
+	 */
+
+	uint32_t status = ((uint32_t) card.state << 9);
+
+	if(!card.busy) status |= (1<<8);
+	if(card.app_cmd) status |= (1<<5);
+
+	return status;
+
+}
+
+static void emu_card_busy(uint32_t busy_us, uint8_t state_during){
+
+	card.busy = 1;
+	card.busy_start_ns = emu_now_ns;
+	card.ready_ns = emu_now_ns + (uint64_t) busy_us * 1000ull;
+	card.state = state_during;
+
+}
+
+static uint32_t emu_card_erase_us(uint32_t addr){
+
+	/*
+	 * Erase time on top of the programming of the block just received
+	 * A card with a slow erase path stalls at the first block it writes into an erase unit - at the start of a unit or at the start of the write (the rest of the unit is moved)
+	 * The units pre-erased on an ACMD23 hint cost no stall, their erase is done in one go at the first block of the write
+	 *
+	 */
+
+	uint32_t us = card.pre_erase_us;
+	uint32_t unit = HOST_emu_timing.erase_unit_blocks;
+
+	card.pre_erase_us = 0;
+
+	if((unit != 0) && (HOST_emu_timing.erase_unit_us != 0) && (card.write_first || ((addr % unit) == 0)) &&
+	   ((addr < card.pre_erase_start) || (addr >= card.pre_erase_end))){
+
+		HOST_emu_stats.erase_stall_cnt++;
+		us += HOST_emu_timing.erase_unit_us;
+
+	}
+
+	card.write_first = 0;
+
+	return us;
+
+}
+
+static void emu_card_reg_read(const uint8_t* reg, uint32_t len){
+
+	memcpy(card.reg_buf, reg, len);
+	card.reg_len = len;
+	card.reg_read = 1;
+	card.blocks_left = 1;
+	card.open_ended = 0;
+	card.ready_ns = emu_now_ns;
+	card.state = CARD_DATA;
+
+}
+
+static uint8_t emu_card_command(uint8_t index, uint32_t arg, emu_resp_t* resp){
+
+	/*
+	 * Card side of a command
+	 * Returns 1 if the card answers, 0 if it stays silent (illegal command in the current state or not addressed)
+	 * The R1 status reflects the state the card was in when the command was received
+	 */
+
+	uint8_t app = card.app_cmd;
+	uint8_t prev = card.state;
+	uint8_t addressed = ((arg >> 16) == card.rca);
+	uint32_t status;
+
+	card.app_cmd = 0;
+	status = emu_card_status();
+
+	resp->long_resp = 0;
+	resp->crc = 1;
+	resp->respcmd = index;
+	resp->resp[0] = status;
+	resp->resp[1] = 0;
+	resp->resp[2] = 0;
+	resp->resp[3] = 0;
+
+	if(app){
+
+		HOST_emu_stats.acmd_cnt[index & 0x3F]++;
+
+		switch(index){
+
+			case 6:																	//SET_BUS_WIDTH
+				if(prev != CARD_TRAN) return 0;
+				card.bus_width = ((arg & 0x3) == 0x2) ? 4 : 1;
+				return 1;
+
+			case 13: {																//SD_STATUS
+				uint8_t sd_status[64] = {0};
+				if(prev != CARD_TRAN) return 0;
+				sd_status[0] = (card.bus_width == 4) ? 0x80 : 0x00;
+				emu_card_reg_read(sd_status, sizeof(sd_status));
+				return 1;
+			}
+
+			case 23:																//SET_WR_BLK_ERASE_COUNT - pre-erase hint for the next multi-block write
+				if(prev != CARD_TRAN) return 0;
+				card.pre_erase_cnt = arg & 0x7FFFFF;
+				return 1;
+
+			case 41:																//SD_SEND_OP_COND
+				if((prev != CARD_IDLE) && (prev != CARD_READY)) return 0;
+				resp->crc = 0;
+				resp->respcmd = 63;
+				if(++card.acmd41_cnt > HOST_emu_timing.acmd41_busy_cnt){
+					card.state = CARD_READY;
+					resp->resp[0] = 0xC0FF8000;										//ready, CCS (SDHC)
+				} else {
+					resp->resp[0] = 0x00FF8000;										//still powering up
+				}
+				return 1;
+
+			case 51: {																//SEND_SCR
+				const uint8_t scr[8] = {0x02, 0x35, 0x80, 0x03, 0x00, 0x00, 0x00, 0x00};
+				if(prev != CARD_TRAN) return 0;
+				emu_card_reg_read(scr, sizeof(scr));
+				return 1;
+			}
+
+			default:
+				break;																//not an ACMD we know - treat it as a normal command
+
+		}
+
+	} else {
+
+		HOST_emu_stats.cmd_cnt[index & 0x3F]++;
+
+	}
+
+	switch(index){
+
+		case 0:																		//GO_IDLE_STATE
+			memset(&card, 0, sizeof(card));
+			card.state = CARD_IDLE;
+			card.bus_width = 1;
+			return 0;
+
+		case 2:																		//ALL_SEND_CID
+			if(prev != CARD_READY) return 0;
+			card.state = CARD_IDENT;
+			resp->long_resp = 1;
+			resp->respcmd = 63;
+			resp->resp[0] = 0x03534453;												//MID, OID, PNM
+			resp->resp[1] = 0x4855454D;
+			resp->resp[2] = 0x80000001;
+			resp->resp[3] = 0x00018E00;
+			return 1;
+
+		case 3:																		//SEND_RELATIVE_ADDR
+			if((prev != CARD_IDENT) && (prev != CARD_STBY)) return 0;
+			card.rca = 0x59B4;
+			card.state = CARD_STBY;
+			resp->resp[0] = ((uint32_t) card.rca << 16) | (status & 0x1FFF);
+			return 1;
+
+		case 7:																		//SELECT/DESELECT_CARD
+			if(addressed){
+				if(prev == CARD_STBY) card.state = CARD_TRAN;
+				else if(prev == CARD_DIS) card.state = CARD_PRG;
+				else return 0;
+				return 1;
+			}
+			if((prev == CARD_TRAN) || (prev == CARD_DATA)) card.state = CARD_STBY;
+			else if(prev == CARD_PRG) card.state = CARD_DIS;
+			return 0;																//the de-selected card does not answer
+
+		case 6: {																	//SWITCH_FUNC
+			uint8_t sw[64] = {0};
+			uint8_t fn = arg & 0xF;
+			uint8_t selected;
+			if(prev != CARD_TRAN) return 0;
+			sw[1] = 100;															//100 mA max
+			for(uint8_t g = 2; g < 12; g += 2){
+				sw[g] = 0x80;														//groups 6...2: default function only
+				sw[g + 1] = 0x01;
+			}
+			sw[12] = 0x80;
+			sw[13] = HOST_emu_timing.high_speed ? 0x03 : 0x01;						//group 1: default, high speed
+			if(fn == 0xF) selected = card.high_speed;								//no change
+			else if((fn == 0) || ((fn == 1) && HOST_emu_timing.high_speed)) selected = fn;
+			else selected = 0xF;													//not supported
+			sw[16] = selected;
+			sw[17] = 0x01;															//data structure version
+			if((arg & (1u<<31)) && (selected != 0xF)) card.high_speed = selected;
+			emu_card_reg_read(sw, sizeof(sw));
+			return 1;
+		}
+
+		case 8:																		//SEND_IF_COND
+			if(prev != CARD_IDLE) return 0;
+			resp->resp[0] = arg & 0xFFF;
+			return 1;
+
+		case 9:																		//SEND_CSD
+		case 10: {																	//SEND_CID
+			uint32_t c_size = (emu_sector_cnt / 1024) - 1;
+			if((prev != CARD_STBY) || !addressed) return 0;
+			resp->long_resp = 1;
+			resp->respcmd = 63;
+			if(index == 9){
+				resp->resp[0] = 0x400E0032;											//CSD v2, TRAN_SPEED 25 MHz
+				resp->resp[1] = 0x5B590000 | ((c_size >> 16) & 0x3F);
+				resp->resp[2] = ((c_size & 0xFFFF) << 16) | 0x7F80;
+				resp->resp[3] = 0x0A400000;
+			} else {
+				resp->resp[0] = 0x03534453;
+				resp->resp[1] = 0x4855454D;
+				resp->resp[2] = 0x80000001;
+				resp->resp[3] = 0x00018E00;
+			}
+			return 1;
+		}
+
+		case 12:																	//STOP_TRANSMISSION
+			if((prev == CARD_RCV) && emu_card_fault(HOST_FAULT_STOP_TIMEOUT, card.addr)) return 0;
+			if(prev == CARD_DATA){
+				card.state = CARD_TRAN;
+			} else if(prev == CARD_RCV){
+				emu_card_busy(HOST_emu_timing.write_prog_us, CARD_PRG);
+			} else {
+				return 0;
+			}
+			card.blocks_left = 0;
+			card.open_ended = 0;
+			return 1;
+
+		case 13:																	//SEND_STATUS
+			if(!addressed || (prev < CARD_STBY)) return 0;
+			return 1;
+
+		case 16:																	//SET_BLOCKLEN - fixed 512 on SDHC
+			if(prev != CARD_TRAN) return 0;
+			return 1;
+
+		case 17:																	//READ_SINGLE_BLOCK
+		case 18:																	//READ_MULTIPLE_BLOCK
+		case 24:																	//WRITE_BLOCK
+		case 25:																	//WRITE_MULTIPLE_BLOCK
+			if(prev != CARD_TRAN) return 0;
+			if(emu_card_fault(HOST_FAULT_CMD_TIMEOUT, arg)) return 0;
+			if(arg >= emu_sector_cnt){
+				resp->resp[0] |= (1u<<31);											//ADDRESS_OUT_OF_RANGE
+				card.preset_cnt = 0;
+				return 1;
+			}
+			if(emu_card_fault(HOST_FAULT_CMD_CRC, arg)) resp->crc = 0;				//the card takes the command, the host sees a broken response
+			card.addr = arg;
+			card.reg_read = 0;
+			if((index == 17) || (index == 24)){
+				card.blocks_left = 1;
+				card.open_ended = 0;
+			} else {
+				card.blocks_left = card.preset_cnt;
+				card.open_ended = (card.preset_cnt == 0);
+			}
+			card.preset_cnt = 0;
+			if(index >= 24){
+				uint32_t unit = HOST_emu_timing.erase_unit_blocks;
+				card.write_first = 1;
+				card.pre_erase_start = arg;
+				card.pre_erase_end = (index == 25) ? (arg + card.pre_erase_cnt) : arg;	//the hint only applies to a multi-block write
+				card.pre_erase_us = 0;
+				if((card.pre_erase_end > arg) && (unit != 0)){
+					uint32_t units = ((card.pre_erase_end - 1) / unit) - (arg / unit) + 1;
+					HOST_emu_stats.pre_erase_unit_cnt += units;
+					card.pre_erase_us = units * HOST_emu_timing.pre_erase_unit_us;
+				}
+				card.pre_erase_cnt = 0;
+			}
+			if(index <= 18){
+				card.state = CARD_DATA;
+				card.ready_ns = emu_now_ns + (uint64_t) HOST_emu_timing.read_access_us * 1000ull;
+			} else {
+				card.state = CARD_RCV;
+			}
+			return 1;
+
+		case 23:																	//SET_BLOCK_COUNT
+			if(prev != CARD_TRAN) return 0;
+			card.preset_cnt = arg;
+			return 1;
+
+		case 55:																	//APP_CMD
+			if((prev != CARD_IDLE) && !addressed) return 0;
+			card.app_cmd = 1;
+			resp->resp[0] = status | (1<<5);
+			return 1;
+
+		default:
+			return 0;																//illegal command: no response
+
+	}
+
+}
+
+static void emu_tick_card(void){
+
+	if(card.busy && (emu_now_ns >= card.ready_ns)){
+
+		card.busy = 0;
+		HOST_emu_stats.busy_ns += card.ready_ns - card.busy_start_ns;
+		if(card.state == CARD_PRG) card.state = CARD_TRAN;
+		else if(card.state == CARD_DIS) card.state = CARD_STBY;
+
+	}
+
+}
+
+static void emu_tick_pins(void){
+
+	/*
+	 * DAT0 (PC8) is pulled up and driven low by the card while it is busy
+	 * The input data register samples the pin even in alternate function mode, so the driver can read it at any time
+	 */
+
+	if(card.busy) GPIOC->IDR &= ~(1<<8);
+	else GPIOC->IDR |= (1<<8);
+
+}
+
+//5)Command path state machine
+static void emu_tick_cpsm(void){
+
+	emu_resp_t resp;
+	uint8_t answered;
+
+	if(!cpsm.active){
+
+		uint32_t cmd = SDIO->CMD;
+		uint32_t ck = emu_sdio_ck_hz();
+		uint32_t clocks;
+
+		if(((cmd & (1<<10)) == 0) || (ck == 0)) return;
+
+		SDIO->CMD &= ~(1<<10);														//CPSMEN is consumed by the emulator so a re-write sends the next command
+		cpsm.index = cmd & 0x3F;
+		cpsm.waitresp = (cmd >> 6) & 0x3;
+		cpsm.arg = SDIO->ARG;
+		cpsm.active = 1;
+
+		clocks = 48 + 8;															//command frame plus Nrc
+		if(cpsm.waitresp == 0x1) clocks += 16 + 48;								//Ncr plus short response
+		if(cpsm.waitresp == 0x3) clocks += 16 + 136;								//Ncr plus long response
+
+		cpsm.done_ns = emu_now_ns + emu_clk_ns(clocks, ck);
+		SDIO->STA |= (1<<11);														//CMDACT
+		return;
+
+	}
+
+	if(emu_now_ns < cpsm.done_ns) return;
+
+	cpsm.active = 0;
+	SDIO->STA &= ~(1<<11);
+
+	answered = emu_card_command(cpsm.index, cpsm.arg, &resp);
+
+	if((cpsm.waitresp == 0x0) || (cpsm.waitresp == 0x2)){
+
+		SDIO->STA |= (1<<7);														//CMDSENT
+
+	} else if(!answered){
+
+		HOST_emu_stats.cmd_timeout_cnt++;
+		SDIO->STA |= (1<<2);														//CTIMEOUT
+
+	} else {
+
+		SDIO->RESPCMD = resp.respcmd;
+		SDIO->RESP1 = resp.resp[0];
+		SDIO->RESP2 = resp.resp[1];
+		SDIO->RESP3 = resp.resp[2];
+		SDIO->RESP4 = resp.resp[3];
+		SDIO->STA |= resp.crc ? (1<<6) : (1<<0);									//CMDREND or CCRCFAIL
+
+	}
+
+}
+
+//6)DMA
+static DMA_Stream_TypeDef* emu_dma_stream(uint8_t dir_read){
+
+	/*
+	 * Finds the enabled stream that moves data in the direction of the transfer (Stream3 and Stream6 are both on Ch4 - SDIO)
+	 */
+
+	DMA_Stream_TypeDef* streams[2] = {DMA2_Stream3, DMA2_Stream6};
+	uint32_t dir = dir_read ? 0x0 : 0x1;
+
+	for(uint8_t i = 0; i < 2; i++){
+
+		if((streams[i]->CR & (1<<0)) && (((streams[i]->CR >> 6) & 0x3) == dir)) return streams[i];
+
+	}
+
+	return NULL;
+
+}
+
+static void emu_dma_flag(DMA_Stream_TypeDef* stream, uint32_t flag){
+
+	/*
+	 * flag is given with the stream 0 bit positions (FEIF 0, DMEIF 2, TEIF 3, HTIF 4, TCIF 5)
+	 */
+
+	if(stream == DMA2_Stream0) DMA2->LISR |= (flag << 0);
+	else if(stream == DMA2_Stream3) DMA2->LISR |= (flag << 22);
+	else if(stream == DMA2_Stream6) DMA2->HISR |= (flag << 16);
+
+}
+
+static uint8_t* emu_dma_memory(DMA_Stream_TypeDef* stream, uint32_t offset){
+
+	/*
+	 * Memory address of the next block
+	 * With the peripheral as flow controller, the whole transfer goes to M0AR
+	 * With the DMA as flow controller, the block goes where NDTR stands in the current target (CT selects M0AR or M1AR in double buffer mode)
+	 * Memory bursts must not cross a 1 kB boundary: a block that would make one do so (burst not aligned to its own size) fails with a transfer error
+	 *
+	 */
+
+	uint32_t msize = (stream->CR >> 13) & 0x3;
+	uint32_t mburst = (stream->CR >> 23) & 0x3;
+	uintptr_t addr = stream->M0AR;
+
+	if((stream->CR & (1<<5)) == 0){
+
+		if((stream->CR & (1<<18)) && (stream->CR & (1<<19))) addr = stream->M1AR;
+		offset = (dpsm.dma_reload - stream->NDTR) * 4;								//PSIZE is a word
+
+		if((dpsm.block_bytes / 4) > stream->NDTR){
+
+			emu_dma_flag(stream, (1<<3));											//TEIF - the block runs over the end of the buffer
+			stream->CR &= ~(1<<0);
+			return NULL;
+
+		}
+
+	}
+
+	if((addr == 0) || (addr & ((1u << msize) - 1))){
+
+		emu_dma_flag(stream, (1<<3));												//TEIF - unaligned memory access for the programmed MSIZE
+		stream->CR &= ~(1<<0);
+		return NULL;
+
+	}
+
+	if(mburst != 0){
+
+		uintptr_t first = addr + offset;
+		uint32_t burst_bytes = (4u << (mburst - 1)) << msize;
+
+		if((first & (burst_bytes - 1)) && ((first >> 10) != ((first + dpsm.block_bytes - 1) >> 10))){
+
+			emu_dma_flag(stream, (1<<3));											//TEIF - a burst of the block would cross a 1 kB boundary
+			stream->CR &= ~(1<<0);
+			return NULL;
+
+		}
+
+	}
+
+	return (uint8_t*) (addr + offset);
+
+}
+
+static uint8_t emu_adc_triggered(void){
+
+	/*
+	 * ADC1 on, DMA requests on, external trigger on TIM2 TRGO (EXTSEL 6, any edge), TIM2 running with TRGO on update
+	 */
+
+	uint32_t cr2 = ADC1->CR2;
+
+	return ((cr2 & (1<<0)) && (cr2 & (1<<8)) && (((cr2 >> 28) & 0x3) != 0) && (((cr2 >> 24) & 0xF) == 6) &&
+			(TIM2->CR1 & (1<<0)) && (((TIM2->CR2 >> 4) & 0x7) == 2));
+
+}
+
+static void emu_tick_adc(uint64_t now){
+
+	/*
+	 * Each TIM2 update is a conversion, moved by DMA2 Stream0 (16 bits, memory increment) into its buffer
+	 * The half transfer and transfer complete flags are raised like on the MCU, circular mode reloads NDTR
+	 * The clock never jumps past a half (see emu_next_event_ns), so at most one flag is raised per tick
+	 */
+
+	DMA_Stream_TypeDef* stream = DMA2_Stream0;
+	uint64_t elapsed = now - tim2.last_ns;
+	uint64_t ticks;
+	uint64_t period;
+	uint64_t triggers;
+
+	tim2.last_ns = now;
+
+	if(!(stream->CR & (1<<0))) adc.running = 0;
+	else if(!adc.running){
+
+		adc.running = 1;
+		adc.reload = stream->NDTR;
+
+	}
+
+	if((TIM2->CR1 & (1<<0)) == 0){
+
+		tim2.frac = 0;
+		return;
+
+	}
+
+	tim2.frac += elapsed * (uint64_t) (emu_sysclk_hz() / (TIM2->PSC + 1));
+	ticks = tim2.frac / 1000000000ull;
+	tim2.frac %= 1000000000ull;
+
+	period = (uint64_t) TIM2->ARR + 1;
+	triggers = ((uint64_t) TIM2->CNT + ticks) / period;
+	TIM2->CNT = (uint32_t) (((uint64_t) TIM2->CNT + ticks) % period);
+
+	if(triggers) TIM2->SR |= (1<<0);												//UIF
+
+	if(!emu_adc_triggered()) return;
+
+	for(; triggers > 0; triggers--){
+
+		uint16_t value = (uint16_t) ((adc.sample_n & 0xFFF) << 4);					//12 bit ramp, left aligned
+
+		adc.sample_n++;
+		ADC1->DR = value;
+
+		if(!adc.running || (stream->NDTR == 0) || (stream->M0AR == 0)){
+
+			ADC1->SR |= (1<<5);														//OVR - nobody took the conversion
+			continue;
+
+		}
+
+		((uint16_t*) stream->M0AR)[adc.reload - stream->NDTR] = value;
+		HOST_emu_stats.adc_samples++;
+		stream->NDTR--;
+
+		if(stream->NDTR == adc.reload / 2) emu_dma_flag(stream, (1<<4));			//HTIF
+
+		if(stream->NDTR == 0){
+
+			emu_dma_flag(stream, (1<<5));											//TCIF
+
+			if(stream->CR & (1<<8)) stream->NDTR = adc.reload;						//circular
+			else {
+
+				stream->CR &= ~(1<<0);
+				adc.running = 0;
+
+			}
+
+		}
+
+	}
+
+}
+
+static uint64_t emu_dma_block_ns(uint32_t bytes){
+
+	/*
+	 * Time the DMA needs to move a block between the FIFO and the memory
+	 * Each memory beat (byte, half word or word as MSIZE tells) is taken as 2 HCLK cycles on the AHB matrix
+	 * With byte beats at a low HCLK this can be longer than the block takes on the bus
+	 *
+	 */
+
+	DMA_Stream_TypeDef* stream = emu_dma_stream(dpsm.dir_read);
+	uint32_t msize = stream ? ((stream->CR >> 13) & 0x3) : 0;
+	uint32_t beats = bytes >> msize;
+
+	HOST_emu_stats.dma_mem_beats += beats;
+
+	return emu_clk_ns(beats * 2, emu_sysclk_hz());
+
+}
+
+//7)Data path state machine
+static void emu_dpsm_end(void){
+
+	dpsm.active = 0;
+	dpsm.in_block = 0;
+	SDIO->STA &= ~((1<<12) | (1<<13));												//TXACT/RXACT
+
+}
+
+static void emu_dpsm_block_done(void){
+
+	DMA_Stream_TypeDef* stream = emu_dma_stream(dpsm.dir_read);
+	uint8_t* mem = stream ? emu_dma_memory(stream, dpsm.done_bytes) : NULL;
+	uint32_t bytes = dpsm.block_bytes;
+	uint32_t erase_us = 0;
+
+	dpsm.in_block = 0;
+
+	if(mem == NULL){
+
+		SDIO->STA |= dpsm.dir_read ? (1<<5) : (1<<4);								//RXOVERR/TXUNDERR - nobody is servicing the FIFO
+		emu_dpsm_end();
+		return;
+
+	}
+
+	if(card.bus_width != emu_host_bus_width()){
+
+		SDIO->STA |= (1<<1);														//DCRCFAIL - card and host disagree on the bus width
+		emu_dpsm_end();
+		return;
+
+	}
+
+	if(!dpsm.dir_read && (HOST_emu_timing.tx_max_hz != 0) && (emu_sdio_ck_hz() > HOST_emu_timing.tx_max_hz)){
+
+		/*
+		 * The DMA does not keep up with the bus: the FIFO runs dry in the middle of the block
+		 * The card sees a cut block with a bad CRC and programs nothing - as for a CRC error on a write
+		 */
+
+		SDIO->STA |= (1<<4);														//TXUNDERR
+
+		if(!card.open_ended && (card.blocks_left == 1)){
+
+			card.state = CARD_TRAN;
+			card.blocks_left = 0;
+
+		}
+
+		emu_dpsm_end();
+		return;
+
+	}
+
+	if((emu_sdio_ck_hz() > emu_bus_max_hz()) || (!card.reg_read && emu_card_fault(HOST_FAULT_CRC, card.addr))){
+
+		/*
+		 * The block is garbled on the bus
+		 * Reads: the card sends the rest of a counted transfer anyway and is back in "tran" (an open-ended one still needs CMD12)
+		 * Writes: the card answers with a negative CRC token and programs nothing - a single block write ends, a multi-block one waits for CMD12 in "rcv"
+		 */
+
+		HOST_emu_stats.crc_error_cnt++;
+		SDIO->STA |= (1<<1);														//DCRCFAIL
+
+		if(card.reg_read || !card.open_ended){
+
+			if(dpsm.dir_read || card.reg_read || (card.blocks_left == 1)){
+
+				card.state = CARD_TRAN;
+				card.blocks_left = 0;
+
+			}
+
+			card.reg_read = 0;
+
+		}
+
+		emu_dpsm_end();
+		return;
+
+	}
+
+	if(dpsm.dir_read){
+
+		if(card.reg_read){
+
+			memset(mem, 0, bytes);
+			memcpy(mem, card.reg_buf, (bytes < card.reg_len) ? bytes : card.reg_len);
+
+		} else {
+
+			if(pread(emu_image_fd, mem, bytes, (off_t) card.addr * 512) != (ssize_t) bytes) memset(mem, 0xFF, bytes);
+			HOST_emu_stats.blocks_read++;
+
+		}
+
+	} else {
+
+		if(pwrite(emu_image_fd, mem, bytes, (off_t) card.addr * 512) == (ssize_t) bytes) HOST_emu_stats.blocks_written++;
+
+	}
+
+	if(!dpsm.dir_read && !card.reg_read) erase_us = emu_card_erase_us(card.addr);
+
+	card.addr++;
+	dpsm.done_bytes += bytes;
+	SDIO->STA |= (1<<10);															//DBCKEND
+
+	//card side
+	if(card.reg_read || (!card.open_ended && (--card.blocks_left == 0))){
+
+		card.reg_read = 0;
+
+		if(dpsm.dir_read) card.state = CARD_TRAN;
+		else emu_card_busy(HOST_emu_timing.write_prog_us + erase_us, CARD_PRG);
+
+	} else if(!dpsm.dir_read){
+
+		emu_card_busy(HOST_emu_timing.write_block_busy_us + erase_us, CARD_RCV);				//card programs the block while staying in "rcv"
+
+	}
+
+	//DMA side
+	if((stream->CR & (1<<5)) == 0){
+
+		/*
+		 * DMA flow control: NDTR counts the words of the current buffer, DATAEND still comes from DLEN
+		 * At the end of a buffer, double buffer mode swaps the target and reloads NDTR - the IRQ has one buffer time to refill the idle one
+		 *
+		 */
+
+		stream->NDTR -= bytes / 4;
+
+		if(stream->NDTR == 0){
+
+			emu_dma_flag(stream, (1<<5));											//TCIF
+
+			if(stream->CR & (1<<18)){
+
+				stream->CR ^= (1<<19);												//CT
+				stream->NDTR = dpsm.dma_reload;
+				HOST_emu_stats.dma_buffer_swaps++;
+
+			} else {
+
+				stream->CR &= ~(1<<0);
+
+			}
+
+		}
+
+		if(dpsm.done_bytes >= dpsm.dlen){
+
+			SDIO->STA |= (1<<8);													//DATAEND
+			emu_dpsm_end();
+
+		}
+
+		return;
+
+	}
+
+	if(!dpsm.half_done && (dpsm.done_bytes >= (dpsm.dlen / 2))){
+
+		dpsm.half_done = 1;
+		emu_dma_flag(stream, (1<<4));												//HTIF
+
+	}
+
+	if(dpsm.done_bytes >= dpsm.dlen){
+
+		emu_dma_flag(stream, (1<<5));												//TCIF
+		stream->CR &= ~(1<<0);														//peripheral flow control: the stream is disabled at the end of the transfer
+		SDIO->STA |= (1<<8);														//DATAEND
+		emu_dpsm_end();
+
+	}
+
+}
+
+static void emu_tick_dpsm(void){
+
+	uint32_t ck = emu_sdio_ck_hz();
+
+	if(!dpsm.active){
+
+		uint32_t dctrl = SDIO->DCTRL;
+
+		if(((dctrl & (1<<0)) == 0) || (ck == 0)) return;
+
+		SDIO->DCTRL &= ~(1<<0);														//DTEN is consumed by the emulator
+		dpsm.active = 1;
+		dpsm.in_block = 0;
+		dpsm.half_done = 0;
+		dpsm.dir_read = (dctrl >> 1) & 0x1;
+		dpsm.dlen = SDIO->DLEN & 0x1FFFFFF;
+		dpsm.block_size = 1u << ((dctrl >> 4) & 0xF);
+		dpsm.done_bytes = 0;
+		dpsm.dma_reload = emu_dma_stream(dpsm.dir_read) ? emu_dma_stream(dpsm.dir_read)->NDTR : 0;
+		dpsm.timeout_ns = emu_now_ns + emu_clk_ns(SDIO->DTIMER, ck);
+		SDIO->STA |= dpsm.dir_read ? (1<<13) : (1<<12);							//RXACT/TXACT
+		return;
+
+	}
+
+	if(dpsm.in_block){
+
+		if(emu_now_ns >= dpsm.block_end_ns) emu_dpsm_block_done();
+		return;
+
+	}
+
+	//waiting for the card
+	if((dpsm.dir_read && (card.state == CARD_DATA) && (emu_now_ns >= card.ready_ns) && !emu_card_withholds()) ||
+	   (!dpsm.dir_read && (card.state == CARD_RCV) && !card.busy)){
+
+		uint32_t bytes = dpsm.dlen - dpsm.done_bytes;
+		uint32_t clocks;
+		uint64_t dma_ns;
+
+		if(bytes > dpsm.block_size) bytes = dpsm.block_size;
+
+		clocks = ((bytes * 8) / emu_host_bus_width()) + 16 + 2;					//data, CRC16, start and end bits
+		if(!dpsm.dir_read) clocks += 8;											//CRC status token
+
+		dpsm.block_bytes = bytes;
+		dpsm.block_end_ns = emu_now_ns + emu_clk_ns(clocks, ck);
+		dma_ns = emu_dma_block_ns(bytes);
+
+		if(emu_now_ns + dma_ns > dpsm.block_end_ns){
+
+			HOST_emu_stats.dma_slow_blocks++;										//the block is paced by the DMA, not by SDIO_CK
+			dpsm.block_end_ns = emu_now_ns + dma_ns;
+
+		}
+
+		dpsm.in_block = 1;
+		dpsm.timeout_ns = dpsm.block_end_ns + emu_clk_ns(SDIO->DTIMER, ck);		//the timeout restarts for each block
+
+	} else if(emu_now_ns >= dpsm.timeout_ns){
+
+		if(dpsm.dir_read && !card.reg_read) emu_card_fault(HOST_FAULT_DATA_TIMEOUT, card.addr);	//the withheld block counts once the host gives up on it
+		SDIO->STA |= (1<<3);														//DTIMEOUT
+		emu_dpsm_end();
+
+	}
+
+}
+
+//8)Interrupts
+static uint32_t emu_dma_pending(DMA_Stream_TypeDef* stream, uint32_t flags){
+
+	uint32_t enabled = 0;
+
+	if(stream->CR & (1<<4)) enabled |= (1<<5);										//TCIE
+	if(stream->CR & (1<<3)) enabled |= (1<<4);										//HTIE
+	if(stream->CR & (1<<2)) enabled |= (1<<3);										//TEIE
+	if(stream->CR & (1<<1)) enabled |= (1<<2);										//DMEIE
+	if(stream->FCR & (1<<7)) enabled |= (1<<0);										//FEIE
+
+	return flags & enabled & 0x3D;
+
+}
+
+static void emu_dispatch_irqs(void){
+
+	/*
+	 * The NVIC: a handler is called as long as its (enabled) source is pending
+	 * The guard stops a handler that never clears its flag from locking up the tick
+	 */
+
+	for(uint8_t guard = 0; guard < 8; guard++){
+
+		uint8_t fired = 0;
+
+		if(emu_nvic_enabled[SDIO_IRQn] && (SDIO->STA & SDIO->MASK)){
+
+			SDIO_IRQHandler();
+			fired = 1;
+
+		}
+
+		emu_tick_clear();
+
+		if(emu_nvic_enabled[DMA2_Stream3_IRQn] && emu_dma_pending(DMA2_Stream3, (DMA2->LISR >> 22))){
+
+			DMA2_Stream3_IRQHandler();
+			fired = 1;
+
+		}
+
+		emu_tick_clear();
+
+		if(emu_nvic_enabled[DMA2_Stream6_IRQn] && emu_dma_pending(DMA2_Stream6, (DMA2->HISR >> 16))){
+
+			DMA2_Stream6_IRQHandler();
+			fired = 1;
+
+		}
+
+		emu_tick_clear();
+
+		if(emu_nvic_enabled[TIM7_IRQn] && (TIM7->SR & TIM7->DIER & (1<<0))){
+
+			TIM7_IRQHandler();
+			fired = 1;
+
+		}
+
+		emu_tick_clear();
+
+		if(emu_nvic_enabled[DMA2_Stream0_IRQn] && emu_dma_pending(DMA2_Stream0, (DMA2->LISR & 0x3F))){
+
+			DMA2_Stream0_IRQHandler();
+			fired = 1;
+
+		}
+
+		emu_tick_clear();
+
+		if(!fired) break;
+
+	}
+
+}
+
+//9)Peripheral tick
+static uint64_t emu_next_event_ns(void){
+
+	/*
+	 * Earliest pending hardware completion
+	 * Timeouts are not events: they are reached on wall time only, so a slow driver is never punished by a clock jump
+	 */
+
+	uint64_t next = EMU_NO_EVENT;
+
+	if(cpsm.active && (cpsm.done_ns < next)) next = cpsm.done_ns;
+	if(dpsm.active && dpsm.in_block && (dpsm.block_end_ns < next)) next = dpsm.block_end_ns;
+	if(dpsm.active && !dpsm.in_block && dpsm.dir_read && (card.state == CARD_DATA) && !emu_card_withholds() && (card.ready_ns < next)) next = card.ready_ns;
+	if(card.busy && (card.ready_ns < next)) next = card.ready_ns;
+
+	if((TIM7->CR1 & (1<<0)) && (TIM7->DIER & (1<<0))){								//one-shot alarm: the update event is a completion too
+
+		uint64_t rate = emu_sysclk_hz() / (TIM7->PSC + 1);
+		uint64_t need = ((uint64_t) TIM7->ARR - TIM7->CNT + 1) * 1000000000ull;
+		uint64_t alarm = tim7.last_ns + ((need > tim7.frac) ? ((need - tim7.frac + rate - 1) / rate) : 0);
+
+		if(alarm < next) next = alarm;
+
+	}
+
+	return next;
+
+}
+
+static uint64_t emu_next_adc_ns(void){
+
+	/*
+	 * End of the ADC half buffer being filled
+	 * Unlike the completions above, this is no reason to jump ahead (the ADC runs alongside the CPU), it only caps the step so the half is handed over on time
+	 */
+
+	uint64_t next = EMU_NO_EVENT;
+
+	if(adc.running && emu_adc_triggered()){
+
+		uint32_t half = adc.reload / 2;
+		uint32_t samples = (DMA2_Stream0->NDTR > half) ? (DMA2_Stream0->NDTR - half) : DMA2_Stream0->NDTR;
+		uint64_t rate = emu_sysclk_hz() / (TIM2->PSC + 1);
+		uint64_t need = ((uint64_t) samples * (TIM2->ARR + 1) - TIM2->CNT) * 1000000000ull;
+		uint64_t alarm = tim2.last_ns + ((need > tim2.frac) ? ((need - tim2.frac + rate - 1) / rate) : 0);
+
+		if(alarm < next) next = alarm;
+
+	}
+
+	return next;
+
+}
+
+static void emu_tick(int signo){
+
+	uint64_t target;
+	uint64_t next;
+
+	(void) signo;
+
+	if(emu_in_tick || emu_irq_disable_cnt) return;									//interrupts are masked - the tick is served late
+	emu_in_tick = 1;
+
+	emu_tick_clear();
+	emu_tick_cpsm();																//commands/transfers started since the last tick are stamped with the last tick's time
+	emu_tick_dpsm();
+
+	next = emu_next_event_ns();
+
+	if(next != EMU_NO_EVENT){
+
+		target = (next > emu_now_ns) ? next : emu_now_ns;							//the hardware is the bottleneck: jump to its next completion
+		emu_idle_ticks = 0;
+
+	} else {
+
+		emu_idle_ticks++;
+		target = emu_now_ns + ((emu_idle_ticks > EMU_IDLE_FAST_CNT) ? EMU_IDLE_FAST_NS : EMU_IDLE_NS);
+
+	}
+
+	next = emu_next_adc_ns();
+	if((next < target) && (next > emu_now_ns)) target = next;
+
+	emu_now_ns = target;
+
+	if((CoreDebug->DEMCR & (1<<24)) && (DWT->CTRL & (1<<0))){
+
+		DWT->CYCCNT = (uint32_t) (emu_now_ns * (SystemCoreClock / 1000000) / 1000);		//wraps like the real one
+
+	}
+
+	for(uint8_t pass = 0; pass < 4; pass++){
+
+		emu_tick_rcc();
+		emu_tick_tim(TIM6, &tim6, emu_now_ns);
+		emu_tick_tim(TIM7, &tim7, emu_now_ns);
+		emu_tick_adc(emu_now_ns);
+		emu_tick_clear();
+		emu_tick_card();
+		emu_tick_cpsm();
+		emu_tick_dpsm();
+		emu_tick_pins();
+		emu_dispatch_irqs();
+
+	}
+
+	emu_in_tick = 0;
+
+}
+
+//10)Start/stop
+uint8_t HOST_Emulator_start(const char* image_path, uint32_t sector_cnt){
+
+	/*
+	 * Opens (or creates) the card image and starts the peripheral tick
+	 * sector_cnt of 0 takes the size of an existing image
+	 * Returns 0 on success, 1 on failure
+	 */
+
+	struct stat st;
+	struct sigaction sa;
+	struct sigevent sev;
+	struct itimerspec its;
+
+	emu_image_fd = open(image_path, O_RDWR | O_CREAT, 0644);
+	if(emu_image_fd < 0) return 1;
+
+	if(fstat(emu_image_fd, &st) != 0) return 1;
+
+	if(sector_cnt == 0) sector_cnt = (uint32_t) (st.st_size / 512);
+	if((uint64_t) st.st_size < (uint64_t) sector_cnt * 512){
+
+		if(ftruncate(emu_image_fd, (off_t) sector_cnt * 512) != 0) return 1;	//sparse image
+
+	}
+
+	if(sector_cnt < 2048) return 1;													//the CSD can't describe less than 1 MB
+	emu_sector_cnt = sector_cnt;
+
+	//reset values
+	memset((void*) SDIO, 0, sizeof(SDIO_TypeDef));
+	memset((void*) DMA2, 0, sizeof(DMA_TypeDef));
+	memset((void*) DMA2_Stream0, 0, sizeof(DMA_Stream_TypeDef));
+	memset((void*) DMA2_Stream3, 0, sizeof(DMA_Stream_TypeDef));
+	memset((void*) DMA2_Stream6, 0, sizeof(DMA_Stream_TypeDef));
+	memset((void*) RCC, 0, sizeof(RCC_TypeDef));
+	memset((void*) TIM6, 0, sizeof(TIM_TypeDef));
+	memset((void*) TIM7, 0, sizeof(TIM_TypeDef));
+	memset((void*) TIM2, 0, sizeof(TIM_TypeDef));
+	memset((void*) ADC1, 0, sizeof(ADC_TypeDef));
+	memset((void*) ADC123_COMMON, 0, sizeof(ADC_Common_TypeDef));
+	memset((void*) DWT, 0, sizeof(DWT_Type));
+	memset((void*) CoreDebug, 0, sizeof(CoreDebug_Type));
+	RCC->CR = 0x83;																	//HSI on and ready
+	RCC->PLLCFGR = 0x24003010;
+	TIM6->ARR = 0xFFFF;
+	TIM7->ARR = 0xFFFF;
+	TIM2->ARR = 0xFFFFFFFF;
+	GPIOC->IDR = 0xFFFF;															//pullups
+	GPIOD->IDR = 0xFFFF;
+
+	memset(&card, 0, sizeof(card));
+	card.bus_width = 1;
+	memset(&cpsm, 0, sizeof(cpsm));
+	memset(&dpsm, 0, sizeof(dpsm));
+	HOST_Emulator_stats_reset();
+
+	emu_now_ns = 0;
+	tim6.last_ns = 0;
+	tim6.frac = 0;
+	tim7.last_ns = 0;
+	tim7.frac = 0;
+	tim2.last_ns = 0;
+	tim2.frac = 0;
+	memset(&adc, 0, sizeof(adc));
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = emu_tick;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if(sigaction(SIGRTMIN, &sa, NULL) != 0) return 1;
+
+	memset(&sev, 0, sizeof(sev));
+	sev.sigev_notify = SIGEV_SIGNAL;
+	sev.sigev_signo = SIGRTMIN;
+	if(timer_create(CLOCK_MONOTONIC, &sev, &emu_timer) != 0) return 1;
+
+	its.it_interval.tv_sec = 0;
+	its.it_interval.tv_nsec = EMU_TICK_NS;
+	its.it_value = its.it_interval;
+	if(timer_settime(emu_timer, 0, &its, NULL) != 0) return 1;
+
+	return 0;
+
+}
+
+void HOST_Emulator_stop(void){
+
+	timer_delete(emu_timer);
+	signal(SIGRTMIN, SIG_IGN);
+
+	if(emu_image_fd >= 0){
+
+		fsync(emu_image_fd);
+		close(emu_image_fd);
+		emu_image_fd = -1;
+
+	}
+
+}
+
+void HOST_Emulator_stats_reset(void){
+
+	memset(&HOST_emu_stats, 0, sizeof(HOST_emu_stats));
+
+}
+
+uint64_t HOST_time_us(void){
+
+	return emu_now_ns / 1000;
+
+}
+
+//11)CMSIS stand-ins
+void NVIC_SetPriority(IRQn_Type IRQn, uint32_t priority){
+
+	(void) IRQn;
+	(void) priority;																//all emulated interrupts share one level
+
+}
+
+void NVIC_EnableIRQ(IRQn_Type IRQn){
+
+	emu_nvic_enabled[IRQn] = 1;
+
+}
+
+void NVIC_DisableIRQ(IRQn_Type IRQn){
+
+	emu_nvic_enabled[IRQn] = 0;
+
+}
+
+void __disable_irq(void){
+
+	emu_irq_disable_cnt++;
+
+}
+
+void __enable_irq(void){
+
+	if(emu_irq_disable_cnt) emu_irq_disable_cnt--;
+
+}
+
+void __DMB(void){
+
+	/*
+	 * The "IRQs" run as a signal handler on the same thread - keeping the compiler from moving memory accesses across is enough
+	 */
+
+	__sync_synchronize();
+
+}
+
+void __WFI(void){
+
+	/*
+	 * Like on the Cortex-M, a pending interrupt wakes the core even when it is masked by __disable_irq
+	 * Here the tick is simply let through while the "core" sleeps: its handlers then run before the wake-up instead of after __enable_irq
+	 */
+
+	uint32_t masked = emu_irq_disable_cnt;
+
+	emu_irq_disable_cnt = 0;
+	pause();																		//any signal - the peripheral tick included - wakes the "core"
+	emu_irq_disable_cnt = masked;
+
+}
+
+void __set_MSP(uint32_t top_of_stack){
+
+	(void) top_of_stack;
+
+}
+
+void SystemCoreClockUpdate(void){
+
+	SystemCoreClock = emu_sysclk_hz();
+
+}
+
+#endif /* SDIO_HOST_EMULATION */
@@ -0,0 +1,321 @@
+/*
+ *  Created on: Oct 17, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_SDIO_FATFS
+ *  Processor: STM32F405 (emulated on a Linux host)
+ *  Program version: 1.0
+ *  Header file: HOST_SDIO_emulator.h
+ *  Change history:
+ */
+
+/*
+ * Host side stand-in for "stm32f405xx.h".
+ * When the project is compiled with SDIO_HOST_EMULATION defined, the drivers include this file instead of the CMSIS device header.
+ * The SDIO, DMA2, RCC (plus the PWR, FLASH, GPIO, TIM6 and TIM7 blocks the clock driver touches) are then plain memory blocks that a periodic peripheral tick watches.
+ * The tick plays the role of the SDIO/DMA hardware and of an SDHC card that is backed by an image file.
+ * Interrupts (SDIO_IRQHandler, DMA2_Stream3_IRQHandler, DMA2_Stream6_IRQHandler, TIM7_IRQHandler) are called from the tick like the NVIC would.
+ * DAT0 (PC8) is reflected in GPIOC->IDR: it is low while the card is busy.
+ * ADC1 stands in for the microphone: on each TIM2 update it converts a ramp (sample n reads n modulo 4096, left aligned) and DMA2 Stream0 stores it, calling DMA2_Stream0_IRQHandler at each half.
+ *
+ * Host build (no IDE project needed):
+ * 	gcc -DSDIO_HOST_EMULATION -I. -O2 HOST_main.c HOST_benchmark.c HOST_SDIO_emulator.c SDIO_DMA_driver.c SDcard_SDIO_driver.c SDcard_SDIO_async.c
+ * 	    SDcard_SDIO_diskio.c SDcard_SDIO_latency.c ClockDriver_STM32F405.c ADC_DMA_driver.c RING_buffer.c INPUT_File_capture.c ff.c ffsystem.c ffunicode.c
+ * 	    -lpthread -lrt -o sdio_host
+ * 	./sdio_host sdcard.img 256
+ * 	./sdio_host sdcard.img 256 bench results.csv											//benchmark suite only (see HOST_benchmark.h)
+ *
+ */
+
+#ifndef INC_HOST_SDIO_EMULATOR_H_
+#define INC_HOST_SDIO_EMULATOR_H_
+
+#include "stdint.h"
+#include "stdio.h"
+
+//LOCAL CONSTANT
+
+#define __IO	volatile
+
+//register blocks - the layout follows the CMSIS device header, only the registers the drivers use are relevant
+typedef struct
+{
+  __IO uint32_t POWER;
+  __IO uint32_t CLKCR;
+  __IO uint32_t ARG;
+  __IO uint32_t CMD;
+  __IO uint32_t RESPCMD;
+  __IO uint32_t RESP1;
+  __IO uint32_t RESP2;
+  __IO uint32_t RESP3;
+  __IO uint32_t RESP4;
+  __IO uint32_t DTIMER;
+  __IO uint32_t DLEN;
+  __IO uint32_t DCTRL;
+  __IO uint32_t DCOUNT;
+  __IO uint32_t STA;
+  __IO uint32_t ICR;
+  __IO uint32_t MASK;
+  uint32_t      RESERVED0[2];
+  __IO uint32_t FIFOCNT;
+  uint32_t      RESERVED1[13];
+  __IO uint32_t FIFO;
+} SDIO_TypeDef;
+
+typedef struct
+{
+  __IO uint32_t CR;
+  __IO uint32_t NDTR;
+  __IO uintptr_t PAR;																		//pointer wide on the host so the DMA can reach host memory
+  __IO uintptr_t M0AR;
+  __IO uintptr_t M1AR;
+  __IO uint32_t FCR;
+} DMA_Stream_TypeDef;
+
+typedef struct
+{
+  __IO uint32_t LISR;
+  __IO uint32_t HISR;
+  __IO uint32_t LIFCR;
+  __IO uint32_t HIFCR;
+} DMA_TypeDef;
+
+typedef struct
+{
+  __IO uint32_t CR;
+  __IO uint32_t PLLCFGR;
+  __IO uint32_t CFGR;
+  __IO uint32_t CIR;
+  __IO uint32_t AHB1RSTR;
+  __IO uint32_t AHB2RSTR;
+  __IO uint32_t AHB3RSTR;
+  uint32_t      RESERVED0;
+  __IO uint32_t APB1RSTR;
+  __IO uint32_t APB2RSTR;
+  uint32_t      RESERVED1[2];
+  __IO uint32_t AHB1ENR;
+  __IO uint32_t AHB2ENR;
+  __IO uint32_t AHB3ENR;
+  uint32_t      RESERVED2;
+  __IO uint32_t APB1ENR;
+  __IO uint32_t APB2ENR;
+} RCC_TypeDef;
+
+typedef struct
+{
+  __IO uint32_t CR;
+  __IO uint32_t CSR;
+} PWR_TypeDef;
+
+typedef struct
+{
+  __IO uint32_t ACR;
+  __IO uint32_t KEYR;
+  __IO uint32_t OPTKEYR;
+  __IO uint32_t SR;
+  __IO uint32_t CR;
+  __IO uint32_t OPTCR;
+} FLASH_TypeDef;
+
+typedef struct
+{
+  __IO uint32_t MODER;
+  __IO uint32_t OTYPER;
+  __IO uint32_t OSPEEDR;
+  __IO uint32_t PUPDR;
+  __IO uint32_t IDR;
+  __IO uint32_t ODR;
+  __IO uint32_t BSRR;
+  __IO uint32_t LCKR;
+  __IO uint32_t AFR[2];
+} GPIO_TypeDef;
+
+typedef struct
+{
+  __IO uint32_t CR1;
+  __IO uint32_t CR2;
+  __IO uint32_t SMCR;
+  __IO uint32_t DIER;
+  __IO uint32_t SR;
+  __IO uint32_t EGR;
+  __IO uint32_t CCMR1;
+  __IO uint32_t CCMR2;
+  __IO uint32_t CCER;
+  __IO uint32_t CNT;
+  __IO uint32_t PSC;
+  __IO uint32_t ARR;
+} TIM_TypeDef;
+
+typedef struct
+{
+  __IO uint32_t SR;
+  __IO uint32_t CR1;
+  __IO uint32_t CR2;
+  __IO uint32_t SMPR1;
+  __IO uint32_t SMPR2;
+  __IO uint32_t JOFR1;
+  __IO uint32_t JOFR2;
+  __IO uint32_t JOFR3;
+  __IO uint32_t JOFR4;
+  __IO uint32_t HTR;
+  __IO uint32_t LTR;
+  __IO uint32_t SQR1;
+  __IO uint32_t SQR2;
+  __IO uint32_t SQR3;
+  __IO uint32_t JSQR;
+  __IO uint32_t JDR1;
+  __IO uint32_t JDR2;
+  __IO uint32_t JDR3;
+  __IO uint32_t JDR4;
+  __IO uint32_t DR;
+} ADC_TypeDef;
+
+typedef struct
+{
+  __IO uint32_t CSR;
+  __IO uint32_t CCR;
+  __IO uint32_t CDR;
+} ADC_Common_TypeDef;
+
+typedef struct
+{
+  __IO uint32_t CTRL;																		//bit 0: CYCCNTENA
+  __IO uint32_t CYCCNT;																		//core cycles - follows the emulated time while enabled
+} DWT_Type;
+
+typedef struct
+{
+  __IO uint32_t DEMCR;																		//bit 24: TRCENA
+} CoreDebug_Type;
+
+typedef enum
+{
+  SDIO_IRQn				= 49,
+  TIM6_DAC_IRQn			= 54,
+  TIM7_IRQn				= 55,
+  DMA2_Stream0_IRQn		= 56,
+  DMA2_Stream3_IRQn		= 59,
+  DMA2_Stream6_IRQn		= 69,
+} IRQn_Type;
+
+#define RCC_CFGR_SWS		(0x3UL << 2)
+#define RCC_CFGR_SWS_PLL	(0x2UL << 2)
+
+//the emulated card model - timings are in microseconds
+typedef struct
+{
+  uint32_t read_access_us;																	//NAC - time from a read command to the first data block
+  uint32_t write_block_busy_us;																//DAT0 busy after each block of a multi-block write
+  uint32_t write_prog_us;																	//"prg" time after the last block of a write
+  uint32_t acmd41_busy_cnt;																	//number of ACMD41 calls answered with "busy" after power up
+  uint8_t high_speed;																		//the card accepts the CMD6 switch to high speed (50 MHz)
+  uint32_t signal_max_hz;																	//highest SDIO_CK the board carries - data blocks fail CRC above it
+  uint32_t tx_max_hz;																		//highest SDIO_CK the DMA keeps the Tx FIFO fed at - written blocks underrun above it (0: no limit)
+  uint32_t erase_unit_blocks;																//blocks the card erases at a time
+  uint32_t erase_unit_us;																	//stall at the first block written into a unit that was not pre-erased (0: erase is free)
+  uint32_t pre_erase_unit_us;																//erase time of a unit pre-erased by ACMD23, paid at the first block of the write
+} HOST_emu_timing_t;
+
+typedef struct
+{
+  uint32_t cmd_cnt[64];																		//commands received by the card, per index
+  uint32_t acmd_cnt[64];																	//application commands received by the card, per index
+  uint32_t cmd_timeout_cnt;																	//commands the card did not answer
+  uint32_t crc_error_cnt;																	//data blocks that failed CRC (clock above the card or board limit)
+  uint32_t blocks_read;																		//blocks sent by the card
+  uint32_t blocks_written;																	//blocks programmed into the image
+  uint64_t busy_ns;																			//total time the card spent with DAT0 held low
+  uint64_t dma_mem_beats;																	//DMA accesses on the memory port (one per MSIZE unit)
+  uint32_t dma_slow_blocks;																	//data blocks where the memory side of the DMA was slower than the bus
+  uint32_t dma_buffer_swaps;																	//double buffer target swaps under DMA flow control
+  uint32_t erase_stall_cnt;																	//blocks that stalled on an erase in the middle of a write
+  uint32_t pre_erase_unit_cnt;																//erase units pre-erased on an ACMD23 hint
+  uint32_t adc_samples;																		//samples converted and stored by DMA2 Stream0
+} HOST_emu_stats_t;
+
+//fault injection - the card misbehaves on one sector for a number of times
+#define HOST_FAULT_NONE			0
+#define HOST_FAULT_CRC			1															//the block at the sector fails CRC (read or write)
+#define HOST_FAULT_DATA_TIMEOUT	2															//the card never sends the block at the sector (read)
+#define HOST_FAULT_CMD_TIMEOUT	3															//a read/write command starting at the sector gets no response
+#define HOST_FAULT_CMD_CRC		4															//a read/write command starting at the sector is taken, its response fails CRC
+#define HOST_FAULT_STOP_TIMEOUT	5															//a CMD12 closing a write that ended right before the sector gets no response
+
+typedef struct
+{
+  uint8_t kind;																				//HOST_FAULT_...
+  uint32_t sector;
+  uint32_t count;																			//faults left - decremented at each hit
+} HOST_emu_fault_t;
+
+//LOCAL VARIABLE
+
+//EXTERNAL VARIABLE
+extern SDIO_TypeDef HOST_SDIO_regs;
+extern DMA_TypeDef HOST_DMA2_regs;
+extern DMA_Stream_TypeDef HOST_DMA2_Stream0_regs;
+extern DMA_Stream_TypeDef HOST_DMA2_Stream3_regs;
+extern DMA_Stream_TypeDef HOST_DMA2_Stream6_regs;
+extern RCC_TypeDef HOST_RCC_regs;
+extern PWR_TypeDef HOST_PWR_regs;
+extern FLASH_TypeDef HOST_FLASH_regs;
+extern GPIO_TypeDef HOST_GPIOA_regs;
+extern GPIO_TypeDef HOST_GPIOC_regs;
+extern GPIO_TypeDef HOST_GPIOD_regs;
+extern TIM_TypeDef HOST_TIM2_regs;
+extern TIM_TypeDef HOST_TIM6_regs;
+extern TIM_TypeDef HOST_TIM7_regs;
+extern ADC_TypeDef HOST_ADC1_regs;
+extern ADC_Common_TypeDef HOST_ADC123_COMMON_regs;
+extern DWT_Type HOST_DWT_regs;
+extern CoreDebug_Type HOST_CoreDebug_regs;
+
+extern uint32_t SystemCoreClock;
+
+extern HOST_emu_timing_t HOST_emu_timing;
+extern HOST_emu_stats_t HOST_emu_stats;
+extern HOST_emu_fault_t HOST_emu_fault;
+
+#define SDIO				(&HOST_SDIO_regs)
+#define DMA2				(&HOST_DMA2_regs)
+#define DMA2_Stream0		(&HOST_DMA2_Stream0_regs)
+#define DMA2_Stream3		(&HOST_DMA2_Stream3_regs)
+#define DMA2_Stream6		(&HOST_DMA2_Stream6_regs)
+#define RCC					(&HOST_RCC_regs)
+#define PWR					(&HOST_PWR_regs)
+#define FLASH				(&HOST_FLASH_regs)
+#define GPIOA				(&HOST_GPIOA_regs)
+#define GPIOC				(&HOST_GPIOC_regs)
+#define GPIOD				(&HOST_GPIOD_regs)
+#define TIM2				(&HOST_TIM2_regs)
+#define TIM6				(&HOST_TIM6_regs)
+#define TIM7				(&HOST_TIM7_regs)
+#define ADC1				(&HOST_ADC1_regs)
+#define ADC123_COMMON		(&HOST_ADC123_COMMON_regs)
+#define DWT					(&HOST_DWT_regs)
+#define CoreDebug			(&HOST_CoreDebug_regs)
+
+//FUNCTION PROTOTYPES
+uint8_t HOST_Emulator_start(const char* image_path, uint32_t sector_cnt);					//open/create the card image and start the peripheral tick
+void HOST_Emulator_stop(void);																//stop the peripheral tick and close the image
+void HOST_Emulator_stats_reset(void);														//wipe the card statistics
+uint64_t HOST_time_us(void);																//emulated time in us
+
+//CMSIS stand-ins
+void NVIC_SetPriority(IRQn_Type IRQn, uint32_t priority);
+void NVIC_EnableIRQ(IRQn_Type IRQn);
+void NVIC_DisableIRQ(IRQn_Type IRQn);
+void __disable_irq(void);																	//holds off the peripheral tick
+void __enable_irq(void);
+void __WFI(void);																			//sleeps until the next peripheral tick
+void __DMB(void);																			//memory barrier
+void __set_MSP(uint32_t top_of_stack);
+void SystemCoreClockUpdate(void);
+
+//the handlers the peripheral tick calls
+void SDIO_IRQHandler(void);
+void DMA2_Stream3_IRQHandler(void);
+void DMA2_Stream6_IRQHandler(void);
+void TIM7_IRQHandler(void);
+void DMA2_Stream0_IRQHandler(void);
+
+#endif /* INC_HOST_SDIO_EMULATOR_H_ */
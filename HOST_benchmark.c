@@ -0,0 +1,469 @@
+/*
+ *  Created on: Oct 17, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_SDIO_FATFS
+ *  Processor: STM32F405 (emulated on a Linux host)
+ *  Program version: 1.0
+ *  Source file: HOST_benchmark.c
+ *  Change history:
+ */
+
+#ifdef SDIO_HOST_EMULATION
+
+#include <HOST_benchmark.h>
+#include <HOST_SDIO_emulator.h>
+#include <SDcard_SDIO_driver.h>
+#include <SDcard_SDIO_diskio.h>
+#include "ff.h"
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t bench_lat[BENCH_LAT_MAX];										//per operation times of the running workload
+static uint32_t bench_lat_cnt;
+static uint8_t bench_buf[32768] __attribute__((aligned(4)));
+static uint32_t bench_seed;
+static FILE* bench_out;
+
+//1)Time stamps
+static uint64_t bench_start_us;
+
+static void HOST_bench_begin(void){
+
+	bench_lat_cnt = 0;
+	bench_start_us = HOST_time_us();
+
+}
+
+static void HOST_bench_op(uint64_t op_start_us){
+
+	if(bench_lat_cnt < BENCH_LAT_MAX) bench_lat[bench_lat_cnt++] = (uint32_t) (HOST_time_us() - op_start_us);
+
+}
+
+//2)Sort for the percentiles
+static int HOST_bench_cmp(const void* a, const void* b){
+
+	uint32_t x = *(const uint32_t*) a;
+	uint32_t y = *(const uint32_t*) b;
+
+	return (x > y) - (x < y);
+
+}
+
+//3)Print one result line
+static void HOST_bench_report(const char* workload, uint32_t request_bytes, uint64_t bytes, const char* result){
+
+	/*
+	 * Percentiles are nearest-rank over the sorted samples
+	 * MB/s is left at 0 for the workloads that move no data worth counting
+	 *
+	 */
+
+	uint64_t total_us = HOST_time_us() - bench_start_us;
+	uint32_t pct[3] = {0, 0, 0};
+	const uint8_t pct_rank[3] = {50, 90, 99};
+	uint32_t max_us = 0;
+
+	if(total_us == 0) total_us = 1;
+
+	if(bench_lat_cnt != 0){
+
+		qsort(bench_lat, bench_lat_cnt, sizeof(uint32_t), HOST_bench_cmp);
+
+		for(uint8_t p = 0; p < 3; p++) pct[p] = bench_lat[((bench_lat_cnt * pct_rank[p]) + 99) / 100 - 1];
+		max_us = bench_lat[bench_lat_cnt - 1];
+
+	}
+
+	fprintf(bench_out, "%s,%u,%u,%llu,%.3f,%.1f,%u,%u,%u,%u,%s\n",
+			workload,
+			request_bytes,
+			bench_lat_cnt,
+			(unsigned long long) total_us,
+			(double) bytes / (double) total_us,
+			(bench_lat_cnt * 1000000.0) / (double) total_us,
+			pct[0],
+			pct[1],
+			pct[2],
+			max_us,
+			result);
+
+}
+
+//4)Test pattern
+static void HOST_bench_fill(uint8_t* buf, uint32_t pos, uint32_t len){
+
+	for(uint32_t i = 0; i < len; i++) buf[i] = (uint8_t) (((pos + i) >> 9) ^ (pos + i));
+
+}
+
+static uint32_t HOST_bench_rand(void){
+
+	bench_seed = bench_seed * 1103515245 + 12345;								//same LCG every run, so every run seeks to the same places
+	return bench_seed >> 8;
+
+}
+
+//5)Sequential
+static uint8_t HOST_bench_sequential(uint32_t req){
+
+	FIL fil;
+	UINT bytes;
+	uint64_t t;
+	const char* result = "ok";
+	uint8_t failed = 0;
+
+	HOST_bench_begin();
+
+	if(f_open(&fil, "bench.bin", FA_CREATE_ALWAYS | FA_WRITE) != FR_OK){
+
+		result = "error";
+
+	} else {
+
+		for(uint32_t pos = 0; pos < BENCH_FILE_BYTES; pos += req){
+
+			HOST_bench_fill(bench_buf, pos, req);
+			t = HOST_time_us();
+			if((f_write(&fil, bench_buf, req, &bytes) != FR_OK) || (bytes != req)) result = "error";
+			HOST_bench_op(t);
+
+		}
+
+		if(f_close(&fil) != FR_OK) result = "error";
+
+	}
+
+	HOST_bench_report("seq_write", req, BENCH_FILE_BYTES, result);
+	failed += (result[0] != 'o');
+
+	result = "ok";
+	HOST_bench_begin();
+
+	if(f_open(&fil, "bench.bin", FA_READ) != FR_OK){
+
+		result = "error";
+
+	} else {
+
+		for(uint32_t pos = 0; pos < BENCH_FILE_BYTES; pos += req){
+
+			t = HOST_time_us();
+			if((f_read(&fil, bench_buf, req, &bytes) != FR_OK) || (bytes != req)) result = "error";
+			HOST_bench_op(t);
+
+			for(uint32_t i = 0; (i < req) && (result[0] == 'o'); i++){
+
+				if(bench_buf[i] != (uint8_t) (((pos + i) >> 9) ^ (pos + i))) result = "corrupt";
+
+			}
+
+		}
+
+		f_close(&fil);
+
+	}
+
+	HOST_bench_report("seq_read", req, BENCH_FILE_BYTES, result);
+	failed += (result[0] != 'o');
+
+	return failed;
+
+}
+
+//6)Random
+static uint8_t HOST_bench_random(void){
+
+	/*
+	 * Runs on the file the last sequential workload left behind
+	 * The writes put the same pattern back, so the reads can still check the data
+	 *
+	 */
+
+	FIL fil;
+	UINT bytes;
+	uint64_t t;
+	uint32_t pos;
+	const char* result = "ok";
+	uint8_t failed = 0;
+
+	bench_seed = 1;
+	HOST_bench_begin();
+
+	if(f_open(&fil, "bench.bin", FA_READ | FA_WRITE) != FR_OK){
+
+		result = "error";
+
+	} else {
+
+		for(uint32_t op = 0; op < BENCH_RANDOM_OPS; op++){
+
+			pos = (HOST_bench_rand() % (BENCH_FILE_BYTES / BENCH_RANDOM_BYTES)) * BENCH_RANDOM_BYTES;
+			HOST_bench_fill(bench_buf, pos, BENCH_RANDOM_BYTES);
+			t = HOST_time_us();
+			if(f_lseek(&fil, pos) != FR_OK) result = "error";
+			if((f_write(&fil, bench_buf, BENCH_RANDOM_BYTES, &bytes) != FR_OK) || (bytes != BENCH_RANDOM_BYTES)) result = "error";
+			HOST_bench_op(t);
+
+		}
+
+		if(f_sync(&fil) != FR_OK) result = "error";
+
+	}
+
+	HOST_bench_report("rand_write", BENCH_RANDOM_BYTES, (uint64_t) BENCH_RANDOM_OPS * BENCH_RANDOM_BYTES, result);
+	failed += (result[0] != 'o');
+
+	if(result[0] == 'o'){
+
+		HOST_bench_begin();
+
+		for(uint32_t op = 0; op < BENCH_RANDOM_OPS; op++){
+
+			pos = (HOST_bench_rand() % (BENCH_FILE_BYTES / BENCH_RANDOM_BYTES)) * BENCH_RANDOM_BYTES;
+			t = HOST_time_us();
+			if(f_lseek(&fil, pos) != FR_OK) result = "error";
+			if((f_read(&fil, bench_buf, BENCH_RANDOM_BYTES, &bytes) != FR_OK) || (bytes != BENCH_RANDOM_BYTES)) result = "error";
+			HOST_bench_op(t);
+
+			for(uint32_t i = 0; (i < BENCH_RANDOM_BYTES) && (result[0] == 'o'); i++){
+
+				if(bench_buf[i] != (uint8_t) (((pos + i) >> 9) ^ (pos + i))) result = "corrupt";
+
+			}
+
+		}
+
+		HOST_bench_report("rand_read", BENCH_RANDOM_BYTES, (uint64_t) BENCH_RANDOM_OPS * BENCH_RANDOM_BYTES, result);
+		failed += (result[0] != 'o');
+
+	}
+
+	f_close(&fil);
+	f_unlink("bench.bin");
+
+	return failed;
+
+}
+
+//7)Create/delete storm
+static uint8_t HOST_bench_storm(void){
+
+	FIL fil;
+	UINT bytes;
+	uint64_t t;
+	char name[24];
+	const char* result = "ok";
+	uint8_t failed = 0;
+
+	f_mkdir("bstorm");
+	memset(bench_buf, 0x5A, BENCH_STORM_BYTES);
+
+	HOST_bench_begin();
+
+	for(uint32_t n = 0; n < BENCH_STORM_FILES; n++){
+
+		sprintf(name, "bstorm/f%05lu.dat", (unsigned long) n);
+		t = HOST_time_us();
+		if(f_open(&fil, name, FA_CREATE_NEW | FA_WRITE) != FR_OK){
+
+			result = "error";
+
+		} else {
+
+			if((f_write(&fil, bench_buf, BENCH_STORM_BYTES, &bytes) != FR_OK) || (bytes != BENCH_STORM_BYTES)) result = "error";
+			if(f_close(&fil) != FR_OK) result = "error";
+
+		}
+		HOST_bench_op(t);
+
+	}
+
+	HOST_bench_report("create", BENCH_STORM_BYTES, 0, result);
+	failed += (result[0] != 'o');
+
+	result = "ok";
+	HOST_bench_begin();
+
+	for(uint32_t n = 0; n < BENCH_STORM_FILES; n++){
+
+		sprintf(name, "bstorm/f%05lu.dat", (unsigned long) n);
+		t = HOST_time_us();
+		if(f_unlink(name) != FR_OK) result = "error";
+		HOST_bench_op(t);
+
+	}
+
+	HOST_bench_report("delete", 0, 0, result);
+	failed += (result[0] != 'o');
+
+	f_unlink("bstorm");
+
+	return failed;
+
+}
+
+//8)Mount and free space
+static uint8_t HOST_bench_mount(void){
+
+	FATFS* fs_ptr;
+	DWORD free_clst;
+	uint64_t t;
+	const char* result = "ok";
+
+	if(f_getfree("", &free_clst, &fs_ptr) != FR_OK) return 1;
+
+	HOST_bench_begin();
+
+	for(uint8_t run = 0; run < BENCH_MOUNT_RUNS; run++){
+
+		f_mount(0, "", 0);
+		t = HOST_time_us();
+		if(f_mount(fs_ptr, "", 1) != FR_OK) result = "error";
+		if(f_getfree("", &free_clst, &fs_ptr) != FR_OK) result = "error";
+		HOST_bench_op(t);
+
+	}
+
+	HOST_bench_report("mount_getfree", 0, 0, result);
+
+	return (result[0] != 'o');
+
+}
+
+//9)Pre-erase hint
+static uint8_t HOST_bench_erase_run(LBA_t base, uint32_t req, uint8_t pre_erase, uint32_t pattern){
+
+	uint8_t expected[512];
+	uint64_t t;
+	const char* result = "ok";
+
+	HOST_bench_begin();
+
+	SDIO_Select_Card();
+
+	for(uint32_t pos = 0; pos < BENCH_ERASE_BYTES; pos += req){
+
+		HOST_bench_fill(bench_buf, pattern + pos, req);
+		t = HOST_time_us();
+		if(SDCard_Card_Data_Mode_Multi_Block_Write_w_SDIO(base + (pos / 512), (uint16_t) (req / 512), bench_buf, pre_erase ? (req / 512) : 0) != 0) result = "error";
+		HOST_bench_op(t);
+
+	}
+
+	HOST_bench_report(pre_erase ? "erase_write_hint" : "erase_write", req, BENCH_ERASE_BYTES, result);
+
+	for(uint32_t pos = 0; (result[0] == 'o') && (pos < BENCH_ERASE_BYTES); pos += sizeof(bench_buf)){	//raw, past the FatFs and read-ahead buffers
+
+		if(SDCard_Card_Data_Mode_Multi_Block_Read_w_SDIO(base + (pos / 512), sizeof(bench_buf) / 512, bench_buf) != 0) result = "error";
+
+		for(uint32_t i = 0; (result[0] == 'o') && (i < sizeof(bench_buf)); i += 512){
+
+			HOST_bench_fill(expected, pattern + pos + i, 512);
+			if(memcmp(bench_buf + i, expected, 512) != 0) result = "corrupt";
+
+		}
+
+	}
+
+	if(result[0] != 'o') fprintf(bench_out, "# erase_write%s %u: read back %s\n", pre_erase ? "_hint" : "", req, result);
+
+	return (result[0] != 'o');
+
+}
+
+static uint8_t HOST_bench_pre_erase(void){
+
+	/*
+	 * The file is allocated contiguous with f_expand, then written raw: every request is a CMD23 + CMD25 of its own, as from a recorder writing whole clusters
+	 * The card is given a slow erase path for the run only
+	 * Every run writes a pattern of its own, so a run that didn't reach the card can't pass on the data of the one before
+	 *
+	 */
+
+	const uint32_t req[2] = {4096, 32768};
+	HOST_emu_timing_t timing = HOST_emu_timing;
+	FIL fil;
+	LBA_t base;
+	uint32_t pattern = 0;
+	uint8_t failed = 0;
+
+	if(f_open(&fil, "erase.bin", FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) return 1;
+
+	if(f_expand(&fil, BENCH_ERASE_BYTES, 1) != FR_OK){
+
+		f_close(&fil);
+		return 1;
+
+	}
+
+	base = fil.obj.fs->database + (LBA_t) fil.obj.fs->csize * (fil.obj.sclust - 2);
+
+	disk_ioctl(0, CTRL_SYNC, NULL);															//no open stream from FatFs in the way
+
+	HOST_emu_timing.erase_unit_us = BENCH_ERASE_UNIT_US;
+	HOST_emu_timing.pre_erase_unit_us = BENCH_PRE_ERASE_UNIT_US;
+
+	for(uint8_t i = 0; i < 2; i++){
+
+		for(uint8_t pre_erase = 0; pre_erase < 2; pre_erase++){
+
+			failed += HOST_bench_erase_run(base, req[i], pre_erase, pattern);
+			pattern += BENCH_ERASE_BYTES;
+
+		}
+
+	}
+
+	HOST_emu_timing = timing;
+
+	if(f_close(&fil) != FR_OK) failed++;
+	if(f_unlink("erase.bin") != FR_OK) failed++;
+
+	return failed;
+
+}
+
+//10)The suite
+uint8_t HOST_bench_run(const char* results_path){
+
+	/*
+	 * The data pattern depends on the file position only, so every read can be checked
+	 * One line is flushed per workload - a crash still leaves the lines before it
+	 *
+	 */
+
+	const uint32_t seq_req[3] = {512, 4096, 32768};
+	uint8_t failed = 0;
+
+	bench_out = (results_path != NULL) ? fopen(results_path, "w") : stdout;
+
+	if(bench_out == NULL){
+
+		printf("Results file could not be opened... \r\n");
+		return 1;
+
+	}
+
+	setvbuf(bench_out, NULL, _IOLBF, 0);
+
+	fprintf(bench_out, "# sdio_ck_hz=%u,high_speed=%u,core_hz=%u\n", SD_clock_hz, SD_high_speed, SystemCoreClock);
+	fprintf(bench_out, "workload,request_bytes,ops,total_us,mb_s,iops,p50_us,p90_us,p99_us,max_us,result\n");
+
+	for(uint8_t i = 0; i < 3; i++) failed += HOST_bench_sequential(seq_req[i]);
+
+	failed += HOST_bench_random();
+
+	failed += HOST_bench_storm();
+
+	failed += HOST_bench_mount();
+
+	failed += HOST_bench_pre_erase();
+
+	if(bench_out != stdout) fclose(bench_out);
+
+	return failed;
+
+}
+
+#endif /* SDIO_HOST_EMULATION */
@@ -0,0 +1,54 @@
+/*
+ *  Created on: Oct 17, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_SDIO_FATFS
+ *  Processor: STM32F405 (emulated on a Linux host)
+ *  Program version: 1.0
+ *  Header file: HOST_benchmark.h
+ *  Change history:
+ */
+
+/*
+ * Benchmark suite for the host emulator.
+ * Run as "sdio_host <card image> <size in MB> bench [results file]": the card is mounted, the suite runs, nothing else does.
+ *
+ * Workloads, all through FatFs on the mounted image:
+ * 	- seq_write / seq_read: a BENCH_FILE_BYTES file in 512 B, 4 kB and 32 kB requests (the close is part of the write)
+ * 	- rand_write / rand_read: BENCH_RANDOM_OPS seeks + 4 kB transfers at random 4 kB aligned offsets of the same file
+ * 	- create / delete: BENCH_STORM_FILES small files created in and removed from a directory of their own
+ * 	- mount_getfree: re-mount and f_getfree, the free space scan a cold start pays for
+ * 	- erase_write / erase_write_hint: raw 4 kB and 32 kB multi-block writes into a contiguous file, on a card with a slow erase path
+ * 	  (BENCH_ERASE_UNIT_US per erase unit), without and with the ACMD23 pre-erase hint - the data is read back raw
+ *
+ * Every operation is timed on the emulated clock. The results are CSV, one line per workload:
+ * 	workload,request_bytes,ops,total_us,mb_s,iops,p50_us,p90_us,p99_us,max_us,result
+ * Lines starting with '#' are comments (card and clock set-up). "result" is "ok", "error" (a FatFs call failed) or "corrupt" (read back data differs).
+ *
+ */
+
+#ifndef INC_HOST_BENCHMARK_H_
+#define INC_HOST_BENCHMARK_H_
+
+#include "stdint.h"
+#include "stdio.h"
+
+//LOCAL CONSTANT
+#define BENCH_FILE_BYTES			(4 * 1048576)								//sequential and random file size
+#define BENCH_RANDOM_OPS			512
+#define BENCH_RANDOM_BYTES			4096
+#define BENCH_STORM_FILES			200
+#define BENCH_STORM_BYTES			100											//payload of each storm file
+#define BENCH_MOUNT_RUNS			8
+#define BENCH_ERASE_BYTES			(2 * 1048576)								//pre-erase file size
+#define BENCH_ERASE_UNIT_US			3000										//erase stall of the slow card
+#define BENCH_PRE_ERASE_UNIT_US		600											//erase of a pre-erased unit on the same card
+#define BENCH_LAT_MAX				8192										//latency samples kept per workload - BENCH_FILE_BYTES / 512
+
+//LOCAL VARIABLE
+
+//EXTERNAL VARIABLE
+
+//FUNCTION PROTOTYPES
+uint8_t HOST_bench_run(const char* results_path);								//run the suite, results to the file (stdout if NULL), gives back the number of failed workloads
+
+#endif /* INC_HOST_BENCHMARK_H_ */
@@ -0,0 +1,1989 @@
+/*
+ *  Created on: Oct 17, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_SDIO_FATFS
+ *  Processor: STM32F405 (emulated on a Linux host)
+ *  Program version: 1.0
+ *  Source file: HOST_main.c
+ *  Change history:
+ */
+
+/*
+ * Host side entry point. It replaces main.c when the project is built with SDIO_HOST_EMULATION (see HOST_SDIO_emulator.h).
+ *
+ * Usage: sdio_host <card image> [size in MB] [bench [results file]]
+ * A new image is formatted as FAT32 using f_mkfs (FAT12/16 only if it is too small for FAT32). After that, the same sequence as on the Feather runs (wav file generation), followed by
+ * throughput measurements of the raw diskio layer and of FatFs. All times are on the emulated clock, so they reflect the bus and card timing, not the host.
+ * With "bench", only the benchmark suite of HOST_benchmark.c runs after the mount and the exit code is the number of failed workloads.
+ *
+ */
+
+#ifdef SDIO_HOST_EMULATION
+
+#include <HOST_SDIO_emulator.h>
+#include <INPUT_File_capture.h>
+#include <ClockDriver_STM32F405.h>
+#include <SDcard_SDIO_async.h>
+#include <HOST_benchmark.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+
+//same globals as in main.c
+char INPUT_SIDE_file_name[FILE_NAME_LEN] = "000.wav";												//we place the input side file name pointer
+
+uint8_t gen_file_no;																	//generated file counter
+
+volatile uint8_t CMDREND_flag = 1;														//global flag flipped by the SDIO IRQ
+volatile uint8_t DATAREND_flag = 1;														//global flag flipped by the SDIO IRQ
+volatile uint8_t DATAERR_flag = 1;															//global flag flipped by the SDIO IRQ
+volatile uint8_t CMDERR_flag = 1;															//global flag flipped by the SDIO IRQ
+
+static BYTE HOST_work_buf[32768] __attribute__((aligned(4)));							//mkfs working buffer and benchmark data
+
+//1)Raw diskio throughput
+static void HOST_diskio_benchmark(void){
+
+	/*
+	 * Reads a region of the card and writes the same data back, so the file system is left untouched
+	 * The write pass goes window by window: a 64 sector window is read into the buffer, then written back with sequential calls and a sync
+	 * Only the writes and the closing sync are timed
+	 * Each request size is timed separately
+	 */
+
+	const UINT req_sizes[3] = {1, 8, 64};													//sectors per disk_read/disk_write call
+	const uint32_t total_sectors = 2048;													//1 MB per measurement
+	const uint32_t window_sectors = sizeof(HOST_work_buf) / 512;
+	LBA_t sector_cnt = 0;
+	LBA_t base;
+
+	disk_ioctl(0, GET_SECTOR_COUNT, &sector_cnt);
+	base = sector_cnt / 2;
+
+	for(uint8_t i = 0; i < 3; i++){
+
+		uint64_t start;
+		uint64_t read_us;
+		uint64_t write_us = 0;
+		uint32_t read_hits;
+		uint32_t cmds = 0;
+		uint32_t status_cmds = SD_status_cmd_cnt;
+		DRESULT res = RES_OK;
+
+		HOST_Emulator_stats_reset();
+		disk_readahead_hit_cnt = 0;
+		start = HOST_time_us();
+		for(uint32_t s = 0; (s < total_sectors) && (res == RES_OK); s += req_sizes[i]) res = disk_read(0, HOST_work_buf, base + s, req_sizes[i]);
+		read_us = HOST_time_us() - start;
+		read_hits = disk_readahead_hit_cnt;
+
+		for(uint32_t w = 0; (w < total_sectors) && (res == RES_OK); w += window_sectors){
+
+			res = disk_read(0, HOST_work_buf, base + w, window_sectors);
+			disk_ioctl(0, CTRL_SYNC, NULL);													//a read-ahead started by the read is collected before the timing
+
+			start = HOST_time_us();
+			for(uint32_t s = 0; (s < window_sectors) && (res == RES_OK); s += req_sizes[i]) res = disk_write(0, &HOST_work_buf[s * 512], base + w + s, req_sizes[i]);
+			if(res == RES_OK) res = disk_ioctl(0, CTRL_SYNC, NULL);
+			write_us += HOST_time_us() - start;
+
+		}
+
+		for(uint8_t c = 0; c < 64; c++) cmds += HOST_emu_stats.cmd_cnt[c] + HOST_emu_stats.acmd_cnt[c];
+		status_cmds = SD_status_cmd_cnt - status_cmds;
+
+		printf("diskio %2u sectors/call: read %7.3f MB/s (%3u%% read-ahead), write %7.3f MB/s, %5.2f commands/sector (%u CMD13)%s\r\n",
+				req_sizes[i],
+				(total_sectors * 512.0) / (double) read_us,
+				(unsigned) ((read_hits * 100) / total_sectors),
+				(total_sectors * 512.0) / (double) write_us,
+				(double) cmds / (double) (2 * total_sectors),
+				status_cmds,
+				(res == RES_OK) ? "" : " (disk error)");
+
+	}
+
+}
+
+//2)FatFs throughput
+static void HOST_fatfs_benchmark(void){
+
+	/*
+	 * Sequential f_write of a 1 MB file in 4 kB chunks, then sequential f_read of it in 4 kB and in 512 byte chunks (playback-like)
+	 */
+
+	const UINT read_chunks[2] = {4096, 512};
+	FIL bench_fil;
+	UINT bytes;
+	uint64_t start;
+	uint64_t write_us;
+	uint64_t read_us[2];
+	uint8_t ok = 1;
+
+	for(UINT i = 0; i < 4096; i++) HOST_work_buf[i] = (BYTE) (i * 7);
+
+	if(f_open(&bench_fil, "bench.bin", FA_CREATE_ALWAYS | FA_WRITE) != FR_OK){
+
+		printf("FatFs benchmark: file could not be created\r\n");
+		return;
+
+	}
+
+	start = HOST_time_us();
+	for(uint16_t chunk = 0; chunk < 256; chunk++){
+
+		if((f_write(&bench_fil, HOST_work_buf, 4096, &bytes) != FR_OK) || (bytes != 4096)) ok = 0;
+
+	}
+	f_close(&bench_fil);
+	write_us = HOST_time_us() - start;
+
+	for(uint8_t r = 0; r < 2; r++){
+
+		f_open(&bench_fil, "bench.bin", FA_READ);
+		start = HOST_time_us();
+		for(uint32_t pos = 0; pos < 1048576; pos += read_chunks[r]){
+
+			if((f_read(&bench_fil, &HOST_work_buf[4096], read_chunks[r], &bytes) != FR_OK) || (bytes != read_chunks[r])) ok = 0;
+			if(memcmp(&HOST_work_buf[pos % 4096], &HOST_work_buf[4096], read_chunks[r]) != 0) ok = 0;
+
+		}
+		f_close(&bench_fil);
+		read_us[r] = HOST_time_us() - start;
+
+	}
+
+	f_unlink("bench.bin");
+
+	printf("FatFs: write 4 kB chunks %7.3f MB/s, read 4 kB chunks %7.3f MB/s, read 512 B chunks %7.3f MB/s, data %s\r\n",
+			(1048576.0) / (double) write_us,
+			(1048576.0) / (double) read_us[0],
+			(1048576.0) / (double) read_us[1],
+			ok ? "verified" : "CORRUPTED");
+
+}
+
+//3)Small files
+static void HOST_smallfile_benchmark(void){
+
+	/*
+	 * Creates, reads back and deletes 32 files of 1 kB each - a workload where every access is short and scattered
+	 * Commands per transferred sector shows the command overhead
+	 */
+
+	char name[16];
+	FIL small_fil;
+	UINT bytes;
+	uint64_t start;
+	uint32_t cmds = 0;
+	uint32_t status_cmds = SD_status_cmd_cnt;
+	uint32_t sectors;
+	uint8_t ok = 1;
+
+	HOST_Emulator_stats_reset();
+	start = HOST_time_us();
+
+	for(uint8_t f = 0; f < 32; f++){
+
+		sprintf(name, "s%02u.bin", f);
+		if(f_open(&small_fil, name, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK){ ok = 0; continue; }
+		if((f_write(&small_fil, HOST_work_buf, 1024, &bytes) != FR_OK) || (bytes != 1024)) ok = 0;
+		f_close(&small_fil);
+
+	}
+
+	for(uint8_t f = 0; f < 32; f++){
+
+		sprintf(name, "s%02u.bin", f);
+		if(f_open(&small_fil, name, FA_READ) != FR_OK){ ok = 0; continue; }
+		if((f_read(&small_fil, &HOST_work_buf[4096], 1024, &bytes) != FR_OK) || (bytes != 1024)) ok = 0;
+		if(memcmp(HOST_work_buf, &HOST_work_buf[4096], 1024) != 0) ok = 0;
+		f_close(&small_fil);
+
+	}
+
+	for(uint8_t f = 0; f < 32; f++){
+
+		sprintf(name, "s%02u.bin", f);
+		if(f_unlink(name) != FR_OK) ok = 0;
+
+	}
+
+	for(uint8_t c = 0; c < 64; c++) cmds += HOST_emu_stats.cmd_cnt[c] + HOST_emu_stats.acmd_cnt[c];
+	sectors = HOST_emu_stats.blocks_read + HOST_emu_stats.blocks_written;
+
+	status_cmds = SD_status_cmd_cnt - status_cmds;
+
+	printf("Small files (32 x 1 kB create/read/delete): %llu us, %u commands (%u CMD7, %u CMD13) for %u sectors, %5.2f commands/sector, %s\r\n",
+			(unsigned long long) (HOST_time_us() - start),
+			cmds,
+			HOST_emu_stats.cmd_cnt[7],
+			status_cmds,
+			sectors,
+			(double) cmds / (double) sectors,
+			ok ? "ok" : "FAILED");
+
+}
+
+//4)Non-blocking transfer
+static volatile uint64_t HOST_async_done_us;
+
+static void HOST_async_callback(SD_request_t* request){
+
+	HOST_async_done_us = HOST_time_us();
+
+}
+
+static void HOST_async_benchmark(void){
+
+	/*
+	 * Rewrites 64 sectors with a non-blocking request and shows how long the CPU was held by the submit compared to the whole transfer
+	 * The time between the two is what the application gets back (e.g. for sampling)
+	 *
+	 */
+
+	SD_request_t request = {.direction = SD_ASYNC_WRITE, .block_addr = 0, .block_cnt = 64, .buf_ptr = HOST_work_buf, .callback = HOST_async_callback};
+	LBA_t sector_cnt = 0;
+	uint64_t start;
+	uint64_t submit_us;
+
+	disk_ioctl(0, GET_SECTOR_COUNT, &sector_cnt);
+	request.block_addr = sector_cnt / 2;
+
+	if(disk_read(0, HOST_work_buf, request.block_addr, 64) != RES_OK) return;
+
+	disk_ioctl(0, CTRL_SYNC, NULL);															//diskio hands the card back de-selected
+
+	SDIO_Select_Card();
+
+	start = HOST_time_us();
+	SDcard_Async_submit(&request);
+	submit_us = HOST_time_us() - start;
+
+	while(SDcard_Async_busy());																//the application is free to run here
+
+	SDIO_DeSelect_Card();
+
+	printf("async 64 sectors: submit held the CPU for %llu us, transfer finished after %llu us with %u CMD13 (%s)\r\n",
+			(unsigned long long) submit_us,
+			(unsigned long long) (HOST_async_done_us - start),
+			request.status_cnt,
+			(request.result == 0) ? "ok" : "error");
+
+}
+
+//5)Clock fallback
+static void HOST_clock_fallback_check(void){
+
+	/*
+	 * Pulls the board limit below the negotiated SDIO_CK: reads fail CRC and diskio steps down the clock ladder, one rung per read, until one goes through
+	 * With the limit lifted again, SDIO_Clock_restore climbs back up to the negotiated clock after enough clean reads
+	 * Both only move CLKDIV: the PLL (PLLQ) must not be touched while the system runs
+	 * The clock is negotiated again afterwards
+	 * Then the DMA is made too slow for writes above 30 MHz: the negotiation must settle below that, and writes must go through without a recovery
+	 *
+	 */
+
+	LBA_t sector_cnt = 0;
+	uint32_t signal_max_hz = HOST_emu_timing.signal_max_hz;
+	uint32_t start_hz;
+	uint32_t low_hz;
+	uint32_t crc_before;
+	uint32_t restore_reads = 0;
+	uint32_t recover_before;
+	uint32_t tx_hz;
+	uint32_t pllcfgr;
+	uint8_t failed = 0;
+	DRESULT res;
+
+	disk_ioctl(0, GET_SECTOR_COUNT, &sector_cnt);
+
+	res = disk_read(0, HOST_work_buf, sector_cnt / 4, 8);								//reference at the negotiated clock
+	disk_ioctl(0, CTRL_SYNC, NULL);
+
+	start_hz = SD_clock_hz;
+	pllcfgr = RCC->PLLCFGR;
+	crc_before = SD_crc_error_cnt;
+	HOST_emu_timing.signal_max_hz = 20000000;
+
+	if(res == RES_OK){
+
+		do {
+
+			res = disk_read(0, &HOST_work_buf[4096], sector_cnt / 4, 8);
+
+		} while((res != RES_OK) && (++failed < SD_CLK_RUNG_CNT));
+
+	}
+
+	low_hz = SD_clock_hz;
+
+	printf("clock fallback: %.1f MHz -> %.1f MHz after %u CRC errors and %u failed reads, %s\r\n",
+			start_hz / 1000000.0,
+			low_hz / 1000000.0,
+			SD_crc_error_cnt - crc_before,
+			failed,
+			((res == RES_OK) && (memcmp(HOST_work_buf, &HOST_work_buf[4096], 8 * 512) == 0)) ? "data verified" : "FAILED");
+
+	HOST_emu_timing.signal_max_hz = signal_max_hz;
+
+	while((SD_clock_hz != start_hz) && (restore_reads < (SD_CLK_RESTORE_AFTER * SD_CLK_RUNG_CNT))){
+
+		if(disk_read(0, &HOST_work_buf[4096], sector_cnt / 4, 1) != RES_OK) break;
+		restore_reads++;
+
+	}
+
+	printf("clock restore: %.1f MHz -> %.1f MHz after %u clean reads, PLLQ %s, %s\r\n",
+			low_hz / 1000000.0,
+			SD_clock_hz / 1000000.0,
+			restore_reads,
+			(RCC->PLLCFGR == pllcfgr) ? "kept" : "MOVED",
+			((SD_clock_hz == start_hz) && (RCC->PLLCFGR == pllcfgr)) ? "ok" : "FAILED");
+
+	disk_ioctl(0, CTRL_SYNC, NULL);
+	SDIO_Clock_negotiate();
+
+	//writes that underrun above 30 MHz - the negotiation must not keep a rung that only reads
+	recover_before = SD_recover_cnt;
+	HOST_emu_timing.tx_max_hz = 30000000;
+	SDIO_Clock_negotiate();
+	tx_hz = SD_clock_hz;
+
+	res = disk_write(0, HOST_work_buf, sector_cnt / 4, 8);								//the same data again
+	if(res == RES_OK) res = disk_ioctl(0, CTRL_SYNC, NULL);
+
+	printf("clock negotiation with writes failing above 30 MHz: %.1f MHz, write result %u, %u recoveries, %s\r\n",
+			tx_hz / 1000000.0,
+			res,
+			SD_recover_cnt - recover_before,
+			((tx_hz <= 30000000) && (res == RES_OK) && (SD_recover_cnt == recover_before)) ? "ok" : "FAILED");
+
+	HOST_emu_timing.tx_max_hz = 0;
+	SDIO_Clock_negotiate();
+
+}
+
+//6)Large transfers, aligned and unaligned buffer
+static void HOST_alignment_benchmark(void){
+
+	/*
+	 * Writes and reads back a 1 MB file in 8 kB chunks, once from a word aligned buffer and once from the same buffer shifted by a byte
+	 * FatFs hands both over to the DMA as they are (whole sectors), only the memory data size differs: 32 bit beats for the first, 8 bit beats for the second
+	 * DMA beats per sector shows the AHB traffic, slow blocks are the ones paced by the DMA instead of the bus
+	 *
+	 */
+
+	const char* label[2] = {"aligned  ", "unaligned"};
+	FIL bench_fil;
+	UINT bytes;
+	uint64_t start;
+	uint64_t write_us;
+	uint64_t read_us;
+	uint8_t ok;
+
+	for(uint8_t a = 0; a < 2; a++){
+
+		BYTE* src = &HOST_work_buf[a];
+		BYTE* dst = &HOST_work_buf[16384 + a];
+
+		ok = 1;
+		for(UINT i = 0; i < 8192; i++) src[i] = (BYTE) (i * 13 + a);
+
+		HOST_Emulator_stats_reset();
+
+		if(f_open(&bench_fil, "align.bin", FA_CREATE_ALWAYS | FA_WRITE) != FR_OK){
+
+			printf("Alignment benchmark: file could not be created\r\n");
+			return;
+
+		}
+
+		start = HOST_time_us();
+		for(uint16_t chunk = 0; chunk < 128; chunk++){
+
+			if((f_write(&bench_fil, src, 8192, &bytes) != FR_OK) || (bytes != 8192)) ok = 0;
+
+		}
+		f_close(&bench_fil);
+		write_us = HOST_time_us() - start;
+
+		f_open(&bench_fil, "align.bin", FA_READ);
+		start = HOST_time_us();
+		for(uint16_t chunk = 0; chunk < 128; chunk++){
+
+			if((f_read(&bench_fil, dst, 8192, &bytes) != FR_OK) || (bytes != 8192)) ok = 0;
+			if(memcmp(src, dst, 8192) != 0) ok = 0;
+
+		}
+		f_close(&bench_fil);
+		read_us = HOST_time_us() - start;
+
+		f_unlink("align.bin");
+
+		printf("FatFs %s buffer: write %7.3f MB/s, read %7.3f MB/s, %5.1f DMA beats/sector, %u slow blocks, data %s\r\n",
+				label[a],
+				(1048576.0) / (double) write_us,
+				(1048576.0) / (double) read_us,
+				(double) HOST_emu_stats.dma_mem_beats / (double) (HOST_emu_stats.blocks_read + HOST_emu_stats.blocks_written),
+				HOST_emu_stats.dma_slow_blocks,
+				ok ? "verified" : "CORRUPTED");
+
+	}
+
+}
+
+//7)WAV recording
+static void HOST_recording_check(void){
+
+	/*
+	 * Records 2 seconds at a few sample rates through the sample ring into a file reserved for 3 seconds, then reads the file back
+	 * The last run keeps the main loop busy for 50 ms after every service call, the ring high water shows how far the saving fell behind
+	 * The emulated ADC converts a ramp, so every sample can be checked against its position: a missing or overwritten sample shows up as a gap
+	 * The header must carry the final sizes, the runs without the busy loop must have no overrun and no gap, the busy run must count its overruns
+	 *
+	 */
+
+	const uint32_t rates[5] = {22050, 44100, 96000, 192000, 96000};
+	const uint32_t busy_us[5] = {0, 0, 0, 0, 50000};
+	FIL rec_check;
+	UINT bytes;
+
+	for(uint8_t r = 0; r < 5; r++){
+
+		uint64_t start;
+		uint32_t gaps = 0;
+		uint32_t samples = 0;
+		uint32_t first = 0;
+		uint32_t cmds = 0;
+		uint8_t header_ok;
+		uint8_t ok = 1;
+
+		HOST_Emulator_stats_reset();
+
+		if(FILE_wav_record_start(rates[r], 3) != 0){
+
+			printf("recording: file could not be created\r\n");
+			return;
+
+		}
+
+		start = HOST_time_us();
+		while((HOST_time_us() - start) < 2000000){
+
+			if(FILE_wav_record_service() != 0) ok = 0;
+
+			if(busy_us[r]){
+
+				uint64_t busy = HOST_time_us();
+				while((HOST_time_us() - busy) < busy_us[r]);
+
+			}
+
+		}
+
+		if(FILE_wav_record_stop() != 0) ok = 0;
+		if(HOST_emu_stats.pre_erase_unit_cnt == 0) ok = 0;											//the extent must go out pre-erased
+
+		for(uint8_t c = 0; c < 64; c++) cmds += HOST_emu_stats.cmd_cnt[c] + HOST_emu_stats.acmd_cnt[c];
+
+		f_open(&rec_check, INPUT_SIDE_file_name, FA_READ);
+		f_read(&rec_check, HOST_work_buf, CAPTURE_HEADER_BYTES, &bytes);
+		header_ok = (bytes == CAPTURE_HEADER_BYTES) &&
+					(*(uint32_t*) &HOST_work_buf[4] == CAPTURE_data_bytes + CAPTURE_HEADER_BYTES - 8) &&
+					(*(uint32_t*) &HOST_work_buf[24] == rates[r]) &&
+					(memcmp(&HOST_work_buf[CAPTURE_HEADER_BYTES - 8], "data", 4) == 0) &&
+					(*(uint32_t*) &HOST_work_buf[CAPTURE_HEADER_BYTES - 4] == CAPTURE_data_bytes) &&
+					(f_size(&rec_check) == CAPTURE_data_bytes + CAPTURE_HEADER_BYTES);
+
+		do {
+
+			f_read(&rec_check, HOST_work_buf, sizeof(HOST_work_buf), &bytes);
+
+			for(UINT i = 0; i < bytes / 2; i++){
+
+				uint32_t value = (uint32_t) ((((uint16_t*) HOST_work_buf)[i] ^ 0x8000) >> 4);
+
+				if(samples == 0) first = value;
+				else if(value != ((first + samples) & 0xFFF)){
+
+					gaps++;
+					first = (value - samples) & 0xFFF;										//count each gap once
+
+				}
+
+				samples++;
+
+			}
+
+		} while(bytes == sizeof(HOST_work_buf));
+
+		f_close(&rec_check);
+		f_unlink(INPUT_SIDE_file_name);
+
+		if(!header_ok) ok = 0;
+		if(busy_us[r] == 0){
+
+			if((gaps != 0) || (ADC_overrun_cnt != 0)) ok = 0;										//the saving kept up - not one sample lost
+
+		} else if(ADC_overrun_cnt == 0) ok = 0;														//the stalled loop must be seen falling behind
+
+		printf("recording %6u Hz: %s, %u samples (%.2f s) in %u byte writes, %u commands (%u CMD25), %u units pre-erased, ring high water %u of %u bytes, %u overruns, %u gaps, header %s, %s\r\n",
+				rates[r],
+				INPUT_SIDE_file_name,
+				samples,
+				(double) samples / (double) rates[r],
+				CAPTURE_chunk_bytes,
+				cmds,
+				HOST_emu_stats.cmd_cnt[25],
+				HOST_emu_stats.pre_erase_unit_cnt,
+				ADC_ring.high_water,
+				ADC_ring.size,
+				ADC_overrun_cnt,
+				gaps,
+				header_ok ? "ok" : "WRONG",
+				ok ? "ok" : "FAILED");
+
+	}
+
+}
+
+//8)Seek latency
+static void HOST_seek_run(const char* name, uint64_t size, FATFS* fs_ptr){
+
+	const uint32_t offset_mb[6] = {0, 1, 16, 128, 512, 1023};
+	FIL seek_fil;
+	UINT bytes;
+	uint64_t start;
+	uint64_t map_us;
+	uint32_t plain_us;
+	uint32_t plain_blocks;
+	uint32_t map_blocks;
+
+	disk_readahead_hit_cnt = 0;
+	disk_readahead_miss_cnt = 0;
+	start = HOST_time_us();
+	if(FILE_wav_open(name) != 0){
+
+		printf("seek benchmark: %s could not be opened\r\n", name);
+		return;
+
+	}
+	map_us = HOST_time_us() - start;
+
+	printf("seek benchmark: %s, %u MB, %u kB clusters, %u fragment(s), map %s in %llu us (%u sectors read)\r\n",
+			name,
+			(uint32_t) (size >> 20),
+			fs_ptr->csize / 2,
+			PLAY_fragment_cnt,
+			PLAY_fast_seek ? "built" : "NOT built",
+			(unsigned long long) map_us,
+			disk_readahead_hit_cnt + disk_readahead_miss_cnt);
+
+	for(uint8_t o = 0; o < 6; o++){
+
+		uint64_t offset = (uint64_t) offset_mb[o] << 20;
+		uint64_t map_seek_us;
+
+		if(offset + 4096 > size) break;
+
+		f_open(&seek_fil, name, FA_READ);
+		disk_readahead_hit_cnt = 0;
+		disk_readahead_miss_cnt = 0;
+		start = HOST_time_us();
+		f_lseek(&seek_fil, (FSIZE_t) offset);
+		f_read(&seek_fil, &HOST_work_buf[4096], 512, &bytes);
+		plain_us = (uint32_t) (HOST_time_us() - start);
+		plain_blocks = disk_readahead_hit_cnt + disk_readahead_miss_cnt;
+		f_close(&seek_fil);
+
+		disk_readahead_hit_cnt = 0;
+		disk_readahead_miss_cnt = 0;
+		start = HOST_time_us();
+		FILE_wav_seek((uint32_t) ((offset - PLAY_data_ofs) / 2));
+		FILE_wav_read((int16_t*) &HOST_work_buf[8192], 256, &bytes);
+		map_seek_us = HOST_time_us() - start;
+		map_blocks = disk_readahead_hit_cnt + disk_readahead_miss_cnt;
+
+		printf("seek to %4u MB: plain %8u us (%5u sectors read), with map %6llu us (%2u sectors read)\r\n",
+				offset_mb[o],
+				plain_us,
+				plain_blocks,
+				(unsigned long long) map_seek_us,
+				map_blocks);
+
+	}
+
+	FILE_wav_close();
+
+}
+
+static void HOST_seek_benchmark(void){
+
+	/*
+	 * Seeks into a large file and reads a sector there, once with a plain f_lseek (a walk along the FAT chain from the first cluster)
+	 * and once through FILE_wav_open/FILE_wav_seek (cluster link map)
+	 * The file is 1 GB if the card image has room for it (run with an image of 2048 MB), 7/8 of the free space otherwise
+	 * Sectors are the ones FatFs asked diskio for (FAT and data), whether they came from the card or from the read-ahead buffer
+	 * It is reserved with f_expand and never written, apart from its header - only the cluster chain matters here
+	 * Then the same on a fragmented file: it grows side by side with a second file, 64 turns of a whole number of MB each (f_lseek past the end allocates
+	 * the clusters without writing them), so its chain is cut into 64 fragments or more (the count is printed) and the map has one entry per fragment
+	 *
+	 */
+
+	FATFS* fs_ptr;
+	DWORD free_clst;
+	FIL seek_fil;
+	FIL other_fil;
+	UINT bytes;
+	uint64_t size;
+	uint64_t chunk;
+	uint8_t ok = 1;
+
+	if(f_getfree("", &free_clst, &fs_ptr) != FR_OK) return;
+
+	size = ((uint64_t) free_clst * fs_ptr->csize * 512 / 8) * 7;
+	if(size > 1073741824ull) size = 1073741824ull;
+	size &= ~((uint64_t) 0xFFFFF);																	//whole MB
+
+	if((f_open(&seek_fil, "seek.wav", FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) || (f_expand(&seek_fil, (FSIZE_t) size, 1) != FR_OK)){
+
+		printf("seek benchmark: no room for the file\r\n");
+		f_close(&seek_fil);
+		return;
+
+	}
+
+	memcpy(HOST_work_buf, "RIFF\0\0\0\0WAVEdata\0\0\0\0", 20);
+	*(uint32_t*) &HOST_work_buf[4] = (uint32_t) (size - 8);
+	*(uint32_t*) &HOST_work_buf[16] = (uint32_t) (size - 20);
+	f_write(&seek_fil, HOST_work_buf, 20, &bytes);
+	f_close(&seek_fil);
+
+	HOST_seek_run("seek.wav", size, fs_ptr);
+	f_unlink("seek.wav");
+
+	chunk = (size / 2 / 64) & ~((uint64_t) 0xFFFFF);												//two files of 64 turns, whole MB each
+	if(chunk == 0){
+
+		printf("seek benchmark: no room for the fragmented file\r\n");
+		return;
+
+	}
+	size = chunk * 64;
+
+	if((f_open(&seek_fil, "seek.wav", FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) || (f_open(&other_fil, "other.wav", FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)) ok = 0;
+
+	for(uint8_t t = 1; ok && (t <= 64); t++){
+
+		if((f_lseek(&seek_fil, (FSIZE_t) (chunk * t)) != FR_OK) || (f_lseek(&other_fil, (FSIZE_t) (chunk * t)) != FR_OK) ||
+			(f_tell(&seek_fil) != chunk * t) || (f_tell(&other_fil) != chunk * t)) ok = 0;					//the disk may be full
+
+	}
+
+	*(uint32_t*) &HOST_work_buf[4] = (uint32_t) (size - 8);
+	*(uint32_t*) &HOST_work_buf[16] = (uint32_t) (size - 20);
+	if(ok && ((f_lseek(&seek_fil, 0) != FR_OK) || (f_write(&seek_fil, HOST_work_buf, 20, &bytes) != FR_OK))) ok = 0;
+	f_close(&seek_fil);
+	f_close(&other_fil);
+
+	if(ok) HOST_seek_run("seek.wav", size, fs_ptr);
+	else printf("seek benchmark: the fragmented file could not be made\r\n");
+
+	f_unlink("seek.wav");
+	f_unlink("other.wav");
+
+}
+
+//9)FAT window cache
+static void HOST_window_cache_check(void){
+
+	/*
+	 * Three metadata heavy workloads, each with the FatFs sectors asked from diskio and the window cache hits and misses:
+	 * 	- a logger that appends 4 kB and calls f_sync every time (FAT, directory entry and FSINFO in turns)
+	 * 	- two files growing side by side (their FAT sectors in turns)
+	 * 	- a full f_getfree scan, forced by dropping the free cluster count as if the FSINFO had been invalid at mount
+	 * Build with FF_WIN_CACHE_WAYS 0 to see the same workloads with the single sector window
+	 *
+	 */
+
+	const char* name[3] = {"logger (1 MB, f_sync per 4 kB)", "two files side by side (2 x 1 MB)", "f_getfree full scan"};
+	FATFS* fs_ptr;
+	DWORD free_clst;
+	FIL log_fil[2];
+	UINT bytes;
+	uint64_t start;
+	uint32_t hit = 0;
+	uint32_t miss = 0;
+	uint8_t ok;
+
+	if(f_getfree("", &free_clst, &fs_ptr) != FR_OK) return;
+
+	for(uint8_t w = 0; w < 3; w++){
+
+		ok = 1;
+		HOST_Emulator_stats_reset();
+		disk_readahead_hit_cnt = 0;
+		disk_readahead_miss_cnt = 0;
+#if FF_WIN_CACHE_WAYS
+		hit = fs_ptr->wc_hit;
+		miss = fs_ptr->wc_miss;
+#endif
+		start = HOST_time_us();
+
+		if(w == 0){
+
+			if(f_open(&log_fil[0], "log0.bin", FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) ok = 0;
+			for(uint16_t c = 0; ok && (c < 256); c++){
+
+				if((f_write(&log_fil[0], HOST_work_buf, 4096, &bytes) != FR_OK) || (bytes != 4096)) ok = 0;
+				if(f_sync(&log_fil[0]) != FR_OK) ok = 0;
+
+			}
+			f_close(&log_fil[0]);
+
+		} else if(w == 1){
+
+			if(f_open(&log_fil[0], "log0.bin", FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) ok = 0;
+			if(f_open(&log_fil[1], "log1.bin", FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) ok = 0;
+			for(uint16_t c = 0; ok && (c < 256); c++){
+
+				if((f_write(&log_fil[c & 1], HOST_work_buf, 8192, &bytes) != FR_OK) || (bytes != 8192)) ok = 0;
+
+			}
+			f_close(&log_fil[0]);
+			f_close(&log_fil[1]);
+
+		} else {
+
+			fs_ptr->free_clst = 0xFFFFFFFF;												//f_getfree has to count the free clusters on the FAT
+			if(f_getfree("", &free_clst, &fs_ptr) != FR_OK) ok = 0;
+
+		}
+
+#if FF_WIN_CACHE_WAYS
+		hit = fs_ptr->wc_hit - hit;
+		miss = fs_ptr->wc_miss - miss;
+#endif
+
+		printf("window cache, %s: %llu us, %u sectors read by FatFs, %u written to the card, %u hits / %u misses, %s\r\n",
+				name[w],
+				(unsigned long long) (HOST_time_us() - start),
+				disk_readahead_hit_cnt + disk_readahead_miss_cnt,
+				HOST_emu_stats.blocks_written,
+				hit,
+				miss,
+				ok ? "ok" : "FAILED");
+
+	}
+
+	f_unlink("log0.bin");
+	f_unlink("log1.bin");
+
+}
+
+//10)Free cluster map
+static uint32_t HOST_full_groups(FATFS* fs_ptr){
+
+	uint32_t full_groups = 0;
+
+#if FF_FREE_MAP_BYTES
+	for(DWORD c = 2; c < fs_ptr->n_fatent; c += ((DWORD) 1 << fs_ptr->fmap_shift)){
+
+		uint32_t g = c >> fs_ptr->fmap_shift;
+		if((fs_ptr->fmap[g / 8] & (1 << (g % 8))) == 0) full_groups++;
+
+	}
+#else
+	(void) fs_ptr;
+#endif
+
+	return full_groups;
+
+}
+
+static void HOST_free_map_check(void){
+
+	/*
+	 * Allocation behind a long run of used clusters
+	 * Half of the free space is taken by one f_expand block, a 256 kB file is written right after it and deleted again
+	 * Then the volume is mounted again and f_getfree is called, like SDcard_start does at boot
+	 * The allocation hint is placed at the top of the block, so the next new cluster is only found past the block
+	 * Without the map, create_chain reads the FAT entries of the whole block; with it, the groups of the block are known to be full
+	 * (FAT32: f_expand marked them and the map came back from the FSINFO sector at mount, FAT12/16: the f_getfree scan rebuilt it)
+	 * On FAT32 the groups must be known to be full right after the mount, before f_getfree, and f_getfree must not have to scan
+	 * Build with FF_FREE_MAP_BYTES 0 to see the plain FAT walk
+	 *
+	 */
+
+	FATFS* fs_ptr;
+	DWORD free_clst;
+	DWORD fill_clst;
+	DWORD fill_clst_cnt;
+	FIL map_fil;
+	UINT bytes;
+	uint64_t start;
+	uint32_t mount_us;
+	uint32_t mount_sectors;
+	uint32_t full_groups;
+	uint32_t fsinfo_groups;
+	uint8_t ok = 1;
+
+	if(f_getfree("", &free_clst, &fs_ptr) != FR_OK) return;
+
+	if((f_open(&map_fil, "fill.bin", FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) ||
+	   (f_expand(&map_fil, (FSIZE_t) (free_clst / 2) * fs_ptr->csize * 512, 1) != FR_OK)){
+
+		printf("free map check: no room for the block\r\n");
+		f_close(&map_fil);
+		f_unlink("fill.bin");
+		return;
+
+	}
+	fill_clst = map_fil.obj.sclust;
+	fill_clst_cnt = free_clst / 2;
+	f_close(&map_fil);
+
+	if(f_open(&map_fil, "hole.bin", FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) ok = 0;
+	for(uint8_t c = 0; ok && (c < 8); c++) if(f_write(&map_fil, HOST_work_buf, 32768, &bytes) != FR_OK) ok = 0;
+	f_close(&map_fil);
+	if(f_unlink("hole.bin") != FR_OK) ok = 0;
+
+	f_mount(0, "", 0);
+	disk_readahead_hit_cnt = 0;
+	disk_readahead_miss_cnt = 0;
+	start = HOST_time_us();
+	if(f_mount(fs_ptr, "", 1) != FR_OK) ok = 0;
+	fsinfo_groups = HOST_full_groups(fs_ptr);														//what the FSINFO sector gave
+	if(f_getfree("", &free_clst, &fs_ptr) != FR_OK) ok = 0;
+	mount_us = (uint32_t) (HOST_time_us() - start);
+	mount_sectors = disk_readahead_hit_cnt + disk_readahead_miss_cnt;
+	full_groups = HOST_full_groups(fs_ptr);
+
+#if FF_FREE_MAP_BYTES
+	if((fs_ptr->fs_type == FS_FAT32) && ((fsinfo_groups == 0) || (fsinfo_groups != full_groups))) ok = 0;	//loaded at mount, no scan needed
+#endif
+
+	fs_ptr->last_clst = fill_clst;																//hint at the top of the block
+
+	disk_readahead_hit_cnt = 0;
+	disk_readahead_miss_cnt = 0;
+	start = HOST_time_us();
+	if(f_open(&map_fil, "new.bin", FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) ok = 0;
+	if(f_write(&map_fil, HOST_work_buf, 512, &bytes) != FR_OK) ok = 0;
+	if(map_fil.obj.sclust < fill_clst + fill_clst_cnt) ok = 0;									//must be past the block
+	f_close(&map_fil);
+
+	printf("free map: %s, mount and f_getfree %u us (%u sectors), %u groups loaded from FSINFO, %u groups known to be full, first cluster past a %u cluster block in %llu us (%u sectors read), %s\r\n",
+			(fs_ptr->fs_type == FS_FAT32) ? "FAT32" : "FAT12/16",
+			mount_us,
+			mount_sectors,
+			fsinfo_groups,
+			full_groups,
+			(uint32_t) (fill_clst_cnt),
+			(unsigned long long) (HOST_time_us() - start),
+			disk_readahead_hit_cnt + disk_readahead_miss_cnt,
+			ok ? "ok" : "FAILED");
+
+	f_unlink("new.bin");
+	f_unlink("fill.bin");
+
+}
+
+//11)Directory name index
+static void HOST_dir_index_check(void){
+
+	/*
+	 * 1000 empty recordings in a directory, then the f_stat probing of FILE_wav_create: 000.wav, 001.wav... until a name is free
+	 * Without the index every probe reads the directory table up to the name (and all of it for the free one)
+	 * Then one name is removed, probed and created again to see that the index follows the table
+	 * Build with FF_DIR_HASH_SLOTS 0 to see the linear search
+	 *
+	 */
+
+	char name[24];
+	FIL idx_fil;
+	FILINFO idx_info;
+	uint64_t start;
+	uint32_t create_us;
+	uint32_t create_sectors;
+	uint16_t probe_cnt = 0;
+	uint8_t ok = 1;
+
+	f_mkdir("idx");
+
+	disk_readahead_hit_cnt = 0;
+	disk_readahead_miss_cnt = 0;
+	start = HOST_time_us();
+
+	for(uint16_t f = 0; f < 1000; f++){
+
+		sprintf(name, "idx/%03u.wav", f);
+		if(f_open(&idx_fil, name, FA_CREATE_NEW | FA_WRITE) != FR_OK){ ok = 0; break; }
+		f_close(&idx_fil);
+
+	}
+
+	create_us = (uint32_t) (HOST_time_us() - start);
+	create_sectors = disk_readahead_hit_cnt + disk_readahead_miss_cnt;
+
+	disk_readahead_hit_cnt = 0;
+	disk_readahead_miss_cnt = 0;
+	start = HOST_time_us();
+
+	do{
+
+		sprintf(name, "idx/%03u.wav", probe_cnt++);
+
+	} while((f_stat(name, &idx_info) == FR_OK) && (probe_cnt < 1001));
+
+	printf("dir index: 1000 files created in %u us (%u sectors read), %u f_stat probes to a free name in %llu us (%u sectors read)",
+			create_us,
+			create_sectors,
+			probe_cnt,
+			(unsigned long long) (HOST_time_us() - start),
+			disk_readahead_hit_cnt + disk_readahead_miss_cnt);
+
+	if(probe_cnt != 1001) ok = 0;
+	if(f_unlink("idx/500.wav") != FR_OK) ok = 0;
+	if(f_stat("idx/500.wav", &idx_info) != FR_NO_FILE) ok = 0;
+	if(f_open(&idx_fil, "idx/500.wav", FA_CREATE_NEW | FA_WRITE) != FR_OK) ok = 0;
+	f_close(&idx_fil);
+	if(f_stat("idx/500.wav", &idx_info) != FR_OK) ok = 0;
+	if(f_stat("idx/999.wav", &idx_info) != FR_OK) ok = 0;
+
+	for(uint16_t f = 0; f < 1000; f++){
+
+		sprintf(name, "idx/%03u.wav", f);
+		if(f_unlink(name) != FR_OK) ok = 0;
+
+	}
+	if(f_unlink("idx") != FR_OK) ok = 0;
+
+	printf(", %s\r\n", ok ? "ok" : "FAILED");
+
+}
+
+//12)File naming
+static void HOST_file_name_check(void){
+
+	/*
+	 * 300 files in the root, first the old way - f_stat from "000.wav" up until a name is free, for every file - then with the naming service
+	 * The service reads the root once and counts from there
+	 * Then a name taken behind the back of the service, the counter growing past 3 digits and a fresh scan after FILE_name_reset
+	 *
+	 */
+
+	char name[FILE_NAME_LEN];
+	FIL name_fil;
+	FILINFO name_info;
+	uint64_t start;
+	uint32_t probe_us, probe_sectors, probe_cnt = 0;
+	uint32_t first = 0;
+	uint8_t ok = 1;
+
+	disk_readahead_hit_cnt = 0;
+	disk_readahead_miss_cnt = 0;
+	start = HOST_time_us();
+
+	for(uint16_t f = 0; f < 300; f++){
+
+		uint16_t n = 0;
+
+		do{
+
+			sprintf(name, "%03u.wav", n++);
+			probe_cnt++;
+
+		} while(f_stat(name, &name_info) == FR_OK);
+
+		if(f_open(&name_fil, name, FA_CREATE_NEW | FA_WRITE) != FR_OK){ ok = 0; break; }
+		f_close(&name_fil);
+
+	}
+
+	probe_us = (uint32_t) (HOST_time_us() - start);
+	probe_sectors = disk_readahead_hit_cnt + disk_readahead_miss_cnt;
+
+	for(uint16_t f = 0; f < 300; f++){
+
+		sprintf(name, "%03u.wav", f);
+		f_unlink(name);
+
+	}
+
+	FILE_name_reset();
+
+	disk_readahead_hit_cnt = 0;
+	disk_readahead_miss_cnt = 0;
+	start = HOST_time_us();
+
+	for(uint16_t f = 0; f < 300; f++){
+
+		if(FILE_name_next() != 0){ ok = 0; break; }
+		if(f == 0) first = FILE_name_seq - 1;
+		if(f_open(&name_fil, INPUT_SIDE_file_name, FA_CREATE_NEW | FA_WRITE) != FR_OK){ ok = 0; break; }
+		f_close(&name_fil);
+
+	}
+
+	printf("file names: 300 files with f_stat probing %u us (%u probes, %u sectors read), with the naming service %llu us (%u entries scanned, %u sectors read)",
+			probe_us,
+			probe_cnt,
+			probe_sectors,
+			(unsigned long long) (HOST_time_us() - start),
+			FILE_name_scan_entries,
+			disk_readahead_hit_cnt + disk_readahead_miss_cnt);
+
+	sprintf(name, "%03u.wav", first + 300);													//taken behind the back of the service
+	if(f_open(&name_fil, name, FA_CREATE_NEW | FA_WRITE) != FR_OK) ok = 0;
+	f_close(&name_fil);
+	FILE_wav_create();
+	sprintf(name, "%03u.wav", first + 301);
+	if(strcmp(INPUT_SIDE_file_name, name) != 0) ok = 0;
+
+	FILE_name_seq = 999;
+	if((FILE_name_next() != 0) || (strcmp(INPUT_SIDE_file_name, "999.wav") != 0)) ok = 0;
+	if((FILE_name_next() != 0) || (strcmp(INPUT_SIDE_file_name, "1000.wav") != 0)) ok = 0;
+	if(f_open(&name_fil, INPUT_SIDE_file_name, FA_CREATE_NEW | FA_WRITE) != FR_OK) ok = 0;
+	f_close(&name_fil);
+
+	FILE_name_reset();
+	if((FILE_name_next() != 0) || (strcmp(INPUT_SIDE_file_name, "1001.wav") != 0)) ok = 0;
+
+	for(uint16_t f = 0; f < 302; f++){
+
+		sprintf(name, "%03u.wav", first + f);
+		if(f_unlink(name) != FR_OK) ok = 0;
+
+	}
+	if(f_unlink("1000.wav") != FR_OK) ok = 0;
+
+	FILE_name_reset();
+
+	printf(", %s\r\n", ok ? "ok" : "FAILED");
+
+}
+
+//13)Logger and player sharing the card
+static uint8_t HOST_shared_buf[2][4096] __attribute__((aligned(4)));
+static volatile uint8_t HOST_shared_ok[2];
+
+static void* HOST_logger_task(void* arg){
+
+	FIL log_fil;
+	UINT bytes;
+
+	(void) arg;
+
+	HOST_shared_ok[0] = (f_open(&log_fil, "log.bin", FA_CREATE_ALWAYS | FA_WRITE) == FR_OK);
+
+	for(uint16_t c = 0; (c < 256) && HOST_shared_ok[0]; c++){
+
+		for(UINT i = 0; i < sizeof(HOST_shared_buf[0]); i++) HOST_shared_buf[0][i] = (uint8_t) (c + i);
+
+		if((f_write(&log_fil, HOST_shared_buf[0], sizeof(HOST_shared_buf[0]), &bytes) != FR_OK) || (bytes != sizeof(HOST_shared_buf[0]))) HOST_shared_ok[0] = 0;
+		if(((c & 3) == 3) && (f_sync(&log_fil) != FR_OK)) HOST_shared_ok[0] = 0;			//every 16 kB
+
+	}
+
+	if(f_close(&log_fil) != FR_OK) HOST_shared_ok[0] = 0;
+
+	return NULL;
+
+}
+
+static void* HOST_player_task(void* arg){
+
+	FIL play;
+	UINT bytes;
+
+	(void) arg;
+
+	HOST_shared_ok[1] = (f_open(&play, "play.bin", FA_READ) == FR_OK);
+
+	for(uint8_t pass = 0; (pass < 4) && HOST_shared_ok[1]; pass++){
+
+		f_lseek(&play, 0);
+
+		for(uint16_t c = 0; c < 256; c++){
+
+			if((f_read(&play, HOST_shared_buf[1], sizeof(HOST_shared_buf[1]), &bytes) != FR_OK) || (bytes != sizeof(HOST_shared_buf[1]))){ HOST_shared_ok[1] = 0; break; }
+
+			for(UINT i = 0; i < bytes; i++) if(HOST_shared_buf[1][i] != (uint8_t) (c ^ i)){ HOST_shared_ok[1] = 0; break; }
+
+		}
+
+	}
+
+	f_close(&play);
+
+	return NULL;
+
+}
+
+static void HOST_shared_card_check(void){
+
+	/*
+	 * Two threads on the card at the same time: a logger writing 1 MB with an f_sync every 16 kB and a player reading a 1 MB file four times
+	 * FatFs serialises them on the volume lock (FF_FS_REENTRANT, POSIX backend of ffsystem.c), the driver sleeps on the transfer semaphore
+	 * The peripheral tick - the interrupts - is kept on the main thread, like on a single core; the tasks block it
+	 * Then both files are checked
+	 *
+	 */
+
+	FIL play;
+	FIL log_fil;
+	UINT bytes;
+	pthread_t logger, player;
+	sigset_t tick;
+	uint64_t start;
+	uint32_t sleeps;
+	uint8_t ok = 1;
+
+	if(f_open(&play, "play.bin", FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) ok = 0;
+	for(uint16_t c = 0; c < 256; c++){
+
+		for(UINT i = 0; i < sizeof(HOST_work_buf) / 8; i++) HOST_work_buf[i] = (uint8_t) (c ^ i);
+		if(f_write(&play, HOST_work_buf, sizeof(HOST_work_buf) / 8, &bytes) != FR_OK) ok = 0;
+
+	}
+	f_close(&play);
+
+	sigemptyset(&tick);
+	sigaddset(&tick, SIGRTMIN);
+
+	sleeps = SD_wait_sleep_cnt;
+	start = HOST_time_us();
+
+	pthread_sigmask(SIG_BLOCK, &tick, NULL);												//the threads inherit the mask
+	pthread_create(&logger, NULL, HOST_logger_task, NULL);
+	pthread_create(&player, NULL, HOST_player_task, NULL);
+	pthread_sigmask(SIG_UNBLOCK, &tick, NULL);
+
+	pthread_join(logger, NULL);
+	pthread_join(player, NULL);
+
+	printf("shared card: logger 1 MB and player 4 x 1 MB from two threads in %llu us, %u sleeps on the transfer semaphore",
+			(unsigned long long) (HOST_time_us() - start),
+			SD_wait_sleep_cnt - sleeps);
+
+	if(!HOST_shared_ok[0] || !HOST_shared_ok[1]) ok = 0;
+
+	if(f_open(&log_fil, "log.bin", FA_READ) != FR_OK) ok = 0;
+	for(uint16_t c = 0; (c < 256) && ok; c++){
+
+		if((f_read(&log_fil, HOST_work_buf, 4096, &bytes) != FR_OK) || (bytes != 4096)) ok = 0;
+		for(UINT i = 0; (i < 4096) && ok; i++) if(HOST_work_buf[i] != (uint8_t) (c + i)) ok = 0;
+
+	}
+	f_close(&log_fil);
+
+	f_unlink("log.bin");
+	f_unlink("play.bin");
+
+	printf(", %s\r\n", ok ? "ok" : "FAILED");
+
+}
+
+//14)Block pool
+static uint32_t HOST_pool_fail_cnt;
+
+static void HOST_pool_fail(UINT msize){
+
+	(void) msize;
+	HOST_pool_fail_cnt++;
+
+}
+
+static void HOST_pool_check(void){
+
+	/*
+	 * Two wav files written in turns, one cluster at a time, so both are cut into 40 fragments
+	 * FILE_wav_open tries the map in a 64 byte block first, learns the size it needs and takes a 1024 byte block instead
+	 * Every sample is read back after a seek through the map, the file is opened once more without closing (still one map block held), then the map goes back to the pool
+	 * Then the 1024 byte class is emptied and one more request has to call the failure hook
+	 * Last, a file with a chunk size reaching past its end must not be opened
+	 *
+	 */
+
+	FATFS* fs_ptr;
+	DWORD free_clst;
+	FIL frag[2];
+	UINT bytes;
+	FF_POOL_STAT st;
+	void* held[3];
+	UINT clst_bytes;
+	int16_t sample;
+	UINT read_cnt;
+	uint8_t refused;
+	uint8_t ok = 1;
+
+	if(f_getfree("", &free_clst, &fs_ptr) != FR_OK) return;
+	clst_bytes = fs_ptr->csize * 512;
+
+	ff_pool_fail_hook = HOST_pool_fail;
+	HOST_pool_fail_cnt = 0;
+
+	f_open(&frag[0], "frag_a.wav", FA_CREATE_ALWAYS | FA_WRITE);
+	f_open(&frag[1], "frag_b.wav", FA_CREATE_ALWAYS | FA_WRITE);
+
+	for(uint8_t f = 0; f < 2; f++){
+
+		memcpy(HOST_work_buf, "RIFF\0\0\0\0WAVEdata\0\0\0\0", 20);
+		*(uint32_t*) &HOST_work_buf[4] = (uint32_t) (40 * clst_bytes - 8);
+		*(uint32_t*) &HOST_work_buf[16] = (uint32_t) (40 * clst_bytes - 20);
+		f_write(&frag[f], HOST_work_buf, 20, &bytes);
+
+	}
+
+	for(uint32_t c = 0; c < 40; c++){
+
+		for(uint8_t f = 0; f < 2; f++){
+
+			UINT len = clst_bytes - ((c == 0) ? 20 : 0);
+			uint32_t first = (c == 0) ? 0 : ((c * clst_bytes) - 20) / 2;								//sample number at the start of the cluster
+
+			for(UINT i = 0; i < len / 2; i++) ((uint16_t*) HOST_work_buf)[i] = (uint16_t) (first + i);
+			if((f_write(&frag[f], HOST_work_buf, len, &bytes) != FR_OK) || (bytes != len)) ok = 0;
+			f_sync(&frag[f]);																		//the next cluster of the other file comes in between
+
+		}
+
+	}
+
+	f_close(&frag[0]);
+	f_close(&frag[1]);
+
+	if(FILE_wav_open("frag_a.wav") != 0) ok = 0;
+	ff_pool_stat(2, &st);
+
+	printf("pool: map of %u fragments %s in a %u byte block",
+			PLAY_fragment_cnt,
+			PLAY_fast_seek ? "built" : "NOT built",
+			st.size);
+
+	if(!PLAY_fast_seek || (st.used != 1)) ok = 0;
+
+	for(uint32_t s = 0; s < (40 * clst_bytes - 20) / 2; s += 997){
+
+		if((FILE_wav_seek(s) != 0) || (FILE_wav_read(&sample, 1, &read_cnt) != 0) || (read_cnt != 1) || ((uint16_t) sample != (uint16_t) s)) ok = 0;
+
+	}
+
+	if(FILE_wav_open("frag_a.wav") != 0) ok = 0;													//again, without FILE_wav_close - the first map is given back
+	ff_pool_stat(2, &st);
+	printf(", reopened with %u map block(s) held", st.used);
+	if(!PLAY_fast_seek || (st.used != 1)) ok = 0;
+
+	FILE_wav_close();
+
+	for(int cls = 0; cls < 3; cls++){
+
+		ff_pool_stat(cls, &st);
+		printf(", %u B class %u/%u peak", st.size, st.peak, st.blocks);
+		if(st.used != 0) ok = 0;																	//all back in the pool
+
+	}
+
+	held[0] = ff_memalloc(1000);
+	held[1] = ff_memalloc(1000);
+	held[2] = ff_memalloc(1000);																	//no third 1024 byte block
+	if((held[0] == NULL) || (held[1] == NULL) || (held[2] != NULL) || (HOST_pool_fail_cnt != 1)) ok = 0;
+	ff_memfree(held[0]);
+	ff_memfree(held[1]);
+	if(ff_memalloc(2000) != NULL) ok = 0;															//larger than any block
+	ff_pool_stat(2, &st);
+
+	printf(", %u failure hook calls (%u counted in the 1024 B class)", HOST_pool_fail_cnt, st.fails);
+
+	if((HOST_pool_fail_cnt != 2) || (st.fails != 1) || (st.used != 0)) ok = 0;
+
+	ff_pool_fail_hook = NULL;
+
+	f_unlink("frag_a.wav");
+	f_unlink("frag_b.wav");
+
+	f_open(&frag[0], "bad.wav", FA_CREATE_ALWAYS | FA_WRITE);										//a chunk size that would wrap the walk back to the start
+	memcpy(HOST_work_buf, "RIFF\0\0\0\0WAVEJUNK\xF8\xFF\xFF\xFF" "data\0\0\0\0", 28);
+	f_write(&frag[0], HOST_work_buf, 28, &bytes);
+	f_close(&frag[0]);
+
+	refused = (FILE_wav_open("bad.wav") != 0);
+	if(!refused){
+
+		FILE_wav_close();
+		ok = 0;
+
+	}
+
+	printf(", bad chunk size %s", refused ? "refused" : "NOT refused");
+
+	f_unlink("bad.wav");
+
+	printf(", %s\r\n", ok ? "ok" : "FAILED");
+
+}
+
+//15)Latency histograms
+static void HOST_latency_report(void){
+
+	/*
+	 * The diskio traffic of single and multi-sector reads and writes (written back unchanged), timed by the request stamps
+	 * Then the card is made slow: 300 ms of programming time after each write must push the writes over the 250 ms limit
+	 *
+	 */
+
+	const UINT req_sizes[2] = {1, 16};
+	LBA_t sector_cnt = 0;
+	LBA_t base;
+	uint32_t prog_us = HOST_emu_timing.write_prog_us;
+	DRESULT res = RES_OK;
+	uint8_t slow;
+
+	disk_ioctl(0, GET_SECTOR_COUNT, &sector_cnt);
+	base = sector_cnt / 2;
+
+	SD_lat_reset();
+
+	for(uint8_t i = 0; i < 2; i++){
+
+		for(uint32_t s = 0; (s < 256) && (res == RES_OK); s += req_sizes[i]){
+
+			res = disk_read(0, HOST_work_buf, base + s, req_sizes[i]);
+			if(res == RES_OK) res = disk_write(0, HOST_work_buf, base + s, req_sizes[i]);
+
+		}
+
+		if(res == RES_OK) res = disk_ioctl(0, CTRL_SYNC, NULL);
+
+	}
+
+	slow = SD_lat_dump();
+
+	printf("latency: %u operations over the SD limits on the normal card%s\r\n", slow, ((res == RES_OK) && (slow == 0)) ? "" : " - FAILED");
+
+	SD_lat_reset();
+	HOST_emu_timing.write_prog_us = 300000;
+
+	for(uint32_t s = 0; (s < 4) && (res == RES_OK); s++){
+
+		res = disk_read(0, HOST_work_buf, base + s, 1);
+		if(res == RES_OK) res = disk_write(0, HOST_work_buf, base + s, 1);
+		if(res == RES_OK) res = disk_ioctl(0, CTRL_SYNC, NULL);
+
+	}
+
+	HOST_emu_timing.write_prog_us = prog_us;
+
+	slow = SD_lat_dump();
+
+	printf("latency: %u operations over the SD limits on the slow card%s\r\n", slow, ((res == RES_OK) && (slow != 0)) ? ", ok" : " - FAILED");
+
+}
+
+//16)Error recovery
+static void HOST_recovery_case(const char* name, uint8_t kind, uint32_t sector, uint32_t count, uint8_t write, DRESULT expected, LBA_t base){
+
+	/*
+	 * One injected fault against an 8 sector transfer at base
+	 * Reads are compared with a clean copy taken before, writes put a new pattern down, are read back and then undone
+	 *
+	 */
+
+	uint32_t recover_cnt = SD_recover_cnt;
+	uint32_t clock_hz = SD_clock_hz;
+	uint64_t start;
+	uint64_t took_us;
+	DRESULT res;
+	uint8_t ok;
+
+	disk_read(0, HOST_work_buf, base, 8);													//clean copy
+	disk_ioctl(0, CTRL_SYNC, NULL);
+
+	for(UINT i = 0; i < 4096; i++) HOST_work_buf[8192 + i] = write ? (BYTE) (i * 3 + 1) : HOST_work_buf[i];
+
+	HOST_emu_fault.kind = kind;
+	HOST_emu_fault.sector = sector;
+	HOST_emu_fault.count = count;
+
+	start = HOST_time_us();
+	if(write){
+
+		res = disk_write(0, &HOST_work_buf[8192], base, 8);
+		if(res == RES_OK) res = disk_ioctl(0, CTRL_SYNC, NULL);
+
+	} else {
+
+		res = disk_read(0, &HOST_work_buf[4096], base, 8);
+
+	}
+	took_us = HOST_time_us() - start;
+
+	HOST_emu_fault.count = 0;
+
+	if(write && (res == RES_OK)) disk_read(0, &HOST_work_buf[4096], base, 8);				//what the card holds now
+
+	ok = (res == expected) && ((res != RES_OK) || (memcmp(&HOST_work_buf[4096], &HOST_work_buf[8192], 4096) == 0));
+
+	if(write){
+
+		disk_write(0, HOST_work_buf, base, 8);												//undo
+		disk_ioctl(0, CTRL_SYNC, NULL);
+
+	}
+
+	if(disk_read(0, &HOST_work_buf[4096], base + 64, 8) != RES_OK) ok = 0;				//no lock-up: the next access goes through
+	disk_ioctl(0, CTRL_SYNC, NULL);
+
+	printf("recovery: %-26s result %u in %6u us, %u recoveries, SDIO_CK %.1f -> %.1f MHz, %s\r\n",
+			name,
+			res,
+			(uint32_t) took_us,
+			SD_recover_cnt - recover_cnt,
+			clock_hz / 1000000.0,
+			SD_clock_hz / 1000000.0,
+			ok ? "ok" : "FAILED");
+
+}
+
+static void HOST_recovery_check(void){
+
+	/*
+	 * A flaky sector must cost a retry, not the clock and not the logger
+	 * A dead one must come back as an error within a bounded time, with the card still usable afterwards
+	 * A failed prefetch must be recovered before the next read, and no prefetch may reach past the end of the card
+	 * disk_initialize must not reset the card under a prefetch or an open stream
+	 * The clock is negotiated again at the end, in case a case stepped it down
+	 *
+	 */
+
+	LBA_t sector_cnt = 0;
+	LBA_t base;
+	uint32_t err_before[SD_ERR_CNT];
+	uint32_t err_prefetch[SD_ERR_CNT];
+	uint32_t recover_cnt;
+	uint32_t address_cnt;
+	uint32_t errors;
+	uint32_t init_errors;
+	DRESULT res;
+
+	disk_ioctl(0, GET_SECTOR_COUNT, &sector_cnt);
+	base = sector_cnt / 2 + 1024;
+
+	memcpy(err_before, (const void*) SD_error_cnt, sizeof(err_before));
+
+	HOST_recovery_case("CRC once, read", HOST_FAULT_CRC, base + 3, 1, 0, RES_OK, base);
+	HOST_recovery_case("data timeout once, read", HOST_FAULT_DATA_TIMEOUT, base + 5, 1, 0, RES_OK, base);
+	HOST_recovery_case("CMD timeout twice, read", HOST_FAULT_CMD_TIMEOUT, base, 2, 0, RES_OK, base);
+	HOST_recovery_case("CRC once, write", HOST_FAULT_CRC, base + 2, 1, 1, RES_OK, base);
+	HOST_recovery_case("CMD timeout once, write", HOST_FAULT_CMD_TIMEOUT, base, 1, 1, RES_OK, base);
+	HOST_recovery_case("CMD CRC once, read", HOST_FAULT_CMD_CRC, base, 1, 0, RES_OK, base);
+	HOST_recovery_case("CMD CRC once, write", HOST_FAULT_CMD_CRC, base, 1, 1, RES_OK, base);
+	HOST_recovery_case("CMD12 lost once, sync", HOST_FAULT_STOP_TIMEOUT, base + 8, 1, 1, RES_OK, base);
+	HOST_recovery_case("dead sector, read", HOST_FAULT_DATA_TIMEOUT, base + 1, 100, 0, RES_ERROR, base);
+	HOST_recovery_case("silent card, read", HOST_FAULT_CMD_TIMEOUT, base, 100, 0, RES_NOTRDY, base);
+	HOST_recovery_case("CRC at every try, read", HOST_FAULT_CRC, base + 4, 100, 0, RES_ERROR, base);
+	HOST_recovery_case("CMD12 lost always, sync", HOST_FAULT_STOP_TIMEOUT, base + 8, 100, 1, RES_ERROR, base);
+
+	recover_cnt = SD_recover_cnt;
+	memcpy(err_prefetch, (const void*) SD_error_cnt, sizeof(err_prefetch));
+	disk_read(0, HOST_work_buf, base + 128, 1);
+	HOST_emu_fault.kind = HOST_FAULT_DATA_TIMEOUT;
+	HOST_emu_fault.sector = base + 131;
+	HOST_emu_fault.count = 1;
+	disk_read(0, HOST_work_buf, base + 129, 1);												//sequential: the prefetch from base + 130 runs into the fault
+	res = disk_read(0, HOST_work_buf, base + 130, 4);
+	HOST_emu_fault.count = 0;
+	errors = 0;
+	for(uint8_t e = 0; e < SD_ERR_CNT; e++) errors += SD_error_cnt[e] - err_prefetch[e];
+	printf("recovery: failed prefetch, next read result %u, %u errors, %u recoveries, %s\r\n", res, errors, SD_recover_cnt - recover_cnt,
+			((res == RES_OK) && (errors == 1) && (SD_recover_cnt - recover_cnt == 1)) ? "ok" : "FAILED");			//only the prefetch fails, the read goes through at once
+
+	address_cnt = SD_error_cnt[SD_ERR_ADDRESS];
+	res = disk_read(0, HOST_work_buf, sector_cnt + 1024 - 2, 1);								//the last sectors of the CSD - GET_SECTOR_COUNT leaves 1024 out
+	if(res == RES_OK) res = disk_read(0, HOST_work_buf, sector_cnt + 1024 - 1, 1);
+	disk_ioctl(0, CTRL_SYNC, NULL);															//collects the prefetch, if any
+	printf("recovery: sequential read up to the end of the card result %u, %u address errors, %s\r\n", res, SD_error_cnt[SD_ERR_ADDRESS] - address_cnt,
+			((res == RES_OK) && (SD_error_cnt[SD_ERR_ADDRESS] == address_cnt)) ? "ok" : "FAILED");
+
+	res = disk_read(0, HOST_work_buf, 0x7FFFFFFF, 1);
+	printf("recovery: read beyond the card result %u, %s\r\n", res, (res == RES_PARERR) ? "ok" : "FAILED");
+
+	memcpy(err_prefetch, (const void*) SD_error_cnt, sizeof(err_prefetch));
+	disk_initialize(0);																		//on an idle card - the rungs the negotiation tries above the emulated limit fail their CRC
+	init_errors = 0;
+	for(uint8_t e = 0; e < SD_ERR_CNT; e++) init_errors += SD_error_cnt[e] - err_prefetch[e];
+
+	recover_cnt = SD_recover_cnt;
+	memcpy(err_prefetch, (const void*) SD_error_cnt, sizeof(err_prefetch));
+	disk_read(0, HOST_work_buf, base + 256, 1);
+	disk_read(0, HOST_work_buf, base + 257, 1);												//sequential: a prefetch is in flight now
+	res = disk_initialize(0);
+	if(res == 0) res = disk_read(0, &HOST_work_buf[4096], base + 256, 8);
+	if(res == RES_OK) res = disk_write(0, &HOST_work_buf[4096], base + 256, 8);				//opens a stream, the card is in "rcv"
+	if(res == RES_OK) res = disk_initialize(0);
+	if(res == 0) res = disk_write(0, &HOST_work_buf[4096], base + 264, 8);					//where the stream would have continued - needs a new CMD25
+	disk_ioctl(0, CTRL_SYNC, NULL);
+	errors = 0;
+	for(uint8_t e = 0; e < SD_ERR_CNT; e++) errors += SD_error_cnt[e] - err_prefetch[e];
+	printf("recovery: re-init with a prefetch in flight and with a stream open result %u, %u errors (%u on an idle card), %u recoveries, %s\r\n", res, errors, 2 * init_errors,
+			SD_recover_cnt - recover_cnt, ((res == RES_OK) && (errors == 2 * init_errors) && (SD_recover_cnt == recover_cnt)) ? "ok" : "FAILED");
+
+	printf("recovery: errors seen - CMD timeout %u, CMD CRC %u, data timeout %u, CRC %u, FIFO %u, DMA %u, address %u, busy %u\r\n",
+			SD_error_cnt[SD_ERR_CMD_TIMEOUT] - err_before[SD_ERR_CMD_TIMEOUT],
+			SD_error_cnt[SD_ERR_CMD_CRC] - err_before[SD_ERR_CMD_CRC],
+			SD_error_cnt[SD_ERR_DATA_TIMEOUT] - err_before[SD_ERR_DATA_TIMEOUT],
+			SD_error_cnt[SD_ERR_DATA_CRC] - err_before[SD_ERR_DATA_CRC],
+			SD_error_cnt[SD_ERR_FIFO] - err_before[SD_ERR_FIFO],
+			SD_error_cnt[SD_ERR_DMA] - err_before[SD_ERR_DMA],
+			SD_error_cnt[SD_ERR_ADDRESS] - err_before[SD_ERR_ADDRESS],
+			SD_error_cnt[SD_ERR_BUSY] - err_before[SD_ERR_BUSY]);
+
+	HOST_emu_fault.kind = HOST_FAULT_NONE;
+	SDIO_Clock_negotiate();
+
+}
+
+//17)Scatter-gather transfers
+static uint8_t HOST_sg_ring[16 * 512] __attribute__((aligned(16)));						//stands in for a wrapped recorder ring
+static uint8_t HOST_sg_scatter[20 * 512] __attribute__((aligned(4)));
+
+static uint8_t HOST_sg_case(const char* name, uint32_t block_addr, const SD_segment_t* seg, uint8_t seg_cnt){
+
+	/*
+	 * Writes the list with one request, reads the blocks back plainly and compares them with the segments
+	 * Then reads them again with one request into the scatter buffer, laid out in the opposite order of the list, and compares that too
+	 *
+	 */
+
+	SD_segment_t back[8];
+	uint32_t offset = 0;
+	uint32_t swaps = HOST_emu_stats.dma_buffer_swaps;
+	uint32_t cmd25_before = HOST_emu_stats.cmd_cnt[25];
+	uint16_t block_cnt = 0;
+	uint8_t ok = 1;
+
+	for(uint8_t i = 0; i < seg_cnt; i++) block_cnt += seg[i].block_cnt;
+
+	SDIO_Select_Card();
+
+	if(SDCard_Card_Data_Mode_SG_Write_w_SDIO(block_addr, seg, seg_cnt) != 0) ok = 0;
+	if(ok && (SDCard_Card_Data_Mode_Multi_Block_Read_w_SDIO(block_addr, block_cnt, HOST_work_buf) != 0)) ok = 0;
+
+	for(uint8_t i = 0; ok && (i < seg_cnt); i++){
+
+		if(memcmp(HOST_work_buf + offset, seg[i].buf, (size_t) seg[i].block_cnt * 512) != 0) ok = 0;
+		offset += (uint32_t) seg[i].block_cnt * 512;
+
+	}
+
+	offset = 0;
+
+	for(uint8_t i = seg_cnt; i > 0; i--){
+
+		back[i - 1].buf = HOST_sg_scatter + offset + ((uintptr_t) seg[i - 1].buf & 0x3);		//same alignment as the written segment
+		back[i - 1].block_cnt = seg[i - 1].block_cnt;
+		offset += (uint32_t) seg[i - 1].block_cnt * 512 + 4;
+
+	}
+
+	memset(HOST_sg_scatter, 0, sizeof(HOST_sg_scatter));
+
+	if(ok && (SDCard_Card_Data_Mode_SG_Read_w_SDIO(block_addr, back, seg_cnt) != 0)) ok = 0;
+
+	for(uint8_t i = 0; ok && (i < seg_cnt); i++){
+
+		if(memcmp(back[i].buf, seg[i].buf, (size_t) seg[i].block_cnt * 512) != 0) ok = 0;
+
+	}
+
+	SDIO_DeSelect_Card();
+
+	printf("scatter-gather %s: %u segments, %u blocks, %u DMA buffer swaps, %u CMD25 - %s\r\n",
+			name, seg_cnt, block_cnt, HOST_emu_stats.dma_buffer_swaps - swaps, HOST_emu_stats.cmd_cnt[25] - cmd25_before, ok ? "ok" : "FAILED");
+
+	return ok;
+
+}
+
+static void HOST_scatter_gather_check(void){
+
+	/*
+	 * A recorder ring that has wrapped holds its oldest data at the end of the buffer and the rest at the start
+	 * Both halves go out in a single CMD25 without being copied together first
+	 * Byte aligned segments (8 bit beats), word aligned ones (32 bit beats without bursts, which could cross a 1 kB boundary) and long segments (large chunks) are covered too,
+	 * as is the refusal of an empty list
+	 *
+	 */
+
+	LBA_t sector_cnt = 0;
+	uint32_t block_addr;
+	uint8_t refused;
+
+	SD_segment_t ring[2] = {{HOST_sg_ring + 11 * 512, 5}, {HOST_sg_ring, 3}};
+	SD_segment_t odd[2] = {{HOST_work_buf + 16385, 4}, {HOST_work_buf + 24579, 4}};
+	SD_segment_t word[2] = {{HOST_sg_ring + 8 * 512 + 4, 4}, {HOST_sg_ring + 4, 4}};
+	SD_segment_t large[2] = {{HOST_shared_buf[0], 8}, {HOST_shared_buf[1], 8}};
+
+	disk_ioctl(0, GET_SECTOR_COUNT, &sector_cnt);
+	disk_ioctl(0, CTRL_SYNC, NULL);																//diskio hands the card back de-selected
+	block_addr = sector_cnt / 2 + 2048;
+
+	for(uint32_t i = 0; i < sizeof(HOST_sg_ring); i++) HOST_sg_ring[i] = (uint8_t) ((i * 7) + (i >> 9));
+	for(uint32_t i = 0; i < 2 * 4 * 512; i++) HOST_work_buf[16385 + i + ((i >= 2048) ? 6146 : 0)] = (uint8_t) ((i * 13) + 1);
+	for(uint32_t i = 0; i < sizeof(HOST_shared_buf); i++) ((uint8_t*) HOST_shared_buf)[i] = (uint8_t) ((i * 3) + (i >> 11));
+
+	HOST_sg_case("wrapped ring", block_addr, ring, 2);
+	HOST_sg_case("unaligned", block_addr + 16, odd, 2);
+	HOST_sg_case("word aligned", block_addr + 48, word, 2);
+	HOST_sg_case("large chunks", block_addr + 32, large, 2);
+
+	SDIO_Select_Card();
+	refused = SDCard_Card_Data_Mode_SG_Write_w_SDIO(block_addr, ring, 0);
+	SDIO_DeSelect_Card();
+
+	printf("scatter-gather empty list: %s\r\n", refused ? "refused, ok" : "FAILED");
+
+}
+
+//18)Continuous write from a buffer pair
+static uint8_t HOST_cont_buf[2][4 * 512] __attribute__((aligned(4)));
+static uint32_t HOST_cont_block;																//next block the refill produces
+static uint32_t HOST_cont_refill_cnt;
+static uint32_t HOST_cont_underrun_at;															//block at which the producer runs dry, 0 for never
+
+static void HOST_cont_pattern(uint8_t* buf, uint32_t block){
+
+	for(uint32_t i = 0; i < 512; i++) buf[i] = (uint8_t) ((block * 31) + (i * 7));
+
+	memcpy(buf, &block, sizeof(block));
+
+}
+
+static uint8_t HOST_cont_refill(uint8_t* buf, uint16_t block_cnt){
+
+	if((HOST_cont_underrun_at != 0) && (HOST_cont_block >= HOST_cont_underrun_at)) return 1;
+
+	for(uint16_t i = 0; i < block_cnt; i++) HOST_cont_pattern(buf + (uint32_t) i * 512, HOST_cont_block++);
+
+	HOST_cont_refill_cnt++;
+
+	return 0;
+
+}
+
+static void HOST_continuous_check(void){
+
+	/*
+	 * A recording longer than any buffer: 6000 blocks (3 MB) go out of 2 x 2 kB through the double buffer, two requests of one open-ended CMD25
+	 * The card is read back in 32 kB pieces and checked block by block
+	 * A stream left open by disk_write must not cost the write any data
+	 * A producer that runs dry half way must fail the write with an underrun and leave a card that can be re-synced and read
+	 *
+	 */
+
+	LBA_t sector_cnt = 0;
+	uint32_t block_addr;
+	uint32_t block_cnt = 6000;
+	uint32_t bad = 0;
+	uint32_t cmd25_before = HOST_emu_stats.cmd_cnt[25];
+	uint32_t cmd12_before = HOST_emu_stats.cmd_cnt[12];
+	uint64_t start;
+	uint64_t write_us;
+	uint8_t result;
+	uint8_t retry_cnt = 0;
+	uint8_t expected[512];
+
+	disk_ioctl(0, GET_SECTOR_COUNT, &sector_cnt);
+	disk_ioctl(0, CTRL_SYNC, NULL);
+	block_addr = sector_cnt / 2 + 8192;
+
+	HOST_cont_block = 0;
+	HOST_cont_refill_cnt = 0;
+	HOST_cont_underrun_at = 0;
+
+	SDIO_Select_Card();
+
+	start = HOST_time_us();
+	result = SDCard_Card_Data_Mode_Continuous_Write_w_SDIO(block_addr, block_cnt, HOST_cont_buf[0], HOST_cont_buf[1], 4, HOST_cont_refill, 0);
+	write_us = HOST_time_us() - start;
+
+	for(uint32_t done = 0; (result == 0) && (done < block_cnt); done += 64){
+
+		uint16_t cnt = (block_cnt - done > 64) ? 64 : (uint16_t) (block_cnt - done);
+
+		if(SDCard_Card_Data_Mode_Multi_Block_Read_w_SDIO(block_addr + done, cnt, HOST_work_buf) != 0){
+
+			bad += cnt;
+			continue;
+
+		}
+
+		for(uint16_t i = 0; i < cnt; i++){
+
+			HOST_cont_pattern(expected, done + i);
+			if(memcmp(HOST_work_buf + (uint32_t) i * 512, expected, 512) != 0) bad++;
+
+		}
+
+	}
+
+	printf("continuous write %u blocks from 2 x %u bytes: %.2f MB/s, %u refills, %u CMD25, %u CMD12, %u bad blocks - %s\r\n",
+			block_cnt, (unsigned) sizeof(HOST_cont_buf[0]),
+			(write_us != 0) ? ((double) block_cnt * 512 / write_us) : 0.0,
+			HOST_cont_refill_cnt, HOST_emu_stats.cmd_cnt[25] - cmd25_before, HOST_emu_stats.cmd_cnt[12] - cmd12_before,
+			bad, ((result == 0) && (bad == 0) && (HOST_cont_block == block_cnt)) ? "ok" : "FAILED");
+
+	//behind a stream left open by disk_write
+	disk_write(0, HOST_work_buf, block_addr + block_cnt, 8);
+	HOST_cont_block = 0;
+
+	result = SDCard_Card_Data_Mode_Continuous_Write_w_SDIO(block_addr, 40, HOST_cont_buf[0], HOST_cont_buf[1], 4, HOST_cont_refill, 0);
+	printf("continuous write behind an open stream: result %u, %u blocks taken - %s\r\n",
+			result, HOST_cont_block, ((result == 0) && (HOST_cont_block == 40) && !SD_stream_open) ? "ok" : "FAILED");
+
+	//producer running dry
+	HOST_cont_block = 0;
+	HOST_cont_underrun_at = 40;
+
+	result = SDCard_Card_Data_Mode_Continuous_Write_w_SDIO(block_addr, 400, HOST_cont_buf[0], HOST_cont_buf[1], 4, HOST_cont_refill, 0);
+	printf("continuous write underrun: result %u, cause %u, ", result, SD_error_last);
+
+	if(result != 0) SDIO_Recover(SD_error_last, &retry_cnt);
+
+	HOST_cont_pattern(expected, 0);
+	result = (result != 0) && (SD_error_last == SD_ERR_UNDERRUN) && !SD_stream_open &&
+			 (SDCard_Card_Data_Mode_Single_Block_Read_w_SDIO(block_addr, HOST_work_buf) == 0) && (memcmp(HOST_work_buf, expected, 512) == 0);
+
+	printf("card re-synced and readable - %s\r\n", result ? "ok" : "FAILED");
+
+	SDIO_DeSelect_Card();
+
+}
+
+//19)Command batches
+static void HOST_cmd_queue_check(void){
+
+	/*
+	 * The CMD23 and the read/write command of a multi-block request go out as one batch: the second one is sent from the IRQ of the first response
+	 * A single block request has no batch, and the data must come through unchanged either way
+	 *
+	 */
+
+	LBA_t sector_cnt = 0;
+	uint32_t block_addr;
+	uint32_t queued = SDIO_cmd_queued_cnt;
+	uint32_t cmd23 = HOST_emu_stats.cmd_cnt[23];
+	uint8_t ok = 1;
+
+	disk_ioctl(0, GET_SECTOR_COUNT, &sector_cnt);
+	disk_ioctl(0, CTRL_SYNC, NULL);
+	block_addr = sector_cnt / 2 + 2048 + 64;
+
+	for(uint32_t i = 0; i < 9 * 512; i++) HOST_work_buf[i] = (uint8_t) ((i * 11) + (i >> 9));
+
+	SDIO_Select_Card();
+
+	if(SDCard_Card_Data_Mode_Multi_Block_Write_w_SDIO(block_addr, 8, HOST_work_buf, 0) != 0) ok = 0;
+	if(SDCard_Card_Data_Mode_Single_Block_Write_w_SDIO(block_addr + 8, HOST_work_buf + 8 * 512) != 0) ok = 0;
+	if(SDCard_Card_Data_Mode_Multi_Block_Read_w_SDIO(block_addr, 9, HOST_work_buf + 16384) != 0) ok = 0;
+
+	SDIO_DeSelect_Card();
+
+	if(memcmp(HOST_work_buf, HOST_work_buf + 16384, 9 * 512) != 0) ok = 0;
+	if((SDIO_cmd_queued_cnt - queued) != 2) ok = 0;
+
+	printf("command batches: 2 multi-block requests, %u CMD23, %u commands sent from the IRQ - %s\r\n",
+			HOST_emu_stats.cmd_cnt[23] - cmd23, SDIO_cmd_queued_cnt - queued, ok ? "ok" : "FAILED");
+
+}
+
+//20)Pre-erase hint
+static void HOST_pre_erase_check(void){
+
+	/*
+	 * On a card with a slow erase path, the same 64 block write goes out without and then with the ACMD23 hint
+	 * The hint must reach the card once, take the erase stall off the write and leave the data as written
+	 *
+	 */
+
+	HOST_emu_timing_t timing = HOST_emu_timing;
+	LBA_t sector_cnt = 0;
+	uint32_t block_addr;
+	uint32_t acmd23 = HOST_emu_stats.acmd_cnt[23];
+	uint32_t stalls;
+	uint32_t stalls_hint;
+	uint64_t start;
+	uint64_t plain_us;
+	uint64_t hint_us;
+	uint8_t ok = 1;
+
+	disk_ioctl(0, GET_SECTOR_COUNT, &sector_cnt);
+	disk_ioctl(0, CTRL_SYNC, NULL);
+	block_addr = ((sector_cnt / 2 + 2048 + 128) / 64) * 64;										//start of an erase unit
+
+	HOST_emu_timing.erase_unit_us = 3000;
+	HOST_emu_timing.pre_erase_unit_us = 600;
+
+	for(uint32_t i = 0; i < 64 * 512; i++) HOST_work_buf[i] = (uint8_t) ((i * 5) + (i >> 9));
+
+	SDIO_Select_Card();
+
+	stalls = HOST_emu_stats.erase_stall_cnt;
+	start = HOST_time_us();
+	if(SDCard_Card_Data_Mode_Multi_Block_Write_w_SDIO(block_addr, 64, HOST_work_buf, 0) != 0) ok = 0;
+	plain_us = HOST_time_us() - start;
+	stalls = HOST_emu_stats.erase_stall_cnt - stalls;
+
+	stalls_hint = HOST_emu_stats.erase_stall_cnt;
+	start = HOST_time_us();
+	if(SDCard_Card_Data_Mode_Multi_Block_Write_w_SDIO(block_addr, 64, HOST_work_buf, 64) != 0) ok = 0;
+	hint_us = HOST_time_us() - start;
+	stalls_hint = HOST_emu_stats.erase_stall_cnt - stalls_hint;
+
+	if(SDCard_Card_Data_Mode_Multi_Block_Read_w_SDIO(block_addr, 64, HOST_work_buf) != 0) ok = 0;				//over the data written - it is checked against the pattern
+
+	SDIO_DeSelect_Card();
+
+	HOST_emu_timing = timing;
+
+	for(uint32_t i = 0; ok && (i < 64 * 512); i++){
+
+		if(HOST_work_buf[i] != (uint8_t) ((i * 5) + (i >> 9))) ok = 0;
+
+	}
+
+	if((HOST_emu_stats.acmd_cnt[23] - acmd23) != 1) ok = 0;
+	if((stalls == 0) || (stalls_hint != 0) || (hint_us >= plain_us)) ok = 0;
+
+	printf("pre-erase 64 blocks on a slow erase card: %llu us plain (%u stalls), %llu us with ACMD23 (%u stalls) - %s\r\n",
+			(unsigned long long) plain_us, stalls, (unsigned long long) hint_us, stalls_hint, ok ? "ok" : "FAILED");
+
+}
+
+int main(int argc, char* argv[]){
+
+	const char* image_path = (argc > 1) ? argv[1] : "sdcard.img";
+	uint32_t size_mb = (argc > 2) ? (uint32_t) atoi(argv[2]) : 256;
+	uint8_t new_image = (access(image_path, F_OK) != 0);
+	uint8_t bench = (argc > 3) && (strcmp(argv[3], "bench") == 0);
+	uint8_t bench_failed;
+
+	setvbuf(stdout, NULL, _IONBF, 0);														//no buffering, like the UART on the Feather
+
+	if(HOST_Emulator_start(image_path, new_image ? (size_mb * 2048) : 0) != 0){
+
+		printf("Card image could not be opened... \r\n");
+		return 1;
+
+	}
+
+	SysClockConfig();
+
+	TIM6Config();																		//custom delay function
+
+	TIM7Config();																		//one-shot alarm for the SDcard status polling
+
+	//---------Set up SDcard----------//
+
+	SDIO_init();
+
+	SDIO_DMA2_init();
+
+	DMA2_SDIO_IRQPriorEnable();
+
+	if(new_image){
+
+		MKFS_PARM format_opt = {FM_FAT32, 0, 0, 0, 0};											//FAT32 like the cards in the field, so the FSINFO paths run
+
+		printf("Formatting new card image... \r\n");
+		if(f_mkfs("", &format_opt, HOST_work_buf, sizeof(HOST_work_buf)) != FR_OK){
+
+			format_opt.fmt = FM_ANY;																//too few clusters for FAT32
+			if(f_mkfs("", &format_opt, HOST_work_buf, sizeof(HOST_work_buf)) != FR_OK) printf("Formatting failed... \r\n");
+
+		}
+
+	}
+
+	//---------Set up SDcard----------//
+
+	SDcard_start();
+	printf("\r\n");
+
+	if(bench){
+
+		bench_failed = HOST_bench_run((argc > 4) ? argv[4] : NULL);
+
+		f_mount(0, "", 0);
+		HOST_Emulator_stop();
+
+		return bench_failed;
+
+	}
+
+	f_unlink("000.wav");																//same sequence as on the Feather
+	f_unlink("001.wav");
+	f_unlink("002.wav");
+	f_unlink("003.wav");
+	f_unlink("004.wav");
+
+	for(gen_file_no = 0; gen_file_no < 5; gen_file_no++) FILE_wav_create();
+
+	printf("Generated up to %s \r\n", INPUT_SIDE_file_name);
+
+	//---------Measurements----------//
+
+	printf("SDIO_CK %.1f MHz, %s speed\r\n", SD_clock_hz / 1000000.0, SD_high_speed ? "high" : "default");
+
+	HOST_diskio_benchmark();
+
+	HOST_fatfs_benchmark();
+
+	HOST_alignment_benchmark();
+
+	HOST_smallfile_benchmark();
+
+	HOST_async_benchmark();
+
+	HOST_clock_fallback_check();
+
+	HOST_recording_check();
+
+	HOST_seek_benchmark();
+
+	HOST_window_cache_check();
+
+	HOST_free_map_check();
+
+	HOST_dir_index_check();
+
+	HOST_file_name_check();
+
+	HOST_shared_card_check();
+
+	HOST_pool_check();
+
+	HOST_latency_report();
+
+	HOST_recovery_check();
+
+	HOST_scatter_gather_check();
+
+	HOST_continuous_check();
+
+	HOST_cmd_queue_check();
+
+	HOST_pre_erase_check();
+
+	f_mount(0, "", 0);
+
+	HOST_Emulator_stop();
+
+	return 0;
+
+}
+
+#endif /* SDIO_HOST_EMULATION */
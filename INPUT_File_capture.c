@@ -25,6 +25,34 @@ uint8_t hex_buffer[100];
 
 UINT br, bw;
 
+FIL rec_fil;																							//file being recorded
+uint32_t CAPTURE_chunk_bytes;
+uint32_t CAPTURE_data_bytes;
+static uint16_t CAPTURE_buf[CAPTURE_CHUNK_MAX] __attribute__((aligned(RING_LINE_BYTES)));		//storage of ADC_ring, two halves of CAPTURE_CHUNK_MAX bytes
+static uint8_t CAPTURE_header[CAPTURE_HEADER_BYTES] __attribute__((aligned(4)));					//first sector of the file
+static uint8_t CAPTURE_flush;																			//the recording has stopped, partial sectors are saved too
+static LBA_t CAPTURE_sector;																			//first sector of the reserved extent - the header
+static LBA_t CAPTURE_next_sector;																		//where the next half goes
+static LBA_t CAPTURE_sector_end;																		//first sector after the extent
+static DWORD CAPTURE_clmt[6];																			//cluster link map of the recording - the extent is one fragment
+
+FIL play_fil;																							//file opened for playback
+uint32_t PLAY_data_ofs;
+uint32_t PLAY_data_bytes;
+uint8_t PLAY_fast_seek;
+uint32_t PLAY_fragment_cnt;
+static DWORD* PLAY_clmt;																				//cluster link map of the playback file - a pool block (ff_memalloc)
+
+uint32_t FILE_name_seq;
+uint32_t FILE_name_scan_entries;
+static uint8_t FILE_name_ready;																			//FILE_name_seq is valid - the directory has been read
+#if FILE_NAME_MODE == FILE_NAME_TIME
+static DWORD FILE_name_day;																				//date of the day directory, upper half of get_fattime
+static char FILE_name_dir[9];																			//"YYYYMMDD"
+#endif
+
+static FRESULT FILE_name_open(FIL* fp, BYTE mode);
+
 FATFS *pfs;
 DWORD fre_clust;
 uint32_t total, free_space;
@@ -60,27 +88,11 @@ void FILE_wav_create(void){
 	 * We create a wav file by writing a header
 	 */
 
-	  uint8_t file_cnt = 0;
-
-	  //NOTE: this part below checks the file names and see what the newest one should be called
-	  //We start from the name "000.wav"
+	  //NOTE: the name comes from the naming service - no f_stat probing from "000.wav" up
 
-	  fresult = f_stat(INPUT_SIDE_file_name, &filinfo);													//we check if the file exists already
-	  while(fresult != FR_NO_FILE){
+	  fresult = FILE_name_open(&fil, FA_WRITE);
+	  if(fresult == FR_OK){																			//a new, empty file
 
-		  file_cnt++;
-		  INPUT_SIDE_file_name[2] = file_cnt%10 + '0';
-		  INPUT_SIDE_file_name[1] = (file_cnt%100)/10 + '0';
-		  INPUT_SIDE_file_name[0] = file_cnt/100 + '0';
-		  fresult = f_stat(INPUT_SIDE_file_name, &filinfo);												//we check if the file exists already
-
-	  }
-
-	  //we create a 16-bit 22050 Hz sampling rate mono wav file
-	  fresult = f_stat(INPUT_SIDE_file_name, &filinfo);													//we check if the file exists already
-	  if(fresult == FR_NO_FILE){																		//if it does not exist
-
-		  f_open(&fil, INPUT_SIDE_file_name, FA_OPEN_ALWAYS | FA_READ | FA_WRITE);
 		  hex_buffer[0] = 0x52;		   															    	// RIFF signature
 		  hex_buffer[1] = 0x49;
 		  hex_buffer[2] = 0x46;
@@ -161,3 +173,524 @@ void bufclear (void)                       																//wipe buffer
   }
 
 }
+
+//4)Create the next free file
+static FRESULT FILE_name_open(FIL* fp, BYTE mode){
+
+	/*
+	 * Takes the next name from the naming service and creates it with FA_CREATE_NEW, so an existing file is never overwritten
+	 * A name can still be taken if the file was made by someone else (another program on a PC, f_open with a name of our own...) - then the next one is tried
+	 * Gives back the result of the last f_open
+	 *
+	 */
+
+	FRESULT result = FR_EXIST;
+
+	for(uint8_t retry = 0; (retry < FILE_NAME_RETRY) && (result == FR_EXIST); retry++){
+
+		if(FILE_name_next() != 0) return FR_DENIED;												//out of names or the directory could not be read
+
+		result = f_open(fp, INPUT_SIDE_file_name, FA_CREATE_NEW | mode);
+
+	}
+
+	return result;
+
+}
+
+//5)Write a 32 bit little endian value into the header
+static void FILE_wav_put32(uint16_t pos, uint32_t value){
+
+	CAPTURE_header[pos] = (uint8_t) value;
+	CAPTURE_header[pos + 1] = (uint8_t) (value >> 8);
+	CAPTURE_header[pos + 2] = (uint8_t) (value >> 16);
+	CAPTURE_header[pos + 3] = (uint8_t) (value >> 24);
+
+}
+
+//6)Start recording
+uint8_t FILE_wav_record_start(uint32_t sample_rate, uint32_t seconds){
+
+	/*
+	 * Creates the next free "xxx.wav" and reserves one contiguous extent (f_expand) for "seconds" of 16-bit mono samples at sample_rate
+	 * Since the extent is contiguous, the file is written as raw sectors through disk_write: no FAT walk, no cluster allocation, no FatFs buffer while recording
+	 * The consecutive disk_write calls continue one open CMD25 on the card (see disk_write), so the whole recording is a single multi-block write
+	 * disk_write holds the disk lock of diskio for each call, so the raw writes never run into the card accesses of another task
+	 * f_expand drops whatever FatFs had cached of the extent (window and window cache), so nothing is written back over the samples later
+	 * The allocated chain and the file size are committed (f_sync) before the first sample, so a power loss during the recording leaves a file, not lost clusters
+	 * The extent is announced with CTRL_PRE_ERASE, so the CMD25 opened by the 1 sector header write carries the whole extent as ACMD23 pre-erase hint
+	 *
+	 * The header fills the first sector: RIFF, fmt and a JUNK chunk padding up to the data chunk, so the samples start on a sector boundary
+	 * Both sizes are left at 0 here - they are only known at the end
+	 * The time one half of the ping-pong buffer takes to fill is the time a save may take without losing samples (e.g. 93 ms at 22050 Hz)
+	 * Returns 0 on success, 1 if the file could not be created, no contiguous space was found or the header could not be written (the file is removed again)
+	 *
+	 */
+
+	uint32_t data_max;
+	LBA_t pre_erase[2];
+
+	if(FILE_name_open(&rec_fil, FA_WRITE) != FR_OK) return 1;
+
+	CAPTURE_chunk_bytes = CAPTURE_CHUNK_MAX;
+	data_max = ((sample_rate * 2 * seconds) + CAPTURE_chunk_bytes - 1) / CAPTURE_chunk_bytes;
+	data_max *= CAPTURE_chunk_bytes;																//whole halves
+
+	if(f_expand(&rec_fil, (FSIZE_t) CAPTURE_HEADER_BYTES + data_max, 1) != FR_OK){
+
+		printf("No contiguous space for the recording... \r\n");
+		f_close(&rec_fil);
+		f_unlink(INPUT_SIDE_file_name);
+		return 1;
+
+	}
+
+	if(f_sync(&rec_fil) != FR_OK){																	//the chain and the size are on the card - a power loss leaves no lost clusters
+
+		f_close(&rec_fil);
+		f_unlink(INPUT_SIDE_file_name);
+		return 1;
+
+	}
+
+	CAPTURE_sector = fs.database + ((LBA_t) (rec_fil.obj.sclust - 2) * fs.csize);					//first sector of the extent
+
+	CAPTURE_clmt[0] = sizeof(CAPTURE_clmt) / sizeof(DWORD);
+	rec_fil.cltbl = CAPTURE_clmt;
+	if(f_lseek(&rec_fil, CREATE_LINKMAP) != FR_OK) rec_fil.cltbl = NULL;							//the seek at the end needs no FAT walk
+	CAPTURE_sector_end = CAPTURE_sector + ((CAPTURE_HEADER_BYTES + data_max) / 512);
+
+	for(uint16_t i = 0; i < CAPTURE_HEADER_BYTES; i++) CAPTURE_header[i] = 0;
+	CAPTURE_header[0] = 'R'; CAPTURE_header[1] = 'I'; CAPTURE_header[2] = 'F'; CAPTURE_header[3] = 'F';	//RIFF signature
+	FILE_wav_put32(4, 0);																			//FileLength - updated at the end
+	CAPTURE_header[8] = 'W'; CAPTURE_header[9] = 'A'; CAPTURE_header[10] = 'V'; CAPTURE_header[11] = 'E';	//WAVE
+	CAPTURE_header[12] = 'f'; CAPTURE_header[13] = 'm'; CAPTURE_header[14] = 't'; CAPTURE_header[15] = ' ';	//fmt
+	FILE_wav_put32(16, 16);																			//fmtChunkSize
+	CAPTURE_header[20] = 0x01;																		//formatTag (PCM)
+	CAPTURE_header[22] = 0x01;																		//channel number (mono)
+	FILE_wav_put32(24, sample_rate);																//sampling rate
+	FILE_wav_put32(28, sample_rate * 2);															//byterate - 2 bytes per sample
+	CAPTURE_header[32] = 0x02;																		//blockalign
+	CAPTURE_header[34] = 0x10;																		//bitspersample (16)
+	CAPTURE_header[36] = 'J'; CAPTURE_header[37] = 'U'; CAPTURE_header[38] = 'N'; CAPTURE_header[39] = 'K';	//JUNK - players skip it
+	FILE_wav_put32(40, CAPTURE_HEADER_BYTES - 52);													//padding up to the data chunk
+	CAPTURE_header[CAPTURE_HEADER_BYTES - 8] = 'd';													//data
+	CAPTURE_header[CAPTURE_HEADER_BYTES - 7] = 'a';
+	CAPTURE_header[CAPTURE_HEADER_BYTES - 6] = 't';
+	CAPTURE_header[CAPTURE_HEADER_BYTES - 5] = 'a';
+	FILE_wav_put32(CAPTURE_HEADER_BYTES - 4, 0);													//datachunkSize - updated at the end
+
+	pre_erase[0] = CAPTURE_sector;
+	pre_erase[1] = CAPTURE_sector_end - CAPTURE_sector;
+	disk_ioctl(fs.pdrv, CTRL_PRE_ERASE, pre_erase);													//the stream opened by the header write covers the whole extent
+
+	if(disk_write(fs.pdrv, CAPTURE_header, CAPTURE_sector, 1) != RES_OK){
+
+		f_close(&rec_fil);
+		f_unlink(INPUT_SIDE_file_name);
+		return 1;
+
+	}
+
+	CAPTURE_next_sector = CAPTURE_sector + 1;
+	CAPTURE_data_bytes = 0;
+	CAPTURE_flush = 0;
+
+	ADC_DMA2_init(CAPTURE_buf, (uint16_t) CAPTURE_chunk_bytes);									//two halves of CAPTURE_chunk_bytes/2 samples, the ring is both
+	ADC_Sampling_start(sample_rate);
+
+	return 0;
+
+}
+
+//7)Save samples
+static uint8_t FILE_wav_save(uint8_t* span, uint32_t bytes){
+
+	/*
+	 * The span is written where it is in the ring - no copy
+	 * The left aligned ADC samples are unsigned, a 16-bit wav is signed: flipping the top bit moves mid-scale to 0
+	 * The last, partial span is padded to a whole sector - the padding is cut off by the truncation at the end
+	 * The padding stays within the buffer: the buffer ends on a sector boundary
+	 * Returns 0 on success, 1 if the write failed, 2 if the extent is full (the samples are dropped)
+	 *
+	 */
+
+	uint16_t* samples = (uint16_t*) span;
+	uint32_t sample_cnt = bytes / 2;
+	uint32_t sector_cnt = (bytes + 511) / 512;
+
+	if(CAPTURE_next_sector + sector_cnt > CAPTURE_sector_end) return 2;
+
+	for(uint32_t i = 0; i < sample_cnt; i++) samples[i] ^= 0x8000;
+	for(uint32_t i = sample_cnt; i < sector_cnt * 256; i++) samples[i] = 0;
+
+	if(disk_write(fs.pdrv, (const BYTE*) samples, CAPTURE_next_sector, sector_cnt) != RES_OK) return 1;
+
+	CAPTURE_next_sector += sector_cnt;
+	CAPTURE_data_bytes += bytes;
+
+	return 0;
+
+}
+
+//8)Recording service
+uint8_t FILE_wav_record_service(void){
+
+	/*
+	 * Saves what is waiting in the ring, in whole sectors, while the DMA goes on with the other half
+	 * The IRQ only commits the halves, the saving happens here in the main loop - the card driver is not re-entrant
+	 * If the service came late, both halves are waiting and they go out in one write (unless the ring wraps in between)
+	 * Once CAPTURE_flush is set (end of the recording), the last partial sector is saved too
+	 * Returns 0 on success, 1 if a write failed, 2 once the reserved length is reached
+	 *
+	 */
+
+	uint8_t result = 0;
+	uint8_t* span;
+	uint32_t bytes;
+
+	while((bytes = RING_consume_span(&ADC_ring, &span, CAPTURE_flush)) != 0){
+
+		result = FILE_wav_save(span, bytes);
+
+		RING_consume_release(&ADC_ring, bytes);													//the space can be filled again
+
+		if(result != 0) break;
+
+	}
+
+	return result;
+
+}
+
+//9)Stop recording
+uint8_t FILE_wav_record_stop(void){
+
+	/*
+	 * Stops the sampling, saves the full halves and the part of the half that was being filled
+	 * Then the RIFF and data chunk sizes are written into the header sector, and the file is cut back from the reserved length to the last sample
+	 * Returns 0 on success, 1 if a write failed
+	 *
+	 */
+
+	uint8_t result;
+
+	ADC_Sampling_stop();																			//the samples of the half being filled are committed too
+
+	CAPTURE_flush = 1;
+	result = FILE_wav_record_service();
+
+	if(result == 2) result = 0;																		//a full extent is no error, the samples just end there
+
+	FILE_wav_put32(4, CAPTURE_data_bytes + CAPTURE_HEADER_BYTES - 8);								//FileLength
+	FILE_wav_put32(CAPTURE_HEADER_BYTES - 4, CAPTURE_data_bytes);									//datachunkSize
+
+	if(disk_write(fs.pdrv, CAPTURE_header, CAPTURE_sector, 1) != RES_OK) result = 1;
+
+	if(f_lseek(&rec_fil, CAPTURE_HEADER_BYTES + CAPTURE_data_bytes) != FR_OK) result = 1;
+	rec_fil.cltbl = NULL;																			//the truncation changes the chain, the map is outdated
+	if(f_truncate(&rec_fil) != FR_OK) result = 1;													//unused clusters of the extent are freed
+	if(f_close(&rec_fil) != FR_OK) result = 1;
+
+	return result;
+
+}
+
+//10)Open a recording for playback
+uint8_t FILE_wav_open(const char* file_name){
+
+	/*
+	 * Opens the file and looks for the "data" chunk, skipping fmt, JUNK and anything else - both the 44 byte and the 512 byte headers are found
+	 * Then the cluster link map (CLMT) of the file is built: one walk along the FAT chain now, none for any later seek or read
+	 * The map is a block of the FatFs pool, first of PLAY_CLMT_LEN DWORDs - if the file has more fragments, the walk tells the size needed and the map is built again in a block that big
+	 * Pool blocks take a fixed time to get, unlike malloc, and the map is given back by FILE_wav_close
+	 * A file with more fragments than the largest pool block can hold is still opened, only without the map (PLAY_fast_seek is 0)
+	 * A file left open by an earlier FILE_wav_open is closed first, so opening again without FILE_wav_close leaks no pool block
+	 * Returns 0 on success, 1 if the file can't be opened, has no data chunk or a chunk before it reaches past the end of the file
+	 *
+	 */
+
+	uint32_t pos = 12;
+	UINT read;
+	FRESULT result = FR_NOT_ENOUGH_CORE;
+	DWORD needed;
+
+	if(play_fil.obj.fs != NULL) FILE_wav_close();													//a file still open for playback is closed first, its map goes back to the pool
+
+	PLAY_fast_seek = 0;
+
+	if(f_open(&play_fil, file_name, FA_READ) != FR_OK) return 1;
+
+	if((f_read(&play_fil, hex_buffer, 12, &read) != FR_OK) || (read != 12) ||
+	   (hex_buffer[0] != 'R') || (hex_buffer[8] != 'W')){
+
+		f_close(&play_fil);
+		return 1;
+
+	}
+
+	while(1){
+
+		uint32_t chunk_size;
+
+		if((f_lseek(&play_fil, pos) != FR_OK) || (f_read(&play_fil, hex_buffer, 8, &read) != FR_OK) || (read != 8)){
+
+			f_close(&play_fil);
+			return 1;																				//no data chunk
+
+		}
+
+		chunk_size = hex_buffer[4] | ((uint32_t) hex_buffer[5] << 8) | ((uint32_t) hex_buffer[6] << 16) | ((uint32_t) hex_buffer[7] << 24);
+
+		if((hex_buffer[0] == 'd') && (hex_buffer[1] == 'a') && (hex_buffer[2] == 't') && (hex_buffer[3] == 'a')){
+
+			PLAY_data_ofs = pos + 8;
+			PLAY_data_bytes = chunk_size;
+			break;
+
+		}
+
+		if(chunk_size > f_size(&play_fil) - pos - 8){
+
+			f_close(&play_fil);
+			return 1;																				//the chunk reaches past the end - the walk would wrap
+
+		}
+
+		pos += 8 + chunk_size + (chunk_size & 1);													//chunks are padded to even sizes
+
+	}
+
+	PLAY_clmt = ff_memalloc(PLAY_CLMT_LEN * sizeof(DWORD));
+	PLAY_fragment_cnt = 0;
+
+	if(PLAY_clmt != NULL){
+
+		PLAY_clmt[0] = PLAY_CLMT_LEN;
+		play_fil.cltbl = PLAY_clmt;
+		result = f_lseek(&play_fil, CREATE_LINKMAP);
+
+		if(result == FR_NOT_ENOUGH_CORE){
+
+			needed = PLAY_clmt[0];																	//the walk counts the fragments even if they don't fit
+			PLAY_fragment_cnt = (needed - 2) / 2;
+			ff_memfree(PLAY_clmt);
+			PLAY_clmt = ff_memalloc(needed * sizeof(DWORD));
+
+			if(PLAY_clmt != NULL){
+
+				PLAY_clmt[0] = needed;
+				play_fil.cltbl = PLAY_clmt;
+				result = f_lseek(&play_fil, CREATE_LINKMAP);
+
+			}
+
+		}
+
+	}
+
+	if(result == FR_OK){
+
+		PLAY_fast_seek = 1;
+		PLAY_fragment_cnt = (PLAY_clmt[0] - 2) / 2;
+
+	} else {
+
+		play_fil.cltbl = NULL;																		//too fragmented - seeks walk the FAT
+		ff_memfree(PLAY_clmt);
+		PLAY_clmt = NULL;
+
+	}
+
+	return FILE_wav_seek(0);
+
+}
+
+//11)Move to a sample
+uint8_t FILE_wav_seek(uint32_t sample){
+
+	/*
+	 * With the map, the cluster of any offset is looked up in the table - the cost doesn't depend on how far into the file we go
+	 * Returns 0 on success, 1 on failure or if the sample is beyond the data
+	 *
+	 */
+
+	if(((uint64_t) sample * 2) > PLAY_data_bytes) return 1;
+
+	return (f_lseek(&play_fil, PLAY_data_ofs + (sample * 2)) == FR_OK) ? 0 : 1;
+
+}
+
+//12)Read samples
+uint8_t FILE_wav_read(int16_t* sample_buf, UINT sample_cnt, UINT* read_cnt){
+
+	/*
+	 * Reads up to sample_cnt samples, stopping at the end of the data chunk
+	 * Returns 0 on success, 1 on failure
+	 *
+	 */
+
+	uint32_t left = PLAY_data_ofs + PLAY_data_bytes - (uint32_t) f_tell(&play_fil);
+	UINT bytes = sample_cnt * 2;
+	UINT read;
+
+	*read_cnt = 0;
+
+	if(bytes > left) bytes = left & ~1u;
+
+	if(f_read(&play_fil, sample_buf, bytes, &read) != FR_OK) return 1;
+
+	*read_cnt = read / 2;
+
+	return 0;
+
+}
+
+//13)Close the playback file
+void FILE_wav_close(void){
+
+	play_fil.cltbl = NULL;
+	f_close(&play_fil);
+
+	ff_memfree(PLAY_clmt);																			//the map goes back to the pool
+	PLAY_clmt = NULL;
+
+}
+
+//14)Read a directory for the highest sequence number
+static uint8_t FILE_name_scan(const char* path, uint8_t tail){
+
+	/*
+	 * One pass of f_readdir over the directory - this is the only time the directory is read
+	 * Only "<digits>.wav" names count, up to 8 digits (8.3 names, no LFN)
+	 * With "tail" set, only the last "tail" digits are the sequence number - the digits in front of them are the time of day
+	 * FILE_name_seq is left at the number after the highest one found, 0 for an empty (or missing) directory
+	 * Returns 0 on success, 1 if the directory could not be read
+	 *
+	 */
+
+	DIR dir;
+	uint32_t next = 0;
+
+	FILE_name_scan_entries = 0;
+
+	fresult = f_opendir(&dir, path);
+	if(fresult == FR_NO_PATH){
+
+		FILE_name_seq = 0;																		//nothing recorded there yet
+		return 0;
+
+	}
+	if(fresult != FR_OK) return 1;
+
+	while(1){
+
+		uint8_t len = 0;
+		uint32_t value = 0;
+
+		fresult = f_readdir(&dir, &filinfo);
+		if((fresult != FR_OK) || (filinfo.fname[0] == 0)) break;								//error or end of the directory
+
+		FILE_name_scan_entries++;
+
+		if(filinfo.fattrib & AM_DIR) continue;
+
+		while((filinfo.fname[len] >= '0') && (filinfo.fname[len] <= '9')) len++;
+
+		if((len == 0) || (len > 8) || (tail && (len != 8))) continue;
+		if((filinfo.fname[len] != '.') ||
+		   ((filinfo.fname[len + 1] | 0x20) != 'w') ||
+		   ((filinfo.fname[len + 2] | 0x20) != 'a') ||
+		   ((filinfo.fname[len + 3] | 0x20) != 'v') ||
+		   (filinfo.fname[len + 4] != 0)) continue;											//not one of ours
+
+		for(uint8_t i = (tail ? (8 - tail) : 0); i < len; i++) value = (value * 10) + (uint32_t) (filinfo.fname[i] - '0');
+
+		if(value >= next) next = value + 1;
+
+	}
+
+	f_closedir(&dir);
+
+	if(fresult != FR_OK) return 1;
+
+	FILE_name_seq = next;
+
+	return 0;
+
+}
+
+//15)Next file name
+uint8_t FILE_name_next(void){
+
+	/*
+	 * Puts the next name into INPUT_SIDE_file_name
+	 * The directory is read once (FILE_name_scan), after that every name is only a counter increment - no matter how many files there are
+	 * FILE_NAME_SEQ: "000.wav", "001.wav"... in the root; the counter is at least FILE_NAME_DIGITS wide and grows up to 8 digits ("1000.wav")
+	 * FILE_NAME_TIME: "YYYYMMDD/HHMMnnnn.wav" - a directory for each day, the time of get_fattime and a counter within the day
+	 * The counter keeps the names unique when the clock stands still (no RTC) and in order when it doesn't
+	 * Returns 0 on success, 1 if the directory could not be read or the counter ran out
+	 *
+	 */
+
+#if FILE_NAME_MODE == FILE_NAME_TIME
+
+	DWORD now = get_fattime();
+
+	if(!FILE_name_ready || ((now >> 16) != FILE_name_day)){									//first name or a new day: new directory
+
+		FILE_name_day = now >> 16;
+		sprintf(FILE_name_dir, "%04u%02u%02u",
+				(unsigned) ((now >> 25) + 1980),
+				(unsigned) ((now >> 21) & 0xF),
+				(unsigned) ((now >> 16) & 0x1F));
+
+		fresult = f_mkdir(FILE_name_dir);
+		if((fresult != FR_OK) && (fresult != FR_EXIST)) return 1;
+
+		if(FILE_name_scan(FILE_name_dir, 4) != 0) return 1;
+		FILE_name_ready = 1;
+
+	}
+
+	if(FILE_name_seq > 9999) return 1;
+
+	sprintf(INPUT_SIDE_file_name, "%s/%02u%02u%04lu.wav",
+			FILE_name_dir,
+			(unsigned) ((now >> 11) & 0x1F),
+			(unsigned) ((now >> 5) & 0x3F),
+			(unsigned long) FILE_name_seq);
+
+#else
+
+	if(!FILE_name_ready){
+
+		if(FILE_name_scan("", 0) != 0) return 1;
+		FILE_name_ready = 1;
+
+	}
+
+	if(FILE_name_seq > 99999999) return 1;
+
+	sprintf(INPUT_SIDE_file_name, "%0*lu.wav", FILE_NAME_DIGITS, (unsigned long) FILE_name_seq);
+
+#endif
+
+	FILE_name_seq++;
+
+	return 0;
+
+}
+
+//16)Forget the sequence number
+void FILE_name_reset(void){
+
+	/*
+	 * The next FILE_name_next reads the directory again
+	 * To be called after a re-mount or a card swap
+	 *
+	 */
+
+	FILE_name_ready = 0;
+
+}
@@ -14,14 +14,42 @@
 #include <SDcard_SDIO_diskio.h>
 #include "stdlib.h"
 #include "ff.h"
+#include <ADC_DMA_driver.h>
 
 //LOCAL CONSTANT
 
+//WAV recording
+#define CAPTURE_CHUNK_MAX			8192														//one half of the ping-pong buffer in bytes - one disk_write, a multiple of 512
+#define CAPTURE_HEADER_BYTES		512															//RIFF, fmt and JUNK up to the data chunk - the samples start on a sector boundary
+
+//File naming
+#define FILE_NAME_SEQ				0															//"000.wav", "001.wav"... in the root
+#define FILE_NAME_TIME				1															//"YYYYMMDD/HHMMnnnn.wav" - a directory for each day
+#define FILE_NAME_MODE				FILE_NAME_SEQ
+#define FILE_NAME_DIGITS			3															//minimum width of the sequence number, it grows up to 8 digits
+#define FILE_NAME_LEN				24															//longest name handed out, with the closing zero
+#define FILE_NAME_RETRY				8															//names tried when the next one is taken already
+
+//WAV playback
+#define PLAY_CLMT_LEN				16															//cluster link map size tried first, in DWORDs - (16 - 2) / 2 = 7 fragments
+
 //LOCAL VARIABLE
 
 //EXTERNAL VARIABLE
 
-extern char INPUT_SIDE_file_name[];
+extern char INPUT_SIDE_file_name[FILE_NAME_LEN];												//the name handed out last
+
+extern uint32_t FILE_name_seq;																	//sequence number of the next name
+extern uint32_t FILE_name_scan_entries;															//directory entries read by the last scan
+
+extern uint32_t CAPTURE_chunk_bytes;															//bytes saved by one disk_write
+extern uint32_t CAPTURE_data_bytes;																//samples saved so far, in bytes
+
+extern FIL play_fil;																			//file opened for playback
+extern uint32_t PLAY_data_ofs;																	//file offset of the first sample
+extern uint32_t PLAY_data_bytes;																//size of the data chunk
+extern uint8_t PLAY_fast_seek;																	//the cluster link map of play_fil is in use
+extern uint32_t PLAY_fragment_cnt;																//contiguous cluster runs in play_fil
 
 //FUNCTION PROTOTYPES
 
@@ -29,4 +57,18 @@ void SDcard_start(void);
 
 void FILE_wav_create(void);
 
+void bufclear (void);
+
+uint8_t FILE_wav_record_start(uint32_t sample_rate, uint32_t seconds);							//open a new wav file, reserve "seconds" of contiguous space and start sampling into it
+uint8_t FILE_wav_record_service(void);															//save the full halves - to be called from the main loop
+uint8_t FILE_wav_record_stop(void);																//stop sampling, save the rest, fix the sizes in the header and close the file
+
+uint8_t FILE_name_next(void);																	//put the next free name into INPUT_SIDE_file_name
+void FILE_name_reset(void);																		//read the directory again for the next name
+
+uint8_t FILE_wav_open(const char* file_name);													//open a wav file for playback, find its data chunk and map its clusters
+uint8_t FILE_wav_seek(uint32_t sample);															//move to a sample - no FAT access with the map
+uint8_t FILE_wav_read(int16_t* sample_buf, UINT sample_cnt, UINT* read_cnt);					//read samples from the current position
+void FILE_wav_close(void);
+
 #endif /* INC_SDCARD_IMAGE_CAPTURE_H_ */
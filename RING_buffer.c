@@ -0,0 +1,164 @@
+/*
+ *  Created on: Oct 17, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_SDIO_FATFS
+ *  Processor: STM32F405
+ *  Program version: 1.0
+ *  Source file: RING_buffer.c
+ *  Change history:
+ */
+
+#include <RING_buffer.h>
+#include <string.h>
+
+//1)Set up an empty ring
+uint8_t RING_init(RING_t* ring, uint8_t* buf, uint32_t size){
+
+	/*
+	 * Neither side may be running while this is called
+	 * Returns 0 on success, 1 if the size is not a power of 2 or not a multiple of RING_SPAN_BYTES
+	 *
+	 */
+
+	if((size == 0) || (size & (size - 1)) || (size % RING_SPAN_BYTES)) return 1;
+
+	ring->buf = buf;
+	ring->size = size;
+	ring->head = 0;
+	ring->tail = 0;
+	ring->high_water = 0;
+	ring->overflow_cnt = 0;
+
+	return 0;
+
+}
+
+//2)Bytes waiting
+uint32_t RING_used(RING_t* ring){
+
+	return ring->head - ring->tail;													//the counters run free, the difference is right even after they wrap
+
+}
+
+//3)Bytes free
+uint32_t RING_free(RING_t* ring){
+
+	return ring->size - (ring->head - ring->tail);
+
+}
+
+//4)Free space in one piece
+uint8_t* RING_produce_span(RING_t* ring, uint32_t* len){
+
+	/*
+	 * The free space from the head up to the tail or the end of the buffer, whichever comes first
+	 * What is left after the end of the buffer comes with the next call, once this span is committed
+	 *
+	 */
+
+	uint32_t pos = ring->head & (ring->size - 1);
+	uint32_t room = RING_free(ring);
+
+	if(room > ring->size - pos) room = ring->size - pos;
+
+	*len = room;
+
+	return &ring->buf[pos];
+
+}
+
+//5)Hand over data
+uint8_t RING_produce_commit(RING_t* ring, uint32_t len){
+
+	/*
+	 * The data must already be in the buffer: the barrier makes sure it is, before the consumer can see the new head
+	 * Returns 0 on success, 1 if there isn't room for len bytes - nothing is committed then
+	 *
+	 */
+
+	uint32_t used = ring->head - ring->tail;
+
+	if(len > ring->size - used){
+
+		ring->overflow_cnt++;
+		return 1;
+
+	}
+
+	__DMB();
+	ring->head += len;
+
+	used += len;
+	if(used > ring->high_water) ring->high_water = used;
+
+	return 0;
+
+}
+
+//6)Copy in and hand over
+uint8_t RING_write(RING_t* ring, const void* data, uint32_t len){
+
+	/*
+	 * For producers that don't write into the buffer directly
+	 * The copy is split at the end of the buffer
+	 * Returns 0 on success, 1 if there isn't room for all of it - nothing is written then
+	 *
+	 */
+
+	uint32_t pos = ring->head & (ring->size - 1);
+	uint32_t first = ring->size - pos;
+
+	if(len > RING_free(ring)){
+
+		ring->overflow_cnt++;
+		return 1;
+
+	}
+
+	if(first > len) first = len;
+
+	memcpy(&ring->buf[pos], data, first);
+	memcpy(ring->buf, (const uint8_t*) data + first, len - first);
+
+	return RING_produce_commit(ring, len);
+
+}
+
+//7)Data waiting in one piece
+uint32_t RING_consume_span(RING_t* ring, uint8_t** ptr, uint8_t flush){
+
+	/*
+	 * The data from the tail up to the head or the end of the buffer, whichever comes first
+	 * Without flush, only whole sectors are given - the rest waits for more data
+	 * With flush, the last partial sector comes too (the end of a recording) - after that the tail is no longer on a sector boundary
+	 * Returns the length in bytes, 0 if there is nothing to take
+	 *
+	 */
+
+	uint32_t pos = ring->tail & (ring->size - 1);
+	uint32_t len = ring->head - ring->tail;
+
+	__DMB();																			//the head first, then the data behind it
+
+	if(len > ring->size - pos) len = ring->size - pos;
+
+	if(!flush) len -= len % RING_SPAN_BYTES;
+
+	*ptr = &ring->buf[pos];
+
+	return len;
+
+}
+
+//8)Give space back
+void RING_consume_release(RING_t* ring, uint32_t len){
+
+	/*
+	 * The barrier keeps the reads of the span before the tail update - the producer may write over it right after
+	 *
+	 */
+
+	__DMB();
+	ring->tail += len;
+
+}
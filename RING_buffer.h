@@ -0,0 +1,71 @@
+/*
+ *  Created on: Oct 17, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_SDIO_FATFS
+ *  Processor: STM32F405
+ *  Program version: 1.0
+ *  Header file: RING_buffer.h
+ *  Change history:
+ */
+
+/*
+ * Single producer, single consumer ring buffer between a data source and the card.
+ * The producer is typically an IRQ (the ADC DMA), the consumer the main loop (or a task) that saves the data.
+ * No lock is needed: "head" is only ever written by the producer, "tail" only by the consumer. Both are free running byte counters, the position in the buffer is the counter masked by size - 1.
+ * A barrier (__DMB) sits between the data and the counter on both sides, so the other side never sees a counter before the data behind it.
+ *
+ * Zero copy on both sides:
+ * 	- RING_produce_span gives the free space in one piece, the producer (a DMA) fills it and hands it over with RING_produce_commit - or RING_write copies data in
+ * 	- RING_consume_span gives the data waiting in one piece, in whole sectors, so it can go straight to f_write/disk_write; RING_consume_release gives the space back
+ * Since the buffer is a whole number of sectors and the tail only moves in whole sectors (except for the last, flushed span), every span starts at a sector boundary of the buffer and of the data stream.
+ *
+ * The counters sit in lines of their own (RING_LINE_BYTES), so the producer and the consumer never write into the same line.
+ * The F405 has no data cache, here this only keeps the layout ready for the cached parts.
+ *
+ * high_water is the most data ever waiting at once, taken at every commit: the buffer size a sampling rate really needs.
+ * overflow_cnt counts the commits that did not fit.
+ *
+ */
+
+#ifndef INC_RING_BUFFER_H_
+#define INC_RING_BUFFER_H_
+
+#include "stdint.h"
+#include "stdio.h"
+#ifdef SDIO_HOST_EMULATION
+#include <HOST_SDIO_emulator.h>														//register blocks are emulated on the host
+#else
+#include "stm32f405xx.h"
+#endif
+
+//LOCAL CONSTANT
+#define RING_LINE_BYTES				32													//producer and consumer fields don't share a line
+#define RING_SPAN_BYTES				512													//consumer spans are whole sectors
+
+typedef struct RING_t
+{
+	uint8_t* buf;																		//storage - set by RING_init, read-only afterwards
+	uint32_t size;																		//bytes, a power of 2 and a multiple of RING_SPAN_BYTES
+
+	volatile uint32_t head __attribute__((aligned(RING_LINE_BYTES)));					//bytes committed since RING_init - written by the producer only
+	uint32_t high_water;																//most bytes waiting at once - producer side
+	uint32_t overflow_cnt;																//commits that did not fit - producer side
+
+	volatile uint32_t tail __attribute__((aligned(RING_LINE_BYTES)));					//bytes released since RING_init - written by the consumer only
+} RING_t;
+
+//LOCAL VARIABLE
+
+//EXTERNAL VARIABLE
+
+//FUNCTION PROTOTYPES
+uint8_t RING_init(RING_t* ring, uint8_t* buf, uint32_t size);							//empty ring on buf, gives back 1 if size is not a power of 2 or not whole sectors
+uint32_t RING_used(RING_t* ring);														//bytes waiting
+uint32_t RING_free(RING_t* ring);														//bytes that can still be committed
+uint8_t* RING_produce_span(RING_t* ring, uint32_t* len);								//free space in one piece - producer side
+uint8_t RING_produce_commit(RING_t* ring, uint32_t len);								//hand over len bytes of the span, gives back 1 if they don't fit
+uint8_t RING_write(RING_t* ring, const void* data, uint32_t len);						//copy in and commit, all or nothing
+uint32_t RING_consume_span(RING_t* ring, uint8_t** ptr, uint8_t flush);				//data waiting in one piece, in whole sectors unless flush is set - consumer side
+void RING_consume_release(RING_t* ring, uint32_t len);									//give len bytes back to the producer
+
+#endif /* INC_RING_BUFFER_H_ */
@@ -9,6 +9,16 @@
  */
 
 #include <SDIO_DMA_driver.h>
+#include <SDcard_SDIO_async.h>
+
+uint32_t SDIO_dma_word_cnt = 0;
+uint32_t SDIO_dma_byte_cnt = 0;
+uint32_t SDIO_dma_single_cnt = 0;
+uint32_t SDIO_cmd_queued_cnt = 0;
+
+static SDIO_cmd_t SDIO_cmd_queue[SDIO_CMD_QUEUE_LEN];
+static volatile uint8_t SDIO_cmd_queue_next = 0;
+static volatile uint8_t SDIO_cmd_queue_cnt = 0;
 
 
 //1)SDIO init
@@ -103,10 +113,17 @@ void SDIO_init(void) {
 	SDIO->MASK |= (1<<6);														//we demask the IRQ for CMDREND
 	SDIO->MASK |= (1<<3);														//we demask the IRQ for DATA timeout
 	SDIO->MASK |= (1<<2);														//we demask the IRQ for CMD timeout
+	SDIO->MASK |= (1<<1);														//we demask the IRQ for DATA CRC fail
+	SDIO->MASK |= (1<<4);														//we demask the IRQ for Tx FIFO underrun
+	SDIO->MASK |= (1<<5);														//we demask the IRQ for Rx FIFO overrun
+	SDIO->MASK |= (1<<0);														//we demask the IRQ for CMD CRC fail
 
 	//We don't configure the data transfer part here
 	//Note: we don't enable transfer here, nor do we tell, which direction the data is to flow since both will the the "data part" of the SDIO
 
+	//6) Latency stamps
+	SD_lat_init();																//DWT cycle counter started for the request stamps
+
 }
 
 
@@ -115,42 +132,30 @@ void SDIO_Host_Card_CMD_write(uint8_t command_index, uint16_t card_rca, uint16_t
 
 	/*
 	 * Send ac, bc or bcr type of commands to the card
+	 * The response type is picked by the command index, then the CMD register is written in one go (see SDIO_Cmd_send)
 	 */
 
-	SDIO->CMD &= ~(1<<10);														//deactivate CSMD
-																				//Note: a running CSMD will send a CMD immediately when the CMD register is updated!
-	SDIO->CMD &= ~(63<<0);														//wipe the command index
-
-	if((command_index == 0x0) || (command_index == 0x77)){											//we expect no response for CMD0
+	uint32_t cmd_reg;
 
-		SDIO->CMD &= ~(1<<6);
-		SDIO->CMD &= ~(1<<7);
-		if(command_index == 0x0){
+	if(command_index == 0x0){																		//we expect no response for CMD0
 
-			//do nothing
+		cmd_reg = SDIO_CMD_REG(0x0, SDIO_CMD_NO_RESP);
 
-		} else {
-
-			command_index = 0x7;
+	} else if(command_index == 0x77){																//de-select is CMD7 without response
 
-		}
+		cmd_reg = SDIO_CMD_REG(0x7, SDIO_CMD_NO_RESP);
 
 	} else if((command_index == 0x2) || (command_index == 0x9) || (command_index == 0x10)){			//we expect a long response for CMD2, CMD9 and CMD10
 
-		SDIO->CMD |= (1<<6);
-		SDIO->CMD |= (1<<7);
+		cmd_reg = SDIO_CMD_REG(command_index, SDIO_CMD_LONG_RESP);
 
 	} else {																						//we expect a short response for the rest
 
-		SDIO->CMD |= (1<<6);
-		SDIO->CMD &= ~(1<<7);
+		cmd_reg = SDIO_CMD_REG(command_index, SDIO_CMD_SHORT_RESP);
 
 	}
 
-	SDIO->ARG = (uint32_t) (card_rca << 16) | (uint32_t)command_arg;								//we load the argument as the RCA and the CMD arg
-
-	SDIO->CMD |= (command_index << 0);																//here the CMD will not be sent yet since CSMD is deactivated
-	SDIO->CMD |= (1<<10);																			//send the CMD
+	SDIO_Cmd_send(cmd_reg, (uint32_t) (card_rca << 16) | (uint32_t)command_arg);					//we load the argument as the RCA and the CMD arg
 
 }
 
@@ -162,13 +167,7 @@ void SDIO_Host_Card_REG_upd(uint8_t command_index, uint32_t command_arg){
 	 * No RCA is fed into the CSMD here
 	 */
 
-	SDIO->CMD &= ~(1<<10);																			//deactivate CSMD
-	SDIO->CMD &= ~(63<<0);																			//wipe the command index
-	SDIO->CMD |= (1<<6);																			//set R1 response
-	SDIO->CMD &= ~(1<<7);
-	SDIO->ARG = command_arg;																		//here the argument will be 32 bits
-	SDIO->CMD |= (command_index << 0);
-	SDIO->CMD |= (1<<10);																			//send CMD
+	SDIO_Cmd_send(SDIO_CMD_REG(command_index, SDIO_CMD_SHORT_RESP), command_arg);					//R1 response, here the argument will be 32 bits
 
 }
 
@@ -198,15 +197,17 @@ void SDIO_DMA2_init(void){
 	DMA2_Stream3->CR &= ~(1<<22);																	//peri side incremental burst of 4
 	DMA2_Stream3->CR |= (1<<23);																	//mem side incremental burst of 4
 	DMA2_Stream3->CR &= ~(1<<24);																	//mem side incremental burst of 4
+																									//Note: only kept for 16 byte aligned buffers, see SDIO_DMA2_Beats
 	DMA2_Stream3->CR |= (1<<6);																		//read from mem to peri
 	DMA2_Stream3->CR &= ~(1<<7);																	//read from mem to peri
 	DMA2_Stream3->CR |= (4<<25);																	//select channel 4
 	DMA2_Stream3->CR &= ~(1<<13);																	//memory data size is 8 bits
 	DMA2_Stream3->CR &= ~(1<<14);																	//memory data size is 8 bits
+																									//Note: changed to 32 bits for each word aligned buffer, see SDIO_DMA2_Memory_Setup
 	DMA2_Stream3->CR &= ~(1<<11);																	//peri data size is 32 bits
 	DMA2_Stream3->CR |= (1<<12);																	//peri data size is 32 bits
 	DMA2_Stream3->CR |= (1<<10);																	//memory increment active
-	DMA2_Stream3->PAR = (uint32_t) (&(SDIO->FIFO));													//we want the data to be written to the SDIO FIFO register
+	DMA2_Stream3->PAR = (uintptr_t) (&(SDIO->FIFO));													//we want the data to be written to the SDIO FIFO register
 	DMA2_Stream3->FCR |= (1<<7);																	//FIFO error interrupt enabled
 	DMA2_Stream3->FCR |= (1<<0);																	//FIFO threshold FULL
 	DMA2_Stream3->FCR |= (1<<1);
@@ -223,15 +224,17 @@ void SDIO_DMA2_init(void){
 	DMA2_Stream6->CR &= ~(1<<22);																	//peri side incremental burst of 4
 	DMA2_Stream6->CR |= (1<<23);																	//mem side incremental burst of 4
 	DMA2_Stream6->CR &= ~(1<<24);																	//mem side incremental burst of 4
+																									//Note: only kept for 16 byte aligned buffers, see SDIO_DMA2_Beats
 	DMA2_Stream6->CR &= ~(1<<6);																	//read from peri to mem
 	DMA2_Stream6->CR &= ~(1<<7);																	//read from peri to mem
 	DMA2_Stream6->CR |= (4<<25);																	//select channel 4
 	DMA2_Stream6->CR &= ~(1<<13);																	//memory data size is 8 bits
 	DMA2_Stream6->CR &= ~(1<<14);																	//memory data size is 8 bits
+																									//Note: changed to 32 bits for each word aligned buffer, see SDIO_DMA2_Memory_Setup
 	DMA2_Stream6->CR &= ~(1<<11);																	//peri data size is 32 bits
 	DMA2_Stream6->CR |= (1<<12);																	//peri data size is 32 bits
 	DMA2_Stream6->CR |= (1<<10);																	//memory increment active
-	DMA2_Stream6->PAR = (uint32_t) (&(SDIO->FIFO));
+	DMA2_Stream6->PAR = (uintptr_t) (&(SDIO->FIFO));
 	DMA2_Stream6->FCR |= (1<<7);																	//FIFO error interrupt enabled
 	DMA2_Stream6->FCR |= (1<<0);																	//FIFO threshold FULL
 	DMA2_Stream6->FCR |= (1<<1);
@@ -252,6 +255,7 @@ void DMA2_Stream3_IRQHandler (void){
 	if ((DMA2->LISR & (1<<27)) == (1<<27)) {														//if we had the full transmission triggered on channel 4
 
 		DMA2->LIFCR |= (1<<27);																		//we remove the full complete flag
+		if(SD_async_request != NULL) SDcard_Async_step(SD_ASYNC_EVT_DMA_TX_DONE);					//next chunk of a scatter-gather write
 
 	} else if ((DMA2->LISR & (1<<26)) == (1<<26)){													//if we had half transmission
 
@@ -264,8 +268,9 @@ void DMA2_Stream3_IRQHandler (void){
 
 	} else if ((DMA2->LISR & (1<<25)) == (1<<25)){													//if we had an error trigger on channel 4
 
-		printf("DMA transmission error!");
-		while(1);
+		DMA2->LIFCR |= (1<<25);
+
+		if(SDcard_Async_error(SD_ERR_DMA)) DATAERR_flag = 0;										//the request in flight is failed, or the blocking code is told
 
 	} else {
 
@@ -288,6 +293,7 @@ void DMA2_Stream6_IRQHandler (void){
 	if ((DMA2->HISR & (1<<21)) == (1<<21)) {														//if we had the full transmission triggered on channel 4
 
 		DMA2->HIFCR |= (1<<21);																		//we remove the full complete flag
+		SDcard_Async_step(SD_ASYNC_EVT_DMA_RX_DONE);												//the data is in the memory
 
 	} else if ((DMA2->HISR & (1<<20)) == (1<<20)){													//if we had half transmission
 
@@ -300,8 +306,9 @@ void DMA2_Stream6_IRQHandler (void){
 
 	}  else if ((DMA2->HISR & (1<<19)) == (1<<19)){													//if we had an error trigger on channel 4
 
-		printf("DMA transmission error!");
-		while(1);
+		DMA2->HIFCR |= (1<<19);
+
+		if(SDcard_Async_error(SD_ERR_DMA)) DATAERR_flag = 0;										//the request in flight is failed, or the blocking code is told
 
 	} else {
 
@@ -316,6 +323,10 @@ void SDIO_IRQHandler (void){
 
 	/*
 	 * Handler for SDIO
+	 * While a non-blocking request is in flight (see SDcard_SDIO_async.c), the events are fed to its state machine instead of the flags
+	 * Errors never stop the MCU: a request is failed with the cause, the blocking code gets CMDERR_flag/DATAERR_flag
+ * A CMD CRC fail is an error like a CMD timeout, except for ACMD41: its R3 response carries no CRC, so the flag is its CMDREND
+	 * A CMDREND in the middle of a command batch sends the next command of the batch straight away
 	 *
 	 */
 
@@ -323,22 +334,52 @@ void SDIO_IRQHandler (void){
 	if ((SDIO->STA & (1<<2)) == (1<<2)) {												//CMD timeout error
 
 		SDIO->ICR |= (1<<2);
-		while(1);
+		SDIO_Cmd_queue_flush();																//the rest of a batch is not sent to a card that didn't answer
+		if(SDcard_Async_error(SD_ERR_CMD_TIMEOUT)) CMDERR_flag = 0;
+
+	} else if ((SDIO->STA & (1<<0)) == (1<<0)) {										//CMD CRC fail
+
+		SDIO->ICR |= (1<<0);
+
+		if((SDIO->CMD & 0x3F) == SDIO_CMD_NO_CRC_INDEX) {								//R3 has no CRC to check - the response is good
+
+			CMDREND_flag = 0;
+
+		} else {
+
+			SDIO_Cmd_queue_flush();															//the card may not have taken the command as it was sent
+			if(SDcard_Async_error(SD_ERR_CMD_CRC)) CMDERR_flag = 0;
+
+		}
 
 	} else if((SDIO->STA & (1<<3)) == (1<<3)) {											//DATA timeout error
 
 		SDIO->ICR |= (1<<3);
-//		while(1);
+		if(SDcard_Async_error(SD_ERR_DATA_TIMEOUT)) DATAERR_flag = 0;
+
+	} else if ((SDIO->STA & (1<<1)) == (1<<1)) {										//DATA CRC fail - the clock may be too fast for the card or the board
+
+		SDIO->ICR |= (1<<1);
+		SD_crc_error_cnt++;
+		if(SDcard_Async_error(SD_ERR_DATA_CRC)) DATAERR_flag = 0;
+
+	} else if ((SDIO->STA & ((1<<4) | (1<<5))) != 0) {									//Tx underrun or Rx overrun
+
+		SDIO->ICR |= ((1<<4) | (1<<5));
+		if(SDcard_Async_error(SD_ERR_FIFO)) DATAERR_flag = 0;
 
 	} else if ((SDIO->STA & (1<<6)) == (1<<6)) {										//CMDREND - CMD send and response received
 
 		SDIO->ICR |= (1<<6);
-		CMDREND_flag = 0;
+		if(SDIO_Cmd_queue_next()) {}														//the next command of a batch went out - only the last response is passed on
+		else if(SD_async_request != NULL) SDcard_Async_step(SD_ASYNC_EVT_CMDREND);
+		else CMDREND_flag = 0;
 
 	}  else if ((SDIO->STA & (1<<8)) == (1<<8)) {										//DATA received or sent
 
 		SDIO->ICR |= (1<<8);
-		DATAREND_flag = 0;
+		if(SD_async_request != NULL) SDcard_Async_step(SD_ASYNC_EVT_DATAEND);
+		else DATAREND_flag = 0;
 
 	} else {
 
@@ -362,4 +403,187 @@ void DMA2_SDIO_IRQPriorEnable(void) {
 	NVIC_EnableIRQ(DMA2_Stream6_IRQn);											//IRQ enable for stream7
 	NVIC_SetPriority(SDIO_IRQn,1);
 	NVIC_EnableIRQ(SDIO_IRQn);
+	NVIC_SetPriority(TIM7_IRQn,1);												//same level as the SDIO: the state machine must not pre-empt itself
+	NVIC_EnableIRQ(TIM7_IRQn);
+}
+
+
+//9)Status polling back-off IRQ
+void TIM7_IRQHandler (void){
+
+	/*
+	 * The TIM7 one-shot armed by the request state machine has run out
+	 * See SDcard_Async_backoff
+	 *
+	 */
+
+	TIM7->SR &= ~(1<<0);															//UIF cleared
+
+	if(SD_async_request != NULL) SDcard_Async_step(SD_ASYNC_EVT_POLL);
+
+}
+
+
+//10)DMA memory side of a transfer
+void SDIO_DMA2_Memory_Setup(DMA_Stream_TypeDef* stream, uint8_t* buf_ptr){
+
+	/*
+	 * Points the stream at the buffer and picks the memory data size and burst by the alignment of the buffer (see SDIO_DMA2_Beats)
+	 * Either way the data goes straight between the card and the buffer, no copy is involved
+	 * The stream must be disabled
+	 *
+	 */
+
+	stream->M0AR = (uintptr_t) buf_ptr;
+
+	stream->CR |= (1<<5);																			//peri is the flow controller
+	stream->CR &= ~((1<<18) | (1<<19));																//single buffer - a scatter-gather request may have left double buffer mode on
+
+	SDIO_DMA2_Beats_set(stream, SDIO_DMA2_Beats(buf_ptr));
+
+}
+
+
+//11)DMA memory side of a scatter-gather transfer
+void SDIO_DMA2_Chain_Setup(DMA_Stream_TypeDef* stream, uint8_t* first, uint8_t* second, uint32_t chunk_bytes, uint8_t beats){
+
+	/*
+	 * Double buffer mode is not allowed with the peripheral as flow controller, so the DMA counts the words of each chunk itself (NDTR)
+	 * The SDIO still ends the transfer by DLEN, the DMA only swaps between M0AR and M1AR (CT) at the end of each chunk
+	 * M0AR takes the first chunk, M1AR the second - the transfer complete IRQ loads the next chunk into the target that has just been left
+	 * beats must suit every chunk the targets will be pointed at, not only the first two (see SDcard_Async_chain_plan)
+	 * The stream must be disabled
+	 *
+	 */
+
+	stream->CR &= ~(1<<5);																			//DMA is the flow controller
+	stream->CR |= (1<<18);																			//double buffer mode
+	stream->CR &= ~(1<<19);																			//start on M0AR
+
+	stream->NDTR = chunk_bytes / 4;																	//in peri data size (32 bits)
+	stream->M0AR = (uintptr_t) first;
+	stream->M1AR = (uintptr_t) second;
+
+	SDIO_DMA2_Beats_set(stream, beats);
+
+}
+
+
+//12)Send a command
+void SDIO_Cmd_send(uint32_t cmd_reg, uint32_t arg){
+
+	/*
+	 * The argument goes first, then the whole CMD register is written at once with CPSMEN set (see SDIO_CMD_REG)
+	 * This is safe since the CPSM is idle between commands: CPSMEN only starts a command when it is written, it doesn't send one on every update of the register
+	 *
+	 */
+
+	SDIO->ARG = arg;
+	SDIO->CMD = cmd_reg;
+
+}
+
+//13)Send a batch of commands
+uint8_t SDIO_Cmd_queue(const SDIO_cmd_t* cmds, uint8_t cmd_cnt){
+
+	/*
+	 * The first command goes out right away, the others are sent by the SDIO IRQ on the CMDREND of the one before (see SDIO_Cmd_queue_next)
+	 * The gap between the commands is only the IRQ entry, and the state machine is called once for the whole batch, on the response of the last command
+	 * Only commands with a short response can be in a batch, as it moves on on CMDREND
+	 * Gives back 1 if a batch is still running or the new one doesn't fit
+	 *
+	 */
+
+	if((SDIO_cmd_queue_cnt != 0) || (cmd_cnt == 0) || (cmd_cnt > SDIO_CMD_QUEUE_LEN)) return 1;
+
+	for(uint8_t i = 1; i < cmd_cnt; i++) SDIO_cmd_queue[i] = cmds[i];
+
+	SDIO_cmd_queue_next = 1;
+	SDIO_cmd_queue_cnt = cmd_cnt;
+
+	if(cmd_cnt == 1) SDIO_cmd_queue_cnt = 0;														//nothing is left for the IRQ
+
+	SDIO_Cmd_send(cmds[0].cmd_reg, cmds[0].arg);
+
+	return 0;
+
+}
+
+//14)Next command of a batch
+uint8_t SDIO_Cmd_queue_next(void){
+
+	/*
+	 * Called by the SDIO IRQ on CMDREND
+	 * Gives back 0 once the batch is over, the CMDREND is then the response of its last command
+	 *
+	 */
+
+	if(SDIO_cmd_queue_next >= SDIO_cmd_queue_cnt){
+
+		SDIO_cmd_queue_cnt = 0;
+		return 0;
+
+	}
+
+	SDIO_Cmd_send(SDIO_cmd_queue[SDIO_cmd_queue_next].cmd_reg, SDIO_cmd_queue[SDIO_cmd_queue_next].arg);
+
+	SDIO_cmd_queue_next++;
+	SDIO_cmd_queued_cnt++;
+
+	if(SDIO_cmd_queue_next >= SDIO_cmd_queue_cnt) SDIO_cmd_queue_cnt = 0;							//the next CMDREND goes to the state machine
+
+	return 1;
+
+}
+
+//15)Drop a batch
+void SDIO_Cmd_queue_flush(void){
+
+	SDIO_cmd_queue_cnt = 0;
+	SDIO_cmd_queue_next = 0;
+
+}
+
+//16)Memory beats for a buffer
+uint8_t SDIO_DMA2_Beats(const uint8_t* buf_ptr){
+
+	/*
+	 * A 16 byte aligned buffer is moved with 32 bit beats in bursts of 4: 16 bytes, one full FIFO (threshold FULL) per AHB burst
+	 * A burst must not cross a 1 kB boundary - it never does from a 16 byte aligned start, as every burst after it is 16 byte aligned too
+	 * A buffer that is only word aligned keeps the 32 bit beats, one by one
+	 * Any other buffer (FatFs hands over the caller's buffer for whole sectors, which can start anywhere) falls back to single 8 bit beats, 4 times as many
+	 *
+	 */
+
+	if(((uintptr_t) buf_ptr & 0xF) == 0) return SDIO_DMA_WORD_BURST;
+
+	if(((uintptr_t) buf_ptr & 0x3) == 0) return SDIO_DMA_WORD;
+
+	return SDIO_DMA_BYTE;
+
+}
+
+//17)Memory data size and burst
+void SDIO_DMA2_Beats_set(DMA_Stream_TypeDef* stream, uint8_t beats){
+
+	/*
+	 * The stream must be disabled
+	 *
+	 */
+
+	stream->CR &= ~((3<<13) | (3<<23));															//8 bit memory data size, single beats
+
+	if(beats == SDIO_DMA_BYTE) {
+
+		SDIO_dma_byte_cnt++;
+		return;
+
+	}
+
+	stream->CR |= (2<<13);																			//memory data size is 32 bits
+	SDIO_dma_word_cnt++;
+
+	if(beats == SDIO_DMA_WORD_BURST) stream->CR |= (1<<23);										//mem side incremental burst of 4
+	else SDIO_dma_single_cnt++;
+
 }
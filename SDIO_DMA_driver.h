@@ -13,15 +13,47 @@
 
 #include "stdint.h"
 #include "stdio.h"
+#ifdef SDIO_HOST_EMULATION
+#include <HOST_SDIO_emulator.h>														//register blocks are emulated on the host
+#else
 #include "stm32f405xx.h"
+#endif
+#include <ClockDriver_STM32F405.h>
 
 //LOCAL CONSTANT
 
+//SDIO->CMD values, computed once instead of being put together bit by bit on the register
+#define SDIO_CMD_CPSMEN				(1<<10)
+#define SDIO_CMD_NO_RESP			(0<<6)
+#define SDIO_CMD_SHORT_RESP			(1<<6)
+#define SDIO_CMD_LONG_RESP			(3<<6)
+#define SDIO_CMD_REG(index, resp)	((uint32_t) (index) | (resp) | SDIO_CMD_CPSMEN)
+
+#define SDIO_CMD_NO_CRC_INDEX		41														//ACMD41 - R3 response, CCRCFAIL is set on every answer
+
+#define SDIO_CMD_QUEUE_LEN			4														//commands in a batch
+
+//memory side of a DMA transfer, see SDIO_DMA2_Beats
+#define SDIO_DMA_BYTE				0														//single 8 bit beats - unaligned buffer
+#define SDIO_DMA_WORD				1														//single 32 bit beats - word aligned buffer
+#define SDIO_DMA_WORD_BURST			2														//32 bit beats in bursts of 4 - 16 byte aligned buffer
+
+typedef struct {
+	uint32_t cmd_reg;																		//SDIO->CMD value, see SDIO_CMD_REG
+	uint32_t arg;																			//SDIO->ARG value
+} SDIO_cmd_t;
+
 //LOCAL VARIABLE
 
 //EXTERNAL VARIABLE
-extern uint8_t CMDREND_flag;																		//flag to indicate that a CMD has been successfully received by the card
-extern uint8_t DATAREND_flag;																		//flag to indicate that DATA has been successfully received/sent on the data bus
+extern volatile uint8_t CMDREND_flag;																		//flag to indicate that a CMD has been successfully received by the card
+extern volatile uint8_t DATAREND_flag;																		//flag to indicate that DATA has been successfully received/sent on the data bus
+extern volatile uint8_t DATAERR_flag;																		//flag to indicate a data timeout/CRC error outside of a request
+extern volatile uint8_t CMDERR_flag;																		//flag to indicate a CMD timeout outside of a request
+extern uint32_t SDIO_dma_word_cnt;																			//transfers set up with 32 bit memory beats
+extern uint32_t SDIO_dma_byte_cnt;																			//transfers set up with 8 bit memory beats - unaligned buffer
+extern uint32_t SDIO_dma_single_cnt;																		//transfers with 32 bit memory beats but no burst - word aligned, not 16 byte aligned
+extern uint32_t SDIO_cmd_queued_cnt;																		//commands sent back-to-back from the SDIO IRQ
 
 //FUNCTION PROTOTYPES
 void SDIO_init(void);																				//this is to set up the SDIO peripheral
@@ -30,5 +62,13 @@ void SDIO_Host_Card_REG_upd(uint8_t command_index, uint32_t command_arg);
 
 void SDIO_DMA2_init(void);																			//set up the two DMAs
 void DMA2_SDIO_IRQPriorEnable(void);																//assign priorities for the DMA and the SDIO interrupts
+void SDIO_DMA2_Memory_Setup(DMA_Stream_TypeDef* stream, uint8_t* buf_ptr);						//buffer address and memory data size by alignment
+void SDIO_Cmd_send(uint32_t cmd_reg, uint32_t arg);												//send a command with a precomputed CMD register value
+uint8_t SDIO_Cmd_queue(const SDIO_cmd_t* cmds, uint8_t cmd_cnt);									//send a batch of commands back-to-back, gives back 1 if it doesn't fit
+uint8_t SDIO_Cmd_queue_next(void);																	//on CMDREND: send the next command of the batch, 1 if there was one
+void SDIO_Cmd_queue_flush(void);																	//drop the rest of the batch after an error
+void SDIO_DMA2_Chain_Setup(DMA_Stream_TypeDef* stream, uint8_t* first, uint8_t* second, uint32_t chunk_bytes, uint8_t beats);	//double buffer mode for a scatter-gather transfer
+uint8_t SDIO_DMA2_Beats(const uint8_t* buf_ptr);													//memory beats a buffer allows - SDIO_DMA_...
+void SDIO_DMA2_Beats_set(DMA_Stream_TypeDef* stream, uint8_t beats);								//memory data size and burst of a stream
 
 #endif /* INC_SDIO_DMA_DRIVER_H_ */
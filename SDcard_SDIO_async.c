@@ -0,0 +1,702 @@
+/*
+ *  Created on: Oct 17, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_SDIO_FATFS
+ *  Processor: STM32F405
+ *  Program version: 1.0
+ *  Source file: SDcard_SDIO_async.c
+ *  Change history:
+ */
+
+#include <SDcard_SDIO_async.h>
+#include <ClockDriver_STM32F405.h>
+#include "ff.h"
+
+SD_request_t* volatile SD_async_request = NULL;
+volatile uint8_t SD_stream_open = 0;
+volatile uint32_t SD_stream_next_addr = 0xFFFFFFFF;
+volatile uint32_t SD_status_cmd_cnt = 0;
+volatile uint16_t SD_status_cmd_last = 0;
+volatile uint32_t SD_wait_sleep_cnt = 0;
+volatile uint8_t SD_error_last = SD_ERR_NONE;
+volatile uint32_t SD_error_cnt[SD_ERR_CNT];
+#if FF_FS_REENTRANT
+static uint8_t SD_sem_ready = 0;															//the transfer semaphore exists
+#endif
+
+//1)Finish the request in flight
+static void SDcard_Async_finish(uint8_t result){
+
+	/*
+	 * Stops the DMA stream of the request and the back-off alarm, releases the card and calls the callback
+	 * The request pointer is cleared before the callback so a new request can be submitted from within it
+	 *
+	 */
+
+	SD_request_t* request = SD_async_request;
+
+	TIM7->CR1 &= ~(1<<0);														//no stale alarm for the next request
+	TIM7->SR &= ~(1<<0);
+
+	if(request->direction == SD_ASYNC_READ) DMA2_Stream6->CR &= ~(1<<0);			//DMA Rx side disabled
+	else if(request->direction != SD_ASYNC_STOP && request->direction != SD_ASYNC_STATUS) DMA2_Stream3->CR &= ~(1<<0);
+																					//DMA Tx side disabled
+
+	if(result != 0){
+
+		SDIO->DCTRL &= ~(1<<0);													//stop the DPSM if it is still running
+		SDIO_Cmd_queue_flush();													//no command of a batch after a failure
+		SD_stream_next_addr = 0xFFFFFFFF;										//a broken stream can't be continued, only closed
+		SD_error_last = request->error;
+
+	}
+
+	request->result = result;
+	request->state = (result == 0) ? SD_ASYNC_DONE : SD_ASYNC_ERROR;
+
+	SD_status_cmd_last = request->status_cnt;
+
+	if(result == 0) SD_lat_request(&request->lat);									//before the callback can re-submit the request
+
+	SD_async_request = NULL;
+
+	if(request->callback != NULL) request->callback(request);
+
+#if FF_FS_REENTRANT
+	ff_sem_give_isr();																//wake the task waiting for the request
+#endif
+
+}
+
+//2)Ask the card for its status
+static void SDcard_Async_status(void){
+
+	SD_async_request->status_cnt++;
+	SD_status_cmd_cnt++;
+
+	SDIO_Cmd_send(CMD13_REG, ((uint32_t) SD_RCA << 16) | CMD13_ARG_CARD_STA);		//CMD13 - the answer comes back as a CMDREND event
+
+}
+
+//3)Come back later
+static void SDcard_Async_backoff(void){
+
+	/*
+	 * Arms the TIM7 one-shot - its IRQ feeds SD_ASYNC_EVT_POLL into the state machine
+	 * Every call doubles the wait, so short busy periods are caught early and long ones cost only a few wake-ups
+	 *
+	 */
+
+	SD_request_t* request = SD_async_request;
+
+	request->busy_us += request->poll_us;
+
+	if(request->busy_us > SD_BUSY_LIMIT_US){
+
+		request->error = SD_ERR_BUSY;											//the card is hung - give up instead of polling forever
+		SD_error_cnt[SD_ERR_BUSY]++;
+		SDcard_Async_finish(1);
+		return;
+
+	}
+
+	TIM7_Start_us(request->poll_us);
+
+	if(request->poll_us < SD_POLL_MAX_US) request->poll_us <<= 1;
+
+}
+
+//4)Look at the card
+static void SDcard_Async_poll(void){
+
+	/*
+	 * While DAT0 is held low the card is still programming: reading the pin costs nothing on the bus, a CMD13 would
+	 * Only "tran" is tied to DAT0 - other target states are asked for with CMD13 right away
+	 *
+	 */
+
+	if((SD_async_request->wait_state == SD_CARD_STATE_TRAN) && ((GPIOC->IDR & (1<<8)) == 0)){
+
+		SDcard_Async_backoff();														//DAT0 low - busy
+
+	} else {
+
+		SDcard_Async_status();
+
+	}
+
+}
+
+//5)Plan a scatter-gather request
+static uint8_t SDcard_Async_chain_plan(SD_request_t* request){
+
+	/*
+	 * Adds up the block count of the segments and picks the DMA chunk: the largest block count that divides every segment, SD_SG_CHUNK_MAX at most
+	 * A chunk then never crosses the end of a segment and every chunk is of the same size, as NDTR is reloaded with the same value at each swap
+	 * A continuous write instead runs on its buffer pair: the chunk is one buffer and block_cnt comes from the caller
+	 * Gives back 1 for a list that can't be transferred
+	 *
+	 */
+
+	uint32_t block_cnt = 0;
+	uint16_t chunk = 0;
+	uint16_t rest;
+	uint8_t beats = SDIO_DMA_WORD_BURST;
+
+	if((request->seg_cnt == 0) || (request->direction == SD_ASYNC_STOP) || (request->direction == SD_ASYNC_STATUS)) return 1;
+
+	if(request->refill != NULL){
+
+		chunk = request->seg[0].block_cnt;
+
+		if((request->direction == SD_ASYNC_READ) || (request->seg_cnt != 2) || (request->seg[1].block_cnt != chunk)) return 1;
+		if((chunk == 0) || (chunk > SD_SG_CHUNK_MAX) || (request->block_cnt == 0) || (request->block_cnt % chunk)) return 1;
+
+		block_cnt = request->block_cnt;
+		beats = SDIO_DMA2_Beats(request->seg[0].buf);
+		if(SDIO_DMA2_Beats(request->seg[1].buf) < beats) beats = SDIO_DMA2_Beats(request->seg[1].buf);
+
+	}
+
+	for(uint8_t i = 0; (request->refill == NULL) && (i < request->seg_cnt); i++){
+
+		uint16_t cnt = request->seg[i].block_cnt;
+
+		if((cnt == 0) || (request->seg[i].buf == NULL)) return 1;
+
+		block_cnt += cnt;
+
+		while(cnt != 0){																//Euclid
+
+			rest = chunk % cnt;
+			chunk = cnt;
+			cnt = rest;
+
+		}
+
+		if(SDIO_DMA2_Beats(request->seg[i].buf) < beats) beats = SDIO_DMA2_Beats(request->seg[i].buf);	//the least aligned segment decides for all of them
+
+	}
+
+	if(block_cnt > 0xFFFF) return 1;
+
+	if(chunk > SD_SG_CHUNK_MAX){
+
+		uint16_t div = SD_SG_CHUNK_MAX;
+
+		while(chunk % div) div--;
+
+		chunk = div;
+
+	}
+
+	request->block_cnt = (uint16_t) block_cnt;
+	request->chunk_blk = chunk;
+	request->chunk_cnt = (uint16_t) (block_cnt / chunk);
+	request->chunk_beats = beats;
+	request->seg_idx = 0;
+	request->seg_blk = 0;
+	request->chunk_loaded = 0;
+	request->chunk_done = 0;
+
+	return 0;
+
+}
+
+//6)Next chunk of a scatter-gather request
+static uint8_t* SDcard_Async_chunk_next(SD_request_t* request){
+
+	uint8_t* chunk = request->seg[request->seg_idx].buf + ((uint32_t) request->seg_blk * 512);
+
+	request->seg_blk += request->chunk_blk;
+
+	if(request->seg_blk >= request->seg[request->seg_idx].block_cnt){
+
+		request->seg_idx++;
+		request->seg_blk = 0;
+
+		if(request->seg_idx == request->seg_cnt) request->seg_idx = 0;				//continuous write: back to the first buffer of the pair
+
+	}
+
+	request->chunk_loaded++;
+
+	return chunk;
+
+}
+
+//7)Chunk finished by the DMA
+static uint8_t SDcard_Async_chunk_done(SD_request_t* request, DMA_Stream_TypeDef* stream){
+
+	/*
+	 * At the transfer complete, the DMA has already swapped to the other target (CT) - the one just finished is idle and can be written
+	 * It takes the next chunk that hasn't been given to the DMA yet, if there is any left
+	 * For a continuous write, that chunk is the same buffer again, filled by the refill callback
+	 * Gives back 1 while the DMA still has chunks to move (or the request has just been failed)
+	 *
+	 */
+
+	request->chunk_done++;
+
+	if((request->refill != NULL) && (request->chunk_loaded < request->chunk_cnt)){
+
+		uint8_t* idle = (uint8_t*) ((stream->CR & (1<<19)) ? stream->M0AR : stream->M1AR);
+
+		if(request->refill(idle, request->chunk_blk) != 0){
+
+			request->error = SD_ERR_UNDERRUN;										//the DMA would send stale data
+			SD_error_cnt[SD_ERR_UNDERRUN]++;
+			SDcard_Async_finish(1);
+			return 1;
+
+		}
+
+	}
+
+	if(request->chunk_loaded < request->chunk_cnt){
+
+		if(stream->CR & (1<<19)) stream->M0AR = (uintptr_t) SDcard_Async_chunk_next(request);		//DMA is on M1AR
+		else stream->M1AR = (uintptr_t) SDcard_Async_chunk_next(request);
+
+	}
+
+	return (request->chunk_done < request->chunk_cnt);
+
+}
+
+//8)Point the DMA at the data
+static void SDcard_Async_dma_setup(SD_request_t* request, DMA_Stream_TypeDef* stream){
+
+	if(request->seg == NULL){
+
+		SDIO_DMA2_Memory_Setup(stream, request->buf_ptr);						//32 bit beats if the buffer allows
+
+	} else {
+
+		uint8_t* first = SDcard_Async_chunk_next(request);
+		uint8_t* second = (request->chunk_cnt > 1) ? SDcard_Async_chunk_next(request) : first;		//a single chunk ends before the swap matters
+
+		SDIO_DMA2_Chain_Setup(stream, first, second, (uint32_t) request->chunk_blk * 512, request->chunk_beats);
+
+	}
+
+}
+
+//9)Pre-erase hint
+static uint8_t SDcard_Async_pre_erase(SD_request_t* request, SDIO_cmd_t* batch){
+
+	/*
+	 * Puts CMD55 + ACMD23 at the start of the command batch of a write that has a hint, gives back the number of commands added
+	 *
+	 */
+
+	if((request->pre_erase_cnt == 0) || (request->direction == SD_ASYNC_READ)) return 0;
+
+	batch[0].cmd_reg = CMD55_REG;
+	batch[0].arg = (uint32_t) SD_RCA << 16;
+	batch[1].cmd_reg = ACMD23_REG;
+	batch[1].arg = (request->pre_erase_cnt > SD_PRE_ERASE_MAX) ? SD_PRE_ERASE_MAX : request->pre_erase_cnt;
+
+	return 2;
+
+}
+
+//10)Submit a request
+uint8_t SDcard_Async_submit(SD_request_t* request){
+
+	/*
+	 * Sets up the DPSM and the DMA the same way as the blocking functions did, then sends the first command
+	 * Everything else happens in the IRQs
+	 * Multi-block transfers are preceded by CMD23, so no CMD12 is needed to close them
+	 * The CMD23 and the read/write command go out as one batch from the SDIO IRQ (see SDIO_Cmd_queue), the state machine only sees the last response
+	 * A write with a pre-erase hint puts CMD55 + ACMD23 in front of them
+	 * Streaming writes either open the stream (CMD25 without CMD23) or, if it is already open, start the DPSM right away
+	 * Stop and status requests don't touch the DPSM or the DMA
+	 * Scatter-gather requests arm the first two chunks into the double buffer of the DMA
+	 * A continuous write has its buffer pair filled by refill only here, once nothing can refuse the request any more
+	 *
+	 */
+
+	if(SD_async_request != NULL){
+
+		SD_error_last = SD_ERR_REFUSED;
+		return 1;																//the previous request is still in flight
+
+	}
+
+#if FF_FS_REENTRANT
+	if(!SD_sem_ready) SD_sem_ready = (uint8_t) ff_sem_create();				//before the first IRQ can give it
+	if(!SD_sem_ready) return 1;
+#endif
+
+	if(SD_stream_open && (request->direction != SD_ASYNC_STOP) &&
+	  ((request->direction != SD_ASYNC_STREAM_WRITE) || (request->block_addr != SD_stream_next_addr))){
+
+		SD_error_last = SD_ERR_REFUSED;
+		return 1;																//the stream must be closed first
+
+	}
+
+	if((request->seg != NULL) && SDcard_Async_chain_plan(request)){
+
+		SD_error_last = SD_ERR_REFUSED;
+		return 1;																//empty or oversized segment list
+
+	}
+
+	if((request->refill != NULL) && ((request->refill(request->seg[0].buf, request->chunk_blk) != 0) ||
+	  ((request->chunk_cnt > 1) && (request->refill(request->seg[1].buf, request->chunk_blk) != 0)))){
+
+		SD_error_last = SD_ERR_UNDERRUN;
+		SD_error_cnt[SD_ERR_UNDERRUN]++;
+		return 1;																//nothing to send yet - the card is not touched
+
+	}
+
+	request->state = SD_ASYNC_IDLE;
+	request->result = 0;
+	request->data_end = 0;
+	request->dma_end = 0;
+	request->poll_us = SD_POLL_FIRST_US;
+	request->status_cnt = 0;
+	request->busy_us = 0;
+	request->error = SD_ERR_NONE;
+
+	request->lat.valid = 0;
+	SD_LAT_MARK(request->lat, SD_LAT_T_SUBMIT);
+
+	if(request->direction == SD_ASYNC_STATUS) request->lat.op = SD_LAT_NONE;		//its time is part of the caller's busy phase
+	else if(request->direction == SD_ASYNC_STOP) request->lat.op = SD_LAT_CMD12;
+	else if(request->direction == SD_ASYNC_STREAM_WRITE) request->lat.op = SD_LAT_CMD25_STREAM;
+	else if(request->direction == SD_ASYNC_READ) request->lat.op = (request->block_cnt > 1) ? SD_LAT_CMD18 : SD_LAT_CMD17;
+	else request->lat.op = (request->block_cnt > 1) ? SD_LAT_CMD25 : SD_LAT_CMD24;
+
+	if(request->direction != SD_ASYNC_STATUS) request->wait_state = SD_CARD_STATE_TRAN;
+
+	if(request->direction == SD_ASYNC_STOP){
+
+		SD_stream_open = 0;
+		SD_stream_next_addr = 0xFFFFFFFF;
+
+		SD_async_request = request;
+		request->state = SD_ASYNC_CMD;
+		SD_LAT_MARK(request->lat, SD_LAT_T_CMD);
+		SDIO_Cmd_send(CMD12_REG, 0x0);											//CMD12 has R1b SHORT response - the card goes to "prg" and is busy until the data is programmed
+
+		return 0;
+
+	}
+
+	if(request->direction == SD_ASYNC_STATUS){
+
+		SD_async_request = request;
+		request->state = SD_ASYNC_WAIT_TRAN;
+		SDcard_Async_poll();
+
+		return 0;
+
+	}
+
+	SDIO->DCTRL &= ~(1<<0);														//turn off DPSM
+																				//Note: a full DCTRL reset is necessary between transfers
+	SDIO->DTIMER = (request->direction == SD_ASYNC_READ) ? SD_dtimer_read : SD_dtimer_write;	//timeout value in SCK ticks, for the current SDIO_CK
+
+	SDIO->DLEN = ((uint32_t) request->block_cnt * 512);
+
+	SDIO->DCTRL &= ~(1<<2);														//block mode
+
+	SDIO->DCTRL |= (1<<3);														//DMA enabled
+
+	SDIO->DCTRL &= ~(0xF<<4);
+	SDIO->DCTRL |= (9<<4);														//block size of 512 bytes
+
+	if(request->direction == SD_ASYNC_READ){
+
+		SDIO->DCTRL |= (1<<1);													//data direction is from card to MCU
+		SDcard_Async_dma_setup(request, DMA2_Stream6);
+		DMA2_Stream6->CR |= (1<<0);												//DMA Rx side enabled
+
+	} else {
+
+		SDIO->DCTRL &= ~(1<<1);													//data direction is from MCU to card
+		SDcard_Async_dma_setup(request, DMA2_Stream3);
+		DMA2_Stream3->CR |= (1<<0);												//DMA Tx side enabled
+
+	}
+
+	SD_async_request = request;													//from here on, the IRQs drive the request
+
+	if(request->direction == SD_ASYNC_STREAM_WRITE){
+
+		if(SD_stream_open){
+
+			request->state = SD_ASYNC_DATA;
+			SDIO->DCTRL |= (1<<0);												//card is still in "rcv" - the DPSM waits out the busy of the previous block by itself
+
+		} else {
+
+			SDIO_cmd_t batch[3];
+			uint8_t cmd_cnt = SDcard_Async_pre_erase(request, batch);
+
+			batch[cmd_cnt].cmd_reg = CMD25_REG;									//no CMD23 ahead: the write runs until CMD12
+			batch[cmd_cnt].arg = request->block_addr;
+
+			request->state = SD_ASYNC_CMD;
+			SD_LAT_MARK(request->lat, SD_LAT_T_CMD);
+			SDIO_Cmd_queue(batch, cmd_cnt + 1);
+
+		}
+
+	} else if(request->block_cnt > 1){
+
+		SDIO_cmd_t batch[4];
+		uint8_t cmd_cnt = SDcard_Async_pre_erase(request, batch);
+
+		batch[cmd_cnt].cmd_reg = CMD23_REG;										//block count
+		batch[cmd_cnt].arg = request->block_cnt;
+		batch[cmd_cnt + 1].cmd_reg = (request->direction == SD_ASYNC_READ) ? CMD18_REG : CMD25_REG;
+		batch[cmd_cnt + 1].arg = request->block_addr;
+
+		request->state = SD_ASYNC_CMD;
+		SD_LAT_MARK(request->lat, SD_LAT_T_CMD);								//the command phase covers the whole batch
+
+		if(request->direction == SD_ASYNC_READ) SDIO->DCTRL |= (1<<0);			//we enable first the DPSM - it waits for the data of CMD18
+
+		SDIO_Cmd_queue(batch, cmd_cnt + 2);
+
+	} else {
+
+		request->state = SD_ASYNC_CMD;
+		SD_LAT_MARK(request->lat, SD_LAT_T_CMD);
+		SDIO_Cmd_send((request->direction == SD_ASYNC_READ) ? CMD17_REG : CMD24_REG, request->block_addr);
+
+	}
+
+	return 0;
+
+}
+
+//11)Request in flight
+uint8_t SDcard_Async_busy(void){
+
+	return (SD_async_request != NULL);
+
+}
+
+//12)Wait for a request
+uint8_t SDcard_Async_wait(SD_request_t* request){
+
+	/*
+	 * Blocking wait - this is what turns a request into the old blocking transfer
+	 * Without an RTOS, the core sleeps in between the IRQs
+	 * Interrupts are masked around the check so the last IRQ can't slip in between the check and the WFI (a pending IRQ still wakes the core)
+	 * With FF_FS_REENTRANT, the task sleeps on the transfer semaphore instead and the other tasks run - the end of the request gives it
+	 * A stale give (a request nobody waited for) only costs one more round of the loop
+	 *
+	 */
+
+#if FF_FS_REENTRANT
+
+	while((request->state != SD_ASYNC_DONE) && (request->state != SD_ASYNC_ERROR)){
+
+		ff_sem_take();																//a timeout just checks the state again
+		SD_wait_sleep_cnt++;
+
+	}
+
+#else
+
+	__disable_irq();
+
+	while((request->state != SD_ASYNC_DONE) && (request->state != SD_ASYNC_ERROR)){
+
+		__WFI();
+		SD_wait_sleep_cnt++;
+		__enable_irq();															//the IRQ that woke us up is served here
+		__disable_irq();
+
+	}
+
+	__enable_irq();
+
+#endif
+
+	return request->result;
+
+}
+
+//13)State machine
+void SDcard_Async_step(uint8_t event){
+
+	/*
+	 * Called from the SDIO IRQ (CMDREND, DATAEND, errors), the DMA IRQs (Rx transfer complete, errors) and the TIM7 IRQ (back-off alarm)
+	 * Each step does what the blocking functions did after the corresponding "while(flag)" loop
+	 * A read is only finished when both the SDIO (DATAEND) and the DMA (TC) are done, otherwise the last bytes may still be in the DMA FIFO
+	 * Status polling is also done from here: DAT0 first, CMD13 only when the card has let go of it, retries on the TIM7 back-off
+	 * Scatter-gather requests get a DMA transfer complete for each chunk - only the last one of a read counts as the end of the DMA side
+	 *
+	 */
+
+	SD_request_t* request = SD_async_request;
+	uint8_t card_state;
+
+	if(request == NULL) return;
+
+	if(event == SD_ASYNC_EVT_ERROR){
+
+		SDcard_Async_finish(1);
+		return;
+
+	}
+
+	if(((event == SD_ASYNC_EVT_DMA_RX_DONE) || (event == SD_ASYNC_EVT_DMA_TX_DONE)) && (request->seg != NULL)){
+
+		if(SDcard_Async_chunk_done(request, (event == SD_ASYNC_EVT_DMA_RX_DONE) ? DMA2_Stream6 : DMA2_Stream3)) return;
+
+	}
+
+	if(event == SD_ASYNC_EVT_DMA_TX_DONE) return;								//writes end on DATAEND and the card, not on the DMA
+
+	card_state = (uint8_t) ((SDIO->RESP1 >> 9) & 0xF);							//only valid for CMDREND after a CMD13
+
+	switch(request->state){
+
+		case SD_ASYNC_CMD:
+
+			if(event != SD_ASYNC_EVT_CMDREND) break;
+
+			SD_LAT_MARK(request->lat, SD_LAT_T_RESP);
+
+			if((request->direction != SD_ASYNC_STOP) && (SDIO->RESP1 & SD_R1_ADDRESS_ERRORS)){
+
+				request->error = SD_ERR_ADDRESS;									//the card stays in "tran", no data will come
+				SD_error_cnt[SD_ERR_ADDRESS]++;
+				SDcard_Async_finish(1);
+
+			} else if(request->direction == SD_ASYNC_STOP){
+
+				request->state = SD_ASYNC_WAIT_TRAN;
+				SDcard_Async_poll();
+
+			} else if(request->direction == SD_ASYNC_STREAM_WRITE){
+
+				SD_stream_open = 1;													//from here on, the card needs a CMD12 to leave "rcv"
+				request->state = SD_ASYNC_WAIT_RCV;
+				SDcard_Async_status();
+
+			} else if(request->block_cnt == 1){
+
+				request->state = SD_ASYNC_DATA;
+				SDIO->DCTRL |= (1<<0);												//enable DPSM
+
+			} else if(request->direction == SD_ASYNC_WRITE){
+
+				request->state = SD_ASYNC_WAIT_RCV;									//activate DPSM only after the card is sent for reception
+				SDcard_Async_status();
+
+			} else {
+
+				request->state = SD_ASYNC_DATA;										//DPSM is already running for a multi-block read
+
+			}
+
+			break;
+
+		case SD_ASYNC_WAIT_RCV:
+
+			if(event == SD_ASYNC_EVT_POLL){
+
+				SDcard_Async_status();
+				break;
+
+			}
+
+			if(event != SD_ASYNC_EVT_CMDREND) break;
+
+			if(card_state == SD_CARD_STATE_RCV){
+
+				request->state = SD_ASYNC_DATA;
+				SDIO->DCTRL |= (1<<0);
+
+			} else {
+
+				SDcard_Async_backoff();
+
+			}
+
+			break;
+
+		case SD_ASYNC_DATA:
+
+			if(event == SD_ASYNC_EVT_DATAEND){
+
+				request->data_end = 1;
+				SD_LAT_MARK(request->lat, SD_LAT_T_DATA);
+
+			}
+
+			if(event == SD_ASYNC_EVT_DMA_RX_DONE) request->dma_end = 1;
+
+			if(request->data_end && (request->direction == SD_ASYNC_STREAM_WRITE)){
+
+				SD_stream_next_addr = request->block_addr + request->block_cnt;		//no status polling: the card stays in "rcv" for the next request
+				SDcard_Async_finish(0);
+
+			} else if(request->data_end && request->dma_end){
+
+				SDcard_Async_finish(0);												//read: the card is back in "tran" after the last block, no need to ask
+
+			} else if(request->data_end && (request->direction == SD_ASYNC_WRITE)){
+
+				request->state = SD_ASYNC_WAIT_TRAN;
+				SDcard_Async_poll();												//wait until card is idle again ("tran" state)
+
+			}
+
+			break;
+
+		case SD_ASYNC_WAIT_TRAN:
+
+			if(event == SD_ASYNC_EVT_POLL){
+
+				SDcard_Async_poll();
+				break;
+
+			}
+
+			if(event != SD_ASYNC_EVT_CMDREND) break;
+
+			if(card_state == request->wait_state) SDcard_Async_finish(0);
+			else SDcard_Async_backoff();
+
+			break;
+
+		default:
+
+			break;
+
+	}
+
+}
+
+//14)Error from an IRQ
+uint8_t SDcard_Async_error(uint8_t error){
+
+	/*
+	 * Counts the error and fails the request in flight with it
+	 * Outside a request, the caller raises its flag for the blocking code instead
+	 *
+	 */
+
+	SD_request_t* request = SD_async_request;
+
+	SD_error_cnt[error]++;
+
+	if(request == NULL) return 1;
+
+	request->error = error;
+	SDcard_Async_step(SD_ASYNC_EVT_ERROR);
+
+	return 0;
+
+}
@@ -0,0 +1,188 @@
+/*
+ *  Created on: Oct 17, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_SDIO_FATFS
+ *  Processor: STM32F405
+ *  Program version: 1.0
+ *  Header file: SDcard_SDIO_async.h
+ *  Change history:
+ */
+
+/*
+ * Non-blocking block transfers.
+ * A transfer is described by a request, submitted and then left to the SDIO and DMA2 interrupts to carry through: command, data phase, card programming.
+ * The CPU is only needed for the few instructions within the IRQs, so the application can keep on working while a transfer is in flight.
+ * The blocking SDCard_Card_Data_Mode_..._w_SDIO functions are simply a submit followed by a wait.
+ *
+ * Rules:
+ * 	- the card must be selected (CMD7, "tran" state) before the submit and must not be de-selected until the request is finished
+ * 	- only one request can be in flight; no other command may be sent to the card while it is (CMDREND is consumed by the state machine)
+ * 	- the buffer must stay untouched until the request is finished
+ * 	- the callback runs in IRQ context
+ *
+ * Streaming writes (SD_ASYNC_STREAM_WRITE) start an open-ended CMD25 and leave the card in "rcv" when the request is finished.
+ * A following streaming request that continues at SD_stream_next_addr goes straight to the data phase, without any command or status polling.
+ * The stream must be closed with CMD12 (see SDCard_Card_Data_Mode_Stream_Stop_w_SDIO) before any other command is sent to the card.
+ *
+ * Card busy:
+ * After a write (or a CMD12) the card holds DAT0 low until it has programmed the data. DAT0 (PC8) is sampled through GPIOC->IDR.
+ * While it is low, no CMD13 is sent: TIM7 wakes the state machine up after SD_POLL_FIRST_US, then after twice that, and so on up to SD_POLL_MAX_US.
+ * Once DAT0 is released, a single CMD13 confirms that the card is in the expected state.
+ * CMD13 answers that show the wrong state are retried on the same back-off, not straight away.
+ * Reads need no status command at all: the card falls back to "tran" by itself once the last block is out.
+ * The number of status commands is counted per request (status_cnt), for the last finished request (SD_status_cmd_last) and in total (SD_status_cmd_cnt).
+ *
+ * Waiting:
+ * SDcard_Async_wait sleeps until the request is finished: on WFI for the bare-metal super loop, on the transfer semaphore of ffsystem.c (ff_sem_take) with FF_FS_REENTRANT.
+ * The semaphore is given at the end of every request, from the IRQ, so the other tasks have the CPU while the transfer is running.
+ * The card itself is shared through the disk lock of the diskio layer (FF_DISK_LOCK), held for the whole disk_read, disk_write and disk_ioctl call.
+ * It covers the raw disk_write calls of the recorder as well, which do not go through the FatFs volume lock: only one task is in the driver at a time.
+ *
+ * Scatter-gather:
+ * A read or write request can take a list of segments (seg, seg_cnt) instead of buf_ptr: the blocks go to/from the segments one after the other, in a single CMD18/CMD25.
+ * The block count is then the sum of the segments and is filled in by the submit.
+ * The DMA runs in double buffer mode with itself as the flow controller and moves the list in chunks of equal size (the largest common divisor of the segments, SD_SG_CHUNK_MAX at most).
+ * Each transfer complete IRQ loads the next chunk into the target the DMA has just left, so the IRQ has one chunk time on the bus to be served.
+ * Segments must not be empty. The least aligned segment picks the memory beats for all of them: 16 byte aligned for bursts, word aligned for 32 bit beats (see SDIO_DMA2_Beats).
+ *
+ * Continuous writes:
+ * A write with a refill callback takes two segments of the same size as a buffer pair instead of a list, and block_cnt is given by the caller.
+ * The DMA goes back and forth between the two, and each time it leaves one the transfer complete IRQ calls refill to put the next data in it.
+ * The submit fills both buffers with refill once the request is accepted, before the DMA is armed, so a refused request takes no data from the producer.
+ * A refill that has no data fails the request with SD_ERR_UNDERRUN - from the submit the card is not touched, from the IRQ it is then still in "rcv".
+ * The half transfer IRQs stay unused: a buffer can only be refilled once the DMA has left it completely.
+ *
+ * Pre-erase:
+ * A multi-block write (or the request opening a stream) with pre_erase_cnt set is preceded by CMD55 + ACMD23, in the same command batch as the CMD25.
+ * The card can then erase the blocks in one go instead of stalling on its erase units in the middle of the data. The hint is dropped for single block writes.
+ * The hint must not be larger than the blocks actually written: the content of pre-erased blocks left unwritten is undefined.
+ *
+ * Every successful request is stamped and timed into the latency histograms of SDcard_SDIO_latency.c.
+ *
+ * Errors:
+ * The IRQs report every error through SDcard_Async_error with its cause (SD_ERR_...). The request in flight is failed with the cause in request->error
+ * and SD_error_last, so the layer above can pick the right recovery (see SDIO_Recover). Errors are counted per cause in SD_error_cnt, inside a request or not.
+ * An R1 response with an address error fails the request right away instead of waiting for the data timeout.
+ * A card that stays busy for more than SD_BUSY_LIMIT_US fails the request with SD_ERR_BUSY.
+ *
+ */
+
+#ifndef INC_SDCARD_SDIO_ASYNC_H_
+#define INC_SDCARD_SDIO_ASYNC_H_
+
+#include "stdint.h"
+#include "stdio.h"
+#include <SDcard_SDIO_driver.h>
+#include <SDcard_SDIO_latency.h>
+
+//LOCAL CONSTANT
+
+//request direction
+#define SD_ASYNC_READ				0
+#define SD_ASYNC_WRITE				1
+#define SD_ASYNC_STREAM_WRITE		2										//open-ended multi-block write that stays open after the request
+#define SD_ASYNC_STOP				3										//no data: CMD12 closing the stream, then wait for "tran"
+#define SD_ASYNC_STATUS				4										//no data: wait until the card is in wait_state
+
+//request states
+#define SD_ASYNC_IDLE				0										//not submitted yet
+#define SD_ASYNC_CMD				1										//command (batch) sent
+#define SD_ASYNC_WAIT_RCV			2										//polling the card until it is in "rcv" (multi-block write)
+#define SD_ASYNC_DATA				3										//data phase on the bus
+#define SD_ASYNC_WAIT_TRAN			4										//polling the card until it is back in "tran" (or in wait_state for SD_ASYNC_STATUS)
+#define SD_ASYNC_DONE				5										//finished successfully
+#define SD_ASYNC_ERROR				6										//finished with an error
+
+//events fed into the state machine by the IRQs
+#define SD_ASYNC_EVT_CMDREND		0										//SDIO CMDREND
+#define SD_ASYNC_EVT_DATAEND		1										//SDIO DATAEND
+#define SD_ASYNC_EVT_DMA_RX_DONE	2										//DMA2 Stream6 transfer complete - the data is in the memory
+#define SD_ASYNC_EVT_ERROR			3										//timeout, CRC, FIFO or DMA error
+#define SD_ASYNC_EVT_POLL			4										//TIM7 back-off alarm - time to look at the card again
+#define SD_ASYNC_EVT_DMA_TX_DONE	5										//DMA2 Stream3 transfer complete - only used by scatter-gather writes
+
+//status polling back-off in us
+#define SD_POLL_FIRST_US			20
+#define SD_POLL_MAX_US				80
+#define SD_BUSY_LIMIT_US			500000									//twice the 250 ms write limit of the SD specification
+
+//error causes
+#define SD_ERR_NONE					0
+#define SD_ERR_CMD_TIMEOUT			1										//no response to a command
+#define SD_ERR_DATA_TIMEOUT			2										//no data block within DTIMER
+#define SD_ERR_DATA_CRC				3										//data CRC fail (or negative CRC token on a write)
+#define SD_ERR_FIFO					4										//SDIO Tx underrun or Rx overrun
+#define SD_ERR_DMA					5										//DMA2 transfer error
+#define SD_ERR_ADDRESS				6										//R1 OUT_OF_RANGE or ADDRESS_ERROR
+#define SD_ERR_BUSY					7										//card busy for longer than SD_BUSY_LIMIT_US
+#define SD_ERR_REFUSED				8										//submit refused: a request in flight or an open stream
+#define SD_ERR_UNDERRUN				9										//continuous write: the refill had no data for the next buffer
+#define SD_ERR_CMD_CRC				10										//response to a command failed its CRC
+#define SD_ERR_CNT					11
+
+//pre-erase hint
+#define SD_PRE_ERASE_MAX			0x7FFFFF								//ACMD23 argument is 23 bits of blocks
+
+//scatter-gather
+#define SD_SG_CHUNK_MAX				511										//blocks in a DMA chunk - NDTR is 16 bits of words
+
+//R1 error bits that end a data command
+#define SD_R1_ADDRESS_ERRORS		((1u<<31) | (1u<<30))
+
+//card states in RESP1 [12:9]
+#define SD_CARD_STATE_STBY			3
+#define SD_CARD_STATE_TRAN			4
+#define SD_CARD_STATE_DATA			5
+#define SD_CARD_STATE_RCV			6
+#define SD_CARD_STATE_PRG			7
+
+typedef struct SD_request_t
+{
+	uint8_t direction;														//SD_ASYNC_READ, SD_ASYNC_WRITE, SD_ASYNC_STREAM_WRITE, SD_ASYNC_STOP or SD_ASYNC_STATUS
+	uint32_t block_addr;													//first block on the card
+	uint16_t block_cnt;														//number of 512 byte blocks
+	uint8_t* buf_ptr;														//data buffer
+	void (*callback)(struct SD_request_t* request);							//called from the IRQ when the request is finished - can be NULL
+	volatile uint8_t state;													//SD_ASYNC_...
+	volatile uint8_t result;												//0 for success, 1 for error
+	uint8_t data_end;														//SDIO side of the data phase is finished
+	uint8_t dma_end;														//DMA side of the data phase is finished
+	uint8_t wait_state;														//card state that ends the request - set by the caller for SD_ASYNC_STATUS only
+	uint16_t poll_us;														//current back-off step
+	uint16_t status_cnt;													//CMD13 sent for this request
+	uint32_t busy_us;														//time spent waiting on the back-off
+	uint8_t error;															//SD_ERR_... of a failed request
+	SD_lat_stamps_t lat;													//cycle counter stamps of the request (see SDcard_SDIO_latency.h)
+	const SD_segment_t* seg;												//scatter-gather list instead of buf_ptr - NULL for a single buffer
+	uint8_t seg_cnt;														//segments in the list
+	uint8_t seg_idx;														//segment of the next chunk to give to the DMA
+	uint16_t seg_blk;														//block of the next chunk within its segment
+	uint16_t chunk_blk;														//blocks in a DMA chunk
+	uint16_t chunk_cnt;														//chunks in the request
+	uint16_t chunk_loaded;													//chunks given to the DMA
+	uint16_t chunk_done;													//chunks the DMA has finished
+	uint8_t chunk_beats;													//memory beats all segments allow - SDIO_DMA_... (see SDIO_DMA2_Beats)
+	SD_refill_t refill;														//continuous write: fills the buffer the DMA has left - NULL otherwise
+	uint32_t pre_erase_cnt;													//ACMD23 pre-erase hint sent ahead of a CMD25 - 0 for none
+} SD_request_t;
+
+//LOCAL VARIABLE
+
+//EXTERNAL VARIABLE
+extern SD_request_t* volatile SD_async_request;								//the request in flight, NULL if there is none
+extern volatile uint8_t SD_stream_open;										//an open-ended CMD25 is running, the card is in "rcv"
+extern volatile uint32_t SD_stream_next_addr;								//the block a streaming request must start at to continue the stream
+extern volatile uint32_t SD_status_cmd_cnt;									//CMD13 sent since power up
+extern volatile uint16_t SD_status_cmd_last;								//CMD13 sent for the last finished request
+extern volatile uint32_t SD_wait_sleep_cnt;									//times SDcard_Async_wait went to sleep
+extern volatile uint8_t SD_error_last;										//cause of the last failed request
+extern volatile uint32_t SD_error_cnt[SD_ERR_CNT];							//errors seen by the IRQs, per cause
+
+//FUNCTION PROTOTYPES
+uint8_t SDcard_Async_submit(SD_request_t* request);							//start a request, gives back 1 if another one is still in flight
+uint8_t SDcard_Async_busy(void);											//1 while a request is in flight
+uint8_t SDcard_Async_wait(SD_request_t* request);							//block until the request is finished, gives back its result
+void SDcard_Async_step(uint8_t event);										//advance the state machine - called by the SDIO, DMA and TIM7 IRQs
+uint8_t SDcard_Async_error(uint8_t error);									//report an error from an IRQ, gives back 1 if no request was in flight to take it
+
+#endif /* INC_SDCARD_SDIO_ASYNC_H_ */
@@ -15,6 +15,9 @@
  */
 
 #include <SDcard_SDIO_diskio.h> /* Declarations of disk functions */
+#include <SDcard_SDIO_async.h>
+#include "ff.h"
+#include "string.h"
 
 
 /*-----------------------------------------------------------------------*/
@@ -24,6 +27,123 @@
   uint16_t Tx_timeout_cnt;  //this will be decreased by an IRQ
   uint16_t Rx_timeout_cnt;  //this will be decreased by an IRQ
 
+/*
+
+The card is selected by the first data access and then stays selected (see SD_card_selected in the driver).
+It is only de-selected when a command that needs "stby" is sent (CMD9 for GET_SECTOR_COUNT) - the driver does that by itself.
+
+Writes are streamed: disk_write leaves the card in "rcv" after an open-ended CMD25, so a following write that continues at the next sector costs no command at all.
+A write of DISK_PRE_ERASE_SECTORS or more that opens the stream sends its sector count as ACMD23 pre-erase hint ahead of the CMD25 (a cluster of a recording, typically).
+A caller that knows how long its stream will be announces it with CTRL_PRE_ERASE: the next write that starts at that sector opens a new stream and sends the whole length as hint, however short the write itself is.
+Anything else (a non-sequential write, a read, a sync or a CSD readout) closes the stream first with CMD12.
+
+*/
+
+/*
+
+Reads are prefetched: when a disk_read continues where the previous one ended, the next DISK_READAHEAD_SECTORS sectors are fetched with a non-blocking CMD18 into a buffer of our own.
+The next disk_read waits for it (usually it is long done) and is served from RAM as far as the buffer goes.
+The buffer is refilled only once it is used up. Writes overlapping it invalidate it.
+A prefetch never reaches past the last sector of the card (disk_sector_cnt, from the CSD at init). One that fails is dropped and the card is recovered as after a failed read - the sectors are read again when they are asked for.
+
+*/
+
+static uint8_t disk_ra_buf[(DISK_READAHEAD_SECTORS ? DISK_READAHEAD_SECTORS : 1) * 512] __attribute__((aligned(4)));
+static SD_request_t disk_ra_request;
+static uint8_t disk_ra_inflight;														//prefetch submitted and not yet collected
+static LBA_t disk_ra_start;																//first sector in the buffer
+static UINT disk_ra_cnt;																//valid sectors in the buffer
+static LBA_t disk_ra_next = 0xFFFFFFFF;													//where the next sequential read would start
+static LBA_t disk_sector_cnt;															//size of the card, 0 until it is known
+
+static LBA_t disk_pe_sector;															//start of the announced stream
+static LBA_t disk_pe_cnt;																//its length in sectors, 0 if nothing is announced
+
+uint32_t disk_readahead_hit_cnt;
+uint32_t disk_readahead_miss_cnt;
+
+static uint8_t disk_readahead_holds(LBA_t sector) {
+
+  return ((disk_ra_cnt != 0) && (sector >= disk_ra_start) && (sector < (disk_ra_start + disk_ra_cnt)));
+
+}
+
+static void disk_readahead_settle(void) {
+
+  if(disk_ra_inflight) {
+
+    uint8_t retry_cnt = 0;
+
+    disk_ra_cnt = (SDcard_Async_wait(&disk_ra_request) == 0) ? disk_ra_request.block_cnt : 0;
+
+    disk_ra_inflight = 0;
+
+    if (disk_ra_cnt == 0) SDIO_Recover(SD_error_last, &retry_cnt);					//back to "tran" - the prefetch itself is not tried again
+
+  }
+
+}
+
+/*
+
+A failed transfer goes through SDIO_Recover: the card is brought back to "tran" (CMD12 if it is stuck in a transfer), then the transfer is tried again.
+A repeated CRC or FIFO error slows the SDIO clock by one CLKDIV step, at the PLLQ SDIO_Clock_negotiate picked (the PLL is never stopped at runtime), anything else is retried after an exponential back-off.
+The step down costs a retry and happens once per transfer at most. Every transfer starts with SDIO_Clock_restore, which climbs back up once the errors have stopped.
+What is left after SD_RETRY_MAX retries is passed up to FatFs with the DRESULT that matches the cause.
+
+*/
+
+static DRESULT disk_result(uint8_t result) {
+
+  if (result == 0) return RES_OK;
+
+  switch (SD_error_last) {
+
+    case SD_ERR_ADDRESS:
+      return RES_PARERR;																//sector beyond the card
+
+    case SD_ERR_CMD_TIMEOUT:
+    case SD_ERR_BUSY:
+    case SD_ERR_REFUSED:
+      return RES_NOTRDY;																//the card does not answer or is hung
+
+    default:
+      return RES_ERROR;																	//the data did not make it
+
+  }
+
+}
+
+/*
+
+The card is locked for the whole disk_read, disk_write and disk_ioctl call (FF_DISK_LOCK of ffsystem.c), not just by the FatFs volume lock.
+The recorder writes its extent with disk_write past FatFs, so the volume lock alone would let it run into a f_read of another task.
+The lock is created by the first disk_initialize. Without FF_FS_REENTRANT there is only one task and the lock is a no-op.
+
+*/
+
+#if FF_FS_REENTRANT
+static uint8_t disk_lock_ready;
+#endif
+
+static uint8_t disk_lock(void) {
+
+#if FF_FS_REENTRANT
+  if (disk_lock_ready && !ff_mutex_take(FF_DISK_LOCK)) return 0;						//timed out after FF_FS_TIMEOUT
+#endif
+
+  return 1;
+
+}
+
+static void disk_unlock(void) {
+
+#if FF_FS_REENTRANT
+  if (disk_lock_ready) ff_mutex_give(FF_DISK_LOCK);
+#endif
+
+}
+
 /*-----------------------------------------------------------------------*/
 /* Get Drive Status                                                      */
 /*-----------------------------------------------------------------------*/
@@ -56,22 +176,53 @@ Fatfs doesn't care, how it is done. It just wants the card running and a valid s
 
 Write protect doesn't work in our card so that answer is discarded.
 
+FatFs calls it again on every forced mount. Before CMD0, the request in flight (a prefetch, mostly) is waited for, the read-ahead buffer is dropped and an open stream is forgotten - the reset ends it on the card.
+
 */
 
 DSTATUS disk_initialize(
   BYTE pdrv /* Physical drive nmuber to identify the drive */
 ) {
 
+#if FF_FS_REENTRANT
+  if (!disk_lock_ready) disk_lock_ready = (uint8_t) ff_mutex_create(FF_DISK_LOCK);
+#endif
+
+  if (!disk_lock()) return STA_NOINIT;
+
+  SD_request_t* inflight = SD_async_request;
+
+  if (inflight != NULL) SDcard_Async_wait(inflight);										//a prefetch (or any other request) must be over before CMD0 - its result does not matter anymore
+
+  disk_ra_inflight = 0;
+  disk_ra_cnt = 0;																		//the read-ahead buffer may hold sectors of another card
+  disk_ra_next = 0xFFFFFFFF;
+  disk_pe_cnt = 0;
+
+  SD_stream_open = 0;																	//CMD0 takes the card out of "rcv" without a CMD12
+  SD_stream_next_addr = 0xFFFFFFFF;
+
   uint8_t init_result = SDCard_Card_ID_Mode_w_SDIO();
 
   SDIO_speed_change();																	//we change the SDIO clocking to 4 MHz from 200 kHz
 
+  if (init_result == 0)  {
+
+	  disk_sector_cnt = SDCard_Card_Sector_cnt_w_SDIO();								//card is still in "stby", as CMD9 needs it - the read-ahead must not go past it
+
+  }
+
   SDIO_Select_Card();																	//we select the card
 
   SDIO_Change_bus_width();																//we change the bus width to 4-wide
 
-  SDIO_DeSelect_Card();																	//we de-select the card
-  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: certain commands sent by FATfs should be done on a non-selected card, so we de-select the card when not interfacing with it directly
+  SDIO_Clock_negotiate();																//high speed if the card has it, then the fastest SDIO_CK that reads back clean
+  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: if nothing works, we stay at 4 MHz as before
+
+  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: the card is left selected for the data accesses that follow
+  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Commands that need a non-selected card (CMD9) de-select it by themselves
+
+  disk_unlock();
 
   return init_result;
 }
@@ -103,6 +254,8 @@ DRESULT disk_ioctl(
 
   DRESULT response = RES_ERROR;  //this is our response byte, resets to R/W error
 
+  if (!disk_lock()) return RES_NOTRDY;
+
   switch (cmd) {
 
     //----SECTOR COUNT command----//
@@ -111,6 +264,9 @@ DRESULT disk_ioctl(
                             															//we need to send CMD9 to the card and load the reply into the buff pointer
                             															//we extract the csize from the csd and then project the value to the buff pointer
 
+      SDCard_Card_Data_Mode_Stream_Stop_w_SDIO();										//CMD9 needs the card in "stby", so nothing may be running on it
+      disk_readahead_settle();
+
       SDCard_Card_Data_Mode_CSD_w_SDIO();												//Note: the CSD will be in the RESP[1..4] registers of the SDIO
     																					//		CSD comes through the CMD line and is 128 bits
     																					//		CSD was 152 bits on SPI because we captured the entire response
@@ -146,7 +302,32 @@ DRESULT disk_ioctl(
 
     case CTRL_SYNC: {
 
-    	//if we conclude all write operations within disk_write, this can be left blank
+    	//the only write that may still be going on is the streaming one
+
+      uint8_t retry_cnt = 0;
+      uint8_t result;
+
+      do {
+
+    	  result = SDCard_Card_Data_Mode_Stream_Stop_w_SDIO();							//CMD12, then wait until the card is in "tran" - after a recovery only the wait
+
+      } while ((result != 0) && (SDIO_Recover(SD_error_last, &retry_cnt) == 0));
+
+      disk_readahead_settle();
+
+      response = (result == 0) ? RES_OK : RES_ERROR;									//the data is only programmed once the card is confirmed back in "tran"
+    																					//Note: FatFs (f_sync, f_mkfs) treats anything else as a disk error
+
+    } break;
+
+    //----PRE-ERASE command----//
+
+    case CTRL_PRE_ERASE: {
+
+      disk_pe_sector = ((LBA_t *)buff)[0];												//only kept here, the ACMD23 goes out with the write it is meant for
+      disk_pe_cnt = ((LBA_t *)buff)[1];
+
+      response = RES_OK;
 
     } break;
 
@@ -158,6 +339,8 @@ DRESULT disk_ioctl(
 
   }
 
+  disk_unlock();
+
   return response;  //we return "all is well" or RES_OK in fatfs speak
 
 }
@@ -174,29 +357,80 @@ DRESULT disk_read(
   UINT count    /* Number of sectors to read/uint16_t */
 ) {
 
-  DRESULT response = RES_ERROR;
+  uint8_t result = 0;
 
-  uint8_t result;
+  UINT cached = 0;
 
-  SDIO_Select_Card();
+  uint8_t sequential = (sector == disk_ra_next);
 
-	if (count == 1)  {
+  uint8_t retry_cnt = 0;
 
-		/* READ_SINGLE_BLOCK */
-		result = SDCard_Card_Data_Mode_Single_Block_Read_w_SDIO(sector, buff);
+  if (!disk_lock()) return RES_NOTRDY;
 
-  } else {
+  SDCard_Card_Data_Mode_Stream_Stop_w_SDIO();
 
-	  	/* READ_MULTI_BLOCK */
-	  	result = SDCard_Card_Data_Mode_Multi_Block_Read_w_SDIO(sector, buff, count);
+  disk_readahead_settle();
+
+  SDIO_Clock_restore();
+
+  SDIO_Select_Card();																	//only sends CMD7 if the card is not selected yet
+
+  /* From the read-ahead buffer */
+  if (disk_readahead_holds(sector))  {
+
+	  cached = disk_ra_start + disk_ra_cnt - sector;
+	  if (cached > count) cached = count;
+
+	  memcpy(buff, &disk_ra_buf[(sector - disk_ra_start) * 512], cached * 512);
+
+	  disk_readahead_hit_cnt += cached;
 
   }
 
-  SDIO_DeSelect_Card();
+  /* From the card */
+  if (cached < count)  {
 
-  if(result == 0) response = RES_OK;			//Note: for a robust solution, this should generate error messages as well
+	  do {
 
-  return response;  //we return "all is well" or RES_OK in fatfs speak
+		  if ((count - cached) == 1)  {
+
+			  /* READ_SINGLE_BLOCK */
+			  result = SDCard_Card_Data_Mode_Single_Block_Read_w_SDIO(sector + cached, buff + (cached * 512));
+
+		  } else {
+
+			  /* READ_MULTI_BLOCK */
+			  result = SDCard_Card_Data_Mode_Multi_Block_Read_w_SDIO(sector + cached, count - cached, buff + (cached * 512));
+
+		  }
+
+	  } while ((result != 0) && (SDIO_Recover(SD_error_last, &retry_cnt) == 0));
+
+	  disk_readahead_miss_cnt += count - cached;
+
+  }
+
+  disk_ra_next = sector + count;
+
+  /* Prefetch - only once the buffer is used up, so nothing still unread is overwritten, and only up to the end of the card */
+  if ((DISK_READAHEAD_SECTORS != 0) && sequential && (result == 0) && !disk_readahead_holds(disk_ra_next) && (disk_ra_next < disk_sector_cnt))  {
+
+	  disk_ra_start = disk_ra_next;
+	  disk_ra_cnt = 0;
+
+	  disk_ra_request.direction = SD_ASYNC_READ;
+	  disk_ra_request.block_addr = disk_ra_start;
+	  disk_ra_request.block_cnt = ((disk_sector_cnt - disk_ra_start) < DISK_READAHEAD_SECTORS) ? (uint16_t) (disk_sector_cnt - disk_ra_start) : DISK_READAHEAD_SECTORS;
+	  disk_ra_request.buf_ptr = disk_ra_buf;
+	  disk_ra_request.callback = NULL;
+
+	  if (SDcard_Async_submit(&disk_ra_request) == 0) disk_ra_inflight = 1;
+
+  }
+
+  disk_unlock();
+
+  return disk_result(result);  //we return "all is well" or RES_OK in fatfs speak
 }
 
 
@@ -213,30 +447,68 @@ DRESULT disk_write(
   UINT count        /* Number of sectors to write */
 ) {
 
-  DRESULT response = RES_ERROR;
-
   uint8_t result;
 
-  SDIO_Select_Card();
+  uint8_t retry_cnt = 0;
+
+  uint32_t pre_erase_cnt = ((DISK_PRE_ERASE_SECTORS != 0) && (count >= DISK_PRE_ERASE_SECTORS)) ? count : 0;
 
-  if (count == 1)  {
+  uint8_t announced;
 
-		/* WRITE_SINGLE_BLOCK */
-		result = SDCard_Card_Data_Mode_Single_Block_Write_w_SDIO(sector, buff);
+  if (!disk_lock()) return RES_NOTRDY;
 
-  } else {
+  announced = (disk_pe_cnt != 0) && (sector == disk_pe_sector);
 
-	    /* WRITE_SINGLE_BLOCK */
-	  	result = SDCard_Card_Data_Mode_Multi_Block_Write_w_SDIO(sector, buff, count);
+  if (announced) pre_erase_cnt = (disk_pe_cnt > count) ? disk_pe_cnt : count;
+
+  disk_pe_cnt = 0;																		//an announcement is good for the next write only
+
+  disk_readahead_settle();
+
+  SDIO_Clock_restore();
+
+  if ((sector < (disk_ra_start + disk_ra_cnt)) && ((sector + count) > disk_ra_start))  {
+
+	  disk_ra_cnt = 0;																	//the read-ahead buffer is outdated
 
   }
 
-	/* Idle */
+  if (SD_stream_open && ((sector != SD_stream_next_addr) || announced))  {
 
-  SDIO_DeSelect_Card();
+	  SDCard_Card_Data_Mode_Stream_Stop_w_SDIO();										//the sectors are not sequential anymore, or the hint needs a new CMD25
 
-  if(result == 0) response = RES_OK;
+  }
 
-  return response;  //we return "all is well" or RES_OK in fatfs speak
+  SDIO_Select_Card();																	//only sends CMD7 if the card is not selected yet
+
+  /* WRITE_MULTIPLE_BLOCK, open-ended */
+  do {
+
+	  result = SDCard_Card_Data_Mode_Stream_Write_w_SDIO(sector, count, (uint8_t*) buff, pre_erase_cnt);	//after a recovery the stream is closed and the blocks go out again as a new one
+
+  } while ((result != 0) && (SDIO_Recover(SD_error_last, &retry_cnt) == 0));
+
+	/* Card is left selected in "rcv" */
+
+  disk_unlock();
+
+  return disk_result(result);  //we return "all is well" or RES_OK in fatfs speak
 }
 
+
+
+/*-----------------------------------------------------------------------*/
+/* Timestamp                                                             */
+/*-----------------------------------------------------------------------*/
+
+/*
+
+We have no RTC running, so every file gets the fixed date from ffconf.h.
+
+*/
+
+DWORD get_fattime(void) {
+
+  return ((DWORD)(FF_NORTC_YEAR - 1980) << 25) | ((DWORD)FF_NORTC_MON << 21) | ((DWORD)FF_NORTC_MDAY << 16);
+
+}
@@ -12,12 +12,20 @@
 #define INC_SDCARD_SDIO_DISKIO_H_
 
 #include <SDcard_SDIO_driver.h>
+#ifndef SDIO_HOST_EMULATION
 #include "main.h"
+#endif
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* Read-ahead: sectors prefetched in the background once disk_read sees sequential requests (0 disables it) */
+#define DISK_READAHEAD_SECTORS	16
+
+/* Pre-erase: a write of at least this many sectors that opens a stream tells the card with ACMD23 to pre-erase them (0 disables it) */
+#define DISK_PRE_ERASE_SECTORS	8
+
 /* Status of Disk Functions */
 typedef unsigned char	BYTE;	/* char must be 8-bit */
 typedef BYTE	DSTATUS;
@@ -45,6 +53,9 @@ DRESULT disk_read (BYTE pdrv, BYTE* buff, LBA_t sector, UINT count);
 DRESULT disk_write (BYTE pdrv, const BYTE* buff, LBA_t sector, UINT count);
 DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
 
+extern uint32_t disk_readahead_hit_cnt;		/* sectors served from the read-ahead buffer */
+extern uint32_t disk_readahead_miss_cnt;	/* sectors read from the card directly */
+
 
 /* Disk Status Bits (DSTATUS) */
 
@@ -59,7 +70,7 @@ DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
 #define CTRL_SYNC			0	/* Complete pending write process (needed at FF_FS_READONLY == 0) */
 #define GET_SECTOR_COUNT	1	/* Get media size (needed at FF_USE_MKFS == 1) */
 #define GET_SECTOR_SIZE		2	/* Get sector size (needed at FF_MAX_SS != FF_MIN_SS) */
-//#define GET_BLOCK_SIZE		3	/* Get erase block size (needed at FF_USE_MKFS == 1) */
+#define GET_BLOCK_SIZE		3	/* Get erase block size (needed at FF_USE_MKFS == 1) */
 //#define CTRL_TRIM			4	/* Inform device that the data on the block of sectors is no longer used (needed at FF_USE_TRIM == 1) */
 
 /* Generic command (Not used by FatFs) */
@@ -83,6 +94,9 @@ DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
 //#define ATA_GET_MODEL		21	/* Get model name */
 //#define ATA_GET_SN			22	/* Get serial number */
 
+/* Driver specific ioctl command */
+#define CTRL_PRE_ERASE		64	/* Announce the length of the next write: LBA_t[2] {start sector, sector count} */
+
 #ifdef __cplusplus
 }
 #endif
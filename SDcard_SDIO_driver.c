@@ -12,6 +12,35 @@
 //FATFS compliant version
 
 #include <SDcard_SDIO_driver.h>
+#include <SDcard_SDIO_async.h>
+#include <string.h>
+
+uint16_t SD_RCA = 0x0;																//the RCA generated for the card (see CMD3)
+uint8_t SD_card_selected = 0;														//the card is selected ("tran" or any of the data states) - see CMD7
+
+uint8_t SD_high_speed = 0;															//CMD6 switched the card to high speed
+uint8_t SD_clock_rung = SD_CLK_RUNG_CNT - 1;										//the rung SDIO_speed_change puts us on
+uint8_t SD_clock_slow_steps = 0;													//CLKDIV steps below the rung - fallbacks not undone yet
+uint32_t SD_clock_hz = 0;
+uint32_t SD_dtimer_read = 0xFFFF;													//until the clock is known
+uint32_t SD_dtimer_write = 0xFFFF;
+volatile uint32_t SD_crc_error_cnt = 0;
+uint32_t SD_recover_cnt = 0;
+static uint16_t SD_clock_clean_cnt = 0;												//transfers since the last CRC or FIFO error
+static uint8_t SD_clock_dropped = 0;												//the transfer under recovery has already stepped the clock down
+static uint8_t SD_stream_stop_failed = 0;											//the last CMD12 was not confirmed - the stream may still be open on the card
+
+static const uint8_t SD_clock_ladder_pllq[SD_CLK_RUNG_CNT] = {3, 4, 5, 3, 4, 3, 3, 8};
+static const uint8_t SD_clock_ladder_div[SD_CLK_RUNG_CNT] = {SD_CLK_BYPASS, SD_CLK_BYPASS, SD_CLK_BYPASS, 0, 0, 1, 2, 2};
+																					//the last rung is PLLQ 8 with DIV4 - the 4 MHz we have always been using
+
+static uint8_t SD_clock_ref_buf[512] __attribute__((aligned(4)));					//the scratch block as read at the safe clock
+static uint8_t SD_clock_test_buf[512] __attribute__((aligned(4)));					//the scratch block as read back at the clock under test, also used for SCR and CMD6 status
+static uint32_t SD_clock_test_block;												//last block of the card - written and read back at each rung
+
+static uint8_t SDIO_Card_state_SD(void);
+static void SDIO_Data_timeout_update(void);
+static uint8_t SDIO_Clock_divide(uint8_t steps);
 
 //1)SDcard init
 uint8_t SDCard_Card_ID_Mode_w_SDIO(void) {  //fatfs demands "DRSTATUS" as an output. DRSTATUS if a BYTE that is "0" for success, "1" for no init and "2" for no disk. Reset value is 0x1.
@@ -38,6 +67,13 @@ uint8_t SDCard_Card_ID_Mode_w_SDIO(void) {  //fatfs demands "DRSTATUS" as an out
   SDIO->CMD &= ~(1<<9);											//CMDPEND not used
 //  SDIO->CMD |= (1<<8);										//bit 8 set removes CPSM timeout and activates interrupts instead. We stay with the timeout.
 
+  SD_card_selected = 0;											//CMD0 puts the card back to "idle"
+  SD_high_speed = 0;												//...and to default speed on a 1-wide bus
+
+  if(((RCC->PLLCFGR >> 24) & 0xF) != 8) SysClock_Set_PLLQ(8);		//a previous negotiation may have moved the SDIOCLK
+  SDIO->CLKCR &= ~((1<<10) | (3<<11) | (0xFF<<0));				//no bypass, 1-wide bus
+  SDIO->CLKCR |= (80<<0);										//ID mode must stay below 400 kHz
+
   SDIO_Host_Card_CMD_write(CMD0_CMD, 0x0, CMD0_ARG);     		//we send the idle command
   	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//CMD0 has no response
   	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//CMD0 ARG is dummy
@@ -86,10 +122,10 @@ uint8_t SDCard_Card_ID_Mode_w_SDIO(void) {  //fatfs demands "DRSTATUS" as an out
   SDIO_Host_Card_CMD_write(ACMD41_CMD, 0x4010, 0x0);       	   //ACMD41	-	we send HCS HIGH to the card
     															 //Note: ACMD41 has a full 32 bit argument unlike other commands which are RCA+ARG
 
-  while((SDIO->STA & (1<<0)) != (1<<0));					    //while response without CRC is not received
-  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	    //here we poll and not use interrupts
+  while(CMDREND_flag);										    //while response without CRC is not received
+  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	    //the IRQ takes the CCRCFAIL of the R3 response as CMDREND
 
-  SDIO->ICR |= (1<<0);										    //clear STA flag
+  CMDREND_flag = 1;
 
   ID_mode_response_buf = SDIO->RESP1;
 
@@ -130,6 +166,7 @@ void SDIO_speed_change(void){
 	/*
 	 * We change the SDIO speed to 4 MHz
 	 * Note: clocking is very tricky. The SDIO source must be clocked half as fast as the DMA. Also, the CLKDIV can't be any value...
+	 * This is the safe speed that works with any card - SDIO_Clock_negotiate goes faster once the card is selected and on the 4-wide bus
 	 *
 	 */
 
@@ -137,6 +174,11 @@ void SDIO_speed_change(void){
 
 	  SDIO->CLKCR |= (2<<0);									//DIV4
 
+	  SD_clock_rung = SD_CLK_RUNG_CNT - 1;
+	  SD_clock_slow_steps = 0;
+	  SD_clock_hz = SysClock_SDIOCLK_Hz() / 4;
+	  SDIO_Data_timeout_update();
+
 }
 
 //3)
@@ -147,18 +189,31 @@ void SDIO_Select_Card(void){
 	 * This function activates the selected card
 	 * SD_RCA is generated within the init function (see CMD3)
 	 * after this section, the card should be in "tran" state
+	 * The card stays selected until a command needs it in "stby", so the function does nothing if it is already selected
+	 * Note: CMD7 to an already selected card is an illegal command that would time out
 	 *
 	 */
 
+	if(SD_card_selected) return;
+
 	//1)select card
 	SDIO_Host_Card_CMD_write(CMD7_CMD, SD_RCA, CMD7_ARG);			//CMD7
 			 	 	 	 	 	 	 	 	 	 	 	 	 	 	//CMD7 has R1b SHORT response
 		 	  	  	  	  	  	 	 	 	 	 	 	 	 	 	//CMD7 ARG is RCA with dummy
 		  	  	  	  	  	  	  	  	  	  	  	  	  	  	    //RESPCMD is "7"
-	while(CMDREND_flag);
+	while(CMDREND_flag && CMDERR_flag);
 
 	CMDREND_flag = 1;
 
+	if(CMDERR_flag == 0){
+
+		CMDERR_flag = 1;											//no answer - the next access tries again
+		return;
+
+	}
+
+	SD_card_selected = 1;
+
 }
 
 //4)
@@ -168,9 +223,14 @@ void SDIO_DeSelect_Card(void){
 	 * This function activates the selected card
 	 * SD_RCA is generated within the init function
 	 * after this section, the card should be in "stb" state - and not be selected
+	 * An open streaming write is closed first (CMD12), since CMD7 is not accepted in "rcv"
 	 *
 	 */
 
+	if(!SD_card_selected) return;
+
+	SDCard_Card_Data_Mode_Stream_Stop_w_SDIO();
+
 	//1)select card
 	SDIO_Host_Card_CMD_write(CMD77_CMD, 0x0, CMD7_ARG);				//CMD7
 			 	 	 	 	 	 	 	 	 	 	 	 	 	 	//CMD7 has R1b SHORT response - only if card is selected
@@ -180,6 +240,8 @@ void SDIO_DeSelect_Card(void){
 																	//here we poll and not use interrupts
 	SDIO->ICR |= (1<<7);
 
+	SD_card_selected = 0;
+
 }
 
 //5)
@@ -216,50 +278,17 @@ uint8_t SDCard_Card_Data_Mode_Single_Block_Write_w_SDIO(uint32_t start_write_blo
 
 	/*
 	 *
-	 * We read one block of data from an address
+	 * We write one block of data to an address
 	 * A block is 512 bytes
+	 * The transfer itself is run by the IRQs (see SDcard_SDIO_async.c), we just wait for it to finish
 	 *
 	 */
 
-	  SDIO->DCTRL &= ~(1<<0);										//turn off DPSM
-	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  		//Note: a full DCTRL reset is necessary between transfers
-
-	  SDIO->DTIMER = 0xFFFF;										//timeout value in SCK ticks
-																	//this starts to count down when the command module is in "wait" or "busy"
-																	//if tripped, it raises a flag
-	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: we aren't actually using this
-
-	  SDIO->DLEN = 512;												//we read out one SD block at a time
-
-	  SDIO->DCTRL &= ~(1<<2);										//block mode
-	  	  	  	  	  	  	  	  	  	  	  	  	  	  			//Note: stream mode is not available on SD cards
-	  SDIO->DCTRL &= ~(1<<1);										//data direction is from MCU to card
-
-	  SDIO->DCTRL |= (1<<3);										//DMA enabled
+	  SD_request_t request = {.direction = SD_ASYNC_WRITE, .block_addr = start_write_block_addr, .block_cnt = 1, .buf_ptr = write_buf_ptr};
 
-	  DMA2_Stream3->M0AR = write_buf_ptr;							//we connect the DMA to the memory buffer
+	  if(SDcard_Async_submit(&request) != 0) return 1;				//a non-blocking transfer is still running
 
-	  DMA2_Stream3->CR |= (1<<0);									//DMA Tx side enabled
-
-	  SDIO->DCTRL |= (9<<4);										//block size of 512 bytes	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: this means that the CRC will come after 512 bytes
-
-	  SDIO_Host_Card_REG_upd(CMD24_CMD, start_write_block_addr);
-
-	  while(CMDREND_flag);											//while response with CRC is not received
-	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  		//Note: this must be sent over before we activate the DPSM, otehrwise we might time out
-	  CMDREND_flag = 1;
-
-	  SDIO->DCTRL |= (1<<0);										//enable DPSM
-
-	  while(DATAREND_flag);
-
-	  DATAREND_flag = 1;
-
-	  SDIO_Wait_for_idle_SD();										//wai until card is idle again ("tran" state)
-
-	  DMA2_Stream3->CR &= ~(1<<0);									//DMA Tx side disabled
-
-	  return 0;
+	  return SDcard_Async_wait(&request);
 
 }
 
@@ -267,165 +296,132 @@ uint8_t SDCard_Card_Data_Mode_Single_Block_Write_w_SDIO(uint32_t start_write_blo
 uint8_t SDCard_Card_Data_Mode_Single_Block_Read_w_SDIO(uint32_t start_read_block_addr, uint8_t* read_buf_ptr) {
 
 	/*
-	 * Writes a single 512 byte block to the SDcard.
+	 * Reads a single 512 byte block from the SDcard.
 	 */
 
-	  SDIO->DCTRL &= ~(1<<0);										//turn off DPSM
-	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  		//Note: a full DCTRL reset is necessary between transfers
-
-	  SDIO->DTIMER = 0xFFFF;										//timeout value in SCK ticks
-
-	  SDIO->DLEN = 512;												//we write one block at a time
-
-	  SDIO->DCTRL &= ~(1<<2);										//block mode
-
-	  SDIO->DCTRL |= (1<<1);										//data direction is from card to MCU
-
-	  SDIO->DCTRL |= (1<<3);										//DMA enabled
+	  SD_request_t request = {.direction = SD_ASYNC_READ, .block_addr = start_read_block_addr, .block_cnt = 1, .buf_ptr = read_buf_ptr};
 
-	  DMA2_Stream6->M0AR = read_buf_ptr;							//we want the data to be funnelled to the memory buffer
+	  if(SDcard_Async_submit(&request) != 0) return 1;
 
-	  DMA2_Stream6->CR |= (1<<0);									//DMA Rx side enabled
-
-	  SDIO->DCTRL |= (9<<4);										//block size of 512 bytes
-	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  		//Note: this means that the CRC will come after 512 bytes
-	  SDIO_Host_Card_REG_upd(CMD17_CMD, start_read_block_addr);		//CMD17
-		 	 	 	 	 	 	 	 	 	 	 	 	 	 		//CMD17 has R1 SHORT response
-	 	  	  	  	  	  	 	 	 	 	 	 	 	 	 		//CMD17 ARG is data address
-	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//RESPCMD is "17"
-
-	  while(CMDREND_flag);											//while response with CRC is not received
-
-	  CMDREND_flag = 1;
-
-	  SDIO->DCTRL |= (1<<0);
-
-	  while(DATAREND_flag);
-
-	  DATAREND_flag = 1;
-
-	  SDIO_Wait_for_idle_SD();
-
-	  DMA2_Stream6->CR &= ~(1<<0);									//DMA Rx side disabled
-
-	  return 0;
+	  return SDcard_Async_wait(&request);
 
 }
 
-//8)SDIO SD single write
-uint8_t SDCard_Card_Data_Mode_Multi_Block_Write_w_SDIO(uint32_t start_write_block_addr, uint16_t write_block_cnt, uint8_t* write_buf_ptr) {
+//8)SDIO SD multi write
+uint8_t SDCard_Card_Data_Mode_Multi_Block_Write_w_SDIO(uint32_t start_write_block_addr, uint16_t write_block_cnt, uint8_t* write_buf_ptr, uint32_t pre_erase_cnt) {
 
 	/*
 	 * Write multiple blocks
-	 * Note: we don't need CMD12 to close the transmission!
+	 * Note: we don't need CMD12 to close the transmission since CMD23 is sent ahead!
+	 * pre_erase_cnt is the ACMD23 hint, in blocks, that tells the card to erase them ahead of the data (0 for none, write_block_cnt for the blocks written)
 	 *
 	 */
 
-	  SDIO->DCTRL &= ~(1<<0);									//turn off DPSM
+	  SD_request_t request = {.direction = SD_ASYNC_WRITE, .block_addr = start_write_block_addr, .block_cnt = write_block_cnt, .buf_ptr = write_buf_ptr};
 
-	  SDIO->DTIMER = 0xFFFF;									//timeout value in SCK ticks
+	  request.pre_erase_cnt = pre_erase_cnt;
 
-	  SDIO->DLEN = (write_block_cnt * 512);						//we write one SD block at a time
+	  if(SDcard_Async_submit(&request) != 0) return 1;
 
-	  SDIO->DCTRL &= ~(1<<2);									//block mode
+	  return SDcard_Async_wait(&request);
 
-	  SDIO->DCTRL &= ~(1<<1);									//data direction is from MCU to card
-
-	  SDIO->DCTRL |= (1<<3);									//DMA enabled
-
-	  DMA2_Stream3->M0AR = write_buf_ptr;
-
-	  DMA2_Stream3->CR |= (1<<0);								//DMA Tx side enabled
+}
 
-	  SDIO->DCTRL |= (9<<4);									//block size of 512 bytes	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: this means that the CRC will come after 512 bytes
+//9)SDIO SD multi read
+uint8_t SDCard_Card_Data_Mode_Multi_Block_Read_w_SDIO(uint32_t start_read_block_addr, uint16_t read_block_cnt, uint8_t* read_buf_ptr) {
 
-	  SDIO_Host_Card_REG_upd(CMD23_CMD, write_block_cnt);		//block count sent
+	/*
+	 *
+	 * Reads multiple 512 byte blocks from the SDcard.
+	 *
+	 */
 
-	  while(CMDREND_flag);
-	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: this must be sent over before we activate the DPSM, otehrwise we might time out
-	  CMDREND_flag = 1;
+	  SD_request_t request = {.direction = SD_ASYNC_READ, .block_addr = start_read_block_addr, .block_cnt = read_block_cnt, .buf_ptr = read_buf_ptr};
 
-	  SDIO_Host_Card_REG_upd(CMD25_CMD, start_write_block_addr);//multi-write CMD sent
+	  if(SDcard_Async_submit(&request) != 0) return 1;
 
-	  while(CMDREND_flag);										//while response with CRC is not received
-	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: this must be sent over before we activate the DPSM, otehrwise we might time out
-	  CMDREND_flag = 1;
+	  return SDcard_Async_wait(&request);
 
-	  SDIO_Wait_for_rcv_SD();
+}
 
-	  SDIO->DCTRL |= (1<<0);									//activate DPSM after the card is sent for reception
+//10)SDIO SD streaming write
+uint8_t SDCard_Card_Data_Mode_Stream_Write_w_SDIO(uint32_t start_write_block_addr, uint16_t write_block_cnt, uint8_t* write_buf_ptr, uint32_t pre_erase_cnt) {
 
-	  while(DATAREND_flag);
+	/*
+	 * Writes blocks into an open-ended multi-block write
+	 * The first call sends CMD25 (without CMD23), later calls that continue at SD_stream_next_addr only run the data phase
+	 * The card is left in "rcv" - the stream must be closed with SDCard_Card_Data_Mode_Stream_Stop_w_SDIO
+	 * pre_erase_cnt only counts for the call that opens the stream: it is the ACMD23 hint, in blocks, and may reach past the blocks of that call (0 for none)
+	 *
+	 */
 
-	  DATAREND_flag = 1;
+	  SD_request_t request = {.direction = SD_ASYNC_STREAM_WRITE, .block_addr = start_write_block_addr, .block_cnt = write_block_cnt, .buf_ptr = write_buf_ptr};
 
-	  SDIO_Wait_for_idle_SD();
+	  request.pre_erase_cnt = pre_erase_cnt;
 
-	  DMA2_Stream3->CR &= ~(1<<0);								//DMA Tx side disabled
+	  if(SDcard_Async_submit(&request) != 0) return 1;				//a transfer is running or the address does not continue the stream
 
-	  return 0;
+	  return SDcard_Async_wait(&request);
 
 }
 
-//9)SDIO SD single read
-uint8_t SDCard_Card_Data_Mode_Multi_Block_Read_w_SDIO(uint32_t start_read_block_addr, uint16_t read_block_cnt, uint8_t* read_buf_ptr) {
+//11)SDIO SD streaming write close
+uint8_t SDCard_Card_Data_Mode_Stream_Stop_w_SDIO(void) {
 
 	/*
-	 *
-	 * Writes a single 512 byte block to the SDcard.
+	 * Closes the open-ended write with CMD12 and waits until the card has programmed everything ("tran" state)
+	 * The wait is on DAT0 and the TIM7 back-off, not on a CMD13 loop (see SDcard_SDIO_async.h)
+	 * Does nothing if no stream is open - unless the last close failed: the stream is then gone from the driver, but not confirmed on the card
+	 * After a failed close the card is asked where it is: still in "rcv" (or "data"), the CMD12 is sent again, otherwise we wait for "tran"
 	 *
 	 */
 
-	  SDIO->DCTRL &= ~(1<<0);									//turn off DPSM
-	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: a full DCTRL reset is necessary between transfers
-
-
-	  SDIO->DTIMER = 0xFFFF;									//timeout value in SCK ticks
-																//this starts to count down when the command module is in "wait" or "busy"
-																//if tripped, it raises a flag
-
-	  SDIO->DLEN = (read_block_cnt * 512);											//we read out one block at a time
+	  if(!SD_stream_open && !SD_stream_stop_failed) return 0;
 
-	  SDIO->DCTRL &= ~(1<<2);									//block mode
-	  	  	  	  	  	  	  	  	  	  	  	  	  	  		//Note: stream mode is not available on SD cards
-	  SDIO->DCTRL |= (1<<1);									//data direction is from card to MCU
+	  SD_request_t request = {.direction = SD_ASYNC_STOP};
+	  uint8_t result;
+	  uint8_t card_state = SD_CARD_STATE_RCV;								//an open stream is closed right away
 
-	  SDIO->DCTRL |= (1<<3);									//DMA enabled
+	  if(!SD_stream_open && !SDcard_Async_busy()) card_state = SDIO_Card_state_SD();
 
-	  DMA2_Stream6->M0AR = read_buf_ptr;						//we want the data to be read from the SDIO FIFO register
+	  if((card_state != SD_CARD_STATE_RCV) && (card_state != SD_CARD_STATE_DATA)){
 
-	  DMA2_Stream6->CR |= (1<<0);								//DMA Rx side enabled
+		  request.direction = SD_ASYNC_STATUS;
+		  request.wait_state = SD_CARD_STATE_TRAN;
 
-	  SDIO->DCTRL |= (9<<4);									//block size of 512 bytes
-	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: this means that the CRC will come after 512 bytes
+	  }
 
-	  SDIO_Host_Card_REG_upd(CMD23_CMD, read_block_cnt);		//block count sent
+	  if(SDcard_Async_submit(&request) != 0) return 1;
 
-	  while(CMDREND_flag);										//while response with CRC is not received
-	  	  	  	  	  	  	  	  	  	  	  	  	  	  	  	//Note: this must be sent over before we activate the DPSM, otehrwise we might time out
-	  CMDREND_flag = 1;
+	  result = SDcard_Async_wait(&request);
 
-	  SDIO->DCTRL |= (1<<0);									//we enable first the DPSM
+	  SD_stream_stop_failed = (result != 0);
 
-	  SDIO_Host_Card_REG_upd(CMD18_CMD, start_read_block_addr);	//once this command is sent, the card will send data to the MCU
+	  return result;
 
-	  while(CMDREND_flag);										//while response with CRC is not received
+}
 
-	  CMDREND_flag = 1;
+//12)
+static void SDIO_Wait_for_state_SD(uint8_t card_state){
 
-	  while(DATAREND_flag);										//wait until the data is received
+	/*
+	 *
+	 * Wait until the card reports card_state in RESP1[12:9]
+	 * Runs as a status request: DAT0 is checked first for "tran", CMD13 retries are spaced out by TIM7, the core sleeps in between
+	 *
+	 */
 
-	  DATAREND_flag = 1;
+	SD_request_t request = {.direction = SD_ASYNC_STATUS};
 
-	  SDIO_Wait_for_idle_SD();
+	request.wait_state = card_state;
 
-	  DMA2_Stream6->CR &= ~(1<<0);								//DMA Rx side disabled
+	if(SDcard_Async_submit(&request) != 0) return;							//a transfer is in flight - it does its own waiting
 
-	  return 0;
+	SDcard_Async_wait(&request);
 
 }
 
-//10)
+//13)
 void SDIO_Wait_for_idle_SD(void){
 
 	/*
@@ -434,97 +430,49 @@ void SDIO_Wait_for_idle_SD(void){
 	 *
 	 */
 
-	//we check the initial values for RESP1
-	//Note: the RESP1 values will reflect on the state of the card when the CMD is received, not taking into consideration the CMD yet...
-
-	SDIO_Host_Card_CMD_write(CMD13_CMD, SD_RCA, CMD13_ARG_CARD_STA);
-
-	while(CMDREND_flag);									//while response with CRC is not received
-
-	CMDREND_flag = 1;
-
-	while(!(((SDIO->RESP1 & (1<<11)) == (1<<11)) && ((SDIO->RESP1 & (1<<10)) != (1<<10)) && ((SDIO->RESP1 & (1<<9)) != (1<<9)))){									//while we are not "data"
-
-			//"tran" is when RESP1[12:9] = 0x4
-			SDIO_Host_Card_CMD_write(CMD13_CMD, SD_RCA, CMD13_ARG_CARD_STA);	//CMD13
-				 	 	 	 	 	 	 	 	 	 	 	 	 	 			//CMD13 has R1 SHORT response
-			 	  	  	  	  	  	 	 	 	 	 	 	 	 	 			//CMD13 ARG is RCA with dummy
-			  	  	  	  	  	  	  	  	  	  	  	  	  	  	    		//RESPCMD is "13"
-
-			while(CMDREND_flag);
-
-			CMDREND_flag = 1;
-
-	 }
+	SDIO_Wait_for_state_SD(SD_CARD_STATE_TRAN);								//"tran" is when RESP1[12:9] = 0x4
 
 }
 
-//11)
+//14)
 void SDIO_Wait_for_rcv_SD(void){
 
 	/*
 	 *
-	 * Wait until card is back in "data" state
+	 * Wait until card is in "rcv" state
 	 *
 	 */
 
-	SDIO_Host_Card_CMD_write(CMD13_CMD, SD_RCA, CMD13_ARG_CARD_STA);
-
-	while(CMDREND_flag);
-
-	CMDREND_flag = 1;
-
-	while(!(((SDIO->RESP1 & (1<<11)) == (1<<11)) && ((SDIO->RESP1 & (1<<10)) == (1<<10)) && ((SDIO->RESP1 & (1<<9)) != (1<<9)))){									//while we are not "rcv"
-
-			//"rcv" is when RESP1[12:9] = 0x6
-			SDIO_Host_Card_CMD_write(CMD13_CMD, SD_RCA, CMD13_ARG_CARD_STA);
-
-			while(CMDREND_flag);
-
-			CMDREND_flag = 1;
-
-	 }
+	SDIO_Wait_for_state_SD(SD_CARD_STATE_RCV);								//"rcv" is when RESP1[12:9] = 0x6
 
 }
 
-//12)
+//15)
 void SDIO_Wait_for_data_SD(void){
 
 	/*
 	 *
-	 * Wait until card is back in "data" state
+	 * Wait until card is in "data" state
 	 *
 	 */
 
-	SDIO_Host_Card_CMD_write(CMD13_CMD, SD_RCA, CMD13_ARG_CARD_STA);
-
-	while(CMDREND_flag);
-
-	CMDREND_flag = 1;
-
-	while(!(((SDIO->RESP1 & (1<<11)) == (1<<11)) && ((SDIO->RESP1 & (1<<10)) != (1<<10)) && ((SDIO->RESP1 & (1<<9)) == (1<<9)))){									//while we are not "tran"
-
-			//"data" is when RESP1[12:9] = 0x5
-			SDIO_Host_Card_CMD_write(CMD13_CMD, SD_RCA, CMD13_ARG_CARD_STA);
-
-			while(CMDREND_flag);
-
-			CMDREND_flag = 1;
-
-	 }
+	SDIO_Wait_for_state_SD(SD_CARD_STATE_DATA);								//"data" is when RESP1[12:9] = 0x5
 
 }
 
 
-//13)Extract card capacity
+//16)Extract card capacity
 void SDCard_Card_Data_Mode_CSD_w_SDIO(void) {
 
 	/*
 	 * Ws extract the CSD register
 	 * Note: we assume that we have only one card on the bus, thus the SD_RCA (the card realtive address) is kept as-is.
+	 * CMD9 is only accepted in "stby", so the card is de-selected first if it is still selected
 	 *
 	 */
 
+	SDIO_DeSelect_Card();
+
 	SDIO_Host_Card_CMD_write(CMD9_CMD, SD_RCA, CMD9_ARG);		//CMD9
 		 	 	 	 	 	 	 	 	 	 	 	 	 	 	//CMD9 has R2 LONG response - 136 bits where bits [127:1] is CSD
 	 	  	  	  	  	  	 	 	 	 	 	 	 	 	 	//CMD2 ARG is dummy
@@ -536,9 +484,9 @@ void SDCard_Card_Data_Mode_CSD_w_SDIO(void) {
 
 }
 
-
 
-//14)DEBUG function
+
+//17)DEBUG function
 void SDCard_Card_Data_Mode_SCR_w_SDIO(void) {
 
 	/*
@@ -574,7 +522,7 @@ void SDCard_Card_Data_Mode_SCR_w_SDIO(void) {
 
 	  SDIO->DCTRL &= ~(1<<0);									//turn off DPSM
 
-	  SDIO->DTIMER = 0xFFFF;									//timeout value in SCK ticks
+	  SDIO->DTIMER = SD_dtimer_read;							//timeout value in SCK ticks
 																//this starts to count down when the command module is in "wait" or "busy"
 																//if tripped, it raises a flag
 
@@ -619,7 +567,7 @@ void SDCard_Card_Data_Mode_SCR_w_SDIO(void) {
 
 }
 
-//15)Reboot function
+//18)Reboot function
 //here to remove the double start bug from the SDcard
 void ReBoot(void)
 {
@@ -643,3 +591,488 @@ void ReBoot(void)
 	}
 
 }
+
+
+//19)Clock ladder rung frequency
+static uint32_t SDIO_Clock_rung_hz(uint8_t rung){
+
+	/*
+	 * SDIO_CK of a rung - the VCO is taken from the current PLLQ and SDIOCLK
+	 *
+	 */
+
+	uint32_t sdioclk = (SysClock_SDIOCLK_Hz() * ((RCC->PLLCFGR >> 24) & 0xF)) / SD_clock_ladder_pllq[rung];
+
+	if(SD_clock_ladder_div[rung] == SD_CLK_BYPASS) return sdioclk;
+
+	return sdioclk / (SD_clock_ladder_div[rung] + 2);
+
+}
+
+//20)Put the SDIO on a rung
+static void SDIO_Clock_apply(uint8_t rung){
+
+	/*
+	 * The SDIO_CK is slowed down to the minimum before PLLQ is moved, so the card never sees a clock above the new one
+	 * Moving PLLQ stops the PLL and runs the core from HSI meanwhile (see SysClock_Set_PLLQ), so this is for SDIO_Clock_negotiate only - at runtime the clock moves by CLKDIV (SDIO_Clock_divide)
+	 * Must not be called while a transfer is running
+	 *
+	 */
+
+	SDIO->CLKCR &= ~(1<<10);									//no bypass
+	SDIO->CLKCR |= (0xFF<<0);									//slowest CLKDIV
+
+	if(((RCC->PLLCFGR >> 24) & 0xF) != SD_clock_ladder_pllq[rung]) SysClock_Set_PLLQ(SD_clock_ladder_pllq[rung]);
+
+	SDIO->CLKCR &= ~(0xFF<<0);
+
+	if(SD_clock_ladder_div[rung] == SD_CLK_BYPASS) SDIO->CLKCR |= (1<<10);		//SDIO_CK = SDIOCLK
+	else SDIO->CLKCR |= (SD_clock_ladder_div[rung]<<0);						//SDIO_CK = SDIOCLK / (CLKDIV + 2)
+
+	SD_clock_rung = rung;
+	SD_clock_slow_steps = 0;
+	SD_clock_hz = SDIO_Clock_rung_hz(rung);
+	SDIO_Data_timeout_update();
+
+}
+
+//21)Short register read on the data lines
+static uint8_t SDIO_Read_Register_SD(uint8_t app_cmd, uint8_t command_index, uint32_t command_arg, uint16_t len, uint8_t block_pow){
+
+	/*
+	 * Reads a status block smaller than 512 bytes (SCR with ACMD51, switch status with CMD6) into SD_clock_test_buf
+	 * Blocking, on the flags - no request may be in flight
+	 * The card must be in "tran"
+	 * Gives back 0 on success, 1 on a data timeout or CRC error
+	 *
+	 */
+
+	uint8_t result;
+
+	SDIO->DCTRL &= ~(1<<0);									//turn off DPSM
+	SDIO->DTIMER = SD_dtimer_read;							//timeout value in SCK ticks
+	SDIO->DLEN = len;
+	SDIO->DCTRL &= ~(1<<2);									//block mode
+	SDIO->DCTRL |= (1<<1);									//data direction is from card to MCU
+	SDIO->DCTRL |= (1<<3);									//DMA enabled
+	SDIO->DCTRL &= ~(0xF<<4);
+	SDIO->DCTRL |= (block_pow<<4);							//block size of 2^block_pow bytes
+
+	SDIO_DMA2_Memory_Setup(DMA2_Stream6, SD_clock_test_buf);
+	DMA2_Stream6->CR |= (1<<0);								//DMA Rx side enabled
+
+	DATAREND_flag = 1;
+	DATAERR_flag = 1;
+
+	if(app_cmd){
+
+		SDIO_Host_Card_CMD_write(CMD55_CMD, SD_RCA, CMD55_ARG);			//CMD55
+
+		while(CMDREND_flag);
+
+		CMDREND_flag = 1;
+
+	}
+
+	SDIO->DCTRL |= (1<<0);									//enable DPSM before the command, the data follows the response right away
+
+	SDIO_Host_Card_REG_upd(command_index, command_arg);
+
+	while(CMDREND_flag);
+
+	CMDREND_flag = 1;
+
+	while(DATAREND_flag && DATAERR_flag);						//data in or failed
+
+	result = (DATAERR_flag == 0);
+
+	DATAREND_flag = 1;
+	DATAERR_flag = 1;
+
+	if(result == 0) while(DMA2_Stream6->CR & (1<<0));		//the stream switches itself off once the FIFO is emptied (peripheral flow control)
+
+	DMA2_Stream6->CR &= ~(1<<0);
+	SDIO->DCTRL &= ~(1<<0);
+
+	return result;
+
+}
+
+//22)Test the current clock
+static uint8_t SDIO_Clock_test(void){
+
+	/*
+	 * Writes the scratch block with the copy taken at the safe clock, then reads it back and compares the two
+	 * A rung can read clean and still fail every write (Tx FIFO underrun when SDIO_CK is too fast for the DMA), so both directions are tried
+	 * The block keeps its content: it is written with what it held, and a rung that garbles it is followed by one that writes it again
+	 * Gives back 0 if the block came through intact both ways
+	 *
+	 */
+
+	memset(SD_clock_test_buf, 0, 512);
+
+	if(SDCard_Card_Data_Mode_Single_Block_Write_w_SDIO(SD_clock_test_block, SD_clock_ref_buf) != 0) return 1;
+
+	if(SDCard_Card_Data_Mode_Single_Block_Read_w_SDIO(SD_clock_test_block, SD_clock_test_buf) != 0) return 1;
+
+	return (memcmp(SD_clock_test_buf, SD_clock_ref_buf, 512) != 0);
+
+}
+
+//23)Clock negotiation
+uint8_t SDIO_Clock_negotiate(void){
+
+	/*
+	 * Goes as fast as the card and the board allow
+	 * 1)Take a reference copy of the scratch block - the last one of the card - at the current (safe) clock
+	 * 2)SCR (ACMD51): CMD6 exists from SD_SPEC 1 (SD 1.10) upwards
+	 * 3)CMD6 check, then switch group 1 to function 1 (high speed) - 50 MHz instead of 25 MHz
+	 * 4)Walk the clock ladder down from the top, skipping rungs the card is not rated for. The first rung that writes the scratch block and reads it back intact is kept.
+	 * The card must already be selected and on the 4-wide bus (see disk_initialize)
+	 * Gives back 0 if a rung was found, 1 if even the slowest one fails (it is left on the slowest)
+	 *
+	 */
+
+	uint32_t card_max_hz = SD_CLK_DEFAULT_SPEED_MAX;
+
+	SDCard_Card_Data_Mode_Stream_Stop_w_SDIO();
+	SD_clock_test_block = SDCard_Card_Sector_cnt_w_SDIO() - 1;
+	SDIO_Select_Card();
+
+	//1)
+	if(SDCard_Card_Data_Mode_Single_Block_Read_w_SDIO(SD_clock_test_block, SD_clock_ref_buf) != 0) return 1;
+
+	//2)
+	if((SDIO_Read_Register_SD(1, ACMD51_CMD, 0x0, 8, 3) == 0) && ((SD_clock_test_buf[0] & 0x0F) >= 1)){
+
+		//3)
+		//the switch status is 512 bits, MSB first: [415:400] group 1 support is in bytes 12/13, [379:376] group 1 selection is the low nibble of byte 16
+		if((SDIO_Read_Register_SD(0, CMD6_CMD, CMD6_ARG_CHECK_HS, 64, 6) == 0) && (SD_clock_test_buf[13] & (1<<1)) && ((SD_clock_test_buf[16] & 0x0F) == 1)){
+
+			if((SDIO_Read_Register_SD(0, CMD6_CMD, CMD6_ARG_SWITCH_HS, 64, 6) == 0) && ((SD_clock_test_buf[16] & 0x0F) == 1)){
+
+				SD_high_speed = 1;								//the card changes its timing within 8 clocks after the status block
+				card_max_hz = SD_CLK_HIGH_SPEED_MAX;
+
+			}
+
+		}
+
+	}
+
+	//4)
+	SD_clock_clean_cnt = 0;
+
+	for(uint8_t rung = 0; rung < SD_CLK_RUNG_CNT; rung++){
+
+		if(SDIO_Clock_rung_hz(rung) > card_max_hz) continue;
+
+		SDIO_Clock_apply(rung);
+
+		if(SDIO_Clock_test() == 0) return 0;
+
+	}
+
+	return 1;
+
+}
+
+//24)Clock fallback
+uint8_t SDIO_Clock_fallback(void){
+
+	/*
+	 * One CLKDIV step down after data CRC errors, at the PLLQ of the negotiated rung (see SDIO_Clock_divide)
+	 * No transfer may be running - an open stream must be closed after the switch, not before (CMD12 is on the CMD line only)
+	 * Gives back 1 if we are already on the slowest step
+	 *
+	 */
+
+	return SDIO_Clock_divide(SD_clock_slow_steps + 1);
+
+}
+
+//25)Card state outside a request
+static uint8_t SDIO_Card_state_SD(void){
+
+	/*
+	 * CMD13 on the flags, gives back RESP1[12:9] or 0xFF if the card does not answer
+	 * No request may be in flight
+	 *
+	 */
+
+	CMDREND_flag = 1;
+	CMDERR_flag = 1;
+
+	SDIO_Host_Card_CMD_write(CMD13_CMD, SD_RCA, CMD13_ARG_CARD_STA);
+
+	while(CMDREND_flag && CMDERR_flag);
+
+	CMDREND_flag = 1;
+
+	if(CMDERR_flag == 0){
+
+		CMDERR_flag = 1;
+		return 0xFF;
+
+	}
+
+	return (uint8_t) ((SDIO->RESP1 >> 9) & 0xF);
+
+}
+
+//26)Error recovery
+uint8_t SDIO_Recover(uint8_t error, uint8_t* retry_cnt){
+
+	/*
+	 * Called after a request failed with error (SD_ERR_..., see SDcard_SDIO_async.h), with the retry counter of the transfer (0 at the start)
+	 * 1)Let the data path run out: a DPSM that was started ahead of its command only stops on its timeout, its flags must not hit the next request
+	 * 2)Abort and re-sync: ask the card where it is (CMD13), close a running transfer with CMD12, wait for "tran", re-select a card that fell back to "stby"
+	 * 3)Pick the retry: a CRC or FIFO error that repeats slows SDIO_CK by one CLKDIV step (SDIO_Clock_fallback), anything else waits SD_RETRY_BACKOFF_US, doubled for each retry
+	 * The step down is one of the retries and is taken once per transfer at most, so a bad sector can't walk the clock down - SDIO_Clock_restore brings it back up
+	 * Address errors, refill underruns and refused submits are not retried - the same request would fail the same way
+	 * Gives back 0 if the transfer should be tried again, 1 if it should be given up
+	 *
+	 */
+
+	uint8_t card_state;
+	uint8_t signal_error;
+
+	SD_recover_cnt++;
+
+	if(*retry_cnt == 0) SD_clock_dropped = 0;						//first failure of the transfer
+
+	//1)
+	SDIO->DCTRL &= ~(1<<0);
+	while(SDIO->STA & ((1<<12) | (1<<13)));							//TXACT/RXACT - at most one DTIMER period
+	SDIO->ICR |= ((1<<1) | (1<<3) | (1<<4) | (1<<5) | (1<<8));		//stale data flags
+	DATAREND_flag = 1;
+	DATAERR_flag = 1;
+
+	if(error == SD_ERR_REFUSED) return 1;
+
+	//2)
+	if(SD_stream_open) SDCard_Card_Data_Mode_Stream_Stop_w_SDIO();	//a broken stream is closed like a good one
+
+	card_state = SDIO_Card_state_SD();
+
+	if((card_state == SD_CARD_STATE_DATA) || (card_state == SD_CARD_STATE_RCV)){
+
+		SD_request_t request = {.direction = SD_ASYNC_STOP};	//CMD12, then wait for "tran"
+
+		if(SDcard_Async_submit(&request) == 0) SDcard_Async_wait(&request);
+
+	} else if(card_state == SD_CARD_STATE_PRG){						//still programming a write
+
+		SDIO_Wait_for_idle_SD();
+
+	} else if(card_state == SD_CARD_STATE_STBY){					//the selection is lost
+
+		SD_card_selected = 0;
+		SDIO_Select_Card();
+
+	}
+
+	if((error == SD_ERR_ADDRESS) || (error == SD_ERR_UNDERRUN)) return 1;
+
+	//3)
+	signal_error = (error == SD_ERR_DATA_CRC) || (error == SD_ERR_FIFO) || (error == SD_ERR_CMD_CRC);
+
+	if(signal_error) SD_clock_clean_cnt = 0;
+
+	if(*retry_cnt >= SD_RETRY_MAX) return 1;
+
+	if(signal_error && (*retry_cnt != 0) && !SD_clock_dropped && (SDIO_Clock_fallback() == 0)){
+
+		SD_clock_dropped = 1;										//failed twice at this clock - one CLKDIV step down, counted as a retry
+		(*retry_cnt)++;
+		return 0;
+
+	}
+
+	Delay_us(SD_RETRY_BACKOFF_US << *retry_cnt);
+
+	(*retry_cnt)++;
+
+	return 0;
+
+}
+
+//27)SDIO SD scatter-gather write
+uint8_t SDCard_Card_Data_Mode_SG_Write_w_SDIO(uint32_t start_write_block_addr, const SD_segment_t* seg, uint8_t seg_cnt) {
+
+	/*
+	 * Writes the segments one after the other into consecutive blocks, with a single CMD23 + CMD25
+	 * The segments can be anywhere in the memory - e.g. the two halves of a wrapped ring buffer - no copy into a bounce buffer is needed
+	 *
+	 */
+
+	  SD_request_t request = {.direction = SD_ASYNC_WRITE, .block_addr = start_write_block_addr};
+
+	  request.seg = seg;
+	  request.seg_cnt = seg_cnt;
+
+	  if(SDcard_Async_submit(&request) != 0) return 1;				//a transfer is running or the list is empty
+
+	  return SDcard_Async_wait(&request);
+
+}
+
+//28)SDIO SD scatter-gather read
+uint8_t SDCard_Card_Data_Mode_SG_Read_w_SDIO(uint32_t start_read_block_addr, const SD_segment_t* seg, uint8_t seg_cnt) {
+
+	/*
+	 * Reads consecutive blocks into the segments one after the other, with a single CMD23 + CMD18
+	 *
+	 */
+
+	  SD_request_t request = {.direction = SD_ASYNC_READ, .block_addr = start_read_block_addr};
+
+	  request.seg = seg;
+	  request.seg_cnt = seg_cnt;
+
+	  if(SDcard_Async_submit(&request) != 0) return 1;
+
+	  return SDcard_Async_wait(&request);
+
+}
+
+//29)SDIO SD continuous write
+uint8_t SDCard_Card_Data_Mode_Continuous_Write_w_SDIO(uint32_t start_write_block_addr, uint32_t write_block_cnt, uint8_t* buf_a, uint8_t* buf_b, uint16_t buf_block_cnt, SD_refill_t refill, uint32_t pre_erase_cnt) {
+
+	/*
+	 * Writes any number of blocks from a pair of buffers of buf_block_cnt blocks each - the RAM needed does not grow with the length
+	 * refill is called for each buffer before it goes out: for both of them by the submit of each request, then from the DMA IRQ each time the DMA has left one
+	 * A stream left open by disk_write is closed first, so the submit is not refused and no refilled data is lost
+	 * It has one buffer time on the bus to fill it, so the pair must be big enough to cover the IRQ latency and the refill itself
+	 * The write is an open-ended CMD25 carried on by requests of SD_CONT_BLOCKS_MAX blocks at most and closed by CMD12 at the end
+	 * A failed write leaves the stream open for SDIO_Recover
+	 * pre_erase_cnt is the ACMD23 hint, in blocks, sent with the CMD25 (0 for none) - write_block_cnt covers the whole length, which is known up front here, unlike for a stream of disk_write calls
+	 *
+	 */
+
+	  SD_segment_t pair[2] = {{buf_a, buf_block_cnt}, {buf_b, buf_block_cnt}};
+	  uint32_t request_max;
+	  uint8_t result = 0;
+
+	  if((buf_block_cnt == 0) || (buf_block_cnt > SD_SG_CHUNK_MAX) || (write_block_cnt % buf_block_cnt)) return 1;
+
+	  result = SDCard_Card_Data_Mode_Stream_Stop_w_SDIO();							//the write opens its own CMD25
+
+	  request_max = SD_CONT_BLOCKS_MAX - (SD_CONT_BLOCKS_MAX % buf_block_cnt);
+
+	  while((write_block_cnt != 0) && (result == 0)){
+
+		  uint16_t block_cnt = (uint16_t) ((write_block_cnt > request_max) ? request_max : write_block_cnt);
+		  SD_request_t request = {.direction = SD_ASYNC_STREAM_WRITE, .block_addr = start_write_block_addr, .block_cnt = block_cnt};
+
+		  request.seg = pair;
+		  request.seg_cnt = 2;
+		  request.refill = refill;
+
+		  if(!SD_stream_open) request.pre_erase_cnt = (pre_erase_cnt > SD_PRE_ERASE_MAX) ? SD_PRE_ERASE_MAX : pre_erase_cnt;
+
+		  if(SDcard_Async_submit(&request) != 0){
+
+			  result = 1;																//refused or no data for the buffers
+
+		  } else {
+
+			  result = SDcard_Async_wait(&request);
+
+		  }
+
+		  start_write_block_addr += block_cnt;
+		  write_block_cnt -= block_cnt;
+
+	  }
+
+	  if(result == 0) result = SDCard_Card_Data_Mode_Stream_Stop_w_SDIO();
+
+	  return result;
+
+}
+
+//30)Clock restore
+void SDIO_Clock_restore(void){
+
+	/*
+	 * One CLKDIV step back up after SD_CLK_RESTORE_AFTER transfers without a CRC or FIFO error, up to the rung SDIO_Clock_negotiate found
+	 * A fallback then only lasts as long as the errors do - a board right at its limit pays a retry every SD_CLK_RESTORE_AFTER transfers for it
+	 * Called ahead of a transfer, no request may be in flight (an open stream is fine, see SDIO_Clock_fallback)
+	 *
+	 */
+
+	if(SD_clock_slow_steps == 0) return;
+
+	if(++SD_clock_clean_cnt < SD_CLK_RESTORE_AFTER) return;
+
+	if(SDcard_Async_busy()) return;
+
+	SDIO_Clock_divide(SD_clock_slow_steps - 1);
+
+	SD_clock_clean_cnt = 0;
+
+}
+
+//31)Data timeouts
+static void SDIO_Data_timeout_update(void){
+
+	/*
+	 * DTIMER counts SDIO_CK ticks, so the same register value is a shorter wait at a faster clock (0xFFFF is only 1.5 ms at 42.7 MHz)
+	 * The read and write limits of the card are turned into ticks of the current SDIO_CK - called at each clock change
+	 *
+	 */
+
+	SD_dtimer_read = (SD_clock_hz / 1000) * SD_READ_TIMEOUT_MS;
+	SD_dtimer_write = (SD_clock_hz / 1000) * SD_WRITE_TIMEOUT_MS;
+
+}
+
+//32)Card size
+uint32_t SDCard_Card_Sector_cnt_w_SDIO(void) {
+
+	/*
+	 * Reads the CSD and gives back the number of 512 byte sectors of the card
+	 * SDHC: the capacity is (C_SIZE + 1) x 512 kB, C_SIZE is bits [69:48] of the CSD - RESP2[5:0] and RESP3[31:16]
+	 * The card is left de-selected (CMD9 needs "stby")
+	 *
+	 */
+
+	uint32_t c_size;
+
+	SDCard_Card_Data_Mode_CSD_w_SDIO();
+
+	c_size = ((((uint32_t) (SDIO->RESP2)) & ((uint32_t)0x3F)) << 16) | (uint32_t) ((SDIO->RESP3) >> 16);
+
+	return (c_size + 1) << 10;
+
+}
+
+//33)Runtime clock step
+static uint8_t SDIO_Clock_divide(uint8_t steps){
+
+	/*
+	 * Puts SDIO_CK "steps" CLKDIV steps below the current rung: SDIOCLK / (d + steps), where d is the divider of the rung (1 in bypass, CLKDIV + 2 otherwise)
+	 * Only CLKDIV is touched - PLLQ stays where SDIO_Clock_negotiate put it, so the system clock and the timers (sampling, TIM7) run on undisturbed
+	 * The floor is the clock of the last rung of the ladder (4 MHz)
+	 * Gives back 1 if the step would go below the floor (nothing is changed), 0 once the clock is set
+	 *
+	 */
+
+	uint32_t sdioclk = SysClock_SDIOCLK_Hz();
+	uint32_t divider = ((SD_clock_ladder_div[SD_clock_rung] == SD_CLK_BYPASS) ? 1 : (SD_clock_ladder_div[SD_clock_rung] + 2)) + steps;
+
+	if((divider > (0xFF + 2)) || ((sdioclk / divider) < SDIO_Clock_rung_hz(SD_CLK_RUNG_CNT - 1))) return 1;
+
+	SDIO->CLKCR &= ~((1<<10) | (0xFF<<0));
+
+	if(divider == 1) SDIO->CLKCR |= (1<<10);					//SDIO_CK = SDIOCLK
+	else SDIO->CLKCR |= ((divider - 2)<<0);					//SDIO_CK = SDIOCLK / (CLKDIV + 2)
+
+	SD_clock_slow_steps = steps;
+	SD_clock_hz = sdioclk / divider;
+	SDIO_Data_timeout_update();
+
+	return 0;
+
+}
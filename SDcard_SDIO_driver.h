@@ -13,7 +13,11 @@
 
 #include "stdint.h"
 #include "stdio.h"
+#ifdef SDIO_HOST_EMULATION
+#include <HOST_SDIO_emulator.h>														//register blocks are emulated on the host
+#else
 #include "stm32f405xx.h"
+#endif
 #include <SDIO_DMA_driver.h>
 
 //LOCAL CONSTANT
@@ -85,29 +89,99 @@ const static uint8_t CMD24_CMD	  			= 0x18;									//write single block
 
 const static uint8_t CMD25_CMD	  			= 0x19;									//write multi block
 
+const static uint8_t CMD6_CMD	  			= 0x6;									//switch function - 64 bytes of status on the data lines
+const static uint32_t CMD6_ARG_CHECK_HS		= 0x00FFFFF1;							//mode 0 (check), group 1 function 1 (high speed), other groups unchanged
+const static uint32_t CMD6_ARG_SWITCH_HS	= 0x80FFFFF1;							//mode 1 (switch), group 1 function 1 (high speed), other groups unchanged
+
+//-----------------------------//
+
+//SDIO->CMD values of the data path commands - all of them with R1 (R1b) short response, see SDIO_Cmd_send
+const static uint32_t CMD12_REG				= SDIO_CMD_REG(0xc, SDIO_CMD_SHORT_RESP);
+const static uint32_t CMD13_REG				= SDIO_CMD_REG(0xd, SDIO_CMD_SHORT_RESP);
+const static uint32_t CMD17_REG				= SDIO_CMD_REG(0x11, SDIO_CMD_SHORT_RESP);
+const static uint32_t CMD18_REG				= SDIO_CMD_REG(0x12, SDIO_CMD_SHORT_RESP);
+const static uint32_t CMD23_REG				= SDIO_CMD_REG(0x17, SDIO_CMD_SHORT_RESP);
+const static uint32_t CMD24_REG				= SDIO_CMD_REG(0x18, SDIO_CMD_SHORT_RESP);
+const static uint32_t CMD25_REG				= SDIO_CMD_REG(0x19, SDIO_CMD_SHORT_RESP);
+const static uint32_t CMD55_REG				= SDIO_CMD_REG(0x37, SDIO_CMD_SHORT_RESP);
+const static uint32_t ACMD23_REG			= SDIO_CMD_REG(0x17, SDIO_CMD_SHORT_RESP);	//set pre-erase block count - same index as CMD23, after a CMD55
+
+//-----------------------------//
+
+//SDIO clock ladder
+//each rung is a PLLQ value and a CLKCR divider (SD_CLK_BYPASS for SDIO_CK = SDIOCLK), fastest first
+//with the 128 MHz VCO of SysClockConfig: 42.7, 32, 25.6, 21.3, 16, 14.2, 10.7 MHz and the old 4 MHz
+#define SD_CLK_BYPASS				0xFF
+#define SD_CLK_RUNG_CNT				8
+#define SD_CLK_DEFAULT_SPEED_MAX	25000000										//highest SDIO_CK without CMD6
+#define SD_CLK_HIGH_SPEED_MAX		50000000										//highest SDIO_CK in high speed mode
+
+//error recovery
+#define SD_RETRY_MAX				3												//retries at the same clock before a transfer is given up
+#define SD_RETRY_BACKOFF_US			500												//wait before the first retry, doubled for each one after
+#define SD_CLK_RESTORE_AFTER		256												//transfers without a CRC error before a fallback is undone by one rung
+
+//data timeouts - DTIMER is set from them for the current SDIO_CK at each clock change
+#define SD_READ_TIMEOUT_MS			100												//longest wait for a read block (SDHC)
+#define SD_WRITE_TIMEOUT_MS			250												//longest busy after a write block (SDHC)
+
+//scatter-gather segment
+typedef struct {
+	uint8_t* buf;																	//first byte of the segment
+	uint16_t block_cnt;																//512 byte blocks in the segment
+} SD_segment_t;
+
+//continuous write refill - fills buf with the next block_cnt blocks, gives back non-zero if there is no data for it
+typedef uint8_t (*SD_refill_t)(uint8_t* buf, uint16_t block_cnt);
+
+#define SD_CONT_BLOCKS_MAX			4096											//blocks in one request of a continuous write - the open-ended CMD25 carries on over them
+
 
 //LOCAL VARIABLE
-static uint16_t SD_RCA	  	  				= 0x0;									//the RCA generated for the card (see CMD3)
 
 //EXTERNAL VARIABLE
-
-extern uint8_t CMDREND_flag;														//SDIO global flag
-extern uint8_t DATAREND_flag;														//SDIO global flag
+extern uint16_t SD_RCA;																//the RCA generated for the card (see CMD3)
+extern uint8_t SD_card_selected;														//card selection state tracked by SDIO_Select_Card/SDIO_DeSelect_Card
+
+extern volatile uint8_t CMDREND_flag;														//SDIO global flag
+extern volatile uint8_t DATAREND_flag;														//SDIO global flag
+extern volatile uint8_t DATAERR_flag;														//SDIO global flag - data timeout/CRC outside of a request
+extern volatile uint8_t CMDERR_flag;														//SDIO global flag - CMD timeout outside of a request
+
+extern uint8_t SD_high_speed;																//card switched to high speed by CMD6
+extern uint8_t SD_clock_rung;																//current rung of the clock ladder
+extern uint8_t SD_clock_slow_steps;															//CLKDIV steps below the negotiated rung, see SDIO_Clock_fallback
+extern uint32_t SD_clock_hz;																//current SDIO_CK
+extern uint32_t SD_dtimer_read;																//DTIMER for reads at the current SDIO_CK
+extern uint32_t SD_dtimer_write;															//DTIMER for writes at the current SDIO_CK
+extern volatile uint32_t SD_crc_error_cnt;													//data CRC failures since power up
+extern uint32_t SD_recover_cnt;																//recoveries run since power up
 
 //FUNCTION PROTOTYPES
 uint8_t SDCard_Card_ID_Mode_w_SDIO(void);											//this is to go through card ID mode using 200 kHz SDIOCK
 void SDIO_speed_change(void);														//this is to go change SDIOCK to higher speed
-void SDIO_Select_Card(void);														//select card using CMD7
-void SDIO_DeSelect_Card(void);														//de-select card using CMD7 (will be using CMD77 instead to distinguish)
+void SDIO_Select_Card(void);														//select card using CMD7 - if it is not selected yet
+void SDIO_DeSelect_Card(void);														//de-select card using CMD7 (will be using CMD77 instead to distinguish) - if it is selected
 void SDIO_Change_bus_width(void);													//change bus width to 4-wide
 uint8_t SDCard_Card_Data_Mode_Single_Block_Write_w_SDIO(uint32_t start_write_block_addr, uint8_t* write_buf_ptr);
 uint8_t SDCard_Card_Data_Mode_Single_Block_Read_w_SDIO(uint32_t start_read_block_addr, uint8_t* read_buf_ptr);
-uint8_t SDCard_Card_Data_Mode_Multi_Block_Write_w_SDIO(uint32_t start_write_block_addr, uint16_t write_block_cnt, uint8_t* write_buf_ptr);
+uint8_t SDCard_Card_Data_Mode_Multi_Block_Write_w_SDIO(uint32_t start_write_block_addr, uint16_t write_block_cnt, uint8_t* write_buf_ptr, uint32_t pre_erase_cnt);
 uint8_t SDCard_Card_Data_Mode_Multi_Block_Read_w_SDIO(uint32_t start_read_block_addr, uint16_t read_block_cnt, uint8_t* read_buf_ptr);
+uint8_t SDCard_Card_Data_Mode_Stream_Write_w_SDIO(uint32_t start_write_block_addr, uint16_t write_block_cnt, uint8_t* write_buf_ptr, uint32_t pre_erase_cnt);
+uint8_t SDCard_Card_Data_Mode_Stream_Stop_w_SDIO(void);							//close the streaming write with CMD12
 void SDIO_Wait_for_idle_SD(void);													//wait until card is in "tran" state - waiting for transmission
 void SDIO_Wait_for_rcv_SD(void);													//wait until card is in "rcv" state - receiving data
 void SDIO_Wait_for_data_SD(void);													//wait until card is in "data" state - sending data
+uint32_t SDCard_Card_Sector_cnt_w_SDIO(void);										//card size in sectors from the CSD - leaves the card de-selected
 void SDCard_Card_Data_Mode_CSD_w_SDIO(void);										//extract CSD register - used for capacity calculation
 void SDCard_Card_Data_Mode_SCR_w_SDIO(void);										//debug function
+void ReBoot(void);																	//reboot to remove the double start bug
+uint8_t SDIO_Clock_negotiate(void);													//switch to high speed if possible and pick the fastest working SDIO_CK
+uint8_t SDIO_Clock_fallback(void);													//step one CLKDIV step down after CRC errors - PLLQ is not touched
+void SDIO_Clock_restore(void);														//step one CLKDIV step back up once the CRC errors have stopped
+uint8_t SDIO_Recover(uint8_t error, uint8_t* retry_cnt);							//abort and re-sync after a failed transfer, gives back 0 if it is worth another try
+uint8_t SDCard_Card_Data_Mode_SG_Write_w_SDIO(uint32_t start_write_block_addr, const SD_segment_t* seg, uint8_t seg_cnt);		//one multi-block write from a list of buffers
+uint8_t SDCard_Card_Data_Mode_SG_Read_w_SDIO(uint32_t start_read_block_addr, const SD_segment_t* seg, uint8_t seg_cnt);		//one multi-block read into a list of buffers
+uint8_t SDCard_Card_Data_Mode_Continuous_Write_w_SDIO(uint32_t start_write_block_addr, uint32_t write_block_cnt, uint8_t* buf_a, uint8_t* buf_b, uint16_t buf_block_cnt, SD_refill_t refill, uint32_t pre_erase_cnt);	//any length from a pair of buffers
 
 #endif /* INC_SDCARD_SDIO_DRIVER_H_ */
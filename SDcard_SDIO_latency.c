@@ -0,0 +1,198 @@
+/*
+ *  Created on: Oct 17, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_SDIO_FATFS
+ *  Processor: STM32F405
+ *  Program version: 1.0
+ *  Source file: SDcard_SDIO_latency.c
+ *  Change history:
+ */
+
+#include <SDcard_SDIO_latency.h>
+
+uint32_t SD_lat_hist[SD_LAT_OPS][SD_LAT_PHASES][SD_LAT_BUCKETS];
+uint32_t SD_lat_max[SD_LAT_OPS][SD_LAT_PHASES];
+
+static const char* const SD_lat_op_name[SD_LAT_OPS] = {"CMD17", "CMD18", "CMD24", "CMD25", "stream", "CMD12"};
+static const char* const SD_lat_phase_name[SD_LAT_PHASES] = {"resp", "data", "busy", "total"};
+
+//1)Start the cycle counter
+void SD_lat_init(void){
+
+	/*
+	 * CYCCNT needs the trace block enabled (TRCENA) before it counts
+	 * It is never reset afterwards: the stamps are only ever subtracted, so a wrap (33 s at 128 MHz) does no harm
+	 *
+	 */
+
+	CoreDebug->DEMCR |= (1<<24);													//TRCENA
+	DWT->CTRL |= (1<<0);															//CYCCNTENA
+
+	SD_lat_reset();
+
+}
+
+//2)Clear
+void SD_lat_reset(void){
+
+	for(uint8_t o = 0; o < SD_LAT_OPS; o++){
+
+		for(uint8_t p = 0; p < SD_LAT_PHASES; p++){
+
+			for(uint8_t b = 0; b < SD_LAT_BUCKETS; b++) SD_lat_hist[o][p][b] = 0;
+			SD_lat_max[o][p] = 0;
+
+		}
+
+	}
+
+}
+
+//3)Add one time
+static void SD_lat_add(uint8_t op, uint8_t phase, uint32_t cycles){
+
+	uint8_t bucket = 0;
+
+	if(cycles != 0) bucket = (uint8_t) (31 - __builtin_clz(cycles));				//CLZ on the M4
+	if(bucket >= SD_LAT_BUCKETS) bucket = SD_LAT_BUCKETS - 1;
+
+	SD_lat_hist[op][phase][bucket]++;
+	if(cycles > SD_lat_max[op][phase]) SD_lat_max[op][phase] = cycles;
+
+}
+
+//4)Sort a finished request
+void SD_lat_request(SD_lat_stamps_t* lat){
+
+	/*
+	 * Called from the IRQ that finishes the request, so "now" is the end of it
+	 * A phase is only counted when both of its stamps were taken - a continued stream has no command, a read no busy phase
+	 *
+	 */
+
+#if SD_LAT_STATS
+
+	uint32_t now = DWT->CYCCNT;
+	uint32_t data_from;
+
+	if(lat->op >= SD_LAT_OPS) return;
+
+	if((lat->valid & (1 << SD_LAT_T_CMD)) && (lat->valid & (1 << SD_LAT_T_RESP))){
+
+		SD_lat_add(lat->op, SD_LAT_RESP, lat->t[SD_LAT_T_RESP] - lat->t[SD_LAT_T_CMD]);
+
+	}
+
+	if(lat->valid & (1 << SD_LAT_T_DATA)){
+
+		data_from = (lat->valid & (1 << SD_LAT_T_RESP)) ? lat->t[SD_LAT_T_RESP] : lat->t[SD_LAT_T_SUBMIT];
+		SD_lat_add(lat->op, SD_LAT_DATA, lat->t[SD_LAT_T_DATA] - data_from);
+
+		if((lat->op == SD_LAT_CMD24) || (lat->op == SD_LAT_CMD25)) SD_lat_add(lat->op, SD_LAT_BUSY, now - lat->t[SD_LAT_T_DATA]);
+
+	} else if((lat->op == SD_LAT_CMD12) && (lat->valid & (1 << SD_LAT_T_RESP))){
+
+		SD_lat_add(lat->op, SD_LAT_BUSY, now - lat->t[SD_LAT_T_RESP]);
+
+	}
+
+	SD_lat_add(lat->op, SD_LAT_TOTAL, now - lat->t[SD_LAT_T_SUBMIT]);
+
+#else
+
+	(void) lat;
+
+#endif
+
+}
+
+//5)Percentile
+uint32_t SD_lat_percentile_us(uint8_t op, uint8_t phase, uint8_t percent){
+
+	/*
+	 * The histogram only knows the bucket: the answer is the upper end of the bucket the percentile falls into, or the worst case if that is lower
+	 * Returns 0 if nothing was counted
+	 *
+	 */
+
+	uint32_t total = 0;
+	uint32_t sum = 0;
+	uint32_t mhz = SystemCoreClock / 1000000;
+
+	for(uint8_t b = 0; b < SD_LAT_BUCKETS; b++) total += SD_lat_hist[op][phase][b];
+
+	if(total == 0) return 0;
+
+	for(uint8_t b = 0; b < SD_LAT_BUCKETS; b++){
+
+		sum += SD_lat_hist[op][phase][b];
+
+		if((uint64_t) sum * 100 >= (uint64_t) total * percent){
+
+			if((b == SD_LAT_BUCKETS - 1) || ((2ull << b) > SD_lat_max[op][phase])) return SD_lat_max[op][phase] / mhz;
+																							//never past the worst case actually seen
+			return (uint32_t) (((2ull << b) + mhz - 1) / mhz);
+
+		}
+
+	}
+
+	return SD_lat_max[op][phase] / mhz;
+
+}
+
+//6)Print the histograms
+uint8_t SD_lat_dump(void){
+
+	/*
+	 * One line per operation and phase that has been seen: count, median, 99th percentile, worst case, then the non-empty buckets as "<upper end in us>:<count>"
+	 * An operation whose worst total time is over the SD limit is marked - the card is slow, or it is on its way out
+	 * Returns the number of such operations
+	 *
+	 */
+
+	uint32_t mhz = SystemCoreClock / 1000000;
+	uint8_t slow_cnt = 0;
+
+	printf("latency (us, log2 buckets at %u MHz):\r\n", mhz);
+
+	for(uint8_t o = 0; o < SD_LAT_OPS; o++){
+
+		uint32_t limit_us = ((o == SD_LAT_CMD17) || (o == SD_LAT_CMD18)) ? SD_LAT_READ_LIMIT_US : SD_LAT_WRITE_LIMIT_US;
+
+		for(uint8_t p = 0; p < SD_LAT_PHASES; p++){
+
+			uint32_t cnt = 0;
+			uint8_t slow;
+
+			for(uint8_t b = 0; b < SD_LAT_BUCKETS; b++) cnt += SD_lat_hist[o][p][b];
+
+			if(cnt == 0) continue;
+
+			slow = (p == SD_LAT_TOTAL) && ((SD_lat_max[o][p] / mhz) > limit_us);
+			slow_cnt += slow;
+
+			printf("  %-6s %-5s n %6u  p50 %7u  p99 %7u  max %7u %s |",
+					SD_lat_op_name[o],
+					SD_lat_phase_name[p],
+					cnt,
+					SD_lat_percentile_us(o, p, 50),
+					SD_lat_percentile_us(o, p, 99),
+					SD_lat_max[o][p] / mhz,
+					slow ? "SLOW" : "    ");
+
+			for(uint8_t b = 0; b < SD_LAT_BUCKETS; b++){
+
+				if(SD_lat_hist[o][p][b] != 0) printf(" %u:%u", (uint32_t) (((2ull << b) + mhz - 1) / mhz), SD_lat_hist[o][p][b]);
+
+			}
+
+			printf("\r\n");
+
+		}
+
+	}
+
+	return slow_cnt;
+
+}
@@ -0,0 +1,92 @@
+/*
+ *  Created on: Oct 17, 2026
+ *  Author: BalazsFarkas
+ *  Project: STM32_SDIO_FATFS
+ *  Processor: STM32F405
+ *  Program version: 1.0
+ *  Header file: SDcard_SDIO_latency.h
+ *  Change history:
+ */
+
+/*
+ * Latency histograms of the card operations.
+ * Every request of SDcard_SDIO_async is stamped with the DWT cycle counter (CYCCNT, free running at SYSCLK) when
+ * 	- it is submitted
+ * 	- its command goes out (a CMD23 ahead of it is sent in the same batch, see SDIO_Cmd_queue)
+ * 	- the response of that command comes back (CMDREND)
+ * 	- the data phase ends (DATAEND)
+ * 	- it is finished, with the card back in "tran" for the writes
+ * The differences are sorted into log2 histograms per operation and phase: bucket n counts the times of 2^n to 2^(n+1)-1 cycles, the last bucket everything longer.
+ * Only successful requests are counted. The CMD13 polling of SD_ASYNC_STATUS requests is not an operation of its own, it shows up in the busy phase.
+ *
+ * SD_lat_dump prints the histograms with the median, the 99th percentile and the worst case, and marks the operations whose worst case is over the limit of the SD specification (100 ms read, 250 ms write).
+ *
+ */
+
+#ifndef INC_SDCARD_SDIO_LATENCY_H_
+#define INC_SDCARD_SDIO_LATENCY_H_
+
+#include "stdint.h"
+#include "stdio.h"
+#ifdef SDIO_HOST_EMULATION
+#include <HOST_SDIO_emulator.h>														//register blocks are emulated on the host
+#else
+#include "stm32f405xx.h"
+#endif
+
+//LOCAL CONSTANT
+#define SD_LAT_STATS				1											//0 removes the stamps and the histograms
+#define SD_LAT_BUCKETS				28											//2^27 cycles is about 1 s at 128 MHz
+#define SD_LAT_READ_LIMIT_US		100000										//SD specification: read access time
+#define SD_LAT_WRITE_LIMIT_US		250000										//SD specification: write busy time
+
+//operations
+#define SD_LAT_CMD17				0											//single block read
+#define SD_LAT_CMD18				1											//multi-block read
+#define SD_LAT_CMD24				2											//single block write
+#define SD_LAT_CMD25				3											//multi-block write with CMD23
+#define SD_LAT_CMD25_STREAM			4											//streaming write - the command only for the first part of the stream
+#define SD_LAT_CMD12				5											//closing the stream
+#define SD_LAT_OPS					6
+#define SD_LAT_NONE					0xFF										//status requests
+
+//phases
+#define SD_LAT_RESP					0											//command sent - response received
+#define SD_LAT_DATA					1											//response (or submit) - DATAEND
+#define SD_LAT_BUSY					2											//DATAEND (or the CMD12 response) - card back in "tran"
+#define SD_LAT_TOTAL				3											//submit - request finished
+#define SD_LAT_PHASES				4
+
+//stamps
+#define SD_LAT_T_SUBMIT				0
+#define SD_LAT_T_CMD				1
+#define SD_LAT_T_RESP				2
+#define SD_LAT_T_DATA				3
+
+typedef struct
+{
+	uint8_t op;																	//SD_LAT_...
+	uint8_t valid;																//bit n: stamp n has been taken
+	uint32_t t[4];																//CYCCNT at SD_LAT_T_...
+} SD_lat_stamps_t;
+
+#if SD_LAT_STATS
+#define SD_LAT_MARK(lat, stamp)		{ (lat).t[stamp] = DWT->CYCCNT; (lat).valid |= (1 << (stamp)); }
+#else
+#define SD_LAT_MARK(lat, stamp)
+#endif
+
+//LOCAL VARIABLE
+
+//EXTERNAL VARIABLE
+extern uint32_t SD_lat_hist[SD_LAT_OPS][SD_LAT_PHASES][SD_LAT_BUCKETS];		//the histograms
+extern uint32_t SD_lat_max[SD_LAT_OPS][SD_LAT_PHASES];						//worst case in cycles
+
+//FUNCTION PROTOTYPES
+void SD_lat_init(void);															//start the cycle counter and clear the histograms
+void SD_lat_reset(void);														//clear the histograms
+void SD_lat_request(SD_lat_stamps_t* lat);										//sort a finished request into the histograms
+uint32_t SD_lat_percentile_us(uint8_t op, uint8_t phase, uint8_t percent);		//upper end of the bucket the percentile falls into, in us
+uint8_t SD_lat_dump(void);														//print the histograms, gives back the number of operations over the SD limits
+
+#endif /* INC_SDCARD_SDIO_LATENCY_H_ */
@@ -35,6 +35,14 @@
 //#error Wrong include file (ff.h).
 #endif
 
+#if FF_FREE_MAP_BYTES > 468
+#error Free cluster map does not fit in the FSINFO sector
+#endif
+
+#if FF_DIR_HASH_SLOTS && (FF_USE_LFN || FF_DIR_HASH_SLOTS > 65536 || (FF_DIR_HASH_SLOTS & (FF_DIR_HASH_SLOTS - 1)))
+#error Wrong FF_DIR_HASH_SLOTS setting
+#endif
+
 
 /* Limits and boundaries */
 #define MAX_DIR		0x200000		/* Max size of FAT directory */
@@ -195,6 +203,11 @@
 #define FSI_StrucSig		484		/* FAT32 FSI: Structure signature (DWORD) */
 #define FSI_Free_Count		488		/* FAT32 FSI: Number of free clusters (DWORD) */
 #define FSI_Nxt_Free		492		/* FAT32 FSI: Last allocated cluster (DWORD) */
+#define FSI_MapSig			4		/* FAT32 FSI: Free cluster map signature (DWORD, in the reserved area) */
+#define FSI_MapShift		8		/* FAT32 FSI: Clusters per free map bit, log2 (BYTE) */
+#define FSI_MapCheck		12		/* FAT32 FSI: Free cluster map check value (DWORD) */
+#define FSI_Map				16		/* FAT32 FSI: Free cluster map (FF_FREE_MAP_BYTES bytes) */
+#define FSI_MAP_SIG			0x50414D46	/* "FMAP" */
 
 #define MBR_Table			446		/* MBR: Offset of partition table in the MBR */
 #define SZ_PTE				16		/* MBR: Size of a partition table entry */
@@ -1053,28 +1066,146 @@ static void clear_share (	/* Clear all lock entries of the volume */
 /* Move/Flush disk access window in the filesystem object                */
 /*-----------------------------------------------------------------------*/
 #if !FF_FS_READONLY
+static DRESULT write_sect (	/* Returns RES_OK or the error of the 1st FAT write */
+	FATFS* fs,			/* Filesystem object */
+	const BYTE* buf,	/* Sector data */
+	LBA_t sect			/* Sector LBA */
+)
+{
+	DRESULT dres;
+
+
+	dres = disk_write(fs->pdrv, buf, sect, 1);	/* Write it back into the volume */
+	if (dres == RES_OK && sect - fs->fatbase < fs->fsize) {	/* Is it in the 1st FAT? */
+		if (fs->n_fats == 2) disk_write(fs->pdrv, buf, sect + fs->fsize, 1);	/* Reflect it to 2nd FAT if needed */
+	}
+	return dres;
+}
+
+
 static FRESULT sync_window (	/* Returns FR_OK or FR_DISK_ERR */
 	FATFS* fs			/* Filesystem object */
 )
 {
 	FRESULT res = FR_OK;
+#if FF_WIN_CACHE_WAYS
+	UINT i;
+#endif
 
 
 	if (fs->wflag) {	/* Is the disk access window dirty? */
-		if (disk_write(fs->pdrv, fs->win, fs->winsect, 1) == RES_OK) {	/* Write it back into the volume */
+		if (write_sect(fs, fs->win, fs->winsect) == RES_OK) {	/* Write it back into the volume */
 			fs->wflag = 0;	/* Clear window dirty flag */
-			if (fs->winsect - fs->fatbase < fs->fsize) {	/* Is it in the 1st FAT? */
-				if (fs->n_fats == 2) disk_write(fs->pdrv, fs->win, fs->winsect + fs->fsize, 1);	/* Reflect it to 2nd FAT if needed */
-			}
 		} else {
 			res = FR_DISK_ERR;
 		}
 	}
+#if FF_WIN_CACHE_WAYS
+	for (i = 0; res == FR_OK && i < FF_WIN_CACHE_LINES; i++) {	/* Write back the dirty cache lines */
+		if (fs->wc_flag[i]) {
+			if (write_sect(fs, fs->wc_buf[i], fs->wc_sect[i]) == RES_OK) {
+				fs->wc_flag[i] = 0;
+			} else {
+				res = FR_DISK_ERR;
+			}
+		}
+	}
+#endif
 	return res;
 }
 #endif
 
 
+#if FF_WIN_CACHE_WAYS
+static void wc_reset (	/* Empty the window cache without writing anything back */
+	FATFS* fs			/* Filesystem object */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < FF_WIN_CACHE_LINES; i++) {
+		fs->wc_sect[i] = (LBA_t)0 - 1;
+		fs->wc_used[i] = 0;
+		fs->wc_flag[i] = 0;
+	}
+	fs->wc_stamp = 0;
+}
+
+
+#if !FF_FS_READONLY
+static void wc_discard (	/* Drop the cache lines of a sector range (freed cluster) */
+	FATFS* fs,			/* Filesystem object */
+	LBA_t sect,			/* First sector of the range */
+	UINT n				/* Number of sectors */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < FF_WIN_CACHE_LINES; i++) {
+		if (fs->wc_sect[i] - sect < n) {	/* Its content is no longer needed, even if it is dirty */
+			fs->wc_sect[i] = (LBA_t)0 - 1;
+			fs->wc_used[i] = 0;
+			fs->wc_flag[i] = 0;
+		}
+	}
+}
+#endif
+
+
+static FRESULT wc_store (	/* Park the window in its cache set. Returns FR_OK or FR_DISK_ERR */
+	FATFS* fs			/* Filesystem object */
+)
+{
+	UINT i, top, lru;
+
+
+	if (fs->winsect == (LBA_t)0 - 1) return FR_OK;	/* Nothing in the window */
+	top = (UINT)(fs->winsect % FF_WIN_CACHE_SETS) * FF_WIN_CACHE_WAYS;	/* First line of the set */
+	for (i = lru = top; i < top + FF_WIN_CACHE_WAYS; i++) {
+		if (fs->wc_sect[i] == fs->winsect) break;	/* An older copy of the sector is in the set (the window was re-targeted directly) */
+		if (fs->wc_used[i] < fs->wc_used[lru]) lru = i;
+	}
+	if (i == top + FF_WIN_CACHE_WAYS) {	/* Not in the set: evict the least recently used line */
+		i = lru;
+#if !FF_FS_READONLY
+		if (fs->wc_flag[i] && write_sect(fs, fs->wc_buf[i], fs->wc_sect[i]) != RES_OK) return FR_DISK_ERR;
+#endif
+	}
+	memcpy(fs->wc_buf[i], fs->win, SS(fs));
+	fs->wc_sect[i] = fs->winsect;
+	fs->wc_flag[i] = fs->wflag;		/* The dirty window becomes a dirty line */
+	fs->wc_used[i] = ++fs->wc_stamp;
+	fs->wflag = 0;
+	return FR_OK;
+}
+
+
+static int wc_load (	/* Bring a sector from the cache into the window. Returns 1 on hit, 0 on miss */
+	FATFS* fs,			/* Filesystem object */
+	LBA_t sect			/* Sector LBA */
+)
+{
+	UINT i, top;
+
+
+	top = (UINT)(sect % FF_WIN_CACHE_SETS) * FF_WIN_CACHE_WAYS;
+	for (i = top; i < top + FF_WIN_CACHE_WAYS; i++) {
+		if (fs->wc_sect[i] == sect) {
+			memcpy(fs->win, fs->wc_buf[i], SS(fs));
+			fs->wflag = fs->wc_flag[i];		/* Line is moved, not copied: the window is the only copy of the sector */
+			fs->wc_sect[i] = (LBA_t)0 - 1;
+			fs->wc_used[i] = 0;
+			fs->wc_flag[i] = 0;
+			return 1;
+		}
+	}
+	return 0;
+}
+#endif	/* FF_WIN_CACHE_WAYS */
+
+
 static FRESULT move_window (	/* Returns FR_OK or FR_DISK_ERR */
 	FATFS* fs,		/* Filesystem object */
 	LBA_t sect		/* Sector LBA to make appearance in the fs->win[] */
@@ -1084,6 +1215,21 @@ static FRESULT move_window (	/* Returns FR_OK or FR_DISK_ERR */
 
 
 	if (sect != fs->winsect) {	/* Window offset changed? */
+#if FF_WIN_CACHE_WAYS
+		res = wc_store(fs);			/* Keep the window in the cache, write back the evicted line */
+		if (res == FR_OK) {
+			if (wc_load(fs, sect)) {	/* Cache hit? */
+				fs->wc_hit++;
+			} else {
+				fs->wc_miss++;
+				if (disk_read(fs->pdrv, fs->win, sect, 1) != RES_OK) {
+					sect = (LBA_t)0 - 1;	/* Invalidate window if read data is not valid */
+					res = FR_DISK_ERR;
+				}
+			}
+			fs->winsect = sect;
+		}
+#else
 #if !FF_FS_READONLY
 		res = sync_window(fs);		/* Flush the window */
 #endif
@@ -1094,6 +1240,7 @@ static FRESULT move_window (	/* Returns FR_OK or FR_DISK_ERR */
 			}
 			fs->winsect = sect;
 		}
+#endif
 	}
 	return res;
 }
@@ -1123,6 +1270,12 @@ static FRESULT sync_fs (	/* Returns FR_OK or FR_DISK_ERR */
 			st_dword(fs->win + FSI_StrucSig, 0x61417272);		/* Structure signature */
 			st_dword(fs->win + FSI_Free_Count, fs->free_clst);	/* Number of free clusters */
 			st_dword(fs->win + FSI_Nxt_Free, fs->last_clst);	/* Last allocated culuster */
+#if FF_FREE_MAP_BYTES
+			st_dword(fs->win + FSI_MapSig, FSI_MAP_SIG);		/* Free cluster map in the reserved area */
+			fs->win[FSI_MapShift] = fs->fmap_shift;
+			st_dword(fs->win + FSI_MapCheck, fs->free_clst ^ fs->last_clst ^ fs->n_fatent);	/* Ties the map to the counters above */
+			memcpy(fs->win + FSI_Map, fs->fmap, FF_FREE_MAP_BYTES);
+#endif
 			fs->winsect = fs->volbase + 1;						/* Write it into the FSInfo sector (Next to VBR) */
 			disk_write(fs->pdrv, fs->win, fs->winsect, 1);
 			fs->fsi_flag = 0;
@@ -1422,6 +1575,100 @@ static FRESULT fill_last_frag (
 
 
 
+#if !FF_FS_READONLY && FF_FREE_MAP_BYTES
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Free cluster map                                       */
+/*-----------------------------------------------------------------------*/
+
+static int fmap_get (	/* 0:The group of the cluster has no free cluster, !=0:It may have one */
+	FATFS* fs,		/* Filesystem object */
+	DWORD clst		/* Cluster# */
+)
+{
+	DWORD g = clst >> fs->fmap_shift;
+
+
+	return fs->fmap[g / 8] & (1 << (g % 8));
+}
+
+
+static void fmap_mark (
+	FATFS* fs,		/* Filesystem object */
+	DWORD clst,		/* Cluster# */
+	int free		/* 0:Its group is full, 1:Its group has a free cluster */
+)
+{
+	DWORD g = clst >> fs->fmap_shift;
+	BYTE b = fs->fmap[g / 8];
+
+
+	b = free ? b | (BYTE)(1 << (g % 8)) : b & (BYTE)~(1 << (g % 8));
+	if (b != fs->fmap[g / 8]) {
+		fs->fmap[g / 8] = b;
+		fs->fsi_flag |= 1;		/* FAT32: FSInfo is to be updated */
+	}
+}
+
+
+static void fmap_fill (	/* Mark the groups covered by an allocated block as full */
+	FATFS* fs,		/* Filesystem object */
+	DWORD scl,		/* First cluster of the block */
+	DWORD n			/* Number of clusters */
+)
+{
+	DWORD clst, gend, ecl = scl + n - 1, msk = ((DWORD)1 << fs->fmap_shift) - 1;
+
+
+	for (clst = scl; clst <= ecl; clst = gend + 1) {
+		gend = clst | msk;		/* Last cluster of the group */
+		if (gend >= fs->n_fatent) gend = fs->n_fatent - 1;
+		if (((clst & msk) == 0 || clst == 2) && gend <= ecl) fmap_mark(fs, clst, 0);
+	}
+}
+
+
+static DWORD fmap_find (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:Free cluster# */
+	FFOBJID* obj,	/* Corresponding object */
+	DWORD scl,		/* The search starts next to this cluster and ends with it */
+	int usemap		/* 1:Skip the groups known to be full, 0:Walk all the clusters */
+)
+{
+	FATFS *fs = obj->fs;
+	DWORD ncl = scl, cs, n, gend, gtop = 0, msk = ((DWORD)1 << fs->fmap_shift) - 1;
+
+
+	for (n = fs->n_fatent - 2; n; n--) {	/* Number of clusters left to look at */
+		if (++ncl >= fs->n_fatent) ncl = 2;	/* Next cluster (wrap-around) */
+		gend = ncl | msk;					/* Last cluster of the group */
+		if (gend >= fs->n_fatent) gend = fs->n_fatent - 1;
+		if ((ncl & msk) == 0 || ncl == 2) {	/* Top of a group? */
+			if (usemap && !fmap_get(fs, ncl)) {	/* Known to be full: skip it */
+				if (gend - ncl >= n - 1) break;	/* Nothing left after it */
+				n -= gend - ncl;
+				ncl = gend;
+				continue;
+			}
+			gtop = ncl;							/* The whole group is going to be walked */
+		}
+		cs = get_fat(obj, ncl);				/* Get the cluster status */
+		if (cs == 0) {						/* Found a free cluster? */
+			fmap_mark(fs, ncl, 1);			/* Only changes the map if it was stale */
+			return ncl;
+		}
+		if (cs == 1 || cs == 0xFFFFFFFF) return cs;	/* Test for error */
+		if (gtop && ncl == gend) {			/* Walked a whole group without a free cluster? */
+			fmap_mark(fs, ncl, 0);
+			gtop = 0;
+		}
+	}
+	return 0;
+}
+
+#endif	/* !FF_FS_READONLY && FF_FREE_MAP_BYTES */
+
+
+
+
 #if !FF_FS_READONLY
 /*-----------------------------------------------------------------------*/
 /* FAT handling - Remove a cluster chain                                 */
@@ -1461,6 +1708,12 @@ static FRESULT remove_chain (	/* FR_OK(0):succeeded, !=0:error */
 			res = put_fat(fs, clst, 0);		/* Mark the cluster 'free' on the FAT */
 			if (res != FR_OK) return res;
 		}
+#if FF_WIN_CACHE_WAYS
+		wc_discard(fs, clst2sect(fs, clst), fs->csize);	/* A cached directory sector must not be written back into a reused cluster */
+#endif
+#if FF_FREE_MAP_BYTES
+		fmap_mark(fs, clst, 1);				/* Its group has a free cluster now */
+#endif
 		if (fs->free_clst < fs->n_fatent - 2) {	/* Update FSINFO */
 			fs->free_clst++;
 			fs->fsi_flag |= 1;
@@ -1585,6 +1838,11 @@ static DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:D
 			}
 		}
 		if (ncl == 0) {	/* The new cluster cannot be contiguous and find another fragment */
+#if FF_FREE_MAP_BYTES
+			ncl = fmap_find(obj, scl, 1);		/* Find a free cluster in the groups that may have one */
+			if (ncl == 0) ncl = fmap_find(obj, scl, 0);	/* None of them had one: the map may be stale, walk the whole FAT */
+			if (ncl < 2 || ncl == 0xFFFFFFFF) return ncl;	/* No free cluster or error? */
+#else
 			ncl = scl;	/* Start cluster */
 			for (;;) {
 				ncl++;							/* Next cluster */
@@ -1597,6 +1855,7 @@ static DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:D
 				if (cs == 1 || cs == 0xFFFFFFFF) return cs;	/* Test for error */
 				if (ncl == scl) return 0;		/* No free cluster found? */
 			}
+#endif
 		}
 		res = put_fat(fs, ncl, 0xFFFFFFFF);		/* Mark the new cluster 'EOC' */
 		if (res == FR_OK && clst != 0) {
@@ -1799,6 +2058,206 @@ static FRESULT dir_next (	/* FR_OK(0):succeeded, FR_NO_FILE:End of table, FR_DEN
 
 
 
+#if FF_DIR_HASH_SLOTS
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Name index                                       */
+/*-----------------------------------------------------------------------*/
+
+#define DH_DIRS		4			/* Directories in the index */
+#define DH_MAXENT	0xFFFE		/* Max entry# that fits in a slot */
+#define DH_HOME(k)	((UINT)(((DWORD)(k) * 0x9E3779B1) >> 16) & (FF_DIR_HASH_SLOTS - 1))	/* Home slot of a key */
+
+static DWORD dh_key (	/* Slot key of a name (b31-18:hash of the SFN, b17-16:directory) */
+	const BYTE* name,	/* 11-byte name */
+	UINT d				/* Directory */
+)
+{
+	DWORD h = 2166136261;
+	UINT i;
+
+
+	for (i = 0; i < 11; i++) h = (h ^ name[i]) * 16777619;	/* FNV-1a */
+	return (h & 0xFFFC0000) | ((DWORD)d << 16);
+}
+
+
+static UINT dh_dir (	/* Directory of the index that holds the table, DH_DIRS if none */
+	FATFS* fs,			/* Filesystem object */
+	DWORD clst			/* Start cluster of the directory */
+)
+{
+	UINT d;
+
+
+	for (d = 0; d < DH_DIRS && (fs->dh_stat[d] == 0 || fs->dh_clust[d] != clst); d++) ;
+	return d;
+}
+
+
+static void dh_put (	/* Add an entry to the index */
+	FATFS* fs,			/* Filesystem object */
+	UINT d,				/* Directory (DH_DIRS:none) */
+	const BYTE* name,	/* 11-byte name of the entry */
+	DWORD dptr			/* Offset of the entry in the directory */
+)
+{
+	DWORD k = dh_key(name, d);
+	UINT i = DH_HOME(k >> 16);
+
+
+	if (d >= DH_DIRS) return;	/* Directory is not indexed */
+	if (dptr / SZDIRE >= DH_MAXENT || fs->dh_used >= FF_DIR_HASH_SLOTS / 4 * 3) {	/* No room in the index? */
+		fs->dh_stat[d] = 1;		/* The index does not cover the directory any more */
+		return;
+	}
+	while (fs->dh_slot[i] & 0xFFFF) i = (i + 1) & (FF_DIR_HASH_SLOTS - 1);	/* Find a free slot (linear probing) */
+	fs->dh_slot[i] = k | (dptr / SZDIRE + 1);
+	fs->dh_used++;
+}
+
+
+static void dh_del (	/* Empty a slot and move the following ones of the probe chain back */
+	FATFS* fs,			/* Filesystem object */
+	UINT i				/* Slot */
+)
+{
+	UINT j, h;
+
+
+	fs->dh_slot[i] = 0;
+	fs->dh_used--;
+	for (j = (i + 1) & (FF_DIR_HASH_SLOTS - 1); fs->dh_slot[j] & 0xFFFF; j = (j + 1) & (FF_DIR_HASH_SLOTS - 1)) {
+		h = DH_HOME(fs->dh_slot[j] >> 16);
+		if (((j - h) & (FF_DIR_HASH_SLOTS - 1)) >= ((j - i) & (FF_DIR_HASH_SLOTS - 1))) {	/* Is the hole between its home and it? */
+			fs->dh_slot[i] = fs->dh_slot[j];
+			fs->dh_slot[j] = 0;
+			i = j;
+		}
+	}
+}
+
+
+static void dh_forget (	/* Remove a directory from the index */
+	FATFS* fs,			/* Filesystem object */
+	UINT d				/* Directory (DH_DIRS:none) */
+)
+{
+	UINT i;
+
+
+	if (d >= DH_DIRS) return;
+	for (i = 0; i < FF_DIR_HASH_SLOTS; i++) {
+		while ((fs->dh_slot[i] & 0xFFFF) && ((fs->dh_slot[i] >> 16) & 3) == d) dh_del(fs, i);	/* A slot moved into i is checked again */
+	}
+	fs->dh_stat[d] = 0;
+}
+
+
+#if !FF_FS_READONLY
+static void dh_drop (	/* Remove an entry from the index */
+	FATFS* fs,			/* Filesystem object */
+	UINT d,				/* Directory (DH_DIRS:none) */
+	const BYTE* name,	/* 11-byte name of the entry */
+	DWORD dptr			/* Offset of the entry in the directory */
+)
+{
+	DWORD s = dh_key(name, d) | (dptr / SZDIRE + 1);
+	UINT i;
+
+
+	if (d >= DH_DIRS) return;
+	if (dptr < fs->dh_free[d]) fs->dh_free[d] = dptr;	/* The entry can be reused */
+	for (i = DH_HOME(s >> 16); fs->dh_slot[i] & 0xFFFF; i = (i + 1) & (FF_DIR_HASH_SLOTS - 1)) {
+		if (fs->dh_slot[i] == s) {
+			dh_del(fs, i);
+			break;
+		}
+	}
+}
+#endif
+
+
+static FRESULT dh_build (	/* Index all entries of the directory (dp is rewound) */
+	DIR* dp,				/* Directory object */
+	UINT d					/* Directory of the index to use */
+)
+{
+	FRESULT res;
+	FATFS *fs = dp->obj.fs;
+	BYTE c;
+
+
+	fs->dh_clust[d] = dp->obj.sclust;
+	fs->dh_stat[d] = 2;
+	fs->dh_free[d] = 0xFFFFFFFF;
+	do {
+		res = move_window(fs, dp->sect);
+		if (res != FR_OK) break;
+		c = dp->dir[DIR_Name];
+		if ((c == DDEM || c == 0) && fs->dh_free[d] == 0xFFFFFFFF) fs->dh_free[d] = dp->dptr;	/* First free entry */
+		if (c == 0) break;				/* Reached to end of table */
+		if (c != DDEM && !(dp->dir[DIR_Attr] & AM_VOL)) {	/* Entries that dir_find can match */
+			dh_put(fs, d, dp->dir, dp->dptr);
+			if (fs->dh_stat[d] != 2) break;	/* Index is full, the rest is searched in the table */
+		}
+		res = dir_next(dp, 0);
+	} while (res == FR_OK);
+	if (res == FR_NO_FILE) res = FR_OK;	/* End of a full table */
+	if (fs->dh_free[d] == 0xFFFFFFFF) fs->dh_free[d] = 0;	/* Not seen: search from the top */
+	if (res != FR_OK) dh_forget(fs, d);
+	return res;
+}
+
+
+static int dh_find (	/* 1:The index has the answer (in *rp), 0:The table has to be searched */
+	DIR* dp,			/* Directory object with the file name (rewound) */
+	FRESULT* rp			/* FR_OK:found (dp points the entry), FR_NO_FILE:not in the directory, or an error */
+)
+{
+	FATFS *fs = dp->obj.fs;
+	DWORD k;
+	UINT d, i;
+
+
+	d = dh_dir(fs, dp->obj.sclust);
+	if (d == DH_DIRS) {		/* Not indexed yet: replace the least recently used directory */
+		for (d = i = 0; i < DH_DIRS; i++) {
+			if (fs->dh_stat[i] == 0) { d = i; break; }
+			if (fs->dh_age[i] > fs->dh_age[d]) d = i;
+		}
+		if (fs->dh_stat[d] != 0) dh_forget(fs, d);
+		*rp = dh_build(dp, d);
+		if (*rp != FR_OK) return 1;
+	}
+	for (i = 0; i < DH_DIRS; i++) {		/* Age the others */
+		if (i != d && fs->dh_age[i] < 0xFF) fs->dh_age[i]++;
+	}
+	fs->dh_age[d] = 0;
+
+	k = dh_key(dp->fn, d);
+	for (i = DH_HOME(k >> 16); fs->dh_slot[i] & 0xFFFF; i = (i + 1) & (FF_DIR_HASH_SLOTS - 1)) {
+		if ((fs->dh_slot[i] & 0xFFFF0000) != k) continue;
+		*rp = dir_sdi(dp, ((fs->dh_slot[i] & 0xFFFF) - 1) * SZDIRE);	/* Go to the entry and compare the name */
+		if (*rp == FR_OK) *rp = move_window(fs, dp->sect);
+		if (*rp != FR_OK) return 1;
+		if (!(dp->dir[DIR_Attr] & AM_VOL) && !memcmp(dp->dir, dp->fn, 11)) {
+			dp->obj.attr = dp->dir[DIR_Attr] & AM_MASK;
+			return 1;
+		}
+	}
+	if (fs->dh_stat[d] != 2) {		/* Partial index: the name may be in the rest of the table */
+		*rp = dir_sdi(dp, 0);
+		return (*rp != FR_OK);
+	}
+	*rp = FR_NO_FILE;
+	return 1;
+}
+
+#endif	/* FF_DIR_HASH_SLOTS */
+
+
+
+
 #if !FF_FS_READONLY
 /*-----------------------------------------------------------------------*/
 /* Directory handling - Reserve a block of directory entries             */
@@ -1812,9 +2271,18 @@ static FRESULT dir_alloc (	/* FR_OK(0):succeeded, !=0:error */
 	FRESULT res;
 	UINT n;
 	FATFS *fs = dp->obj.fs;
+#if FF_DIR_HASH_SLOTS
+	UINT d;
+#endif
 
 
+#if FF_DIR_HASH_SLOTS
+	d = dh_dir(fs, dp->obj.sclust);
+	res = (d < DH_DIRS) ? dir_sdi(dp, fs->dh_free[d]) : FR_INT_ERR;	/* Skip the entries known to be in use */
+	if (res != FR_OK) res = dir_sdi(dp, 0);
+#else
 	res = dir_sdi(dp, 0);
+#endif
 	if (res == FR_OK) {
 		n = 0;
 		do {
@@ -1833,6 +2301,9 @@ static FRESULT dir_alloc (	/* FR_OK(0):succeeded, !=0:error */
 		} while (res == FR_OK);
 	}
 
+#if FF_DIR_HASH_SLOTS
+	if (res == FR_OK && d < DH_DIRS) fs->dh_free[d] = dp->dptr + SZDIRE;	/* Entries up to the new one are in use */
+#endif
 	if (res == FR_NO_FILE) res = FR_DENIED;	/* No directory entry to allocate */
 	return res;
 }
@@ -2395,6 +2866,9 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 
 	res = dir_sdi(dp, 0);			/* Rewind directory object */
 	if (res != FR_OK) return res;
+#if FF_DIR_HASH_SLOTS
+	if (dh_find(dp, &res)) return res;	/* Look the name up in the index */
+#endif
 #if FF_FS_EXFAT
 	if (fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
 		BYTE nc;
@@ -2554,6 +3028,9 @@ static FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too
 			dp->dir[DIR_NTres] = dp->fn[NSFLAG] & (NS_BODY | NS_EXT);	/* Put NT flag */
 #endif
 			fs->wflag = 1;
+#if FF_DIR_HASH_SLOTS
+			dh_put(fs, dh_dir(fs, dp->obj.sclust), dp->fn, dp->dptr);	/* Keep the index coherent */
+#endif
 		}
 	}
 
@@ -2598,6 +3075,9 @@ static FRESULT dir_remove (	/* FR_OK:Succeeded, FR_DISK_ERR:A disk error */
 
 	res = move_window(fs, dp->sect);
 	if (res == FR_OK) {
+#if FF_DIR_HASH_SLOTS
+		dh_drop(fs, dh_dir(fs, dp->obj.sclust), dp->dir, dp->dptr);	/* Keep the index coherent */
+#endif
 		dp->dir[DIR_Name] = DDEM;	/* Mark the entry 'deleted'.*/
 		fs->wflag = 1;
 	}
@@ -3299,6 +3779,9 @@ static UINT check_fs (	/* 0:FAT/FAT32 VBR, 1:exFAT VBR, 2:Not FAT and valid BS,
 
 
 	fs->wflag = 0; fs->winsect = (LBA_t)0 - 1;		/* Invaidate window */
+#if FF_WIN_CACHE_WAYS
+	wc_reset(fs);		/* Cached sectors may be of another volume */
+#endif
 	if (move_window(fs, sect) != FR_OK) return 4;	/* Load the boot sector */
 	sign = ld_word(fs->win + BS_55AA);
 #if FF_FS_EXFAT
@@ -3565,6 +4048,10 @@ static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
 		/* Get FSInfo if available */
 		fs->last_clst = fs->free_clst = 0xFFFFFFFF;		/* Initialize cluster allocation information */
 		fs->fsi_flag = 0x80;
+#if FF_FREE_MAP_BYTES
+		for (fs->fmap_shift = 0; ((fs->n_fatent - 1) >> fs->fmap_shift) >= FF_FREE_MAP_BYTES * 8; fs->fmap_shift++) ;	/* Cluster group size */
+		memset(fs->fmap, 0xFF, FF_FREE_MAP_BYTES);		/* No group is known to be full yet */
+#endif
 #if (FF_FS_NOFSINFO & 3) != 3
 		if (fmt == FS_FAT32				/* Allow to update FSInfo only if BPB_FSInfo32 == 1 */
 			&& ld_word(fs->win + BPB_FSInfo32) == 1
@@ -3580,6 +4067,14 @@ static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
 #endif
 #if (FF_FS_NOFSINFO & 2) == 0
 				fs->last_clst = ld_dword(fs->win + FSI_Nxt_Free);
+#endif
+#if FF_FREE_MAP_BYTES
+				if (ld_dword(fs->win + FSI_MapSig) == FSI_MAP_SIG	/* Load the free cluster map if it was written with these counters */
+					&& fs->win[FSI_MapShift] == fs->fmap_shift
+					&& ld_dword(fs->win + FSI_MapCheck) == (ld_dword(fs->win + FSI_Free_Count) ^ ld_dword(fs->win + FSI_Nxt_Free) ^ fs->n_fatent))
+				{
+					memcpy(fs->fmap, fs->win + FSI_Map, FF_FREE_MAP_BYTES);
+				}
 #endif
 			}
 		}
@@ -3588,6 +4083,11 @@ static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
 	}
 
 	fs->fs_type = (BYTE)fmt;/* FAT sub-type (the filesystem object gets valid) */
+#if FF_DIR_HASH_SLOTS
+	memset(fs->dh_stat, 0, sizeof fs->dh_stat);	/* No directory is indexed yet */
+	memset(fs->dh_slot, 0, sizeof fs->dh_slot);
+	fs->dh_used = 0;
+#endif
 	fs->id = ++Fsid;		/* Volume mount ID */
 #if FF_USE_LFN == 1
 	fs->lfnbuf = LfnBuf;	/* Static LFN working buffer */
@@ -4838,6 +5338,9 @@ FRESULT f_getfree (
 		} else {
 			/* Scan FAT to obtain number of free clusters */
 			nfree = 0;
+#if FF_FREE_MAP_BYTES
+			memset(fs->fmap, 0, FF_FREE_MAP_BYTES);	/* The scan rebuilds the free cluster map */
+#endif
 			if (fs->fs_type == FS_FAT12) {	/* FAT12: Scan bit field FAT entries */
 				clst = 2; obj.fs = fs;
 				do {
@@ -4848,7 +5351,12 @@ FRESULT f_getfree (
 					if (stat == 1) {
 						res = FR_INT_ERR; break;
 					}
-					if (stat == 0) nfree++;
+					if (stat == 0) {
+						nfree++;
+#if FF_FREE_MAP_BYTES
+						fmap_mark(fs, clst, 1);
+#endif
+					}
 				} while (++clst < fs->n_fatent);
 			} else {
 #if FF_FS_EXFAT
@@ -4882,12 +5390,18 @@ FRESULT f_getfree (
 							if (res != FR_OK) break;
 						}
 						if (fs->fs_type == FS_FAT16) {
-							if (ld_word(fs->win + i) == 0) nfree++;
+							stat = ld_word(fs->win + i);
 							i += 2;
 						} else {
-							if ((ld_dword(fs->win + i) & 0x0FFFFFFF) == 0) nfree++;
+							stat = ld_dword(fs->win + i) & 0x0FFFFFFF;
 							i += 4;
 						}
+						if (stat == 0) {
+							nfree++;
+#if FF_FREE_MAP_BYTES
+							fmap_mark(fs, fs->n_fatent - clst, 1);	/* Entry clst counts down from the top */
+#endif
+						}
 						i %= SS(fs);
 					} while (--clst);
 				}
@@ -4897,6 +5411,11 @@ FRESULT f_getfree (
 				fs->free_clst = nfree;	/* Now free_clst is valid */
 				fs->fsi_flag |= 1;		/* FAT32: FSInfo is to be updated */
 			}
+#if FF_FREE_MAP_BYTES
+			else {
+				memset(fs->fmap, 0xFF, FF_FREE_MAP_BYTES);	/* A partial map would hide free clusters */
+			}
+#endif
 		}
 	}
 
@@ -5032,6 +5551,9 @@ FRESULT f_unlink (
 			if (res == FR_OK) {
 				res = dir_remove(&dj);			/* Remove the directory entry */
 				if (res == FR_OK && dclst != 0) {	/* Remove the cluster chain if exist */
+#if FF_DIR_HASH_SLOTS
+					dh_forget(fs, dh_dir(fs, dclst));	/* The indexed directory is gone */
+#endif
 #if FF_FS_EXFAT
 					res = remove_chain(&obj, dclst, 0);
 #else
@@ -5601,8 +6123,30 @@ FRESULT f_expand (
 	} else
 #endif
 	{
+#if FF_FREE_MAP_BYTES
+		DWORD gend, msk = ((DWORD)1 << fs->fmap_shift) - 1;
+		UINT pass = 0;
+
+		do {	/* 1st pass skips the groups known to be full, 2nd pass walks the whole FAT in case the map is stale */
+			res = FR_OK;
+#endif
 		scl = clst = stcl; ncl = 0;
 		for (;;) {	/* Find a contiguous cluster block */
+#if FF_FREE_MAP_BYTES
+			if (pass == 0 && clst != stcl && ((clst & msk) == 0 || clst == 2) && !fmap_get(fs, clst)) {	/* Top of a full group? */
+				gend = clst | msk;			/* Last cluster of the group */
+				if (gend >= fs->n_fatent) gend = fs->n_fatent - 1;
+				if (stcl - clst <= gend - clst) {	/* Start cluster is in the group: no contiguous cluster */
+					res = FR_DENIED; break;
+				}
+				clst = (gend + 1 >= fs->n_fatent) ? 2 : gend + 1;	/* Skip it, it breaks any block */
+				scl = clst; ncl = 0;
+				if (clst == stcl) {
+					res = FR_DENIED; break;
+				}
+				continue;
+			}
+#endif
 			n = get_fat(&fp->obj, clst);
 			if (++clst >= fs->n_fatent) clst = 2;
 			if (n == 1) {
@@ -5620,6 +6164,9 @@ FRESULT f_expand (
 				res = FR_DENIED; break;
 			}
 		}
+#if FF_FREE_MAP_BYTES
+		} while (res == FR_DENIED && ++pass < 2);
+#endif
 		if (res == FR_OK) {	/* A contiguous free area is found */
 			if (opt) {		/* Allocate it now */
 				for (clst = scl, n = tcl; n; clst++, n--) {	/* Create a cluster chain on the FAT */
@@ -5627,6 +6174,9 @@ FRESULT f_expand (
 					if (res != FR_OK) break;
 					lclst = clst;
 				}
+#if FF_FREE_MAP_BYTES
+				if (res == FR_OK) fmap_fill(fs, scl, tcl);	/* Groups inside the block are full now */
+#endif
 			} else {		/* Set it as suggested point for next allocation */
 				lclst = scl - 1;
 			}
@@ -5638,6 +6188,12 @@ FRESULT f_expand (
 		if (opt) {	/* Is it allocated now? */
 			fp->obj.sclust = scl;		/* Update object allocation information */
 			fp->obj.objsize = fsz;
+#if FF_WIN_CACHE_WAYS
+			wc_discard(fs, clst2sect(fs, scl), tcl * fs->csize);	/* The block may be written past FatFs (disk_write), a cached copy must not be written back over it */
+#endif
+			if (fs->winsect - clst2sect(fs, scl) < (LBA_t)tcl * fs->csize) {	/* Neither may the window */
+				fs->wflag = 0; fs->winsect = (LBA_t)0 - 1;
+			}
 			if (FF_FS_EXFAT) fp->obj.stat = 2;	/* Set status 'contiguous chain' */
 			fp->flag |= FA_MODIFIED;
 			if (fs->free_clst <= fs->n_fatent - 2) {	/* Update FSINFO */
@@ -86,6 +86,17 @@ typedef DWORD LBA_t;
 
 
 
+/* Sector cache behind the disk access window */
+
+#if FF_WIN_CACHE_WAYS
+#if FF_FS_TINY
+#error The window cache can not be used at tiny configuration
+#endif
+#define FF_WIN_CACHE_LINES	(FF_WIN_CACHE_SETS * FF_WIN_CACHE_WAYS)
+#endif
+
+
+
 /* Type of path name strings on FatFs API (TCHAR) */
 
 #if FF_USE_LFN && FF_LFN_UNICODE == 1 	/* Unicode in UTF-16 encoding */
@@ -152,6 +163,10 @@ typedef struct {
 #if !FF_FS_READONLY
 	DWORD	last_clst;		/* Last allocated cluster */
 	DWORD	free_clst;		/* Number of free clusters */
+#if FF_FREE_MAP_BYTES
+	BYTE	fmap_shift;		/* Clusters per free map bit (log2) */
+	BYTE	fmap[FF_FREE_MAP_BYTES];	/* Free cluster map (1 bit per cluster group, 0:no free cluster in the group) */
+#endif
 #endif
 #if FF_FS_RPATH
 	DWORD	cdir;			/* Current directory start cluster (0:root) */
@@ -169,9 +184,26 @@ typedef struct {
 	LBA_t	database;		/* Data base sector */
 #if FF_FS_EXFAT
 	LBA_t	bitbase;		/* Allocation bitmap base sector */
+#endif
+#if FF_DIR_HASH_SLOTS
+	DWORD	dh_clust[4];	/* Start cluster of each indexed directory */
+	BYTE	dh_stat[4];		/* Index status of each directory (0:not indexed, 1:partial, 2:complete) */
+	BYTE	dh_age[4];		/* Lookups since each directory was last used */
+	DWORD	dh_free[4];		/* Offset of the first entry of each directory that may be free */
+	UINT	dh_used;		/* Slots in use */
+	DWORD	dh_slot[FF_DIR_HASH_SLOTS];	/* Name index (b31-18:name hash, b17-16:directory, b15-0:entry# + 1 or 0:empty) */
 #endif
 	LBA_t	winsect;		/* Current sector appearing in the win[] */
 	BYTE	win[FF_MAX_SS];	/* Disk access window for Directory, FAT (and file data at tiny cfg) */
+#if FF_WIN_CACHE_WAYS
+	LBA_t	wc_sect[FF_WIN_CACHE_LINES];	/* Sector held by each cache line ((LBA_t)0 - 1: empty) */
+	DWORD	wc_used[FF_WIN_CACHE_LINES];	/* Last use of each line (0: empty) */
+	BYTE	wc_flag[FF_WIN_CACHE_LINES];	/* Cache line status (b0:dirty) */
+	DWORD	wc_stamp;		/* Use counter for the LRU replacement */
+	DWORD	wc_hit;			/* Window moves served from the cache */
+	DWORD	wc_miss;		/* Window moves that had to read the sector */
+	BYTE	wc_buf[FF_WIN_CACHE_LINES][FF_MAX_SS];	/* Cache lines, set by set */
+#endif
 } FATFS;
 
 
@@ -372,15 +404,31 @@ DWORD ff_wtoupper (DWORD uni);			/* Unicode upper-case conversion */
 
 /* O/S dependent functions (samples available in ffsystem.c) */
 
-#if FF_USE_LFN == 3		/* Dynamic memory allocation */
+#if FF_USE_LFN == 3 || FF_USE_POOL	/* Dynamic memory allocation */
 void* ff_memalloc (UINT msize);		/* Allocate memory block */
 void ff_memfree (void* mblock);		/* Free memory block */
 #endif
+#if FF_USE_POOL		/* Fixed-block pool behind ff_memalloc */
+typedef struct {
+	UINT	size;		/* Block size of the class */
+	BYTE	blocks;		/* Number of blocks */
+	BYTE	used;		/* Blocks in use */
+	BYTE	peak;		/* Most blocks in use at once */
+	DWORD	fails;		/* Requests of this size that found no free block */
+} FF_POOL_STAT;
+
+int ff_pool_stat (int cls, FF_POOL_STAT* st);	/* Get the statistics of a block class */
+extern void (*ff_pool_fail_hook)(UINT msize);	/* Called when a request can't be served */
+#endif
 #if FF_FS_REENTRANT	/* Sync functions */
+#define FF_DISK_LOCK	(FF_VOLUMES + 1)	/* Mutex ID of the disk driver lock, taken by diskio */
 int ff_mutex_create (int vol);		/* Create a sync object */
 void ff_mutex_delete (int vol);		/* Delete a sync object */
 int ff_mutex_take (int vol);		/* Lock sync object */
 void ff_mutex_give (int vol);		/* Unlock sync object */
+int ff_sem_create (void);			/* Create the transfer semaphore of the disk driver */
+int ff_sem_take (void);				/* Sleep until the transfer semaphore is given */
+void ff_sem_give_isr (void);		/* Give the transfer semaphore from an interrupt */
 #endif
 
 
@@ -34,15 +34,19 @@
 /  f_findnext(). (0:Disable, 1:Enable 2:Enable with matching altname[] too) */
 
 
+#ifdef SDIO_HOST_EMULATION
+#define FF_USE_MKFS		1	/* the host emulator formats fresh card images */
+#else
 #define FF_USE_MKFS		0
+#endif
 /* This option switches f_mkfs() function. (0:Disable or 1:Enable) */
 
 
-#define FF_USE_FASTSEEK	0
+#define FF_USE_FASTSEEK	1
 /* This option switches fast seek function. (0:Disable or 1:Enable) */
 
 
-#define FF_USE_EXPAND	0
+#define FF_USE_EXPAND	1
 /* This option switches f_expand function. (0:Disable or 1:Enable) */
 
 
@@ -235,6 +239,71 @@
 /  buffer in the filesystem object (FATFS) is used for the file data transfer. */
 
 
+#define FF_WIN_CACHE_SETS	4
+#define FF_WIN_CACHE_WAYS	2
+/* This set of options configures the sector cache behind the disk access window
+/  of the filesystem object. FAT and directory sectors that are moved out of the
+/  window are kept in FF_WIN_CACHE_SETS x FF_WIN_CACHE_WAYS lines of FF_MAX_SS bytes
+/  each (a sector always goes to set: sector % FF_WIN_CACHE_SETS, the least recently
+/  used line of the set is evicted). Dirty lines are written back when they are
+/  evicted or when the volume is synced, so a FAT sector and a directory sector
+/  that are accessed in turns are read only once. The cache adds about
+/  FF_WIN_CACHE_SETS x FF_WIN_CACHE_WAYS x (FF_MAX_SS + 9) bytes to the FATFS.
+/  Set FF_WIN_CACHE_WAYS to 0 to disable it. This option must be 0 when FF_FS_TINY
+/  is 1. */
+
+
+#define FF_FREE_MAP_BYTES	448
+/* This option sets the size of the free cluster map in the filesystem object.
+/  Each bit of the map covers a group of clusters (a power of 2, chosen at mount
+/  time to make the volume fit) and is cleared once the group is known to have no
+/  free cluster. create_chain() and f_expand() skip such groups instead of reading
+/  their FAT entries. The map is rebuilt by a full f_getfree() scan, updated as
+/  clusters are freed and, on FAT32, kept in the reserved area of the FSINFO sector
+/  together with a check value of the FSINFO counters, so it is valid right after
+/  mount. A stale map only costs a full FAT walk, it never hides free space.
+/  0:Disable or 4 to 468 bytes. */
+
+
+#ifdef SDIO_HOST_EMULATION
+#define FF_DIR_HASH_SLOTS	4096	/* the host checks index a 1000 file directory */
+#else
+#define FF_DIR_HASH_SLOTS	256		/* 1 kB in the FATFS, the RAM of the F405 is shared with the sample ring and the read-ahead buffer */
+#endif
+/* This option sets the number of slots (a power of 2, 65536 max) of the name index
+/  kept for the last 4 directories searched. The index maps each name of the
+/  directory to its entry, so looking up a name, and finding out that it is not
+/  there, does not read the directory table. A directory is indexed by one pass
+/  over its table when it is searched for the first time, and the index is kept
+/  coherent by the functions that create and remove entries. It also remembers
+/  the first entry that may be free, where a new entry is searched from. Up to 3/4 of the slots
+/  are used, the directory that does not fit is indexed in part (names not in the
+/  index are searched for the old way). The index takes FF_DIR_HASH_SLOTS x 4
+/  bytes in the filesystem object (16 kB at 4096 slots, so keep it small on the
+/  target: 256 slots hold 192 names for all 4 directories).
+/  0:Disable. It needs FF_USE_LFN == 0. */
+
+
+#define FF_USE_POOL		1
+#define FF_POOL_BLK0	64
+#define FF_POOL_CNT0	8
+#define FF_POOL_BLK1	256
+#define FF_POOL_CNT1	4
+#define FF_POOL_BLK2	1024
+#define FF_POOL_CNT2	2
+/* The option FF_USE_POOL replaces malloc() and free() behind ff_memalloc() and
+/  ff_memfree() with a fixed-block pool in ffsystem.c. The pool has three block
+/  classes of FF_POOL_BLKn bytes (multiples of 8, in ascending order) with
+/  FF_POOL_CNTn blocks each (0 to 32, 0 removes the class). A request gets a block
+/  of the smallest class it fits into that still has one free, so an allocation
+/  and a free take the same few instructions every time and the heap can't be
+/  fragmented. The pool is lock-free and can be used from any task or interrupt.
+/  The use of each class and its peak are given by ff_pool_stat(), and a request
+/  that can't be served calls ff_pool_fail_hook (if set) before it returns null.
+/  The pool takes the sum of FF_POOL_BLKn x FF_POOL_CNTn bytes on the BSS.
+/  0:Disable (malloc/free are used when FF_USE_LFN == 3) or 1:Enable */
+
+
 #define FF_FS_EXFAT		0
 /* This option switches support for exFAT filesystem. (0:Disable or 1:Enable)
 /  To enable exFAT, also LFN needs to be enabled. (FF_USE_LFN >= 1)
@@ -279,7 +348,11 @@
 /      lock control is independent of re-entrancy. */
 
 
-#define FF_FS_REENTRANT	0
+#ifdef SDIO_HOST_EMULATION
+#define FF_FS_REENTRANT	1	/* The host runs FatFs from several threads (POSIX backend of ffsystem.c) */
+#else
+#define FF_FS_REENTRANT	0	/* The firmware is a single super loop - 1 once it runs on an RTOS */
+#endif
 #define FF_FS_TIMEOUT	1000
 /* The option FF_FS_REENTRANT switches the re-entrancy (thread safe) of the FatFs
 /  module itself. Note that regardless of this option, file access to different
@@ -291,6 +364,7 @@
 /   1: Enable re-entrancy. Also user provided synchronization handlers,
 /      ff_mutex_create(), ff_mutex_delete(), ff_mutex_take() and ff_mutex_give()
 /      function, must be added to the project. Samples are available in ffsystem.c.
+/      The disk driver then also sleeps on ff_sem_take() during transfers.
 /
 /  The FF_FS_TIMEOUT defines timeout period in unit of O/S time tick.
 */
@@ -6,7 +6,104 @@
 #include "ff.h"
 
 
-#if FF_USE_LFN == 3	/* Use dynamic memory allocation */
+#if FF_USE_POOL		/* Use the fixed-block pool */
+
+/*------------------------------------------------------------------------*/
+/* Fixed-Block Pool                                                       */
+/*------------------------------------------------------------------------*/
+/* Each class is an array of equal blocks and a 32-bit map of the blocks in
+/  use. A block is taken by setting its bit with a compare-and-swap and given
+/  back by clearing it, so the pool needs no lock and any task or interrupt
+/  can use it. Finding the free block is a count of trailing zeros, the time
+/  does not depend on how many blocks are in use.
+*/
+
+#if FF_POOL_CNT0 > 32 || FF_POOL_CNT1 > 32 || FF_POOL_CNT2 > 32
+#error Wrong FF_POOL_CNTn setting
+#endif
+#if (FF_POOL_BLK0 % 8) || (FF_POOL_BLK1 % 8) || (FF_POOL_BLK2 % 8) || FF_POOL_BLK0 > FF_POOL_BLK1 || FF_POOL_BLK1 > FF_POOL_BLK2
+#error Wrong FF_POOL_BLKn setting
+#endif
+
+#define POOL_CLASSES	3
+#define POOL_BYTES		(FF_POOL_BLK0 * FF_POOL_CNT0 + FF_POOL_BLK1 * FF_POOL_CNT1 + FF_POOL_BLK2 * FF_POOL_CNT2)
+
+static unsigned long long PoolMem[POOL_BYTES / 8 + 1];	/* Blocks of all classes, 8-byte aligned */
+static const UINT PoolBlk[POOL_CLASSES] = {FF_POOL_BLK0, FF_POOL_BLK1, FF_POOL_BLK2};
+static const BYTE PoolCnt[POOL_CLASSES] = {FF_POOL_CNT0, FF_POOL_CNT1, FF_POOL_CNT2};
+static const UINT PoolOfs[POOL_CLASSES] = {0, FF_POOL_BLK0 * FF_POOL_CNT0, FF_POOL_BLK0 * FF_POOL_CNT0 + FF_POOL_BLK1 * FF_POOL_CNT1};
+static DWORD PoolMap[POOL_CLASSES];		/* Bit n set: block n of the class is in use */
+static BYTE PoolPeak[POOL_CLASSES];
+static DWORD PoolFails[POOL_CLASSES];
+
+void (*ff_pool_fail_hook)(UINT msize);
+
+
+void* ff_memalloc (	/* Returns pointer to the allocated memory block (null if not enough core) */
+	UINT msize		/* Number of bytes to allocate */
+)
+{
+	int cls, fit = -1;
+	DWORD map, full;
+	BYTE used;
+	UINT blk;
+
+
+	for (cls = 0; cls < POOL_CLASSES; cls++) {
+		if (PoolCnt[cls] == 0 || msize > PoolBlk[cls]) continue;
+		if (fit < 0) fit = cls;		/* Smallest class the request fits into */
+		full = (PoolCnt[cls] == 32) ? 0xFFFFFFFF : (((DWORD)1 << PoolCnt[cls]) - 1);
+		map = __atomic_load_n(&PoolMap[cls], __ATOMIC_RELAXED);
+		while (map != full) {		/* Only another task or interrupt taking a block at the same time makes this loop */
+			blk = (UINT)__builtin_ctz(~map);
+			if (__atomic_compare_exchange_n(&PoolMap[cls], &map, map | ((DWORD)1 << blk), 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+				used = (BYTE)__builtin_popcount(map) + 1;
+				if (used > PoolPeak[cls]) PoolPeak[cls] = used;
+				return (BYTE*)PoolMem + PoolOfs[cls] + blk * PoolBlk[cls];
+			}
+		}
+	}
+
+	if (fit >= 0) PoolFails[fit]++;	/* A request larger than any block is counted nowhere */
+	if (ff_pool_fail_hook) ff_pool_fail_hook(msize);
+	return 0;
+}
+
+
+void ff_memfree (
+	void* mblock	/* Pointer to the memory block to free (no effect if null) */
+)
+{
+	int cls;
+	UINT ofs;
+
+
+	if (!mblock) return;
+	ofs = (UINT)((BYTE*)mblock - (BYTE*)PoolMem);
+	for (cls = 0; cls < POOL_CLASSES; cls++) {
+		if (ofs < PoolOfs[cls] + PoolBlk[cls] * PoolCnt[cls]) {
+			__atomic_fetch_and(&PoolMap[cls], ~((DWORD)1 << ((ofs - PoolOfs[cls]) / PoolBlk[cls])), __ATOMIC_RELEASE);
+			return;
+		}
+	}
+}
+
+
+int ff_pool_stat (	/* Returns 1:Succeeded or 0:No such class */
+	int cls,			/* Block class (0 to 2) */
+	FF_POOL_STAT* st	/* Statistics of the class */
+)
+{
+	if (cls < 0 || cls >= POOL_CLASSES) return 0;
+	st->size = PoolBlk[cls];
+	st->blocks = PoolCnt[cls];
+	st->used = (BYTE)__builtin_popcount(__atomic_load_n(&PoolMap[cls], __ATOMIC_RELAXED));
+	st->peak = PoolPeak[cls];
+	st->fails = PoolFails[cls];
+	return 1;
+}
+
+#elif FF_USE_LFN == 3	/* Use dynamic memory allocation */
 
 /*------------------------------------------------------------------------*/
 /* Allocate/Free a Memory Block                                           */
@@ -40,30 +137,52 @@ void ff_memfree (
 /* Definitions of Mutex                                                   */
 /*------------------------------------------------------------------------*/
 
-#define OS_TYPE	0	/* 0:Win32, 1:uITRON4.0, 2:uC/OS-II, 3:FreeRTOS, 4:CMSIS-RTOS */
+#ifdef SDIO_HOST_EMULATION
+#define OS_TYPE	5	/* The host build runs FatFs on POSIX threads */
+#else
+#define OS_TYPE	3	/* 0:Win32, 1:uITRON4.0, 2:uC/OS-II, 3:FreeRTOS, 4:CMSIS-RTOS, 5:POSIX threads */
+#endif
 
 
 #if   OS_TYPE == 0	/* Win32 */
 #include <windows.h>
-static HANDLE Mutex[FF_VOLUMES + 1];	/* Table of mutex handle */
+static HANDLE Mutex[FF_VOLUMES + 2];	/* Table of mutex handle */
 
 #elif OS_TYPE == 1	/* uITRON */
 #include "itron.h"
 #include "kernel.h"
-static mtxid Mutex[FF_VOLUMES + 1];		/* Table of mutex ID */
+static mtxid Mutex[FF_VOLUMES + 2];		/* Table of mutex ID */
 
 #elif OS_TYPE == 2	/* uc/OS-II */
 #include "includes.h"
-static OS_EVENT *Mutex[FF_VOLUMES + 1];	/* Table of mutex pinter */
+static OS_EVENT *Mutex[FF_VOLUMES + 2];	/* Table of mutex pinter */
 
 #elif OS_TYPE == 3	/* FreeRTOS */
 #include "FreeRTOS.h"
 #include "semphr.h"
-static SemaphoreHandle_t Mutex[FF_VOLUMES + 1];	/* Table of mutex handle */
+static SemaphoreHandle_t Mutex[FF_VOLUMES + 2];	/* Table of mutex handle */
 
 #elif OS_TYPE == 4	/* CMSIS-RTOS */
 #include "cmsis_os.h"
-static osMutexId Mutex[FF_VOLUMES + 1];	/* Table of mutex ID */
+static osMutexId Mutex[FF_VOLUMES + 2];	/* Table of mutex ID */
+
+#elif OS_TYPE == 5	/* POSIX threads */
+#include <pthread.h>
+#include <semaphore.h>
+#include <errno.h>
+#include <time.h>
+static pthread_mutex_t Mutex[FF_VOLUMES + 2];	/* Table of mutex */
+
+static void abs_timeout (struct timespec* ts, UINT ms)	/* Deadline ms from now, for the timed waits */
+{
+	clock_gettime(CLOCK_REALTIME, ts);
+	ts->tv_sec += ms / 1000;
+	ts->tv_nsec += (long)(ms % 1000) * 1000000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
 
 #endif
 
@@ -75,10 +194,11 @@ static osMutexId Mutex[FF_VOLUMES + 1];	/* Table of mutex ID */
 /* This function is called in f_mount function to create a new mutex
 /  or semaphore for the volume. When a 0 is returned, the f_mount function
 /  fails with FR_INT_ERR.
+/  The disk lock (FF_DISK_LOCK) is created the same way by disk_initialize.
 */
 
 int ff_mutex_create (	/* Returns 1:Function succeeded or 0:Could not create the mutex */
-	int vol				/* Mutex ID: Volume mutex (0 to FF_VOLUMES - 1) or system mutex (FF_VOLUMES) */
+	int vol				/* Mutex ID: Volume mutex (0 to FF_VOLUMES - 1), system mutex (FF_VOLUMES) or disk lock (FF_DISK_LOCK) */
 )
 {
 #if OS_TYPE == 0	/* Win32 */
@@ -107,6 +227,9 @@ int ff_mutex_create (	/* Returns 1:Function succeeded or 0:Could not create the
 	Mutex[vol] = osMutexCreate(osMutex(cmsis_os_mutex));
 	return (int)(Mutex[vol] != NULL);
 
+#elif OS_TYPE == 5	/* POSIX threads */
+	return (int)(pthread_mutex_init(&Mutex[vol], NULL) == 0);
+
 #endif
 }
 
@@ -119,7 +242,7 @@ int ff_mutex_create (	/* Returns 1:Function succeeded or 0:Could not create the
 */
 
 void ff_mutex_delete (	/* Returns 1:Function succeeded or 0:Could not delete due to an error */
-	int vol				/* Mutex ID: Volume mutex (0 to FF_VOLUMES - 1) or system mutex (FF_VOLUMES) */
+	int vol				/* Mutex ID: Volume mutex (0 to FF_VOLUMES - 1), system mutex (FF_VOLUMES) or disk lock (FF_DISK_LOCK) */
 )
 {
 #if OS_TYPE == 0	/* Win32 */
@@ -139,6 +262,9 @@ void ff_mutex_delete (	/* Returns 1:Function succeeded or 0:Could not delete due
 #elif OS_TYPE == 4	/* CMSIS-RTOS */
 	osMutexDelete(Mutex[vol]);
 
+#elif OS_TYPE == 5	/* POSIX threads */
+	pthread_mutex_destroy(&Mutex[vol]);
+
 #endif
 }
 
@@ -151,7 +277,7 @@ void ff_mutex_delete (	/* Returns 1:Function succeeded or 0:Could not delete due
 */
 
 int ff_mutex_take (	/* Returns 1:Succeeded or 0:Timeout */
-	int vol			/* Mutex ID: Volume mutex (0 to FF_VOLUMES - 1) or system mutex (FF_VOLUMES) */
+	int vol			/* Mutex ID: Volume mutex (0 to FF_VOLUMES - 1), system mutex (FF_VOLUMES) or disk lock (FF_DISK_LOCK) */
 )
 {
 #if OS_TYPE == 0	/* Win32 */
@@ -172,6 +298,12 @@ int ff_mutex_take (	/* Returns 1:Succeeded or 0:Timeout */
 #elif OS_TYPE == 4	/* CMSIS-RTOS */
 	return (int)(osMutexWait(Mutex[vol], FF_FS_TIMEOUT) == osOK);
 
+#elif OS_TYPE == 5	/* POSIX threads (the time tick is 1 ms) */
+	struct timespec ts;
+
+	abs_timeout(&ts, FF_FS_TIMEOUT);
+	return (int)(pthread_mutex_timedlock(&Mutex[vol], &ts) == 0);
+
 #endif
 }
 
@@ -184,7 +316,7 @@ int ff_mutex_take (	/* Returns 1:Succeeded or 0:Timeout */
 */
 
 void ff_mutex_give (
-	int vol			/* Mutex ID: Volume mutex (0 to FF_VOLUMES - 1) or system mutex (FF_VOLUMES) */
+	int vol			/* Mutex ID: Volume mutex (0 to FF_VOLUMES - 1), system mutex (FF_VOLUMES) or disk lock (FF_DISK_LOCK) */
 )
 {
 #if OS_TYPE == 0	/* Win32 */
@@ -202,6 +334,156 @@ void ff_mutex_give (
 #elif OS_TYPE == 4	/* CMSIS-RTOS */
 	osMutexRelease(Mutex[vol]);
 
+#elif OS_TYPE == 5	/* POSIX threads */
+	pthread_mutex_unlock(&Mutex[vol]);
+
+#endif
+}
+
+
+
+/*------------------------------------------------------------------------*/
+/* Definitions of the Transfer Semaphore                                  */
+/*------------------------------------------------------------------------*/
+/* Not a part of FatFs: the disk driver sleeps on this semaphore while a
+/  transfer is in flight and the interrupt that ends the transfer gives it.
+/  There is only one, since only one transfer can be in flight at a time.
+/  A give without a waiter is harmless, the driver checks the state of its
+/  request after every take.
+*/
+
+#if   OS_TYPE == 0	/* Win32 */
+static HANDLE Sem;
+
+#elif OS_TYPE == 1	/* uITRON */
+static semid Sem;
+
+#elif OS_TYPE == 2	/* uC/OS-II */
+static OS_EVENT *Sem;
+
+#elif OS_TYPE == 3	/* FreeRTOS */
+static SemaphoreHandle_t Sem;
+
+#elif OS_TYPE == 4	/* CMSIS-RTOS */
+static osSemaphoreId Sem;
+
+#elif OS_TYPE == 5	/* POSIX threads */
+static sem_t Sem;
+
+#endif
+
+
+
+/*------------------------------------------------------------------------*/
+/* Create the Transfer Semaphore                                          */
+/*------------------------------------------------------------------------*/
+
+int ff_sem_create (void)	/* Returns 1:Function succeeded or 0:Could not create the semaphore */
+{
+#if OS_TYPE == 0	/* Win32 */
+	Sem = CreateSemaphore(NULL, 0, 1, NULL);
+	return (int)(Sem != NULL);
+
+#elif OS_TYPE == 1	/* uITRON */
+	T_CSEM csem = {TA_TPRI, 0, 1};
+
+	Sem = acre_sem(&csem);
+	return (int)(Sem > 0);
+
+#elif OS_TYPE == 2	/* uC/OS-II */
+	Sem = OSSemCreate(0);
+	return (int)(Sem != NULL);
+
+#elif OS_TYPE == 3	/* FreeRTOS */
+	Sem = xSemaphoreCreateBinary();
+	return (int)(Sem != NULL);
+
+#elif OS_TYPE == 4	/* CMSIS-RTOS */
+	osSemaphoreDef(cmsis_os_sem);
+
+	Sem = osSemaphoreCreate(osSemaphore(cmsis_os_sem), 1);
+	if (Sem != NULL) osSemaphoreWait(Sem, 0);	/* Created with a token - take it */
+	return (int)(Sem != NULL);
+
+#elif OS_TYPE == 5	/* POSIX threads */
+	return (int)(sem_init(&Sem, 0, 0) == 0);
+
+#endif
+}
+
+
+
+/*------------------------------------------------------------------------*/
+/* Wait for the Transfer Semaphore                                        */
+/*------------------------------------------------------------------------*/
+/* The calling task sleeps until the interrupt gives the semaphore or
+/  FF_FS_TIMEOUT runs out.
+*/
+
+int ff_sem_take (void)	/* Returns 1:Succeeded or 0:Timeout */
+{
+#if OS_TYPE == 0	/* Win32 */
+	return (int)(WaitForSingleObject(Sem, FF_FS_TIMEOUT) == WAIT_OBJECT_0);
+
+#elif OS_TYPE == 1	/* uITRON */
+	return (int)(twai_sem(Sem, FF_FS_TIMEOUT) == E_OK);
+
+#elif OS_TYPE == 2	/* uC/OS-II */
+	INT8U err;
+
+	OSSemPend(Sem, FF_FS_TIMEOUT, &err);
+	return (int)(err == OS_NO_ERR);
+
+#elif OS_TYPE == 3	/* FreeRTOS */
+	return (int)(xSemaphoreTake(Sem, FF_FS_TIMEOUT) == pdTRUE);
+
+#elif OS_TYPE == 4	/* CMSIS-RTOS */
+	return (int)(osSemaphoreWait(Sem, FF_FS_TIMEOUT) > 0);
+
+#elif OS_TYPE == 5	/* POSIX threads (the time tick is 1 ms) */
+	struct timespec ts;
+	int rv;
+
+	abs_timeout(&ts, FF_FS_TIMEOUT);
+	while ((rv = sem_timedwait(&Sem, &ts)) != 0 && errno == EINTR) ;	/* A signal is no timeout */
+	return (int)(rv == 0);
+
+#endif
+}
+
+
+
+/*------------------------------------------------------------------------*/
+/* Give the Transfer Semaphore                                            */
+/*------------------------------------------------------------------------*/
+/* Called from the interrupt that ends the transfer.
+*/
+
+void ff_sem_give_isr (void)
+{
+#if OS_TYPE == 0	/* Win32 */
+	ReleaseSemaphore(Sem, 1, NULL);
+
+#elif OS_TYPE == 1	/* uITRON */
+	isig_sem(Sem);
+
+#elif OS_TYPE == 2	/* uC/OS-II */
+	OSSemPost(Sem);
+
+#elif OS_TYPE == 3	/* FreeRTOS */
+	BaseType_t woken = pdFALSE;
+
+	xSemaphoreGiveFromISR(Sem, &woken);
+	portYIELD_FROM_ISR(woken);	/* Switch to the waiting task right at the end of the interrupt */
+
+#elif OS_TYPE == 4	/* CMSIS-RTOS */
+	osSemaphoreRelease(Sem);
+
+#elif OS_TYPE == 5	/* POSIX threads */
+	int cnt;
+
+	if (sem_getvalue(&Sem, &cnt) == 0 && cnt == 0) sem_post(&Sem);	/* Binary, like the others (sem_post is async-signal-safe) */
+
 #endif
 }
 
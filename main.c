@@ -37,6 +37,7 @@
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
 #include "ff.h"
+#include <INPUT_File_capture.h>
 
 /* USER CODE END Includes */
 
@@ -70,12 +71,14 @@ void SystemClock_Config(void);
 /* Private user code ---------------------------------------------------------*/
 /* USER CODE BEGIN 0 */
 
-char INPUT_SIDE_file_name[] = "000.wav";												//we place the input side file name pointer
+char INPUT_SIDE_file_name[FILE_NAME_LEN] = "000.wav";												//we place the input side file name pointer
 
 uint8_t gen_file_no;																	//generated file counter
 
-uint8_t CMDREND_flag = 1;																//global flag flipped by the SDIO IRQ
-uint8_t DATAREND_flag = 1;																//global flag flipped by the SDIO IRQ
+volatile uint8_t CMDREND_flag = 1;																//global flag flipped by the SDIO IRQ
+volatile uint8_t DATAREND_flag = 1;																//global flag flipped by the SDIO IRQ
+volatile uint8_t DATAERR_flag = 1;																//global flag flipped by the SDIO IRQ
+volatile uint8_t CMDERR_flag = 1;																//global flag flipped by the SDIO IRQ
 
 /* USER CODE END 0 */
 
@@ -112,6 +115,8 @@ int main(void)
 
   TIM6Config();																			//custom delay function
 
+  TIM7Config();																			//one-shot alarm for the SDcard status polling
+
   //---------Set up SDcard----------//
 
   SDIO_init();